@@ -33,6 +33,7 @@ typedef struct chidb chidb;
 #define CHIDB_EIO (7)
 #define CHIDB_EMISUSE (8)
 #define CHIDB_CANTMOVE (9)
+#define CHIDB_EBUSY (10)
 
 #define CHIDB_ROW (100)
 #define CHIDB_DONE (101)
@@ -41,6 +42,16 @@ typedef struct chidb chidb;
  *
  * If the file does not exist, it will be created
  *
+ * The same file can be opened several times, e.g., to query it from
+ * several threads (each connection must only be used by one thread at
+ * a time). The connections share the file and a cache of its pages.
+ * Any number of them can read at the same time, but only one can
+ * write: statements that change the database (and transactions, see
+ * BEGIN) wait until the one that is writing is done. Readers and the
+ * writer don't wait for each other. While a connection is running
+ * statements, it reads the database as it was when the first of them
+ * started, even if other connections commit changes meanwhile.
+ *
  * Parameters
  * - file: Filename of the chidb file to open/create
  * - db: Out parameter. Returns a pointer to a chidb struct. The chidb
@@ -60,6 +71,38 @@ typedef struct chidb chidb;
 int chidb_open(const char *file, chidb **db); 
 
 
+/* Flags for chidb_open_v2 */
+#define CHIDB_OPEN_COMPACT (1)
+
+/* Opens a chidb file, with flags
+ *
+ * Same as chidb_open, but the way the file is opened can be changed
+ * with the following flags (or'ed together):
+ *
+ * - CHIDB_OPEN_COMPACT: Records written to the file from now on use the
+ *   compact record format, which stores integers in as few bytes as
+ *   possible. This is recorded in the file, so it keeps using that
+ *   format when it is opened again without this flag. Records that
+ *   are already in the file are not rewritten (they can be read
+ *   whatever their format).
+ *
+ * Parameters
+ * - file: Filename of the chidb file to open/create
+ * - db: Out parameter (see chidb_open)
+ * - flags: CHIDB_OPEN_* flags, or 0
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECANTOPEN: Unable to open the database file
+ * - CHIDB_ECORRUPT: The database file is not well formed
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_EBUSY: The record format has to be changed, but another
+ *   connection is writing
+ */
+int chidb_open_v2(const char *file, chidb **db, int flags);
+
+
 /* Prepares a SQL statement for execution
  *
  * Parameters
@@ -91,17 +134,97 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt);
  * results, then CHIDB_DONE is returned (note that this function does
  * not return CHIDB_OK).
  *
+ * If the schema has changed since the statement was prepared (by this
+ * connection or another one), the statement is compiled again before
+ * it starts running, keeping the values bound to its parameters.
+ *
  * Parameters
  * - stmt: Prepared SQL statement
  *
  * Return
  * - CHIDB_ROW: Statement returned a row.
  * - CHIDB_DONE: Statement has finished executing.
+ * - CHIDB_EBUSY: The statement changes the database, but another
+ *   connection is writing (or has written since this connection's
+ *   other statements, which are still running, started reading it).
+ *   The statement can be run again once the other statements are reset
+ *   or finalized.
  */
 int chidb_step(chidb_stmt *stmt);
 
 
+/* Resets a SQL statement, so that it can be run again from the start
+ *
+ * The values bound to the statement's parameters are kept.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_reset(chidb_stmt *stmt);
+
+
+/* Binds a value to a parameter of a SQL statement
+ *
+ * A statement can have parameters in place of literal values: each
+ * "?" is a new parameter, and every ":name" with the same name is the
+ * same parameter. Parameters are numbered from 1, in the order they
+ * first appear in the statement. Parameters that have not been bound
+ * are NULL.
+ *
+ * Values can only be bound before the statement is first stepped, or
+ * after it has been reset with chidb_reset.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - param: Parameter (parameters are numbered from 1)
+ * - value: Value of the parameter. chidb_bind_text copies the string,
+ *          and chidb_bind_blob copies its n bytes.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no such parameter, or the statement is running
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_bind_int(chidb_stmt *stmt, int param, int value);
+int chidb_bind_int64(chidb_stmt *stmt, int param, int64_t value);
+int chidb_bind_double(chidb_stmt *stmt, int param, double value);
+int chidb_bind_text(chidb_stmt *stmt, int param, const char *value);
+int chidb_bind_blob(chidb_stmt *stmt, int param, const void *value, int n);
+int chidb_bind_null(chidb_stmt *stmt, int param);
+
+
+/* Returns the number of parameters of a SQL statement
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ *
+ * Return
+ * - Number of parameters (the largest parameter number)
+ */
+int chidb_bind_parameter_count(chidb_stmt *stmt);
+
+
+/* Returns the number of a named parameter
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - name: Name of the parameter, with or without its leading ':'
+ *
+ * Return
+ * - Number of the parameter, or 0 if there is no parameter with
+ *   that name
+ */
+int chidb_bind_parameter_index(chidb_stmt *stmt, const char *name);
+
+
 /* Finalizes a SQL statement, freeing all resources associated with it.
+ *
+ * The compiled statement may be kept by the database, so that preparing
+ * the same SQL again does not have to compile it again. The statement
+ * must not be used after it has been finalized.
  *
  * Parameters
  * - stmt: Prepared SQL statement
@@ -164,6 +287,31 @@ const char *chidb_column_name(chidb_stmt* stmt, int col);
 int chidb_column_int(chidb_stmt *stmt, int col);
 
 
+/* Returns the value of a column of 64-bit integer type
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - col: Column (columns are numbered from 0)
+ *
+ * Return
+ * - Integer value (columns of any integer type, or of double
+ *   type, are converted to a 64-bit integer)
+ */
+int64_t chidb_column_int64(chidb_stmt *stmt, int col);
+
+
+/* Returns the value of a column of double type
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - col: Column (columns are numbered from 0)
+ *
+ * Return
+ * - Double value (columns of integer type are converted to a double)
+ */
+double chidb_column_double(chidb_stmt *stmt, int col);
+
+
 /* Returns the value of a column of string type
  *
  * Parameters
@@ -179,7 +327,54 @@ int chidb_column_int(chidb_stmt *stmt, int col);
 const char *chidb_column_text(chidb_stmt *stmt, int col);
 
 
+/* Returns the value of a column of BLOB type
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - col: Column (columns are numbered from 0)
+ *
+ * Return
+ * - Pointer to the bytes of the BLOB (use chidb_column_bytes to get
+ *   their number). As with chidb_column_text, the API client does not
+ *   have to free() the returned pointer, and it may become invalid
+ *   after chidb_step is called again.
+ */
+const void *chidb_column_blob(chidb_stmt *stmt, int col);
+
+
+/* Returns the size of a column of BLOB or string type
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - col: Column (columns are numbered from 0)
+ *
+ * Return
+ * - Number of bytes in the BLOB or string
+ */
+int chidb_column_bytes(chidb_stmt *stmt, int col);
+
+
+/* Returns whether a chidb database is in autocommit mode
+ *
+ * A database is in autocommit mode unless a transaction has been begun
+ * with BEGIN (and not yet ended with COMMIT or ROLLBACK). In autocommit
+ * mode, each statement that changes the database runs in a transaction
+ * of its own, which is committed when the statement finishes, or
+ * rolled back if it fails. The changes made in a transaction are kept
+ * in memory, as far as possible, until it is committed.
+ *
+ * Parameters
+ * - db: chidb database
+ *
+ * Return
+ * - 1 if the database is in autocommit mode, 0 if a transaction is open
+ */
+int chidb_get_autocommit(chidb *db);
+
+
 /* Closes a chidb database
+ *
+ * A transaction that is still open is rolled back.
  *
  * Parameters
  * - db: chidb database
@@ -12,12 +12,19 @@
 #define SQL_INTEGER_1BYTE (1)
 #define SQL_INTEGER_2BYTE (2)
 #define SQL_INTEGER_4BYTE (4)
+#define SQL_INTEGER_8BYTE (6)
+#define SQL_DOUBLE (7)
+#define SQL_BLOB (12)
 #define SQL_TEXT (13)
 
 #define STMT_CREATE (0)
 #define STMT_SELECT (1)
 #define STMT_INSERT (2)
 #define STMT_DELETE (3)
+#define STMT_ANALYZE (4)
+#define STMT_BEGIN (5)
+#define STMT_COMMIT (6)
+#define STMT_ROLLBACK (7)
 
 typedef struct chisql_statement
 {
@@ -29,7 +36,12 @@ typedef struct chisql_statement
         SRA_t    *select;
         Insert_t *insert;
         Delete_t *delete;
+        char *analyze;   /* Table to analyze (NULL for every table) */
     } stmt;
+    /* Parameters ("?" or ":name") in the statement, numbered from 1.
+     * params[i] is the name of parameter i+1 (NULL for a "?") */
+    int nParams;
+    char **params;
 } chisql_statement_t;
 
 int chisql_parser(const char *sql, chisql_statement_t **stmt);
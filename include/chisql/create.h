@@ -27,6 +27,7 @@ typedef struct TableReference_s {
 typedef struct Index_s {
    char *name, *table_name, *column_name;
    int unique;
+   StrList_t *include; /* Included columns of a covering index */
 } Index_t;
 
 enum CreateType { CREATE_TABLE, CREATE_INDEX };
@@ -53,6 +54,7 @@ void        TableReference_free(TableReference_t *tref);
 
 Index_t *   Index_make(char *name, char *table_name, char *column_name);
 Index_t *   Index_makeUnique(Index_t *idx);
+Index_t *   Index_include(Index_t *idx, StrList_t *columns);
 void        Index_print(Index_t *idx);
 void        Index_free(Index_t *idx);
 
@@ -1,10 +1,11 @@
 #ifndef __LITERAL_H_
 #define __LITERAL_H_
 
+#include <stdint.h>
 #include "common.h"
 
 union LitVal {
-   int ival;
+   int64_t ival;
    double dval;
    char cval;
    char *strval;
@@ -13,13 +14,15 @@ union LitVal {
 typedef struct Literal_t {
    enum data_type t;
    union LitVal val;
+   int param; /* Parameter (numbered from 1) whose value is bound at run time, or 0 */
    struct Literal_t *next; /* linked list */
 } Literal_t;
 
-Literal_t *litInt(int i);
+Literal_t *litInt(int64_t i);
 Literal_t *litDouble(double d);
 Literal_t *litChar(char c);
 Literal_t *litText(char *str);
+Literal_t *litParam(int param);
 Literal_t *Literal_append(Literal_t *val, Literal_t *toAppend);
 
 void Literal_free(Literal_t *lval);
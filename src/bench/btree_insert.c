@@ -0,0 +1,175 @@
+/*****************************************************************************
+ *
+ *																 chidb
+ *
+ * Measures how inserts into a B-Tree scale with the number of threads
+ * inserting at once (see Latches in btree.c).
+ *
+ * Each run inserts the same rows into a new B-Tree, in one transaction,
+ * from a number of threads that insert disjoint ranges of keys (or, with
+ * -i, interleaved keys), and prints how long the inserts took, and the
+ * speedup over one thread. The commit isn't included in the time.
+ *
+ * Usage: btree_insert [-n rows] [-s size] [-t maxthreads] [-i]
+ *
+\*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <chidb/chidb.h>
+#include "libchidb/chidbInt.h"
+#include "libchidb/btree.h"
+
+struct bench_thread
+{
+    BTree *bt;
+    chidb_key_t first, end, step;
+    uint16_t size;
+    int rc;
+};
+
+static void *bench_insert(void *arg)
+{
+    struct bench_thread *t = arg;
+    uint8_t *data = calloc(t->size, 1);
+
+    t->rc = data == NULL ? CHIDB_ENOMEM : CHIDB_OK;
+    for(chidb_key_t key = t->first; key < t->end && t->rc == CHIDB_OK; key += t->step)
+    {
+        memcpy(data, &key, sizeof(key) < t->size ? sizeof(key) : t->size);
+        t->rc = chidb_Btree_insertInTable(t->bt, 1, key, data, t->size);
+    }
+    free(data);
+
+    return NULL;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Inserts rows 1..nrows from nthreads threads into a new B-Tree, and
+ * returns the seconds that took (or a negative number on errors) */
+static double bench_run(int nthreads, chidb_key_t nrows, uint16_t size, bool interleaved)
+{
+    char fname[] = "/tmp/chidb-bench-XXXXXX";
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    struct bench_thread *args = malloc(nthreads * sizeof(struct bench_thread));
+    chidb *db = malloc(sizeof(chidb));
+    double start, elapsed = -1;
+    int fd, rc;
+
+    if(threads == NULL || args == NULL || db == NULL || (fd = mkstemp(fname)) < 0)
+        goto out;
+    close(fd);
+    unlink(fname);
+
+    if((rc = chidb_Btree_open(fname, db, &db->bt)) != CHIDB_OK ||
+       (rc = chidb_Btree_begin(db->bt)) != CHIDB_OK)
+    {
+        fprintf(stderr, "Could not open %s (%d)\n", fname, rc);
+        goto out;
+    }
+
+    start = bench_now();
+    for(int i = 0; i < nthreads; i++)
+    {
+        args[i].bt = db->bt;
+        args[i].size = size;
+        if(interleaved)
+        {
+            args[i].first = 1 + i;
+            args[i].end = nrows + 1;
+            args[i].step = nthreads;
+        }
+        else
+        {
+            args[i].first = 1 + (uint64_t) i * nrows / nthreads;
+            args[i].end = 1 + (uint64_t) (i + 1) * nrows / nthreads;
+            args[i].step = 1;
+        }
+        pthread_create(&threads[i], NULL, bench_insert, &args[i]);
+    }
+    for(int i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    elapsed = bench_now() - start;
+
+    for(int i = 0; i < nthreads; i++)
+        if(args[i].rc != CHIDB_OK)
+        {
+            fprintf(stderr, "Insert failed (%d)\n", args[i].rc);
+            elapsed = -1;
+            break;
+        }
+
+    if((rc = chidb_Btree_commit(db->bt)) != CHIDB_OK)
+    {
+        fprintf(stderr, "Commit failed (%d)\n", rc);
+        elapsed = -1;
+    }
+    chidb_Btree_close(db->bt);
+    unlink(fname);
+
+out:
+    free(threads);
+    free(args);
+    free(db);
+
+    return elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    chidb_key_t nrows = 200000;
+    int size = 64, maxthreads = 16;
+    bool interleaved = false;
+    double base = 0, elapsed;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:s:t:ih")) != -1)
+        switch(opt)
+        {
+        case 'n':
+            nrows = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            size = atoi(optarg);
+            break;
+        case 't':
+            maxthreads = atoi(optarg);
+            break;
+        case 'i':
+            interleaved = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n rows] [-s size] [-t maxthreads] [-i]\n", argv[0]);
+            exit(opt == 'h' ? 0 : 1);
+        }
+
+    if(nrows == 0 || size <= 0 || size > 256 || maxthreads <= 0)
+    {
+        fprintf(stderr, "Invalid arguments\n");
+        exit(1);
+    }
+
+    printf("%lu rows of %d bytes, %s keys, %ld CPUs\n", (unsigned long) nrows, size,
+           interleaved ? "interleaved" : "disjoint ranges of", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %12s %14s %8s\n", "threads", "seconds", "rows/second", "speedup");
+    for(int nthreads = 1; nthreads <= maxthreads; nthreads *= 2)
+    {
+        if((elapsed = bench_run(nthreads, nrows, size, interleaved)) < 0)
+            exit(1);
+        if(nthreads == 1)
+            base = elapsed;
+        printf("%8d %12.3f %14.0f %8.2f\n", nthreads, elapsed, nrows / elapsed, base / elapsed);
+    }
+
+    return 0;
+}
@@ -45,8 +45,10 @@
 #include <chidb/chidb.h>
 #include "dbm.h"
 #include "btree.h"
+#include "pager.h"
 #include "record.h"
 #include "util.h"
+#include "schema.h"
 
 /* Implemented in codegen.c */
 int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt);
@@ -60,29 +62,87 @@ int chidb_stmt_optimize(chidb *db,
 
 int chidb_open(const char *file, chidb **db)
 {
+    return chidb_open_v2(file, db, 0);
+}
+
+int chidb_open_v2(const char *file, chidb **db, int flags)
+{
+    int rc;
+
     *db = malloc(sizeof(chidb));
     if (*db == NULL)
         return CHIDB_ENOMEM;
-    chidb_Btree_open(file, *db, &(*db)->bt);
+    if ((rc = chidb_Btree_open(file, *db, &(*db)->bt)) != CHIDB_OK)
+    {
+        free(*db);
+        if (rc == CHIDB_ECORRUPTHEADER)
+            return CHIDB_ECORRUPT;
+        return rc == CHIDB_ENOMEM ? CHIDB_ENOMEM : CHIDB_ECANTOPEN;
+    }
+
+    /* The schema is loaded when statements are prepared */
+    list_init(&(*db)->schema);
+    (*db)->schema_loaded = false;
+
+    chidb_stmt_cache_init(&(*db)->stmt_cache);
+
+    if (flags & CHIDB_OPEN_COMPACT)
+    {
+        if ((rc = chidb_Btree_lock((*db)->bt, BTREE_LOCK_WRITE)) == CHIDB_OK)
+        {
+            if ((*db)->bt->record_format != RECORD_FORMAT_COMPACT)
+                rc = chidb_Btree_setRecordFormat((*db)->bt, RECORD_FORMAT_COMPACT);
+            if (rc != CHIDB_OK)
+                chidb_Btree_rollback((*db)->bt);
+            else
+                rc = chidb_Btree_unlock((*db)->bt, BTREE_LOCK_WRITE);
+        }
+        if (rc != CHIDB_OK)
+        {
+            chidb_close(*db);
+            return rc;
+        }
+    }
 
-    /* Additional initialization code goes here */
     return CHIDB_OK;
 }
 
+int chidb_get_autocommit(chidb *db)
+{
+    return !db->bt->pager->in_txn;
+}
+
 int chidb_close(chidb *db)
 {
+    chidb_stmt_cache_free(&db->stmt_cache);
+    chidb_schema_free(db);
+    list_destroy(&db->schema);
     chidb_Btree_close(db->bt);
     free(db);
 
-    /* Additional cleanup code goes here */
-
     return CHIDB_OK;
 }
 
-int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
+/* Compiles a statement (see chidb_prepare), while the database can't
+ * be changed by other connections */
+static int prepare(chidb *db, const char *sql, chidb_stmt **stmt)
 {
     int rc;
     chisql_statement_t *sql_stmt, *sql_stmt_opt;
+    char *key;
+
+    key = chidb_stmt_cache_key(sql);
+    if(key == NULL)
+        return CHIDB_ENOMEM;
+
+    /* If this statement has been prepared (and finalized) before, and
+     * the schema hasn't changed since, reuse its program */
+    *stmt = chidb_stmt_cache_take(&db->stmt_cache, key, db->bt->schema_cookie);
+    if(*stmt != NULL)
+    {
+        free(key);
+        return CHIDB_OK;
+    }
 
     *stmt = malloc(sizeof(chidb_stmt));
 
@@ -90,14 +150,19 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
 
     if(rc != CHIDB_OK)
     {
+        free(key);
         free(*stmt);
         return rc;
     }
 
+    (*stmt)->cache_key = key;
+    (*stmt)->cookie = db->bt->schema_cookie;
+
     rc = chisql_parser(sql, &sql_stmt);
 
     if(rc != CHIDB_OK)
     {
+        chidb_stmt_free(*stmt);
         free(*stmt);
         return rc;
     }
@@ -106,19 +171,78 @@ int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
 
     if(rc != CHIDB_OK)
     {
+        chidb_stmt_free(*stmt);
         free(*stmt);
         return rc;
     }
 
     rc = chidb_stmt_codegen(*stmt, sql_stmt_opt);
 
+    if(rc == CHIDB_OK)
+        rc = chidb_stmt_peephole(*stmt);
+
     free(sql_stmt_opt);
 
+    if(rc != CHIDB_OK)
+    {
+        chidb_stmt_free(*stmt);
+        free(*stmt);
+        return rc;
+    }
+
     (*stmt)->explain = sql_stmt->explain;
+    (*stmt)->access = chidb_stmt_access(*stmt);
+
+    return rc;
+}
+
+int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
+{
+    /* The schema is read (and the cookie checked) with a read lock,
+     * unless this connection has a transaction */
+    uint8_t lock = chidb_get_autocommit(db) ? BTREE_LOCK_READ : BTREE_LOCK_NONE;
+    int rc;
+
+    if((rc = chidb_Btree_lock(db->bt, lock)) != CHIDB_OK)
+        return rc;
+    rc = prepare(db, sql, stmt);
+    chidb_Btree_unlock(db->bt, lock);
 
     return rc;
 }
 
+/* Compiles a statement again from its SQL, because the schema has
+ * changed since it was compiled. Called by chidb_stmt_exec, with the
+ * lock the statement needs. The statement keeps the values bound to
+ * its parameters (the SQL is the same, so the parameters are too) */
+int chidb_stmt_recompile(chidb_stmt *stmt)
+{
+    chidb_stmt *fresh, old;
+    int rc;
+
+    if((rc = prepare(stmt->db, stmt->cache_key, &fresh)) != CHIDB_OK)
+        return rc;
+
+    /* The caller's statement gets the new program, and the old program
+     * is freed in its place */
+    old = *stmt;
+    *stmt = *fresh;
+    stmt->lock = old.lock;
+    stmt->vars = old.vars;
+    stmt->var_names = old.var_names;
+    stmt->nVars = old.nVars;
+
+    old.lock = BTREE_LOCK_NONE;
+    old.vars = fresh->vars;
+    old.var_names = fresh->var_names;
+    old.nVars = fresh->nVars;
+    *fresh = old;
+    chidb_stmt_free(fresh);
+    free(fresh);
+
+    return CHIDB_OK;
+}
+
 int chidb_step(chidb_stmt *stmt)
 {
 	if(stmt->explain)
@@ -135,9 +259,113 @@ int chidb_step(chidb_stmt *stmt)
 		return chidb_stmt_exec(stmt);
 }
 
+int chidb_reset(chidb_stmt *stmt)
+{
+    return chidb_stmt_reset(stmt);
+}
+
+int chidb_bind_int(chidb_stmt *stmt, int param, int value)
+{
+    chidb_dbm_register_t reg;
+
+    reg.type = REG_INT32;
+    reg.value.i = value;
+
+    return chidb_stmt_bind(stmt, param, &reg);
+}
+
+int chidb_bind_int64(chidb_stmt *stmt, int param, int64_t value)
+{
+    chidb_dbm_register_t reg;
+
+    reg.type = REG_INT64;
+    reg.value.i64 = value;
+
+    return chidb_stmt_bind(stmt, param, &reg);
+}
+
+int chidb_bind_double(chidb_stmt *stmt, int param, double value)
+{
+    chidb_dbm_register_t reg;
+
+    reg.type = REG_DOUBLE;
+    reg.value.d = value;
+
+    return chidb_stmt_bind(stmt, param, &reg);
+}
+
+int chidb_bind_text(chidb_stmt *stmt, int param, const char *value)
+{
+    chidb_dbm_register_t reg;
+
+    if(value == NULL)
+        return chidb_bind_null(stmt, param);
+
+    reg.type = REG_STRING;
+    reg.value.s = (char *) value;
+    reg.slen = strlen(value);
+
+    return chidb_stmt_bind(stmt, param, &reg);
+}
+
+int chidb_bind_blob(chidb_stmt *stmt, int param, const void *value, int n)
+{
+    chidb_dbm_register_t reg;
+
+    if(value == NULL)
+        return chidb_bind_null(stmt, param);
+    if(n < 0)
+        return CHIDB_EMISUSE;
+
+    reg.type = REG_BINARY;
+    reg.value.bin.bytes = (uint8_t *) value;
+    reg.value.bin.nbytes = n;
+
+    return chidb_stmt_bind(stmt, param, &reg);
+}
+
+int chidb_bind_null(chidb_stmt *stmt, int param)
+{
+    chidb_dbm_register_t reg;
+
+    reg.type = REG_NULL;
+
+    return chidb_stmt_bind(stmt, param, &reg);
+}
+
+int chidb_bind_parameter_count(chidb_stmt *stmt)
+{
+    return stmt->nVars;
+}
+
+int chidb_bind_parameter_index(chidb_stmt *stmt, const char *name)
+{
+    if(name[0] == ':')
+        name++;
+
+    for(int i = 0; i < stmt->nVars; i++)
+        if(stmt->var_names[i] != NULL && !strcmp(stmt->var_names[i], name))
+            return i + 1;
+
+    return 0;
+}
+
 int chidb_finalize(chidb_stmt *stmt)
 {
-    return chidb_stmt_free(stmt);
+    chidb *db = stmt->db;
+
+    /* Keep the program around, in case the same SQL is prepared again
+     * (without the values bound to it, which are part of this use of
+     * the statement) */
+    chidb_stmt_reset(stmt);
+    chidb_stmt_unbind(stmt);
+    if(chidb_stmt_cache_put(&db->stmt_cache, stmt, db->bt->schema_cookie))
+        return CHIDB_OK;
+
+    chidb_stmt_free(stmt);
+    free(stmt);
+
+    return CHIDB_OK;
 }
 
 int chidb_column_count(chidb_stmt *stmt)
@@ -184,7 +412,6 @@ int chidb_column_type(chidb_stmt *stmt, int col)
 			switch(r->type)
 			{
 			case REG_UNSPECIFIED:
-			case REG_BINARY:
 				return SQL_NOTVALID;
 				break;
 			case REG_NULL:
@@ -193,9 +420,18 @@ int chidb_column_type(chidb_stmt *stmt, int col)
 			case REG_INT32:
 				return SQL_INTEGER_4BYTE;
 				break;
+			case REG_INT64:
+				return SQL_INTEGER_8BYTE;
+				break;
+			case REG_DOUBLE:
+				return SQL_DOUBLE;
+				break;
 			case REG_STRING:
 				return 2 * strlen(r->value.s) + SQL_TEXT;
 				break;
+			case REG_BINARY:
+				return 2 * r->value.bin.nbytes + SQL_BLOB;
+				break;
 			default:
 				return SQL_NOTVALID;
 			}
@@ -259,6 +495,26 @@ int chidb_column_int(chidb_stmt *stmt, int col)
 		}
 	}
 	else
+	{
+		if(col < 0 || col >= stmt->nCols)
+		{
+			/* Undefined behaviour */
+			return 0;
+		}
+		else
+		{
+			return chidb_column_int64(stmt, col);
+		}
+	}
+}
+
+int64_t chidb_column_int64(chidb_stmt *stmt, int col)
+{
+	if(stmt->explain)
+	{
+		return chidb_column_int(stmt, col);
+	}
+	else
 	{
 		if(col < 0 || col >= stmt->nCols)
 		{
@@ -269,19 +525,101 @@ int chidb_column_int(chidb_stmt *stmt, int col)
 		{
 			chidb_dbm_register_t *r = &stmt->reg[stmt->startRR + col];
 
-			if(r->type != REG_INT32)
+			switch(r->type)
 			{
+			case REG_INT32:
+				return r->value.i;
+			case REG_INT64:
+				return r->value.i64;
+			case REG_DOUBLE:
+				return (int64_t) r->value.d;
+			default:
 				/* Undefined behaviour */
 				return 0;
 			}
-			else
+		}
+	}
+}
+
+double chidb_column_double(chidb_stmt *stmt, int col)
+{
+	if(stmt->explain)
+	{
+		return chidb_column_int(stmt, col);
+	}
+	else
+	{
+		if(col < 0 || col >= stmt->nCols)
+		{
+			/* Undefined behaviour */
+			return 0.0;
+		}
+		else
+		{
+			chidb_dbm_register_t *r = &stmt->reg[stmt->startRR + col];
+
+			switch(r->type)
 			{
+			case REG_INT32:
 				return r->value.i;
+			case REG_INT64:
+				return r->value.i64;
+			case REG_DOUBLE:
+				return r->value.d;
+			default:
+				/* Undefined behaviour */
+				return 0.0;
 			}
 		}
 	}
 }
 
+const void *chidb_column_blob(chidb_stmt *stmt, int col)
+{
+	if(stmt->explain || col < 0 || col >= stmt->nCols)
+	{
+		/* Undefined behaviour */
+		return NULL;
+	}
+	else
+	{
+		chidb_dbm_register_t *r = &stmt->reg[stmt->startRR + col];
+
+		if(r->type != REG_BINARY)
+		{
+			/* Undefined behaviour */
+			return NULL;
+		}
+		else
+		{
+			return r->value.bin.bytes;
+		}
+	}
+}
+
+int chidb_column_bytes(chidb_stmt *stmt, int col)
+{
+	if(stmt->explain || col < 0 || col >= stmt->nCols)
+	{
+		/* Undefined behaviour */
+		return 0;
+	}
+	else
+	{
+		chidb_dbm_register_t *r = &stmt->reg[stmt->startRR + col];
+
+		switch(r->type)
+		{
+		case REG_BINARY:
+			return r->value.bin.nbytes;
+		case REG_STRING:
+			return r->slen;
+		default:
+			return 0;
+		}
+	}
+}
+
 const char *chidb_column_text(chidb_stmt *stmt, int col)
 {
 	if(stmt->explain)
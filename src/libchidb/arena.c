@@ -0,0 +1,325 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module provides a simple arena (or "region") allocator. Memory is
+ * handed out from large chunks by bumping a pointer, and individual
+ * allocations are never freed. Instead, the whole arena is reset in bulk
+ * once none of its allocations are needed anymore, and its chunks are
+ * reused for the next batch of allocations.
+ *
+ * This is a good fit for memory whose lifetime is tied to a single row
+ * produced by a DBM program (values read from a record into registers,
+ * records built by MakeRecord, etc.): each DBM has its own arena, which
+ * is reset when the program starts. Each loop of the program marks the
+ * arena's position before it starts (chidb_Arena_mark), and releases the
+ * arena to that mark at the end of each iteration (chidb_Arena_release),
+ * so the values of outer loops survive. So, in the common case, no calls
+ * to malloc or free are made while running a DBM.
+ *
+ * The following is an example of how an arena could be used:
+ *
+ *   Arena arena;
+ *   char *s;
+ *   chidb_Arena_init(&arena);
+ *   chidb_Arena_strndup(&arena, "foobar", 3, &s); // s == "foo"
+ *   ...
+ *   chidb_Arena_reset(&arena); // s is no longer valid
+ *   ...
+ *   chidb_Arena_free(&arena);
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/* All allocations are aligned to this many bytes */
+#define ARENA_ALIGN (8)
+#define ARENA_ROUNDUP(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+
+/* Initialize an arena
+ *
+ * No memory is allocated until the first allocation is made.
+ *
+ * Parameters
+ * - arena: Pointer to an uninitialized arena
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Arena_init(Arena *arena)
+{
+    arena->first = NULL;
+    arena->current = NULL;
+
+    return CHIDB_OK;
+}
+
+
+/* Allocate memory from an arena
+ *
+ * The memory remains valid until the arena is reset or freed.
+ *
+ * Parameters
+ * - arena: An initialized arena
+ * - size: Number of bytes to allocate
+ * - p: Out parameter used to return a pointer to the allocated memory
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Arena_alloc(Arena *arena, uint32_t size, void **p)
+{
+    ArenaChunk *chunk = arena->current;
+
+    size = ARENA_ROUNDUP(size);
+
+    /* Look for a chunk with enough room, starting with the current one.
+     * Chunks after the current one are either empty (after a reset) or
+     * have never been used. */
+    while (chunk != NULL && chunk->used + size > chunk->size)
+    {
+        chunk = chunk->next;
+        if (chunk != NULL)
+            chunk->used = 0;
+    }
+
+    if (chunk == NULL)
+    {
+        uint32_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+
+        chunk = malloc(sizeof(ArenaChunk) + chunk_size);
+        if (chunk == NULL)
+            return CHIDB_ENOMEM;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+
+        /* New chunks go right after the current one, so that the chunks
+         * we skipped over because they were too small still get used
+         * after the next reset */
+        if (arena->current == NULL)
+        {
+            chunk->next = arena->first;
+            arena->first = chunk;
+        }
+        else
+        {
+            chunk->next = arena->current->next;
+            arena->current->next = chunk;
+        }
+    }
+
+    arena->current = chunk;
+    *p = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return CHIDB_OK;
+}
+
+
+/* Grow a previous allocation
+ *
+ * If "old" is the most recent allocation made from the arena, and there
+ * is enough room for it to grow in its chunk, it is grown in place.
+ * Otherwise, new memory is allocated and the old contents are copied into
+ * it (the old memory is not reclaimed until the arena is reset).
+ *
+ * Parameters
+ * - arena: An initialized arena
+ * - old: Pointer to a previous allocation (or NULL)
+ * - old_size: Size of the previous allocation
+ * - size: New size (must be >= old_size)
+ * - p: Out parameter used to return a pointer to the allocated memory
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Arena_realloc(Arena *arena, void *old, uint32_t old_size, uint32_t size, void **p)
+{
+    ArenaChunk *chunk = arena->current;
+
+    if (old != NULL && chunk != NULL &&
+            (uint8_t *) old + ARENA_ROUNDUP(old_size) == chunk->data + chunk->used &&
+            (uint8_t *) old - chunk->data + ARENA_ROUNDUP(size) <= chunk->size)
+    {
+        chunk->used = (uint8_t *) old - chunk->data + ARENA_ROUNDUP(size);
+        *p = old;
+        return CHIDB_OK;
+    }
+
+    int rc = chidb_Arena_alloc(arena, size, p);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    if (old != NULL)
+        memcpy(*p, old, old_size);
+
+    return CHIDB_OK;
+}
+
+
+/* Copy a string into an arena
+ *
+ * Copies at most "len" characters from a string (which does not have
+ * to be null-terminated) and null-terminates the copy.
+ *
+ * Parameters
+ * - arena: An initialized arena
+ * - s: String to copy
+ * - len: Maximum number of characters to copy
+ * - p: Out parameter used to return a pointer to the copy
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Arena_strndup(Arena *arena, const char *s, uint32_t len, char **p)
+{
+    int rc;
+    void *buf;
+
+    len = strnlen(s, len);
+    rc = chidb_Arena_alloc(arena, len + 1, &buf);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    memcpy(buf, s, len);
+    ((char *) buf)[len] = '\0';
+    *p = buf;
+
+    return CHIDB_OK;
+}
+
+
+/* Mark the current position of an arena
+ *
+ * Allocations made after this can be released with chidb_Arena_release,
+ * while the ones made before it are kept. Marks nest like a stack: once
+ * the arena is released to a mark, any mark taken after it is invalid.
+ *
+ * Parameters
+ * - arena: An initialized arena
+ * - mark: Out parameter used to return the position
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Arena_mark(Arena *arena, ArenaMark *mark)
+{
+    mark->chunk = arena->current;
+    mark->used = arena->current != NULL ? arena->current->used : 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Release an arena to a mark
+ *
+ * Releases all the allocations made from the arena since a mark was
+ * taken with chidb_Arena_mark, in bulk. Like chidb_Arena_reset, the
+ * chunks are kept around for subsequent allocations.
+ *
+ * Parameters
+ * - arena: An initialized arena
+ * - mark: Position returned by chidb_Arena_mark
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Arena_release(Arena *arena, const ArenaMark *mark)
+{
+    /* Nothing had been allocated when the mark was taken */
+    if (mark->chunk == NULL)
+        return chidb_Arena_reset(arena);
+
+    /* The chunks after the mark's are emptied as they're reached again
+     * (see chidb_Arena_alloc) */
+    arena->current = mark->chunk;
+    arena->current->used = mark->used;
+
+    return CHIDB_OK;
+}
+
+
+/* Reset an arena
+ *
+ * Releases all the allocations made from the arena in bulk. The arena's
+ * chunks are kept around, and will be used by subsequent allocations.
+ *
+ * Parameters
+ * - arena: An initialized arena
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Arena_reset(Arena *arena)
+{
+    arena->current = arena->first;
+    if (arena->current != NULL)
+        arena->current->used = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Free an arena
+ *
+ * Frees all the memory used by the arena. The arena can be used
+ * again after this (it will behave like a newly initialized arena).
+ *
+ * Parameters
+ * - arena: An initialized arena
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Arena_free(Arena *arena)
+{
+    ArenaChunk *chunk = arena->first;
+
+    while (chunk != NULL)
+    {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    return chidb_Arena_init(arena);
+}
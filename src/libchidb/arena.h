@@ -0,0 +1,79 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Arena allocator header. See arena.c for details.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include "chidbInt.h"
+
+#define ARENA_CHUNK_SIZE (4096)
+
+/* A chunk of memory from which an Arena hands out allocations. */
+typedef struct ArenaChunk
+{
+    struct ArenaChunk *next;
+    uint32_t size;
+    uint32_t used;
+    uint8_t data[];
+} ArenaChunk;
+
+struct Arena
+{
+    ArenaChunk *first;
+    ArenaChunk *current;
+};
+typedef struct Arena Arena;
+
+/* A position in an Arena (see chidb_Arena_mark) */
+typedef struct ArenaMark
+{
+    ArenaChunk *chunk;
+    uint32_t used;
+} ArenaMark;
+
+int chidb_Arena_init(Arena *arena);
+int chidb_Arena_alloc(Arena *arena, uint32_t size, void **p);
+int chidb_Arena_realloc(Arena *arena, void *old, uint32_t old_size, uint32_t size, void **p);
+int chidb_Arena_strndup(Arena *arena, const char *s, uint32_t len, char **p);
+int chidb_Arena_mark(Arena *arena, ArenaMark *mark);
+int chidb_Arena_release(Arena *arena, const ArenaMark *mark);
+int chidb_Arena_reset(Arena *arena);
+int chidb_Arena_free(Arena *arena);
+
+#endif /*ARENA_H_*/
@@ -47,6 +47,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <unistd.h>
 #include <chidb/log.h>
 #include "chidbInt.h"
 #include "btree.h"
@@ -55,6 +56,19 @@
 #include "util.h"
 
 
+static int btree_find_optimistic(BTree *bt, npage_t nroot, chidb_key_t key,
+                                 uint8_t **data, uint16_t *size);
+
+static void btree_init_latches(BTree *bt)
+{
+    for(int i = 0; i < BTREE_LATCHES; i++)
+    {
+        pthread_mutex_init(&bt->latches[i].mutex, NULL);
+        bt->latches[i].version = 0;
+    }
+}
+
+
 /* Open a B-Tree file
  *
  * This function opens a database file and verifies that the file
@@ -112,14 +126,17 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
     // Create a BTree and set members of BTree and Database
     *bt = (BTree*) malloc(sizeof(BTree));
     if(*bt == NULL) {
+        chidb_Pager_close(pager);
         return CHIDB_ENOMEM;
     }
     (*bt)->pager = pager;
     (*bt)->db = db;
     db->bt = *bt;
+    btree_init_latches(*bt);
 
     if(!newFile) {
         if (chidb_Pager_readHeader(pager, header) != CHIDB_OK) {
+            chidb_Btree_close(*bt);
             return CHIDB_ECORRUPTHEADER;
         }
         // Check header is correct, just hardcoded checking, nothing special    
@@ -128,23 +145,30 @@ int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
                 &header[0x12], 6) && 
             !memcmp(fourZeroes, &header[0x20], 4) &&
             !memcmp(fourZeroes, &header[0x24], 4) &&
-            !memcmp(zeroAndOne, &header[0x2C], 4) &&
+            (get4byte(&header[HEADER_FORMAT]) == RECORD_FORMAT_LEGACY ||
+             get4byte(&header[HEADER_FORMAT]) == RECORD_FORMAT_COMPACT) &&
             !memcmp(fourZeroes, &header[0x34], 4) &&
             !memcmp(zeroAndOne, &header[0x38], 4) &&
             !memcmp(fourZeroes, &header[0x40], 4) &&
             !memcmp(fourZeroes, &header[HEADER_FILECHANGE], 4) &&
             !memcmp(fourZeroes, &header[HEADER_SCHEMA], 4) &&
-            !memcmp(pageCacheSize, &header[HEADER_PAGECACHESIZE], 4) &&
-            !memcmp(fourZeroes, &header[HEADER_COOKIE], 4)
+            !memcmp(pageCacheSize, &header[HEADER_PAGECACHESIZE], 4)
         ) {
             // If we made it here, the header is correct, set page size
             uint16_t pageSize = get2byte(&header[HEADER_PAGESIZE]);
             chidb_Pager_setPageSize(pager, pageSize);
+            (*bt)->record_format = get4byte(&header[HEADER_FORMAT]);
+            (*bt)->schema_cookie = get4byte(&header[HEADER_COOKIE]);
         } else {
+            chidb_Btree_close(*bt);
             return CHIDB_ECORRUPTHEADER;
         }
 
     } else {
+        // New files use the legacy record format, unless
+        // chidb_Btree_setRecordFormat is used to change it
+        (*bt)->record_format = RECORD_FORMAT_LEGACY;
+        (*bt)->schema_cookie = 0;
         chidb_Pager_setPageSize(pager, DEFAULT_PAGE_SIZE);
         pager->n_pages = 0;
         npage_t npage;
@@ -171,11 +195,316 @@ int chidb_Btree_close(BTree *bt)
 {
 
     chidb_Pager_close(bt->pager);
+    for(int i = 0; i < BTREE_LATCHES; i++)
+        pthread_mutex_destroy(&bt->latches[i].mutex);
     free(bt);
     return CHIDB_OK;
 }
 
 
+/* Open a temporary B-Tree file
+ *
+ * Creates a B-Tree file that isn't part of any database (e.g., to hold
+ * rows that don't fit in memory while a statement runs), with an empty
+ * table leaf node in page 1. The file is removed right away, so it goes
+ * away once it's closed (with chidb_Btree_close), or when the process
+ * exits.
+ *
+ * Parameters
+ * - bt: An out parameter. Used to return a pointer to the
+ *       newly created BTree.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_openTemp(BTree **bt)
+{
+    Pager *pager;
+    npage_t npage;
+    char filename[] = P_tmpdir "/chidb-XXXXXX";
+    int fd, err;
+
+    if((fd = mkstemp(filename)) == -1)
+        return CHIDB_EIO;
+    close(fd);
+
+    err = chidb_Pager_open(&pager, filename);
+    unlink(filename);
+    if(err != CHIDB_OK)
+        return err;
+
+    if((*bt = malloc(sizeof(BTree))) == NULL)
+    {
+        chidb_Pager_close(pager);
+        return CHIDB_ENOMEM;
+    }
+    (*bt)->pager = pager;
+    (*bt)->db = NULL;
+    btree_init_latches(*bt);
+    (*bt)->record_format = RECORD_FORMAT_COMPACT;
+    (*bt)->schema_cookie = 0;
+    chidb_Pager_setPageSize(pager, DEFAULT_PAGE_SIZE);
+    pager->n_pages = 0;
+
+    if((err = chidb_Btree_newNode(*bt, &npage, PGTYPE_TABLE_LEAF)) != CHIDB_OK)
+    {
+        chidb_Btree_close(*bt);
+        return err;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Set the format of new records
+ *
+ * Changes the record format (see record.h) that will be used to write
+ * new records in this file. Existing records are not rewritten, since
+ * records in either format can be read regardless of this setting.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - format: RECORD_FORMAT_LEGACY or RECORD_FORMAT_COMPACT
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Invalid record format
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_setRecordFormat(BTree *bt, uint8_t format)
+{
+    int err;
+    MemPage* page;
+
+    if(format != RECORD_FORMAT_LEGACY && format != RECORD_FORMAT_COMPACT)
+        return CHIDB_EMISUSE;
+
+    check_fail(chidb_Pager_readPage(bt->pager, 1, &page));
+    put4byte(page->data + HEADER_FORMAT, format);
+    err = chidb_Pager_writePage(bt->pager, page);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+    if(err != CHIDB_OK)
+        return err;
+
+    bt->record_format = format;
+
+    return CHIDB_OK;
+}
+
+
+/* Record a change in the schema
+ *
+ * Increments the schema cookie in the file header. Anything derived
+ * from the schema (such as compiled statements) that was produced with
+ * a different cookie is out of date.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_incrSchemaCookie(BTree *bt)
+{
+    int err;
+    MemPage* page;
+
+    check_fail(chidb_Pager_readPage(bt->pager, 1, &page));
+    put4byte(page->data + HEADER_COOKIE, bt->schema_cookie + 1);
+    err = chidb_Pager_writePage(bt->pager, page);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+    if(err != CHIDB_OK)
+        return err;
+
+    bt->schema_cookie++;
+
+    return CHIDB_OK;
+}
+
+
+/* Reads the record format and the schema cookie from the file header,
+ * since another B-Tree open on the same file may have changed them */
+static int btree_read_header(BTree *bt)
+{
+    MemPage* page;
+    int err;
+
+    check_fail(chidb_Pager_readPage(bt->pager, 1, &page));
+    bt->record_format = get4byte(page->data + HEADER_FORMAT);
+    bt->schema_cookie = get4byte(page->data + HEADER_COOKIE);
+    chidb_Pager_releaseMemPage(bt->pager, page);
+
+    return CHIDB_OK;
+}
+
+
+/* Lock a B-Tree file
+ *
+ * Several B-Trees (in different threads) can be open on the same file
+ * (see chidb_Pager_open). While one of them holds a BTREE_LOCK_READ
+ * lock, it reads a snapshot of the file, which doesn't include the
+ * changes other B-Trees commit meanwhile (see chidb_Pager_lockRead).
+ * BTREE_LOCK_WRITE is needed to change the file outside a transaction:
+ * it begins one (see chidb_Btree_begin), which is committed when the
+ * lock is released, so that readers see all of the changes or none.
+ * Inside a transaction, no lock is needed.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - lock: BTREE_LOCK_NONE, BTREE_LOCK_READ or BTREE_LOCK_WRITE
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EBUSY: This B-Tree holds a read lock and another one is
+ *   writing, or has written since (see chidb_Pager_lockWrite)
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_lock(BTree *bt, uint8_t lock)
+{
+    int err;
+
+    if(lock == BTREE_LOCK_NONE)
+        return CHIDB_OK;
+    else if(lock == BTREE_LOCK_WRITE)
+        return chidb_Btree_begin(bt);
+
+    check_fail(chidb_Pager_lockRead(bt->pager));
+    if((err = btree_read_header(bt)) != CHIDB_OK)
+        chidb_Btree_unlock(bt, lock);
+
+    return err;
+}
+
+
+/* Unlock a B-Tree file
+ *
+ * Releasing BTREE_LOCK_WRITE commits the changes made while it was
+ * held (if that fails, they are rolled back).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - lock: Lock acquired with chidb_Btree_lock
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_unlock(BTree *bt, uint8_t lock)
+{
+    int err;
+
+    if(lock == BTREE_LOCK_READ)
+        return chidb_Pager_unlockRead(bt->pager);
+    else if(lock == BTREE_LOCK_WRITE && (err = chidb_Btree_commit(bt)) != CHIDB_OK)
+    {
+        chidb_Btree_rollback(bt);
+        return err;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Begin a transaction
+ *
+ * Changes made to the file until the transaction is committed are
+ * not written to it, and can be undone with chidb_Btree_rollback
+ * (see chidb_Pager_begin). Only one B-Tree open on a file can have a
+ * transaction, so this waits until any other transaction is over.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: A transaction is already open
+ * - CHIDB_EBUSY: Another B-Tree has a transaction, and this one holds
+ *   a read lock
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Btree_begin(BTree *bt)
+{
+    int err;
+
+    if(bt->pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    check_fail(chidb_Pager_lockWrite(bt->pager));
+    if((err = btree_read_header(bt)) == CHIDB_OK)
+        err = chidb_Pager_begin(bt->pager);
+    if(err != CHIDB_OK)
+        chidb_Pager_unlockWrite(bt->pager);
+
+    return err;
+}
+
+
+/* Commit the current transaction
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no transaction
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_commit(BTree *bt)
+{
+    int err;
+
+    check_fail(chidb_Pager_commit(bt->pager));
+
+    return chidb_Pager_unlockWrite(bt->pager);
+}
+
+
+/* Roll back the current transaction
+ *
+ * Undoes every change made to the file in the transaction, including
+ * changes to the schema cookie and the record format in the header.
+ * If the schema was changed in the transaction, the cookie is then
+ * given a value it has never had, since statements may have been
+ * compiled with the schema that was rolled back.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no transaction
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_rollback(BTree *bt)
+{
+    uint32_t cookie = bt->schema_cookie;
+    int err;
+
+    if(!bt->pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    if((err = chidb_Pager_rollback(bt->pager)) == CHIDB_OK)
+        err = btree_read_header(bt);
+
+    if(err == CHIDB_OK && bt->schema_cookie != cookie &&
+       (err = chidb_Pager_begin(bt->pager)) == CHIDB_OK)
+    {
+        bt->schema_cookie = cookie;
+        if((err = chidb_Btree_incrSchemaCookie(bt)) == CHIDB_OK)
+            err = chidb_Pager_commit(bt->pager);
+        if(err != CHIDB_OK)
+            chidb_Pager_rollback(bt->pager);
+    }
+
+    chidb_Pager_unlockWrite(bt->pager);
+
+    return err;
+}
+
+
 /* Loads a B-Tree node from disk
  *
  * Reads a B-Tree node from a page in the disk. All the information regarding
@@ -332,8 +661,8 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
         data = page->data + HEADER_SCHEMA;
         put4byte(data, 0);
 
-        data = page->data + HEADER_ONE;
-        put4byte(data, 1);
+        data = page->data + HEADER_FORMAT;
+        put4byte(data, bt->record_format);
         
         data = page->data + HEADER_PAGECACHESIZE;
         put4byte(data, 20000);
@@ -486,9 +815,28 @@ int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
 
         cell->key = get4byte(cell_data + INDEXINTCELL_KEYIDX_OFFSET);
         cell->fields.indexInternal.keyPk = get4byte(cell_data + INDEXINTCELL_KEYPK_OFFSET);
+
+        // Record of included columns, if any
+        if(cell_data[INDEXINTCELL_MAGIC_OFFSET] == INDEXCELL_MAGIC_DATA) {
+            cell->fields.indexInternal.data_size =
+                get2byte(cell_data + INDEXINTCELL_MAGIC_OFFSET + INDEXCELL_DATASIZE_OFFSET);
+            cell->fields.indexInternal.data = cell_data + INDEXINTCELL_DATA_OFFSET;
+        } else {
+            cell->fields.indexInternal.data_size = 0;
+            cell->fields.indexInternal.data = NULL;
+        }
     } else {
         cell->key = get4byte(cell_data + INDEXLEAFCELL_KEYIDX_OFFSET);
         cell->fields.indexLeaf.keyPk = get4byte(cell_data + INDEXLEAFCELL_KEYPK_OFFSET);
+
+        if(cell_data[INDEXLEAFCELL_MAGIC_OFFSET] == INDEXCELL_MAGIC_DATA) {
+            cell->fields.indexLeaf.data_size =
+                get2byte(cell_data + INDEXLEAFCELL_MAGIC_OFFSET + INDEXCELL_DATASIZE_OFFSET);
+            cell->fields.indexLeaf.data = cell_data + INDEXLEAFCELL_DATA_OFFSET;
+        } else {
+            cell->fields.indexLeaf.data_size = 0;
+            cell->fields.indexLeaf.data = NULL;
+        }
     }
 
 
@@ -548,7 +896,8 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
         memcpy(data + TABLELEAFCELL_DATA_OFFSET, cell->fields.tableLeaf.data, size);
     } else if (cell->type == PGTYPE_INDEX_INTERNAL) {
         // index internal node       
-        length = INDEXINTCELL_SIZE;
+        uint16_t size = cell->fields.indexInternal.data_size;
+        length = INDEXINTCELL_SIZE + size;
         data = page->data + btn->cells_offset - length;
         put4byte(data + INDEXINTCELL_CHILD_OFFSET, 
             cell->fields.indexInternal.child_page);
@@ -558,8 +907,14 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
             cell->key);
         put4byte(data + INDEXINTCELL_KEYPK_OFFSET, 
             cell->fields.indexInternal.keyPk);
+        if(size > 0) {
+            data[INDEXINTCELL_MAGIC_OFFSET] = INDEXCELL_MAGIC_DATA;
+            put2byte(data + INDEXINTCELL_MAGIC_OFFSET + INDEXCELL_DATASIZE_OFFSET, size);
+            memcpy(data + INDEXINTCELL_DATA_OFFSET, cell->fields.indexInternal.data, size);
+        }
     } else {
-        length = INDEXLEAFCELL_SIZE;
+        uint16_t size = cell->fields.indexLeaf.data_size;
+        length = INDEXLEAFCELL_SIZE + size;
         data = page->data + btn->cells_offset - length;
         memcpy(data + INDEXLEAFCELL_MAGIC_OFFSET,
             index_magic, 4);
@@ -567,6 +922,11 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
             cell->key);
         put4byte(data + INDEXLEAFCELL_KEYPK_OFFSET, 
             cell->fields.indexLeaf.keyPk);
+        if(size > 0) {
+            data[INDEXLEAFCELL_MAGIC_OFFSET] = INDEXCELL_MAGIC_DATA;
+            put2byte(data + INDEXLEAFCELL_MAGIC_OFFSET + INDEXCELL_DATASIZE_OFFSET, size);
+            memcpy(data + INDEXLEAFCELL_DATA_OFFSET, cell->fields.indexLeaf.data, size);
+        }
     }
     
     // Write data into cell area and update offset
@@ -599,56 +959,20 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
  * Return
  * - CHIDB_OK: Operation successful
  * - CHIDB_ENOTFOUND: No entry with the given key way found
+ * - CHIDB_EBUSY: Other threads inserting into the B-Tree kept changing
+ *   the nodes on the way (see Latches)
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
 int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size)
 {
-    int err;
-    BTreeNode* node;
+    int tries = 0, err;
 
-    if((err = chidb_Btree_getNodeByPage(bt, nroot, &node)) != CHIDB_OK) {
-        return err;
-    }
-    
-    for(ncell_t i = 0; i < node->n_cells; i++) {
-        BTreeCell cell;
-        chidb_Btree_getCell(node, i, &cell);
-        if(cell.key == key) {
-           // We found it, or at least we're almost there
-            if(node->type == PGTYPE_TABLE_LEAF) {
-                *size = cell.fields.tableLeaf.data_size;
-                *data = (uint8_t *) malloc(sizeof(uint8_t) * (*size));
-                
-                if(*data == NULL) {
-                    chidb_Btree_freeMemNode(bt, node);
-                    return CHIDB_ENOMEM;
-                }
-
-                memcpy(*data, cell.fields.tableLeaf.data, *size);
-                return chidb_Btree_freeMemNode(bt, node);
-            }
-        }
-        if (key <= cell.key){
-            // It's lower down the tree (if that exists), so recurse
-            if(node->type == PGTYPE_TABLE_LEAF) {
-                chidb_Btree_freeMemNode(bt, node);
-                return CHIDB_ENOTFOUND;
-            }
-            chidb_Btree_freeMemNode(bt, node);
-            return chidb_Btree_find(bt, 
-                cell.fields.tableInternal.child_page, key, data, size);
-        }
-    }
-    // If we made it this far, it either doesn't exist, or is in the right page
-    if(node->type == PGTYPE_TABLE_LEAF) {
-        chidb_Btree_freeMemNode(bt, node);
-        return CHIDB_ENOTFOUND;
-    }
-    npage_t page = node->right_page;
-    chidb_Btree_freeMemNode(bt, node);
-    return chidb_Btree_find(bt, page, key, data, size);
+    do
+        err = btree_find_optimistic(bt, nroot, key, data, size);
+    while(err == CHIDB_EBUSY && ++tries < BTREE_OPTIMISTIC_TRIES);
 
+    return err;
 }
 
 
@@ -707,16 +1031,194 @@ int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
 int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk)
+{
+    return chidb_Btree_insertInCoveringIndex(bt, nroot, keyIdx, keyPk, NULL, 0);
+}
+
+
+/* Insert an entry into a covering index B-Tree
+ *
+ * Same as chidb_Btree_insertInIndex, but the entry also stores a record
+ * of the included columns of the row, so that they can be read from
+ * the index without looking up the row in the table.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to insert
+ *          this entry in.
+ * - keyIdx: See The chidb File Format.
+ * - keyPk: See The chidb File Format.
+ * - data: Record of the included columns
+ * - size: Number of bytes of data (0 if there are no included columns)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: An entry with that key already exists
+ * - CHIDB_EMISUSE: The record is larger than INDEXCELL_MAX_DATA
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_insertInCoveringIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk,
+                                      uint8_t *data, uint16_t size)
 {
     BTreeCell cell;
-    
+
+    if(size > INDEXCELL_MAX_DATA)
+        return CHIDB_EMISUSE;
+
     cell.type = PGTYPE_INDEX_LEAF;
     cell.key = keyIdx;
-    cell.fields.indexInternal.keyPk = keyPk;
+    cell.fields.indexLeaf.keyPk = keyPk;
+    cell.fields.indexLeaf.data_size = size;
+    cell.fields.indexLeaf.data = data;
 
     return chidb_Btree_insert(bt, nroot, &cell);
 }
 
+
+/* State of chidb_Btree_loadIndex */
+typedef struct
+{
+    BTree *bt;
+    chidb_Btree_indexSource next;
+    void *ctx;
+    /* Number of entries a subtree of height h+1 can hold */
+    uint64_t capacity[32];
+} index_load_t;
+
+/* Number of cells a node of an index B-Tree can hold without
+ * overflowing (see would_overflow) */
+static ncell_t index_capacity(BTree *bt, uint8_t type, bool covering)
+{
+    uint16_t header = type == PGTYPE_INDEX_LEAF ? LEAFPG_CELLSOFFSET_OFFSET : INTPG_CELLSOFFSET_OFFSET;
+    uint16_t size = type == PGTYPE_INDEX_LEAF ? INDEXLEAFCELL_SIZE : INDEXINTCELL_SIZE;
+
+    if(covering)
+        size = INDEXINTCELL_SIZE + INDEXCELL_MAX_DATA;
+
+    return (bt->pager->page_size - header) / (size + 2);
+}
+
+/* Writes a subtree of the given height with the next n entries in page
+ * npage. Its children are written before it, left to right */
+static int index_load_node(index_load_t *load, npage_t npage, uint32_t height, uint64_t n)
+{
+    int err;
+    BTreeNode *node;
+    BTreeCell cell;
+
+    check_fail(chidb_Btree_initEmptyNode(load->bt, npage, height == 1 ? PGTYPE_INDEX_LEAF : PGTYPE_INDEX_INTERNAL));
+    check_fail(chidb_Btree_getNodeByPage(load->bt, npage, &node));
+
+    if(height == 1)
+    {
+        for(ncell_t i = 0; i < n; i++)
+        {
+            check_fail(load->next(load->ctx, &cell));
+            check_fail(chidb_Btree_insertCell(node, i, &cell));
+        }
+    }
+    else
+    {
+        /* Use the fewest children that can hold the entries (all of
+         * them but one separator between each two children), and
+         * share the entries evenly among them */
+        uint64_t below = load->capacity[height - 2];
+        uint64_t nchildren = (n + below + 1) / (below + 1);
+        uint64_t rest = n - (nchildren - 1);
+
+        for(uint64_t i = 0; i < nchildren; i++)
+        {
+            npage_t child;
+
+            chidb_Pager_allocatePage(load->bt->pager, &child);
+            check_fail(index_load_node(load, child, height - 1, rest / nchildren + (i < rest % nchildren)));
+
+            if(i == nchildren - 1)
+            {
+                node->right_page = child;
+                break;
+            }
+
+            // The separator becomes an internal cell
+            check_fail(load->next(load->ctx, &cell));
+            chidb_key_t keyPk = cell.fields.indexLeaf.keyPk;
+            uint16_t data_size = cell.fields.indexLeaf.data_size;
+            uint8_t *data = cell.fields.indexLeaf.data;
+            cell.type = PGTYPE_INDEX_INTERNAL;
+            cell.fields.indexInternal.keyPk = keyPk;
+            cell.fields.indexInternal.child_page = child;
+            cell.fields.indexInternal.data_size = data_size;
+            cell.fields.indexInternal.data = data;
+            check_fail(chidb_Btree_insertCell(node, i, &cell));
+        }
+    }
+
+    check_fail(chidb_Btree_writeNode(load->bt, node));
+    return chidb_Btree_freeMemNode(load->bt, node);
+}
+
+/* Load the entries of an empty index B-Tree
+ *
+ * Builds an index B-Tree from its entries, which must be given in
+ * increasing order of keyIdx. This is much faster than inserting
+ * them one by one: the B-Tree is written bottom-up, each node once,
+ * with no searches or splits. Its shape is planned from the number
+ * of entries beforehand, so all of its leaves are at the same depth,
+ * and every node is about as full as its siblings (full nodes
+ * are split by the first insertion that reaches them).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree (an empty
+ *          index leaf node)
+ * - ncells: Number of entries
+ * - covering: Whether the entries have records of included columns
+ *             (which nodes have to keep room for; see would_overflow)
+ * - next: Function that returns each of the entries, in order
+ * - ctx: Passed on to next
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The B-Tree is not empty
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - Any error returned by next
+ */
+int chidb_Btree_loadIndex(BTree *bt, npage_t nroot, uint32_t ncells, bool covering,
+                          chidb_Btree_indexSource next, void *ctx)
+{
+    int err;
+    BTreeNode *root;
+    index_load_t load;
+    uint32_t height = 1;
+    ncell_t ninternal;
+    bool empty;
+
+    check_fail(chidb_Btree_getNodeByPage(bt, nroot, &root));
+    empty = root->type == PGTYPE_INDEX_LEAF && root->n_cells == 0;
+    check_fail(chidb_Btree_freeMemNode(bt, root));
+    if(!empty)
+        return CHIDB_EMISUSE;
+    if(ncells == 0)
+        return CHIDB_OK;
+
+    load.bt = bt;
+    load.next = next;
+    load.ctx = ctx;
+
+    /* The root's height is the smallest one that can hold every entry */
+    ninternal = index_capacity(bt, PGTYPE_INDEX_INTERNAL, covering);
+    load.capacity[0] = index_capacity(bt, PGTYPE_INDEX_LEAF, covering);
+    while(load.capacity[height - 1] < ncells)
+    {
+        load.capacity[height] = ninternal + (uint64_t) (ninternal + 1) * load.capacity[height - 1];
+        height++;
+    }
+
+    return index_load_node(&load, nroot, height, ncells);
+}
+
 // helper function to check if a node can fit a certain cell
 // uses pointers to avoid making copy
 bool would_overflow(BTreeNode* node, BTreeCell* cell) {
@@ -733,9 +1235,432 @@ bool would_overflow(BTreeNode* node, BTreeCell* cell) {
         size_cell = INDEXLEAFCELL_SIZE;
     }
 
-    return (size_cell > available);
+    /* A covering index needs room for the largest cell it can have,
+     * and the median of a split leaf becomes an internal cell */
+    if((cell->type == PGTYPE_INDEX_INTERNAL && cell->fields.indexInternal.data_size > 0) ||
+       (cell->type == PGTYPE_INDEX_LEAF && cell->fields.indexLeaf.data_size > 0))
+        size_cell = INDEXINTCELL_SIZE + INDEXCELL_MAX_DATA;
+
+    /* The cell also needs a two-byte slot in the cell offset array */
+    return (size_cell + 2 > available);
+}
+
+/* Latches
+ *
+ * Several threads can insert into the same B-Tree at once (e.g., in
+ * the same transaction), using optimistic lock coupling. Going down
+ * the tree, a thread only reads the version of each node's latch, and
+ * checks that the node's version hasn't changed after it has read the
+ * version of the child it goes to (otherwise, the child may no longer
+ * be the right one, and it starts again). Only the leaf is latched, and
+ * only if its version is still the one the thread read, so insertions
+ * into different leaves don't wait for each other.
+ *
+ * Insertions that have to split a node latch the nodes from the root
+ * down instead (see chidb_Btree_insertNonFull), holding the latches of
+ * a node and its child at most: the node is released as soon as it's
+ * clear that the child won't be split. Since nodes share latches, a
+ * thread never waits for a latch while it holds another one.
+ *
+ * Lookups (chidb_Btree_find) and cursors go down the same way, and
+ * also check that the leaf's version hasn't changed after reading it,
+ * since it may have been split meanwhile. A cursor that finds that a
+ * node it goes down from has changed looks for its entry from the root
+ * again (see chidb_dbm_cursor_table_move).
+ */
+
+static BTreeLatch *btree_latch(BTree *bt, npage_t npage)
+{
+    return &bt->latches[npage % BTREE_LATCHES];
+}
+
+
+/* Returns the version of a latch, waiting until no thread holds it */
+static uint32_t latch_version(BTreeLatch *latch)
+{
+    uint32_t version;
+
+    while((version = __sync_fetch_and_add(&latch->version, 0)) & 1)
+    {
+        pthread_mutex_lock(&latch->mutex);
+        pthread_mutex_unlock(&latch->mutex);
+    }
+
+    return version;
+}
+
+
+static bool latch_changed(BTreeLatch *latch, uint32_t version)
+{
+    return __sync_fetch_and_add(&latch->version, 0) != version;
+}
+
+
+static void latch_lock(BTreeLatch *latch)
+{
+    pthread_mutex_lock(&latch->mutex);
+    __sync_fetch_and_add(&latch->version, 1);
+}
+
+
+static bool latch_trylock(BTreeLatch *latch)
+{
+    if(pthread_mutex_trylock(&latch->mutex) != 0)
+        return false;
+    __sync_fetch_and_add(&latch->version, 1);
+
+    return true;
+}
+
+
+/* Releases a latch. If its nodes weren't changed, its version goes
+ * back to the one it had, so threads that read it don't start again */
+static void latch_unlock(BTreeLatch *latch, bool changed)
+{
+    __sync_fetch_and_add(&latch->version, changed ? 1 : (uint32_t) -1);
+    pthread_mutex_unlock(&latch->mutex);
+}
+
+
+/* Finds the position of a key in a node: the first cell with a greater
+ * key (or n_cells, if there isn't one), which is returned in cell.
+ * Returns true if a cell has the same key */
+static bool btree_search(BTreeNode *node, chidb_key_t key, ncell_t *ncell, BTreeCell *cell)
+{
+    for(*ncell = 0; *ncell < node->n_cells; (*ncell)++)
+    {
+        chidb_Btree_getCell(node, *ncell, cell);
+        if(key < cell->key)
+            return false;
+        else if(key == cell->key)
+            return true;
+    }
+
+    return false;
+}
+
+
+/* Child of an internal node where keys at a position (see btree_search)
+ * are */
+static npage_t btree_child(BTreeNode *node, ncell_t ncell, BTreeCell *cell)
+{
+    if(ncell == node->n_cells)
+        return node->right_page;
+    else if(node->type == PGTYPE_TABLE_INTERNAL)
+        return cell->fields.tableInternal.child_page;
+    else
+        return cell->fields.indexInternal.child_page;
+}
+
+
+static bool btree_is_leaf(BTreeNode *node)
+{
+    return node->type == PGTYPE_TABLE_LEAF || node->type == PGTYPE_INDEX_LEAF;
+}
+
+
+/* Version of the latch of a node, once no thread holds it
+ *
+ * Threads that read nodes without latching them (see Latches) take
+ * the version before reading a node, and check that it hasn't changed
+ * (with chidb_Btree_latchChanged) once they have read it, and once
+ * they have read the version of the child they go to.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page number of the node
+ *
+ * Return
+ * - The version of the node's latch
+ */
+uint32_t chidb_Btree_latchVersion(BTree *bt, npage_t npage)
+{
+    return latch_version(btree_latch(bt, npage));
+}
+
+
+/* Has a node changed since the version of its latch was taken? (see
+ * chidb_Btree_latchVersion)
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page number of the node
+ * - version: Version returned by chidb_Btree_latchVersion
+ *
+ * Return
+ * - true if the node may have changed (or another thread holds its
+ *   latch), and false otherwise
+ */
+bool chidb_Btree_latchChanged(BTree *bt, npage_t npage, uint32_t version)
+{
+    return latch_changed(btree_latch(bt, npage), version);
+}
+
+
+/* Looks for a key in a table B-Tree without latching the nodes, like
+ * btree_insert_optimistic, and copies its data (see chidb_Btree_find).
+ * Returns CHIDB_EBUSY if other threads changed the nodes on the way, or
+ * the leaf while it was being read */
+static int btree_find_optimistic(BTree *bt, npage_t nroot, chidb_key_t key,
+                                 uint8_t **data, uint16_t *size)
+{
+    BTreeLatch *latch = btree_latch(bt, nroot), *child_latch;
+    uint32_t version = latch_version(latch), child_version;
+    npage_t npage = nroot, nchild;
+    BTreeNode *node;
+    BTreeCell cell;
+    ncell_t ncell;
+    bool found;
+    int err;
+
+    for(;;)
+    {
+        if((err = chidb_Btree_getNodeByPage(bt, npage, &node)) != CHIDB_OK)
+            return latch_changed(latch, version) ? CHIDB_EBUSY : err;
+
+        found = btree_search(node, key, &ncell, &cell);
+        if(btree_is_leaf(node))
+            break;
+
+        // Keys equal to an internal cell's are in its child
+        nchild = btree_child(node, ncell, &cell);
+        chidb_Btree_freeMemNode(bt, node);
+        child_latch = btree_latch(bt, nchild);
+        child_version = latch_version(child_latch);
+        if(latch_changed(latch, version))
+            return CHIDB_EBUSY;
+
+        npage = nchild;
+        latch = child_latch;
+        version = child_version;
+    }
+
+    err = CHIDB_ENOTFOUND;
+    if(found)
+    {
+        *size = cell.fields.tableLeaf.data_size;
+        if((*data = malloc(*size)) == NULL)
+            err = CHIDB_ENOMEM;
+        else
+        {
+            memcpy(*data, cell.fields.tableLeaf.data, *size);
+            err = CHIDB_OK;
+        }
+    }
+    chidb_Btree_freeMemNode(bt, node);
+
+    // The leaf may have been split after it was reached
+    if(latch_changed(latch, version))
+    {
+        if(err == CHIDB_OK)
+            free(*data);
+        return CHIDB_EBUSY;
+    }
+
+    return err;
+}
+
+
+/* Inserts a cell into a leaf, latching only the leaf (see Latches).
+ * Returns CHIDB_EBUSY if other threads changed the nodes on the way, or
+ * if the leaf is full (then, *full is set to true) */
+static int btree_insert_optimistic(BTree *bt, npage_t nroot, BTreeCell *btc, bool *full)
+{
+    BTreeLatch *latch = btree_latch(bt, nroot), *child_latch;
+    uint32_t version = latch_version(latch), child_version;
+    npage_t npage = nroot, nchild;
+    BTreeNode *node;
+    BTreeCell cell;
+    ncell_t ncell;
+    int err;
+
+    *full = false;
+    for(;;)
+    {
+        check_fail(chidb_Btree_getNodeByPage(bt, npage, &node));
+
+        if(btree_search(node, btc->key, &ncell, &cell))
+        {
+            chidb_Btree_freeMemNode(bt, node);
+            return latch_changed(latch, version) ? CHIDB_EBUSY : CHIDB_EDUPLICATE;
+        }
+
+        if(btree_is_leaf(node))
+            break;
+
+        nchild = btree_child(node, ncell, &cell);
+        chidb_Btree_freeMemNode(bt, node);
+        child_latch = btree_latch(bt, nchild);
+        child_version = latch_version(child_latch);
+        if(latch_changed(latch, version))
+            return CHIDB_EBUSY;
+
+        npage = nchild;
+        latch = child_latch;
+        version = child_version;
+    }
+
+    if(would_overflow(node, btc))
+    {
+        chidb_Btree_freeMemNode(bt, node);
+        *full = true;
+        return CHIDB_EBUSY;
+    }
+
+    /* The leaf may have changed since it was read */
+    latch_lock(latch);
+    if(latch_changed(latch, version + 1))
+    {
+        latch_unlock(latch, false);
+        chidb_Btree_freeMemNode(bt, node);
+        return CHIDB_EBUSY;
+    }
+
+    chidb_Btree_insertCell(node, ncell, btc);
+    err = chidb_Btree_writeNode(bt, node);
+    latch_unlock(latch, true);
+    chidb_Btree_freeMemNode(bt, node);
+
+    return err;
+}
+
+
+/* Moves the cells of a full root to a new node, and splits it (the
+ * root stays in the same page, with the two halves as its children) */
+static int btree_split_root(BTree *bt, npage_t nroot, BTreeNode *root)
+{
+    int err;
+
+    // We need to move all of roots contents into a new node
+    // And we need to make that node its right page
+
+    // First, make a new node
+    BTreeNode* new_right;
+    npage_t new_right_num;
+    check_fail(chidb_Btree_newNode(bt, &new_right_num, root->type));
+    check_fail(chidb_Btree_getNodeByPage(bt, new_right_num, &new_right));
+
+    for(ncell_t i = 0; i < root->n_cells; i++) {
+        BTreeCell temp;
+        check_fail(chidb_Btree_getCell(root, i, &temp));
+        check_fail(chidb_Btree_insertCell(new_right, i, &temp));
+    }
+
+    // Roots old right page becomes new nodes right page
+    new_right->right_page = root->right_page;
+
+    // Empty root and reinit it as an internal node
+    check_fail(chidb_Btree_freeMemNode(bt, root));
+    if(new_right->type == PGTYPE_TABLE_LEAF || new_right->type == PGTYPE_TABLE_INTERNAL) {
+        // reinit as a table internal
+        check_fail(chidb_Btree_initEmptyNode(bt, nroot, PGTYPE_TABLE_INTERNAL));
+    } else {
+        // reinit as an index internal
+        check_fail(chidb_Btree_initEmptyNode(bt, nroot, PGTYPE_INDEX_INTERNAL));
+    }
+
+    // Open root again and set it's right page
+    check_fail(chidb_Btree_getNodeByPage(bt, nroot, &root));
+    root->right_page = new_right_num;
+
+    check_fail(chidb_Btree_writeNode(bt, root));
+    check_fail(chidb_Btree_writeNode(bt, new_right));
+
+    check_fail(chidb_Btree_freeMemNode(bt, root));
+    check_fail(chidb_Btree_freeMemNode(bt, new_right));
+
+    // Split the new node
+    npage_t other_child; // throwaway
+    return chidb_Btree_split(bt, nroot, new_right_num, 0, &other_child);
 }
 
+
+/* Inserts a cell below a node whose latch is held (and isn't full),
+ * latching the nodes from the node down (see Latches). The latches are
+ * released (changed tells if the node was already changed while its
+ * latch was held). Returns CHIDB_EBUSY if a child's latch was held by
+ * another thread: the insertion must start again from the root */
+static int btree_insert_latched(BTree *bt, npage_t npage, BTreeCell *btc, bool changed)
+{
+    BTreeLatch *latch = btree_latch(bt, npage), *child_latch;
+    BTreeNode *node, *child;
+    BTreeCell cell;
+    ncell_t ncell;
+    npage_t nchild, nnew;
+    bool full = false;
+    int err;
+
+    for(;;)
+    {
+        if((err = chidb_Btree_getNodeByPage(bt, npage, &node)) != CHIDB_OK)
+            break;
+
+        if(btree_search(node, btc->key, &ncell, &cell))
+        {
+            chidb_Btree_freeMemNode(bt, node);
+            err = CHIDB_EDUPLICATE;
+            break;
+        }
+
+        if(btree_is_leaf(node))
+        {
+            chidb_Btree_insertCell(node, ncell, btc);
+            err = chidb_Btree_writeNode(bt, node);
+            chidb_Btree_freeMemNode(bt, node);
+            changed = true;
+            break;
+        }
+
+        nchild = btree_child(node, ncell, &cell);
+        chidb_Btree_freeMemNode(bt, node);
+        child_latch = btree_latch(bt, nchild);
+        if(child_latch != latch && !latch_trylock(child_latch))
+        {
+            latch_unlock(latch, changed);
+            latch_version(child_latch);
+            return CHIDB_EBUSY;
+        }
+
+        if((err = chidb_Btree_getNodeByPage(bt, nchild, &child)) == CHIDB_OK)
+        {
+            full = would_overflow(child, btc);
+            chidb_Btree_freeMemNode(bt, child);
+        }
+
+        if(err == CHIDB_OK && full)
+        {
+            // If the child would overflow, split it (the new node can't
+            // be reached by other threads until the node is written)
+            err = chidb_Btree_split(bt, npage, nchild, ncell, &nnew);
+            changed = true;
+        }
+
+        if(err != CHIDB_OK || full)
+        {
+            if(child_latch != latch)
+                latch_unlock(child_latch, full);
+            if(err != CHIDB_OK)
+                break;
+            // Look for the key in the node again
+            continue;
+        }
+
+        // The child won't be split, so the node won't be changed
+        if(child_latch != latch)
+        {
+            latch_unlock(latch, changed);
+            changed = false;
+        }
+        npage = nchild;
+        latch = child_latch;
+    }
+
+    latch_unlock(latch, changed);
+
+    return err;
+}
+
+
 /* Insert a BTreeCell into a B-Tree
  *
  * The chidb_Btree_insert and chidb_Btree_insertNonFull functions
@@ -746,6 +1671,13 @@ bool would_overflow(BTreeNode* node, BTreeCell* cell) {
  * splitting any other node). If so, chidb_Btree_split is called
  * before calling chidb_Btree_insertNonFull.
  *
+ * Several threads can insert into the same B-Tree at once (see
+ * Latches, and BTREE_LATCHES in btree.h). Unless the leaf the cell
+ * goes in is full, only the leaf is latched. Lookups and cursors don't
+ * latch the nodes: they check the versions of their latches instead,
+ * like the insertions that don't split a node, so they can run at the
+ * same time.
+ *
  * Parameters
  * - bt: B-Tree file
  * - nroot: Page number of the root node of the B-Tree we want to insert
@@ -760,59 +1692,41 @@ bool would_overflow(BTreeNode* node, BTreeCell* cell) {
  */
 int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
 {
-    int err;
+    BTreeLatch *latch = btree_latch(bt, nroot);
     BTreeNode* root;
-    check_fail(chidb_Btree_getNodeByPage(bt, nroot, &root));
-
-    // If root is full
-    if(would_overflow(root, btc)) {
-        // We need to move all of roots contents into a new node
-        // And we need to make that node its right page
-
-        // First, make a new node
-        BTreeNode* new_right;
-        npage_t new_right_num;
-        check_fail(chidb_Btree_newNode(bt, &new_right_num, root->type));
-        check_fail(chidb_Btree_getNodeByPage(bt, new_right_num, &new_right));
-
-        for(ncell_t i = 0; i < root->n_cells; i++) {
-            BTreeCell temp;
-            check_fail(chidb_Btree_getCell(root, i, &temp));
-            check_fail(chidb_Btree_insertCell(new_right, i, &temp));
-        }
+    bool full;
+    int err;
 
-        // Empty root and reinit it as an internal node
-        check_fail(chidb_Btree_freeMemNode(bt, root));
+    do
+    {
+        int tries = 0;
+        do
+            err = btree_insert_optimistic(bt, nroot, btc, &full);
+        while(err == CHIDB_EBUSY && !full && ++tries < BTREE_OPTIMISTIC_TRIES);
+        if(err != CHIDB_EBUSY)
+            return err;
 
-        // Roots old right page becomes new nodes right page
-        new_right->right_page = root->right_page;
-        if(new_right->type == PGTYPE_TABLE_LEAF || new_right->type == PGTYPE_TABLE_INTERNAL) {
-            // reinit as a table internal
-            check_fail(chidb_Btree_initEmptyNode(bt, nroot, PGTYPE_TABLE_INTERNAL));
-        } else {
-            // reinit as an index internal
-            check_fail(chidb_Btree_initEmptyNode(bt, nroot, PGTYPE_INDEX_INTERNAL));
+        latch_lock(latch);
+        if((err = chidb_Btree_getNodeByPage(bt, nroot, &root)) != CHIDB_OK)
+        {
+            latch_unlock(latch, false);
+            return err;
         }
 
-        // Open root again and set it's right page
-        check_fail(chidb_Btree_getNodeByPage(bt, nroot, &root));
-        root->right_page = new_right_num;
-
-        check_fail(chidb_Btree_writeNode(bt, root));
-        check_fail(chidb_Btree_writeNode(bt, new_right));
-
-        check_fail(chidb_Btree_freeMemNode(bt, root));
-        check_fail(chidb_Btree_freeMemNode(bt, new_right));
-
-        // Split the new node
-        npage_t other_child; // throwaway
-        check_fail(chidb_Btree_split(bt, nroot, new_right_num, 0, &other_child));
-        
-        // Write and close root and new child
-    }  
+        // If root is full
+        full = would_overflow(root, btc);
+        if(!full)
+            chidb_Btree_freeMemNode(bt, root);
+        else if((err = btree_split_root(bt, nroot, root)) != CHIDB_OK)
+        {
+            latch_unlock(latch, true);
+            return err;
+        }
 
-    return chidb_Btree_insertNonFull(bt, nroot, btc);
+        err = btree_insert_latched(bt, nroot, btc, full);
+    } while(err == CHIDB_EBUSY);
 
+    return err;
 }
 
 
@@ -823,8 +1737,8 @@ int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
  * node is a leaf node, the cell is directly added in the appropriate
  * position according to its key. If the node is an internal node, the
  * function will determine what child node it must insert it in, and
- * calls itself recursively on that child node. However, before doing so
- * it will check if the child node is full or not. If it is, then it will
+ * continues with that child node. However, before doing so it will
+ * check if the child node is full or not. If it is, then it will
  * have to be split first.
  *
  * Parameters
@@ -842,87 +1756,14 @@ int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc)
 int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc)
 {
     int err;
-    bool found = false;
-
-    BTreeNode* node;
-    if((err = chidb_Btree_getNodeByPage(bt, npage, &node)) != CHIDB_OK) {
-        return err;
-    }
-
-    chidb_key_t key = btc->key;
-    BTreeCell search_cell;
-    if(node->type == PGTYPE_TABLE_LEAF || node->type == PGTYPE_INDEX_LEAF) { 
-        int i;
-        for(i = 0; i < node->n_cells; i++) {
-            chidb_Btree_getCell(node, i, &search_cell);
-            if(key < search_cell.key) {
-                break;
-            }
-            else if (search_cell.key == key)
-                return CHIDB_EDUPLICATE;
-        }
-       
-        chidb_Btree_insertCell(node, i, btc); 
-        if((err = chidb_Btree_writeNode(bt, node)) != CHIDB_OK) {
-            return err;
-        }
-        return CHIDB_OK;
-    } else {
-        int i; 
-        for(i = 0; i < node->n_cells; i++) {
-            chidb_Btree_getCell(node, i, &search_cell);
-            if(search_cell.key > key) {
-                found = true;
-                break;
-            }
-            else if (search_cell.key == key)
-                return CHIDB_EDUPLICATE;
-        }
-        
-        if(!found) {
-            npage_t right_page = node->right_page;
-            
-            check_fail(chidb_Btree_freeMemNode(bt, node));
 
-            BTreeNode* right_page_node;
-            check_fail(chidb_Btree_getNodeByPage(bt, right_page, &right_page_node));
-
-            if(would_overflow(right_page_node, btc)) {
-                npage_t new_node;
-
-                check_fail(chidb_Btree_freeMemNode(bt, right_page_node));
-                
-                check_fail(chidb_Btree_split(bt, npage, right_page, i, &new_node));
-
-                return chidb_Btree_insertNonFull(bt, npage, btc);
-            }
-            return chidb_Btree_insertNonFull(bt, right_page, btc);
-        }
-        
-        npage_t child_num;
-        if(node->type == PGTYPE_TABLE_INTERNAL) {
-            child_num = search_cell.fields.tableInternal.child_page;
-        } else {
-            child_num = search_cell.fields.indexInternal.child_page;
-        }
-        
-        BTreeNode* child_node;
-        // close our current node
-        check_fail(chidb_Btree_freeMemNode(bt, node));
-        check_fail(chidb_Btree_getNodeByPage(bt, child_num, &child_node));
-        
-        if(would_overflow(child_node, btc)) {
-            npage_t new_node; // We don't use this, but we need to give it
-            // If the child would overflow, split it
-            check_fail(chidb_Btree_split(bt, npage, child_num, i, &new_node));
-            return chidb_Btree_insertNonFull(bt, npage, btc);
-        }
+    do
+    {
+        latch_lock(btree_latch(bt, npage));
+        err = btree_insert_latched(bt, npage, btc, false);
+    } while(err == CHIDB_EBUSY);
 
-        return chidb_Btree_insertNonFull(bt, child_num, btc);
-    }
-    
-    
-    return CHIDB_OK;
+    return err;
 }
 
 
@@ -991,8 +1832,10 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
     if(child->type == PGTYPE_TABLE_LEAF) {
         // insert
         check_fail(chidb_Btree_insertCell(new_node, median, &median_cell));
-        top_half++;
     }
+    // either way the median leaves the child: it went to the new node
+    // or it moves up to the parent
+    top_half++;
      
 
 
@@ -1006,54 +1849,14 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
         new_node->right_page = median_cell.fields.indexInternal.child_page;
     }
 
-    // Step 3c: set original child to top half
-    
-    // First we need to store the top half somewhere
-    BTreeNode* top;
-    npage_t top_page;
-    
-    // Create temp top node
-    check_fail(chidb_Btree_newNode(bt, &top_page, child->type));
-    check_fail(chidb_Btree_getNodeByPage(bt, top_page, &top));
-
-
-    // Copy top half into top
-    for(ncell_t i = top_half; i < child->n_cells; i++) {
-        BTreeCell to_insert;
-        // get
-        check_fail(chidb_Btree_getCell(child, i, &to_insert));
-
-        // insert
-        check_fail(chidb_Btree_insertCell(top, i - top_half, &to_insert));
-    }
-    
-
-
-    // Now we reset the child
-    // (this is only needed because we have no method to delete cells)
-    npage_t child_right = child->right_page; // Need to keep right cell as well
-
-    check_fail(chidb_Btree_freeMemNode(bt, child)); // "empty" the child
-    check_fail(chidb_Btree_initEmptyNode(bt, npage_child, top->type)); // "recreate" it
-    check_fail(chidb_Btree_getNodeByPage(bt, npage_child, &child));
-
-
-    child->right_page = child_right;
-    
-    // fill it with top half
-    for(ncell_t i = 0; i < top->n_cells; i++) {
-        BTreeCell to_insert;
-
-        check_fail(chidb_Btree_getCell(top, i, &to_insert));
-        check_fail(chidb_Btree_insertCell(child, i, &to_insert)); 
-    }
-    
-    
-    // Step 4: move median cell into parent
+    // Step 4: move median cell into parent (before the child is reset,
+    // since the record of a covering index cell points into the child)
     // Step 4a: reassign type
     if(median_cell.type == PGTYPE_INDEX_LEAF) { // can't be leaf, so we must convert
-        median_cell.fields.indexInternal.keyPk = 
-            median_cell.fields.indexLeaf.keyPk;
+        BTreeCell leaf_cell = median_cell;
+        median_cell.fields.indexInternal.keyPk = leaf_cell.fields.indexLeaf.keyPk;
+        median_cell.fields.indexInternal.data_size = leaf_cell.fields.indexLeaf.data_size;
+        median_cell.fields.indexInternal.data = leaf_cell.fields.indexLeaf.data;
     }
     median_cell.type = parent->type;
 
@@ -1067,11 +1870,29 @@ int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncel
     // Step 4c: Insert into parent
     check_fail(chidb_Btree_insertCell(parent, parent_ncell, &median_cell));
 
-    // Step 5: Clean up
-    // First, erase any sign of our temp node, top
-    check_fail(chidb_Btree_freeMemNode(bt, top));
-    bt->pager->n_pages--;
-    
+    // Step 5: set original child to top half
+    // The cells are copied from the in-memory copy of the child, which
+    // isn't affected by resetting its page
+    BTreeNode* old_child = child;
+    npage_t child_right = child->right_page; // Need to keep right cell as well
+
+    check_fail(chidb_Btree_initEmptyNode(bt, npage_child, old_child->type)); // "empty" the child
+    check_fail(chidb_Btree_getNodeByPage(bt, npage_child, &child));
+
+    child->right_page = child_right;
+
+    // fill it with top half
+    for(ncell_t i = top_half; i < old_child->n_cells; i++) {
+        BTreeCell to_insert;
+
+        check_fail(chidb_Btree_getCell(old_child, i, &to_insert));
+        check_fail(chidb_Btree_insertCell(child, i - top_half, &to_insert));
+    }
+
+
+    // Step 6: Clean up
+    check_fail(chidb_Btree_freeMemNode(bt, old_child));
+
     // write nodes to disk
     check_fail(chidb_Btree_writeNode(bt, parent));
     check_fail(chidb_Btree_writeNode(bt, child));
@@ -40,6 +40,7 @@
 #ifndef BTREE_H_
 #define BTREE_H_
 
+#include <pthread.h>
 #include "chidbInt.h"
 #include "pager.h"
 
@@ -84,13 +85,26 @@
 #define INDEXINTCELL_SIZE (16)
 #define INDEXLEAFCELL_SIZE (12)
 
+/* The cells of a covering index also store a record of the included
+ * columns after keyPk. Their magic bytes start with INDEXCELL_MAGIC_DATA
+ * (instead of 0x0B), and their last two bytes are the size of the record */
+#define INDEXCELL_MAGIC_DATA (0x0C)
+#define INDEXCELL_DATASIZE_OFFSET (2)
+#define INDEXINTCELL_DATA_OFFSET (16)
+#define INDEXLEAFCELL_DATA_OFFSET (12)
+
+/* Largest record an index cell can store. Nodes always keep room for
+ * a cell with a record this large, since the cell that moves up to the
+ * parent when a node is split can be larger than the one being inserted */
+#define INDEXCELL_MAX_DATA (128)
+
 // Table Header offsets
 #define HEADER_PAGESIZE (0x10)
 #define HEADER_JUNK (0x12)
 #define HEADER_FILECHANGE (0x18)
 #define HEADER_EMPTY (0x20)
 #define HEADER_SCHEMA (0x28)
-#define HEADER_ONE (0x2C)
+#define HEADER_FORMAT (0x2C) /* Record format (RECORD_FORMAT_*, see record.h) */
 #define HEADER_PAGECACHESIZE (0x30)
 #define HEADER_EMPTYONE (0x34)
 #define HEADER_COOKIE (0x3C)
@@ -100,6 +114,37 @@
 // assumes variable named err exists in function
 #define check_fail(test) do { if((err = test) != CHIDB_OK) return err;} while(false)
 
+/* Locks on a B-Tree file (see chidb_Btree_lock) */
+#define BTREE_LOCK_NONE (0)
+#define BTREE_LOCK_READ (1)
+#define BTREE_LOCK_WRITE (2)
+
+/* Latches on the nodes of a B-Tree, which let several threads insert
+ * into it at once (see chidb_Btree_insert). A node's latch is number
+ * npage % BTREE_LATCHES
+ *
+ * Concurrent inserts: once a transaction is open (chidb_Btree_begin),
+ * any number of threads can call chidb_Btree_insertInTable,
+ * chidb_Btree_insertInIndex and chidb_Btree_insertInCoveringIndex on
+ * the same BTree, and chidb_Btree_find and cursors can be used at the
+ * same time (they check the versions of the latches, and return
+ * CHIDB_EBUSY if other threads kept changing the nodes they read). The
+ * transaction is committed (chidb_Btree_commit) or rolled back once
+ * every thread is done. src/bench/btree_insert.c ("make bench")
+ * measures how this scales with the number of threads */
+#define BTREE_LATCHES (1024)
+
+/* Times an insertion is retried without latching the nodes above the
+ * leaf, after other threads changed them */
+#define BTREE_OPTIMISTIC_TRIES (4)
+
+typedef struct BTreeLatch
+{
+    pthread_mutex_t mutex;
+    uint32_t version;          /* Odd while the latch is held, and
+                                * incremented once its nodes change */
+} BTreeLatch;
+
 // Advance declarations
 typedef struct BTreeCell BTreeCell;
 typedef struct BTreeNode BTreeNode;
@@ -111,6 +156,9 @@ typedef struct BTree
 {
     chidb *db;
     Pager *pager;
+    uint8_t record_format; /* Format used to write new records */
+    uint32_t schema_cookie; /* Changes whenever the schema changes */
+    BTreeLatch latches[BTREE_LATCHES];
 } Btree;
 
 /* The BTreeNode struct is an in-memory representation of a B-Tree node. Thus,
@@ -157,18 +205,35 @@ struct BTreeCell
         {
             chidb_key_t keyPk;         /* Primary key of row where the indexed field is equal to key */
             npage_t child_page;  /* Child page with keys < key */
+            uint16_t data_size;  /* Size of the record of included columns (0 if none) */
+            uint8_t *data;       /* Pointer to in-memory copy of the record */
         } indexInternal;
         struct
         {
             chidb_key_t keyPk;         /* Primary key of row where the indexed field is equal to key */
+            uint16_t data_size;  /* Size of the record of included columns (0 if none) */
+            uint8_t *data;       /* Pointer to in-memory copy of the record */
         } indexLeaf;
     } fields;
 };
 
+/* Source of the entries loaded by chidb_Btree_loadIndex. Each call fills
+ * in an index leaf cell with the next entry (in increasing order of
+ * keyIdx); the cell's data must remain valid until the next call */
+typedef int (*chidb_Btree_indexSource)(void *ctx, BTreeCell *cell);
+
 bool would_overflow(BTreeNode* node, BTreeCell* cell);
 
 int chidb_Btree_open(const char *filename, chidb *db, BTree **bt);
 int chidb_Btree_close(BTree *bt);
+int chidb_Btree_openTemp(BTree **bt);
+int chidb_Btree_setRecordFormat(BTree *bt, uint8_t format);
+int chidb_Btree_incrSchemaCookie(BTree *bt);
+int chidb_Btree_lock(BTree *bt, uint8_t lock);
+int chidb_Btree_unlock(BTree *bt, uint8_t lock);
+int chidb_Btree_begin(BTree *bt);
+int chidb_Btree_commit(BTree *bt);
+int chidb_Btree_rollback(BTree *bt);
 
 int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **node);
 int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn);
@@ -182,8 +247,15 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
 
 int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size);
 
+uint32_t chidb_Btree_latchVersion(BTree *bt, npage_t npage);
+bool chidb_Btree_latchChanged(BTree *bt, npage_t npage, uint32_t version);
+
 int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size);
 int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk);
+int chidb_Btree_insertInCoveringIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk,
+                                      uint8_t *data, uint16_t size);
+int chidb_Btree_loadIndex(BTree *bt, npage_t nroot, uint32_t ncells, bool covering,
+                          chidb_Btree_indexSource next, void *ctx);
 int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc);
 int chidb_Btree_insertNonFull(BTree *bt, npage_t npage, BTreeCell *btc);
 int chidb_Btree_split(BTree *bt, npage_t npage_parent, npage_t npage_child, ncell_t parent_cell, npage_t *npage_child2);
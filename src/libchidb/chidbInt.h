@@ -49,6 +49,8 @@
 #include <assert.h>
 #include <string.h>
 #include <chidb/chidb.h>
+#include "simclist.h"
+#include "stmtcache.h"
 
 // Private codes (shouldn't be used by API users)
 #define CHIDB_NOHEADER (1)
@@ -84,6 +86,10 @@ typedef struct BTree BTree;
 struct chidb
 {
     BTree   *bt;
+    list_t  schema;  /* Tables and indexes (chidb_schema_item_t's, see schema.h) */
+    bool    schema_loaded;
+    uint32_t schema_cookie;  /* Schema cookie when the schema was loaded */
+    chidb_stmt_cache_t stmt_cache;
 };
 
 #endif /*CHIDBINT_H_*/
@@ -37,49 +37,3117 @@
  *
  */
 
+#include <strings.h>
+#include <inttypes.h>
 #include <chidb/chidb.h>
 #include <chisql/chisql.h>
 #include "dbm.h"
+#include "dbm-agg.h"
+#include "schema.h"
+#include "stats.h"
 #include "util.h"
 
-  /* ...code... */
+/* The code generator turns a parsed SQL statement into a DBM program.
+ *
+ * A SELECT statement is generated as a set of nested loops, one for each
+ * table in the FROM clause (in the order they appear in), with the
+ * projection (a ResultRow instruction) in the innermost loop. Each
+ * condition of the statement (from the WHERE clause, or from the ON
+ * clause of a join) is split into its conjuncts, and each conjunct is
+ * attached to the loop in which it is applied. For a Select node in
+ * the SRA tree, that is the innermost loop of the tables below it, so
+ * a condition on a single table is applied as soon as that table's row
+ * is read if the optimizer has pushed it down to the table. A table may
+ * also be wrapped in a Project of some of its columns, if the optimizer
+ * has pruned the columns the statement doesn't use, and then only those
+ * columns can be read from it.
+ *
+ * Each loop either scans its whole table, or uses one of the conjuncts
+ * attached to it to seek instead:
+ *
+ *   - pk = k        Seek on the table (at most one row)
+ *   - col = k       Seek on an index on col, if there is one, and
+ *                   read each matching row from the table
+ *   - pk > k, etc.  Seek to the first row in the range on the table,
+ *                   and stop at the end of the range
+ *
+ * where pk is the table's INTEGER PRIMARY KEY, and k is an integer
+ * literal or a column of a table in an outer loop. Conjuncts that are
+ * fully enforced by the seek are not evaluated again.
+ *
+ * If the rows of the outermost loop are needed in the order of an indexed
+ * column col (for GROUP BY or ORDER BY), and there is a conjunct col > k
+ * or col >= k (k being a non-negative integer literal), the loop instead
+ * walks the index from k, stopping at the end of the range (the index
+ * keys are unsigned, so negative values, which the range doesn't include
+ * anyway, come after all the others), and reads each row from the table.
+ * Without such a conjunct, the loop may still walk the whole index on a
+ * GROUP BY key, if that is expected to be cheaper than aggregating the
+ * rows in a hash table (see codegen_index_scan): the rows of each group
+ * then come one after the other, although not in the order of the key.
+ *
+ * A loop that reads its rows through an index doesn't look them up in
+ * the table if the index holds every column the statement reads from
+ * the table: the indexed column (the key of the index entry), the
+ * INTEGER PRIMARY KEY (the key of the row), and the columns a covering
+ * index (created with INCLUDE) stores in each of its entries.
+ *
+ * If the optimizer has marked a join as a hash join, the loop of the
+ * table on its right reads it through a hash table instead, using a
+ * conjunct "col = c" where c is a column of a table in an outer loop.
+ * Before any of the loops, the table is scanned once, and each of its
+ * rows that satisfies the conjuncts on the table alone is added to a
+ * hash table under its value of col. The loop then looks up the value
+ * of c, and reads the matching rows from a hash cursor.
+ *
+ * With ORDER BY, the innermost loop adds a record of the sort key and
+ * the result columns to a sorter instead of producing a result row, and
+ * once the loops are done the result rows are produced from the sorter,
+ * in order.
+ *
+ * With GROUP BY or aggregate functions, the innermost loop instead adds
+ * a record of the group key and the argument of each aggregate function
+ * to an aggregator, which keeps one group per value of the key (a single
+ * group without GROUP BY). Once the loops are done, each group produces
+ * a result row (or a row added to the sorter, with ORDER BY), whose
+ * columns can only be the group key, aggregate functions and literals.
+ * If the loops produce the rows of each group one after the other (the
+ * group key is a column the outermost loop reads in order), there is
+ * only ever one group in the aggregator: before a row is added to it,
+ * AggBreak checks whether the row starts a new group, and if so the
+ * previous group produces its result row right away. Keys are unique
+ * in the INTEGER PRIMARY KEY and in indexes, so the groups only have
+ * more than one row when the inner loops of a join add them. And if the
+ * only aggregate function is MIN or MAX of the INTEGER PRIMARY KEY or of
+ * an indexed column of a single table, without conditions, the loop only
+ * reads the row with the smallest (or largest) value, with a seek.
+ *
+ * With LIMIT, the result rows are counted down in a register, and once
+ * the last one has been produced the program jumps right past the loops
+ * (or past the loop over the sorter). With ORDER BY as well, the sorter
+ * only keeps the first LIMIT + OFFSET rows. If the loops already produce
+ * the rows in order (ORDER BY the INTEGER PRIMARY KEY of the table in the
+ * outermost loop, which is read in key order), there is no sorter at all,
+ * and the loops stop after the last row of the LIMIT.
+ *
+ * Strings, BLOBs and records that a loop's iterations read or make are
+ * allocated from the DBM's arena, which each loop marks before it starts
+ * and releases at the end of every iteration (see codegen_mark). Values
+ * computed outside a loop therefore stay valid for the whole loop, even
+ * when a result row suspends the program in the middle of it.
+ *
+ * Jump targets are often generated after the jumps to them, so jumps
+ * are generated with a label instead of an address, and the labels are
+ * replaced with their addresses once the whole program has been generated.
+ */
+
+/* How a loop reads rows from its table */
+typedef enum codegen_access
+{
+    ACCESS_SCAN,         /* All the rows */
+    ACCESS_PK_EQ,        /* The row with a given key */
+    ACCESS_PK_RANGE,     /* The rows with keys in a range */
+    ACCESS_INDEX_EQ,     /* The rows with a given value in an indexed column */
+    ACCESS_INDEX_RANGE,  /* The rows with values in a range in an indexed
+                            column, in the order of the column */
+    ACCESS_INDEX_SCAN,   /* All the rows, in the order of the index on a
+                            column (see codegen_index_scan) */
+    ACCESS_HASH,         /* The rows with a given value in a hash table */
+    ACCESS_MIN_MAX       /* The row with the smallest (or largest) value of
+                            the INTEGER PRIMARY KEY or an indexed column */
+} codegen_access_t;
+
+/* How a column of a table read in batches is read into its vector
+ * (see codegen_batch) */
+typedef enum codegen_vector
+{
+    VECTOR_NONE,    /* Not read */
+    VECTOR_FILTER,  /* Read before the filters, which use it */
+    VECTOR_ROW      /* Read once the rows have been filtered */
+} codegen_vector_t;
+
+/* A conjunct of a condition, and the loop it's applied in */
+typedef struct codegen_cond
+{
+    Condition_t *cond;
+    int level;
+    /* Enforced by the loop's seek, so it doesn't have to be evaluated */
+    bool done;
+    /* Created by the code generator (for USING and NATURAL joins) */
+    bool owned;
+} codegen_cond_t;
+
+/* A table in the FROM clause. Table i is read in loop i, which is
+ * nested inside loops 0..i-1 */
+typedef struct codegen_table
+{
+    chidb_schema_item_t *schema;
+    const char *name;   /* Name (or alias) the table is referred to by */
+    int32_t cursor;
+    int pkey;           /* INTEGER PRIMARY KEY column, or -1 */
+    /* If the optimizer has pruned the table's columns, the only columns
+     * that can be read (see codegen_from) */
+    bool pruned;
+    Expression_t *columns;
+
+    codegen_access_t access;
+    /* Conjuncts used to seek (the lower and upper bounds of a range) */
+    codegen_cond_t *seek, *seek_hi;
+    chidb_schema_item_t *index;
+    int32_t index_cursor;
+    /* Read from the index alone, without looking rows up in the table
+     * (see codegen_covers) */
+    bool covered;
+    /* For ACCESS_MIN_MAX, whether to read the largest value */
+    bool max;
+    /* For ACCESS_INDEX_SCAN, whether the rows with a NULL in the indexed
+     * column (which aren't in the index) are read from the table once
+     * the index has been walked */
+    bool nulls;
+    /* Read through a hash table, if the optimizer chose to (see
+     * codegen_hash_build) */
+    bool hash;
+    int32_t hash_cursor;
+    /* Read in batches (see codegen_batch), with column i in vector (and
+     * register) vec + i */
+    bool batch;
+    int32_t vec;
+    uint8_t vectors[DBRECORD_MAX_FIELDS];
+} codegen_table_t;
+
+/* A check that a result row goes through before it's produced (see
+ * codegen_compound): the row is dropped if it's already in the set (and
+ * otherwise added to it), or with member, if it isn't in the set */
+typedef struct codegen_check
+{
+    int32_t set;
+    bool member;
+} codegen_check_t;
+
+typedef struct codegen
+{
+    chidb_stmt *stmt;
+    chidb *db;
+
+    uint32_t pc;       /* Address of the next instruction */
+    int32_t nReg;      /* Number of registers used */
+    int32_t nCursors;  /* Number of cursors used */
+    int32_t nMarks;    /* Number of arena marks used (see codegen_mark) */
+
+    /* Addresses of labels (-1 if not bound yet) */
+    int32_t *labels;
+    uint32_t nLabels;
+    /* Instructions whose p2 is a label */
+    uint32_t *fixups;
+    uint32_t nFixups;
+
+    codegen_table_t *tables;
+    int nTables;
+    codegen_cond_t *conds;
+    int nConds;
+
+    /* With ORDER BY: the sorter's cursor, and the registers the sort key
+     * is evaluated into (followed by the result columns) */
+    int32_t sorter;
+    int32_t rkey;
+    int nKeys;
+
+    /* With LIMIT: the registers counting down the rows to skip and the
+     * rows to produce (-1 if none), and the label after the last result
+     * row */
+    int32_t roffset;
+    int32_t rlimit;
+    int32_t done;
+
+    /* With GROUP BY or aggregate functions: the aggregator's cursor (-1
+     * if none), and the registers the group key (nGroup columns) and the
+     * argument of each of the nAggs aggregate functions are evaluated
+     * into */
+    int32_t agg;
+    int32_t ragg;
+    int nGroup;
+    int nAggs;
+    /* Whether the loops produce the rows of each group one after the
+     * other, so each group can be produced as soon as it ends */
+    bool stream;
+
+    /* With DISTINCT, UNION, INTERSECT or EXCEPT: the checks each result
+     * row goes through (the last one first, down to checks[firstCheck]),
+     * and the set the rows that pass them are added to instead of being
+     * produced (-1 if they are produced) */
+    codegen_check_t *checks;
+    int nChecks;
+    int firstCheck;
+    int32_t fill;
+} codegen_t;
+
+/* Jump instructions generated by the code generator for each comparison */
+static const opcode_t codegen_cmp_true[] =
+{
+    [RA_COND_EQ] = Op_Eq, [RA_COND_LT] = Op_Lt, [RA_COND_GT] = Op_Gt,
+    [RA_COND_LEQ] = Op_Le, [RA_COND_GEQ] = Op_Ge
+};
+
+/* Type-specialised versions of the instructions above (see dbm-ops.c),
+ * used when the types of the operands are known: comparisons of two
+ * integers, of two strings, and of a value with an integer constant */
+static const opcode_t codegen_cmp_int[] =
+{
+    [Op_Eq] = Op_EqInt, [Op_Ne] = Op_NeInt, [Op_Lt] = Op_LtInt,
+    [Op_Le] = Op_LeInt, [Op_Gt] = Op_GtInt, [Op_Ge] = Op_GeInt
+};
+
+static const opcode_t codegen_cmp_str[] =
+{
+    [Op_Eq] = Op_EqStr, [Op_Ne] = Op_NeStr, [Op_Lt] = Op_LtStr,
+    [Op_Le] = Op_LeStr, [Op_Gt] = Op_GtStr, [Op_Ge] = Op_GeStr
+};
+
+static const opcode_t codegen_cmp_const[] =
+{
+    [Op_Eq] = Op_EqConst, [Op_Ne] = Op_NeConst, [Op_Lt] = Op_LtConst,
+    [Op_Le] = Op_LeConst, [Op_Gt] = Op_GtConst, [Op_Ge] = Op_GeConst
+};
+
+/* Batch versions of the comparisons (see dbm-ops.c), which filter the
+ * rows of a batch: comparisons of two vectors, and of a vector with an
+ * integer constant */
+static const opcode_t codegen_cmp_vector[] =
+{
+    [Op_Eq] = Op_VEq, [Op_Ne] = Op_VNe, [Op_Lt] = Op_VLt,
+    [Op_Le] = Op_VLe, [Op_Gt] = Op_VGt, [Op_Ge] = Op_VGe
+};
+
+static const opcode_t codegen_cmp_vector_const[] =
+{
+    [Op_Eq] = Op_VEqConst, [Op_Ne] = Op_VNeConst, [Op_Lt] = Op_VLtConst,
+    [Op_Le] = Op_VLeConst, [Op_Gt] = Op_VGtConst, [Op_Ge] = Op_VGeConst
+};
+
+/* Comparison with its operands swapped (a < b is b > a) */
+static const enum CondType codegen_cmp_swap[] =
+{
+    [RA_COND_EQ] = RA_COND_EQ, [RA_COND_LT] = RA_COND_GT, [RA_COND_GT] = RA_COND_LT,
+    [RA_COND_LEQ] = RA_COND_GEQ, [RA_COND_GEQ] = RA_COND_LEQ
+};
+
+/* Aggregate function of the aggregator (see dbm-agg.h) for each function
+ * of the SQL parser, and its name */
+static const char codegen_agg_funcs[] =
+{
+    [FUNC_MAX] = DBM_AGG_MAX, [FUNC_MIN] = DBM_AGG_MIN, [FUNC_COUNT] = DBM_AGG_COUNT,
+    [FUNC_AVG] = DBM_AGG_AVG, [FUNC_SUM] = DBM_AGG_SUM
+};
+
+static const char *codegen_agg_names[] =
+{
+    [FUNC_MAX] = "MAX", [FUNC_MIN] = "MIN", [FUNC_COUNT] = "COUNT",
+    [FUNC_AVG] = "AVG", [FUNC_SUM] = "SUM"
+};
+
+#define IS_COMPARISON(t) ((t) == RA_COND_EQ || (t) == RA_COND_LT || (t) == RA_COND_GT || \
+                          (t) == RA_COND_LEQ || (t) == RA_COND_GEQ)
+
+
+/*** INSTRUCTIONS, REGISTERS AND LABELS ***/
+
+static int codegen_op(codegen_t *cg, opcode_t opcode, int32_t p1, int32_t p2, int32_t p3, char *p4)
+{
+    chidb_dbm_op_t op = {opcode, p1, p2, p3, p4};
+
+    return chidb_stmt_set_op(cg->stmt, &op, cg->pc++);
+}
+
+/* Generates a jump instruction. p2 is a label */
+static int codegen_jump(codegen_t *cg, opcode_t opcode, int32_t p1, int32_t label, int32_t p3)
+{
+    uint32_t *fixups = realloc(cg->fixups, sizeof(uint32_t) * (cg->nFixups + 1));
+    if(fixups == NULL)
+        return CHIDB_ENOMEM;
+
+    cg->fixups = fixups;
+    cg->fixups[cg->nFixups++] = cg->pc;
+
+    return codegen_op(cg, opcode, p1, label, p3, NULL);
+}
+
+static int codegen_label(codegen_t *cg, int32_t *label)
+{
+    int32_t *labels = realloc(cg->labels, sizeof(int32_t) * (cg->nLabels + 1));
+    if(labels == NULL)
+        return CHIDB_ENOMEM;
+
+    cg->labels = labels;
+    cg->labels[cg->nLabels] = -1;
+    *label = cg->nLabels++;
+
+    return CHIDB_OK;
+}
+
+/* Makes a label point to the next instruction */
+static void codegen_bind(codegen_t *cg, int32_t label)
+{
+    /* -1 is a label that could not be allocated (the error is returned
+     * by codegen_label, so there's nothing to bind) */
+    if(label >= 0)
+        cg->labels[label] = cg->pc;
+}
+
+/* Generates the ArenaMark a loop starts with, right before it reads its
+ * first row, and returns the mark's number. At the end of each iteration,
+ * the loop releases the arena to the mark with ArenaRelease (see
+ * dbm-ops.c), so the values an iteration computes don't pile up, while
+ * the values computed before the loop (by outer loops, or before any
+ * loop) stay valid throughout it */
+static int codegen_mark(codegen_t *cg, int32_t *mark)
+{
+    *mark = cg->nMarks++;
+    return codegen_op(cg, Op_ArenaMark, *mark, 0, 0, NULL);
+}
+
+/* Allocates n consecutive registers, and returns the first one */
+static int32_t codegen_reg(codegen_t *cg, int n)
+{
+    int32_t reg = cg->nReg;
+
+    cg->nReg += n;
+    return reg;
+}
+
+/* Replaces labels with addresses, and makes sure the DBM has
+ * as many registers and cursors as the program uses */
+static int codegen_finish(codegen_t *cg)
+{
+    int err;
+
+    for(uint32_t i = 0; i < cg->nFixups; i++)
+    {
+        chidb_dbm_op_t *op = &cg->stmt->ops[cg->fixups[i]];
+        op->p2 = cg->labels[op->p2];
+    }
+
+    if(cg->nReg > cg->stmt->nReg)
+        check_fail(realloc_reg(cg->stmt, cg->nReg));
+    if(cg->nCursors > cg->stmt->nCursors)
+        check_fail(realloc_cur(cg->stmt, cg->nCursors));
+
+    return CHIDB_OK;
+}
+
+/* Frees the conditions created by the code generator */
+static void codegen_free_conds(codegen_t *cg)
+{
+    for(int i = 0; i < cg->nConds; i++)
+    {
+        if(!cg->conds[i].owned)
+            continue;
+        Condition_t *cond = cg->conds[i].cond;
+        for(int j = 0; j < 2; j++)
+        {
+            Expression_t *expr = j == 0 ? cond->cond.comp.expr1 : cond->cond.comp.expr2;
+            free(expr->expr.term.ref->tableName);
+            free(expr->expr.term.ref->columnName);
+            free(expr->expr.term.ref);
+            free(expr);
+        }
+        free(cond);
+    }
+    cg->nConds = 0;
+}
+
+static void codegen_free(codegen_t *cg)
+{
+    codegen_free_conds(cg);
+    free(cg->labels);
+    free(cg->fixups);
+    free(cg->tables);
+    free(cg->conds);
+    free(cg->checks);
+}
+
+
+/*** EXPRESSIONS ***/
+
+/* Is a column in the list of columns a pruned table reads? */
+static bool codegen_table_reads(codegen_table_t *t, const char *column)
+{
+    for(Expression_t *expr = t->columns; expr != NULL; expr = expr->next)
+        if(!strcasecmp(expr->expr.term.ref->columnName, column))
+            return true;
+
+    return false;
+}
+
+/* Can a column of a table be read from one of its indexes? An index
+ * entry holds the indexed column, the key of the row (so the INTEGER
+ * PRIMARY KEY) and, in a covering index, the included columns */
+static bool codegen_index_has(codegen_table_t *t, chidb_schema_item_t *index, const char *column)
+{
+    int c = chidb_schema_column(t->schema, column, NULL);
+
+    return (c >= 0 && c == t->pkey) ||
+           !strcasecmp(index->stmt->stmt.create->index->column_name, column) ||
+           chidb_schema_included(index, column) >= 0;
+}
+
+/* Does an index hold every column the statement reads from a table?
+ * Unless the optimizer has pruned the table, that's all of them */
+static bool codegen_covers(codegen_table_t *t, chidb_schema_item_t *index)
+{
+    if(t->pruned)
+    {
+        for(Expression_t *expr = t->columns; expr != NULL; expr = expr->next)
+            if(!codegen_index_has(t, index, expr->expr.term.ref->columnName))
+                return false;
+        return true;
+    }
+
+    for(Column_t *col = t->schema->stmt->stmt.create->table->columns; col != NULL; col = col->next)
+        if(!codegen_index_has(t, index, col->name))
+            return false;
+    return true;
+}
+
+/* Finds the table and column a column reference refers to
+ *
+ * Parameters
+ * - cg: Code generator
+ * - ref: Column reference
+ * - ntables: Only the first ntables tables are searched
+ * - table, column: Out parameters for the table and the column
+ * - coldef: Out parameter for the column's definition (can be NULL)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: There is no such column, or the reference is ambiguous
+ */
+static int codegen_colref(codegen_t *cg, ColumnReference_t *ref, int ntables,
+                          int *table, int *column, Column_t **coldef)
+{
+    int found = 0;
+
+    for(int i = 0; i < ntables; i++)
+    {
+        codegen_table_t *t = &cg->tables[i];
+        int col;
+
+        if(ref->tableName != NULL && strcasecmp(ref->tableName, t->name))
+            continue;
+        if((col = chidb_schema_column(t->schema, ref->columnName, coldef)) < 0)
+            continue;
+        if(t->pruned && !codegen_table_reads(t, ref->columnName))
+            continue;
+
+        *table = i;
+        *column = col;
+        found++;
+    }
+
+    return found == 1 ? CHIDB_OK : CHIDB_EINVALIDSQL;
+}
+
+/* Innermost loop in which an expression can be evaluated (-1 if it
+ * doesn't use any columns) */
+static int codegen_expr_level(codegen_t *cg, Expression_t *expr, int *level)
+{
+    int err;
+    int table, column, l1, l2;
+
+    switch(expr->t)
+    {
+    case EXPR_TERM:
+        *level = -1;
+        if(expr->expr.term.t == TERM_COLREF)
+        {
+            check_fail(codegen_colref(cg, expr->expr.term.ref, cg->nTables, &table, &column, NULL));
+            *level = table;
+        }
+        return CHIDB_OK;
+    case EXPR_NEG:
+        return codegen_expr_level(cg, expr->expr.unary.expr, level);
+    default:
+        check_fail(codegen_expr_level(cg, expr->expr.binary.expr1, &l1));
+        check_fail(codegen_expr_level(cg, expr->expr.binary.expr2, &l2));
+        *level = l1 > l2 ? l1 : l2;
+        return CHIDB_OK;
+    }
+}
+
+/* Same as codegen_expr_level, for a condition */
+static int codegen_cond_level(codegen_t *cg, Condition_t *cond, int *level)
+{
+    int err;
+    int l1, l2;
+
+    switch(cond->t)
+    {
+    case RA_COND_AND:
+    case RA_COND_OR:
+        check_fail(codegen_cond_level(cg, cond->cond.binary.cond1, &l1));
+        check_fail(codegen_cond_level(cg, cond->cond.binary.cond2, &l2));
+        break;
+    case RA_COND_NOT:
+        return codegen_cond_level(cg, cond->cond.unary.cond, level);
+    case RA_COND_IN:
+        return codegen_expr_level(cg, cond->cond.in.expr, level);
+    default:
+        check_fail(codegen_expr_level(cg, cond->cond.comp.expr1, &l1));
+        check_fail(codegen_expr_level(cg, cond->cond.comp.expr2, &l2));
+        break;
+    }
+
+    *level = l1 > l2 ? l1 : l2;
+    return CHIDB_OK;
+}
+
+/* Does an integer fit in 32 bits (e.g., in p1 of an Integer instruction)? */
+static bool codegen_is_int32(int64_t v)
+{
+    return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+/* Generates an instruction that loads a literal into a register. Integer
+ * literals that don't fit in 32 bits are loaded as 64-bit integers */
+static int codegen_literal(codegen_t *cg, Literal_t *val, bool negate, int32_t reg)
+{
+    char buf[32];
+    int64_t i;
+
+    /* The value of a parameter is only known when the program runs */
+    if(val->param)
+        return negate ? CHIDB_EINVALIDSQL : codegen_op(cg, Op_Variable, val->param, reg, 0, NULL);
+
+    switch(val->t)
+    {
+    case TYPE_INT:
+        i = negate ? (int64_t) -(uint64_t) val->val.ival : val->val.ival;
+        if(codegen_is_int32(i))
+            return codegen_op(cg, Op_Integer, i, reg, 0, NULL);
+        snprintf(buf, sizeof(buf), "%" PRId64, i);
+        return codegen_op(cg, Op_Int64, 0, reg, 0, buf);
+    case TYPE_DOUBLE:
+        snprintf(buf, sizeof(buf), "%.17g", negate ? -val->val.dval : val->val.dval);
+        return codegen_op(cg, Op_Real, 0, reg, 0, buf);
+    case TYPE_CHAR:
+        if(negate)
+            return CHIDB_EINVALIDSQL;
+        buf[0] = val->val.cval;
+        buf[1] = '\0';
+        return codegen_op(cg, Op_String, 1, reg, 0, buf);
+    case TYPE_TEXT:
+        if(negate)
+            return CHIDB_EINVALIDSQL;
+        return codegen_op(cg, Op_String, strlen(val->val.strval), reg, 0, val->val.strval);
+    }
+
+    return CHIDB_EINVALIDSQL;
+}
+
+/* Generates an instruction that reads a column of a table's current row */
+static int codegen_column(codegen_t *cg, int table, int column, int32_t reg)
+{
+    codegen_table_t *t = &cg->tables[table];
+    Column_t *col;
+
+    if(t->covered)
+    {
+        /* The index entry the loop is on (see codegen_covers) */
+        col = t->schema->stmt->stmt.create->table->columns;
+        for(int i = 0; i < column; i++)
+            col = col->next;
+
+        if(column == t->pkey)
+            return codegen_op(cg, Op_IdxPKey, t->index_cursor, reg, 0, NULL);
+        else if(!strcasecmp(t->index->stmt->stmt.create->index->column_name, col->name))
+            return codegen_op(cg, Op_Key, t->index_cursor, reg, 0, NULL);
+        else
+            return codegen_op(cg, Op_Column, t->index_cursor, chidb_schema_included(t->index, col->name), reg, NULL);
+    }
+
+    /* BatchRow has copied the row's values into the registers of the
+     * vectors. The columns that aren't read yet are read once the batch
+     * has been filtered (see codegen_batch) */
+    if(t->batch)
+    {
+        if(t->vectors[column] == VECTOR_NONE)
+            t->vectors[column] = VECTOR_ROW;
+        return codegen_op(cg, Op_SCopy, t->vec + column, reg, 0, NULL);
+    }
+
+    if(column == t->pkey)
+        return codegen_op(cg, Op_Key, t->cursor, reg, 0, NULL);
+    else
+        return codegen_op(cg, Op_Column, t->cursor, column, reg, NULL);
+}
+
+/* Generates the code that evaluates an expression into a register. The
+ * DBM has no arithmetic instructions, so only columns, literals (and
+ * negated numeric literals) and NULL are supported */
+static int codegen_expr(codegen_t *cg, Expression_t *expr, int32_t reg)
+{
+    int err;
+    int table, column;
+
+    if(expr->t == EXPR_NEG && expr->expr.unary.expr->t == EXPR_TERM &&
+       expr->expr.unary.expr->expr.term.t == TERM_LITERAL)
+        return codegen_literal(cg, expr->expr.unary.expr->expr.term.val, true, reg);
+
+    if(expr->t != EXPR_TERM)
+        return CHIDB_EINVALIDSQL;
+
+    switch(expr->expr.term.t)
+    {
+    case TERM_LITERAL:
+        return codegen_literal(cg, expr->expr.term.val, false, reg);
+    case TERM_NULL:
+        return codegen_op(cg, Op_Null, 0, reg, 0, NULL);
+    case TERM_COLREF:
+        check_fail(codegen_colref(cg, expr->expr.term.ref, cg->nTables, &table, &column, NULL));
+        return codegen_column(cg, table, column, reg);
+    default:
+        return CHIDB_EINVALIDSQL;
+    }
+}
+
+
+/* If an expression is an integer literal (or a negated one) that fits
+ * in 32 bits, returns true and its value in k */
+static bool codegen_int_const(Expression_t *expr, int32_t *k)
+{
+    bool negate = expr->t == EXPR_NEG;
+    Literal_t *val;
+
+    if(negate)
+        expr = expr->expr.unary.expr;
+    if(expr->t != EXPR_TERM || expr->expr.term.t != TERM_LITERAL)
+        return false;
+
+    val = expr->expr.term.val;
+    if(val->param || val->t != TYPE_INT || !codegen_is_int32(val->val.ival) || val->val.ival == INT32_MIN)
+        return false;
+
+    *k = negate ? -val->val.ival : val->val.ival;
+    return true;
+}
+
+/* Type of the values of an expression, according to the schema (TYPE_INT
+ * or TYPE_TEXT), or -1 if it isn't known. This is only a hint: a column
+ * can hold values of other types (e.g., NULL) */
+static int codegen_expr_type(codegen_t *cg, Expression_t *expr)
+{
+    int32_t k;
+    int table, column;
+    Column_t *coldef;
+
+    if(codegen_int_const(expr, &k))
+        return TYPE_INT;
+    if(expr->t != EXPR_TERM)
+        return -1;
+
+    if(expr->expr.term.t == TERM_LITERAL && !expr->expr.term.val->param)
+    {
+        if(expr->expr.term.val->t == TYPE_CHAR || expr->expr.term.val->t == TYPE_TEXT)
+            return TYPE_TEXT;
+    }
+    else if(expr->expr.term.t == TERM_COLREF &&
+            codegen_colref(cg, expr->expr.term.ref, cg->nTables, &table, &column, &coldef) == CHIDB_OK)
+    {
+        if(column == cg->tables[table].pkey || coldef->type == TYPE_INT)
+            return TYPE_INT;
+        if(coldef->type == TYPE_CHAR || coldef->type == TYPE_TEXT)
+            return TYPE_TEXT;
+    }
+
+    return -1;
+}
+
+
+/*** CONDITIONS ***/
+
+static int codegen_cond_true(codegen_t *cg, Condition_t *cond, int32_t label);
+
+/* Generates the code that jumps to label if "expr1 cmp expr2" is true
+ * (or, with !when, if it is false). A comparison with an integer literal
+ * doesn't load the literal into a register, and a comparison of two
+ * integers or two strings skips the type dispatch (see dbm-ops.c).
+ *
+ * The comparison instructions never jump on NULL, so "a < b" is false
+ * but so is "a >= b". Jumping if a comparison is false is therefore done
+ * by jumping over a Goto to label if it is true. */
+static int codegen_compare(codegen_t *cg, enum CondType cmp, bool when,
+                           Expression_t *expr1, Expression_t *expr2, int32_t label)
+{
+    int err;
+    int32_t r1, r2, k, skip;
+    int type1, type2;
+    opcode_t op;
+
+    if(!when)
+    {
+        check_fail(codegen_label(cg, &skip));
+        check_fail(codegen_compare(cg, cmp, true, expr1, expr2, skip));
+        check_fail(codegen_jump(cg, Op_Goto, 0, label, 0));
+        codegen_bind(cg, skip);
+        return CHIDB_OK;
+    }
+
+    if(codegen_int_const(expr1, &k) && !codegen_int_const(expr2, &k))
+    {
+        Expression_t *expr = expr1;
+
+        expr1 = expr2;
+        expr2 = expr;
+        cmp = codegen_cmp_swap[cmp];
+    }
+    op = codegen_cmp_true[cmp];
+
+    r1 = codegen_reg(cg, 1);
+    check_fail(codegen_expr(cg, expr1, r1));
+    if(codegen_int_const(expr2, &k))
+        return codegen_jump(cg, codegen_cmp_const[op], k, label, r1);
+
+    r2 = codegen_reg(cg, 1);
+    check_fail(codegen_expr(cg, expr2, r2));
+
+    type1 = codegen_expr_type(cg, expr1);
+    type2 = codegen_expr_type(cg, expr2);
+    if(type1 == TYPE_INT && type2 == TYPE_INT)
+        op = codegen_cmp_int[op];
+    else if(type1 == TYPE_TEXT && type2 == TYPE_TEXT)
+        op = codegen_cmp_str[op];
+
+    return codegen_jump(cg, op, r2, label, r1);
+}
+
+/* Generates the code that jumps to label if register r holds the value
+ * of a literal (one of the values of an IN list) */
+static int codegen_in_value(codegen_t *cg, Literal_t *val, int32_t r, int32_t label)
+{
+    int err;
+    int32_t r2;
+
+    if(!val->param && val->t == TYPE_INT && codegen_is_int32(val->val.ival))
+        return codegen_jump(cg, Op_EqConst, val->val.ival, label, r);
+
+    r2 = codegen_reg(cg, 1);
+    check_fail(codegen_literal(cg, val, false, r2));
+    return codegen_jump(cg, Op_Eq, r2, label, r);
+}
+
+/* Generates the code that jumps to label if a condition is false (and
+ * falls through if it is true) */
+static int codegen_cond_false(codegen_t *cg, Condition_t *cond, int32_t label)
+{
+    int err;
+    int32_t r1, match;
+
+    switch(cond->t)
+    {
+    case RA_COND_AND:
+        check_fail(codegen_cond_false(cg, cond->cond.binary.cond1, label));
+        return codegen_cond_false(cg, cond->cond.binary.cond2, label);
+    case RA_COND_OR:
+        check_fail(codegen_label(cg, &match));
+        check_fail(codegen_cond_true(cg, cond->cond.binary.cond1, match));
+        check_fail(codegen_cond_false(cg, cond->cond.binary.cond2, label));
+        codegen_bind(cg, match);
+        return CHIDB_OK;
+    case RA_COND_NOT:
+        return codegen_cond_true(cg, cond->cond.unary.cond, label);
+    case RA_COND_IN:
+        check_fail(codegen_label(cg, &match));
+        r1 = codegen_reg(cg, 1);
+        check_fail(codegen_expr(cg, cond->cond.in.expr, r1));
+        for(Literal_t *val = cond->cond.in.values_list; val != NULL; val = val->next)
+            check_fail(codegen_in_value(cg, val, r1, match));
+        check_fail(codegen_jump(cg, Op_Goto, 0, label, 0));
+        codegen_bind(cg, match);
+        return CHIDB_OK;
+    default:
+        return codegen_compare(cg, cond->t, false, cond->cond.comp.expr1, cond->cond.comp.expr2, label);
+    }
+}
+
+/* Generates the code that jumps to label if a condition is true (and
+ * falls through if it is false) */
+static int codegen_cond_true(codegen_t *cg, Condition_t *cond, int32_t label)
+{
+    int err;
+    int32_t r1, skip;
+
+    switch(cond->t)
+    {
+    case RA_COND_AND:
+        check_fail(codegen_label(cg, &skip));
+        check_fail(codegen_cond_false(cg, cond->cond.binary.cond1, skip));
+        check_fail(codegen_cond_true(cg, cond->cond.binary.cond2, label));
+        codegen_bind(cg, skip);
+        return CHIDB_OK;
+    case RA_COND_OR:
+        check_fail(codegen_cond_true(cg, cond->cond.binary.cond1, label));
+        return codegen_cond_true(cg, cond->cond.binary.cond2, label);
+    case RA_COND_NOT:
+        return codegen_cond_false(cg, cond->cond.unary.cond, label);
+    case RA_COND_IN:
+        r1 = codegen_reg(cg, 1);
+        check_fail(codegen_expr(cg, cond->cond.in.expr, r1));
+        for(Literal_t *val = cond->cond.in.values_list; val != NULL; val = val->next)
+            check_fail(codegen_in_value(cg, val, r1, label));
+        return CHIDB_OK;
+    default:
+        return codegen_compare(cg, cond->t, true, cond->cond.comp.expr1, cond->cond.comp.expr2, label);
+    }
+}
+
+/* Adds the conjuncts of a condition to the conditions applied in a loop */
+static int codegen_add_cond(codegen_t *cg, Condition_t *cond, int level, bool owned)
+{
+    int err;
+
+    if(cond->t == RA_COND_AND)
+    {
+        check_fail(codegen_add_cond(cg, cond->cond.binary.cond1, level, false));
+        return codegen_add_cond(cg, cond->cond.binary.cond2, level, false);
+    }
+
+    codegen_cond_t *conds = realloc(cg->conds, sizeof(codegen_cond_t) * (cg->nConds + 1));
+    if(conds == NULL)
+        return CHIDB_ENOMEM;
+
+    cg->conds = conds;
+    cg->conds[cg->nConds].cond = cond;
+    cg->conds[cg->nConds].level = level;
+    cg->conds[cg->nConds].done = false;
+    cg->conds[cg->nConds].owned = owned;
+    cg->nConds++;
+
+    return CHIDB_OK;
+}
+
+/* Adds the condition "t1.column = t2.column" (for USING and NATURAL joins)
+ * to the conditions applied in the loop of table t2 */
+static int codegen_add_join_column(codegen_t *cg, int t1, int t2, const char *column)
+{
+    Expression_t *e1 = TermColumnReference(ColumnReference_make(cg->tables[t1].name, column));
+    Expression_t *e2 = TermColumnReference(ColumnReference_make(cg->tables[t2].name, column));
+
+    return codegen_add_cond(cg, Eq(e1, e2), t2, true);
+}
+
+
+/*** SELECT ***/
+
+/* Adds a table of the FROM clause */
+static int codegen_add_table(codegen_t *cg, TableReference_t *ref)
+{
+    codegen_table_t *tables, *t;
+    chidb_schema_item_t *schema = chidb_schema_table(cg->db, ref->table_name);
+
+    if(schema == NULL)
+        return CHIDB_EINVALIDSQL;
+
+    tables = realloc(cg->tables, sizeof(codegen_table_t) * (cg->nTables + 1));
+    if(tables == NULL)
+        return CHIDB_ENOMEM;
+    cg->tables = tables;
+
+    t = &cg->tables[cg->nTables++];
+    t->schema = schema;
+    t->name = ref->alias != NULL ? ref->alias : ref->table_name;
+    t->cursor = cg->nCursors++;
+    t->pkey = chidb_schema_pkey(schema);
+    t->pruned = false;
+    t->columns = NULL;
+    t->access = ACCESS_SCAN;
+    t->seek = t->seek_hi = NULL;
+    t->index = NULL;
+    t->index_cursor = -1;
+    t->covered = false;
+    t->nulls = false;
+    t->hash = false;
+    t->hash_cursor = -1;
+    t->batch = false;
+    t->vec = -1;
+
+    return CHIDB_OK;
+}
+
+/* Collects the tables below a node of the SRA tree (in the order they are
+ * read in), and the conditions applied in each table's loop */
+static int codegen_from(codegen_t *cg, SRA_t *sra)
+{
+    int err;
+    int first, col;
+    Column_t *column;
+
+    switch(sra->t)
+    {
+    case SRA_TABLE:
+        return codegen_add_table(cg, sra->table.ref);
+
+    case SRA_SELECT:
+        check_fail(codegen_from(cg, sra->select.sra));
+        return codegen_add_cond(cg, sra->select.cond, cg->nTables - 1, false);
+
+    case SRA_PROJECT:
+        /* A table pruned by the optimizer to the columns that are used */
+        first = cg->nTables;
+        check_fail(codegen_from(cg, sra->project.sra));
+        if(cg->nTables != first + 1)
+            return CHIDB_EINVALIDSQL;
+        for(Expression_t *expr = sra->project.expr_list; expr != NULL; expr = expr->next)
+            if(expr->t != EXPR_TERM || expr->expr.term.t != TERM_COLREF)
+                return CHIDB_EINVALIDSQL;
+        cg->tables[first].pruned = true;
+        cg->tables[first].columns = sra->project.expr_list;
+        return CHIDB_OK;
+
+    case SRA_JOIN:
+    case SRA_NATURAL_JOIN:
+        check_fail(codegen_from(cg, sra->join.sra1));
+        first = cg->nTables;
+        check_fail(codegen_from(cg, sra->join.sra2));
+
+        if(sra->t == SRA_JOIN && sra->join.hash && cg->nTables == first + 1)
+            cg->tables[first].hash = true;
+
+        if(sra->t == SRA_NATURAL_JOIN)
+        {
+            /* Every column of the right table that is also in one of the
+             * tables on the left */
+            if(cg->nTables != first + 1)
+                return CHIDB_EINVALIDSQL;
+            for(column = cg->tables[first].schema->stmt->stmt.create->table->columns; column != NULL; column = column->next)
+                for(int i = 0; i < first; i++)
+                    if(chidb_schema_column(cg->tables[i].schema, column->name, NULL) >= 0)
+                    {
+                        check_fail(codegen_add_join_column(cg, i, first, column->name));
+                        break;
+                    }
+            return CHIDB_OK;
+        }
+
+        if(sra->join.opt_cond == NULL)
+            return CHIDB_OK;
+
+        if(sra->join.opt_cond->t == JOIN_COND_ON)
+            return codegen_add_cond(cg, sra->join.opt_cond->on, cg->nTables - 1, false);
+
+        for(StrList_t *name = sra->join.opt_cond->col_list; name != NULL; name = name->next)
+        {
+            ColumnReference_t ref = { NULL, name->str, NULL };
+            int left, right;
+
+            check_fail(codegen_colref(cg, &ref, first, &left, &col, NULL));
+            if(cg->nTables != first + 1 || chidb_schema_column(cg->tables[first].schema, name->str, NULL) < 0)
+                return CHIDB_EINVALIDSQL;
+            right = first;
+            check_fail(codegen_add_join_column(cg, left, right, name->str));
+        }
+        return CHIDB_OK;
+
+    default:
+        /* Outer joins, set operations and subqueries */
+        return CHIDB_EINVALIDSQL;
+    }
+}
+
+/* Can an expression be used as the key of a seek in loop i? It has to be
+ * a non-negative integer literal (keys are unsigned), or an integer column
+ * of a table in an outer loop */
+static bool codegen_is_key(codegen_t *cg, Expression_t *expr, int level, bool range)
+{
+    int table, column;
+    Column_t *col;
+
+    if(expr->t != EXPR_TERM)
+        return false;
+
+    /* Parameters and columns are checked when the program runs (see
+     * codegen_key), which is only enough to look up a single key */
+    if(expr->expr.term.t == TERM_LITERAL && expr->expr.term.val->param)
+        return !range;
+
+    if(expr->expr.term.t == TERM_LITERAL)
+        return expr->expr.term.val->t == TYPE_INT && expr->expr.term.val->val.ival >= 0 &&
+               expr->expr.term.val->val.ival <= INT32_MAX;
+
+    /* Ranges only use literals, since a column could be negative */
+    if(range || expr->expr.term.t != TERM_COLREF ||
+       codegen_colref(cg, expr->expr.term.ref, cg->nTables, &table, &column, &col) != CHIDB_OK ||
+       table >= level)
+        return false;
+
+    return col->type == TYPE_INT;
+}
+
+/* If a conjunct is a comparison between a column of a loop's table and a
+ * key, returns the column, the key and the comparison (as "column OP key") */
+static bool codegen_seekable(codegen_t *cg, codegen_cond_t *c, int level,
+                             int *column, Column_t **coldef, Expression_t **key, enum CondType *cmp)
+{
+    Condition_t *cond = c->cond;
+    int table;
+
+    if(c->level != level || !IS_COMPARISON(cond->t))
+        return false;
+
+    for(int i = 0; i < 2; i++)
+    {
+        Expression_t *e1 = i == 0 ? cond->cond.comp.expr1 : cond->cond.comp.expr2;
+        Expression_t *e2 = i == 0 ? cond->cond.comp.expr2 : cond->cond.comp.expr1;
+        enum CondType t = i == 0 ? cond->t : codegen_cmp_swap[cond->t];
+
+        if(e1->t != EXPR_TERM || e1->expr.term.t != TERM_COLREF)
+            continue;
+        if(codegen_colref(cg, e1->expr.term.ref, cg->nTables, &table, column, coldef) != CHIDB_OK || table != level)
+            continue;
+        if(!codegen_is_key(cg, e2, level, t != RA_COND_EQ))
+            continue;
+
+        *key = e2;
+        *cmp = t;
+        return true;
+    }
+
+    return false;
+}
+
+/* If a conjunct is an equality between a column of a loop's table and a
+ * column of a table in an outer loop, returns the first column and the
+ * second (which a hash table can be looked up with) */
+static bool codegen_hashable(codegen_t *cg, codegen_cond_t *c, int level, int *column, Expression_t **key)
+{
+    Condition_t *cond = c->cond;
+    int t1, c1, t2, c2;
+
+    if(c->level != level || cond->t != RA_COND_EQ)
+        return false;
+
+    for(int i = 0; i < 2; i++)
+    {
+        Expression_t *e1 = i == 0 ? cond->cond.comp.expr1 : cond->cond.comp.expr2;
+        Expression_t *e2 = i == 0 ? cond->cond.comp.expr2 : cond->cond.comp.expr1;
+
+        if(e1->t != EXPR_TERM || e1->expr.term.t != TERM_COLREF ||
+           e2->t != EXPR_TERM || e2->expr.term.t != TERM_COLREF)
+            return false;
+        if(codegen_colref(cg, e1->expr.term.ref, cg->nTables, &t1, &c1, NULL) != CHIDB_OK ||
+           codegen_colref(cg, e2->expr.term.ref, cg->nTables, &t2, &c2, NULL) != CHIDB_OK)
+            return false;
+        if(t1 == level && t2 < level)
+        {
+            *column = c1;
+            *key = e2;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Does an expression only use columns of a given table (if any)? */
+static bool codegen_expr_only(codegen_t *cg, Expression_t *expr, int table)
+{
+    int t, column;
+
+    switch(expr->t)
+    {
+    case EXPR_TERM:
+        return expr->expr.term.t != TERM_COLREF ||
+               (codegen_colref(cg, expr->expr.term.ref, cg->nTables, &t, &column, NULL) == CHIDB_OK && t == table);
+    case EXPR_NEG:
+        return codegen_expr_only(cg, expr->expr.unary.expr, table);
+    default:
+        return codegen_expr_only(cg, expr->expr.binary.expr1, table) &&
+               codegen_expr_only(cg, expr->expr.binary.expr2, table);
+    }
+}
+
+/* Same as codegen_expr_only, for a condition */
+static bool codegen_cond_only(codegen_t *cg, Condition_t *cond, int table)
+{
+    switch(cond->t)
+    {
+    case RA_COND_AND:
+    case RA_COND_OR:
+        return codegen_cond_only(cg, cond->cond.binary.cond1, table) &&
+               codegen_cond_only(cg, cond->cond.binary.cond2, table);
+    case RA_COND_NOT:
+        return codegen_cond_only(cg, cond->cond.unary.cond, table);
+    case RA_COND_IN:
+        return codegen_expr_only(cg, cond->cond.in.expr, table);
+    default:
+        return codegen_expr_only(cg, cond->cond.comp.expr1, table) &&
+               codegen_expr_only(cg, cond->cond.comp.expr2, table);
+    }
+}
+
+/* If the rows of the outermost loop are needed in the order of an
+ * indexed column (the GROUP BY key, or the only ORDER BY key, if it's
+ * ascending), and a conjunct gives its values a lower bound, makes the
+ * loop walk the index over the range instead of scanning the table.
+ * Without a lower bound, the walk would miss the negative values */
+static void codegen_index_range(codegen_t *cg, SRA_Project_t *project)
+{
+    codegen_table_t *t = &cg->tables[0];
+    Expression_t *order = project->group_by, *key;
+    chidb_schema_item_t *index;
+    codegen_cond_t *lo = NULL, *hi = NULL;
+    int table, column, c;
+    Column_t *col, *ccol;
+    enum CondType cmp;
+
+    if(order == NULL && project->order_by != NULL && project->order_by->next == NULL &&
+       project->asc_desc == ORDER_BY_ASC)
+        order = project->order_by;
+    if(order == NULL || order->t != EXPR_TERM || order->expr.term.t != TERM_COLREF ||
+       codegen_colref(cg, order->expr.term.ref, cg->nTables, &table, &column, &col) != CHIDB_OK ||
+       table != 0 || column == t->pkey || col->type != TYPE_INT)
+        return;
+    if((index = chidb_schema_index(cg->db, t->schema->name, col->name)) == NULL)
+        return;
+
+    /* Range keys are always non-negative literals */
+    for(int i = 0; i < cg->nConds; i++)
+    {
+        if(!codegen_seekable(cg, &cg->conds[i], 0, &c, &ccol, &key, &cmp) || c != column)
+            continue;
+        if((cmp == RA_COND_GT || cmp == RA_COND_GEQ) && lo == NULL)
+            lo = &cg->conds[i];
+        else if((cmp == RA_COND_LT || cmp == RA_COND_LEQ) && hi == NULL)
+            hi = &cg->conds[i];
+    }
+    if(lo == NULL)
+        return;
+
+    t->access = ACCESS_INDEX_RANGE;
+    t->seek = lo;
+    t->seek_hi = hi;
+    t->index = index;
+}
+
+/* Does a conjunct drop the rows with a NULL in a column of the table
+ * of the outermost loop? A comparison with the column does, since it
+ * never holds if either side is NULL */
+static bool codegen_not_null(codegen_t *cg, int column)
+{
+    Expression_t *exprs[2];
+    int table, c;
+
+    for(int i = 0; i < cg->nConds; i++)
+    {
+        Condition_t *cond = cg->conds[i].cond;
+
+        if(!IS_COMPARISON(cond->t))
+            continue;
+        exprs[0] = cond->cond.comp.expr1;
+        exprs[1] = cond->cond.comp.expr2;
+        for(int j = 0; j < 2; j++)
+            if(exprs[j]->t == EXPR_TERM && exprs[j]->expr.term.t == TERM_COLREF &&
+               codegen_colref(cg, exprs[j]->expr.term.ref, cg->nTables, &table, &c, NULL) == CHIDB_OK &&
+               table == 0 && c == column)
+                return true;
+    }
+
+    return false;
+}
+
+/* If the outermost loop would scan its table, and the GROUP BY key is an
+ * indexed column of the table, makes the loop walk the whole index
+ * instead, if that is expected to be cheaper: the rows then come in the
+ * order of the index, so the groups can be produced one at a time as
+ * they end (see codegen_grouped), instead of being aggregated in the
+ * aggregator's hash table. The index keys are unsigned, so the
+ * negative values come after the others, and the rows with a NULL in
+ * the column, which aren't in the index, are read from the table once
+ * the index has been walked (unless a conjunct drops them anyway): they
+ * are the last group. Walking the index is expected to be cheaper when
+ * the index covers the columns the statement reads */
+static void codegen_index_scan(codegen_t *cg, SRA_Project_t *project)
+{
+    codegen_table_t *t = &cg->tables[0];
+    Expression_t *group = project->group_by;
+    chidb_schema_item_t *index;
+    int table, column;
+    Column_t *col;
+    bool nulls;
+    double hash, walk;
+
+    if(group == NULL || group->t != EXPR_TERM || group->expr.term.t != TERM_COLREF ||
+       codegen_colref(cg, group->expr.term.ref, cg->nTables, &table, &column, &col) != CHIDB_OK ||
+       table != 0 || column == t->pkey || col->type != TYPE_INT)
+        return;
+    if((index = chidb_schema_index(cg->db, t->schema->name, col->name)) == NULL)
+        return;
+
+    nulls = !codegen_not_null(cg, column);
+    hash = chidb_cost_scan(t->schema) +
+           chidb_cost_hash_agg(chidb_stats_rows(t->schema), chidb_stats_distinct(index));
+    walk = chidb_cost_index_scan(t->schema, index, codegen_covers(t, index)) +
+           (nulls ? chidb_cost_scan(t->schema) : 0);
+    if(walk >= hash)
+        return;
+
+    t->access = ACCESS_INDEX_SCAN;
+    t->index = index;
+    t->nulls = nulls;
+}
+
+/* Decides how each loop reads its table: whichever is expected to be
+ * cheapest (see stats.h) of scanning the whole table, and each of the
+ * seeks the loop's conjuncts can be used for. With GROUP BY, walking an
+ * index on the group key is also weighed against aggregating the rows
+ * in a hash table (see codegen_index_scan) */
+static void codegen_plan(codegen_t *cg, SRA_Project_t *project)
+{
+    for(int level = 0; level < cg->nTables; level++)
+    {
+        codegen_table_t *t = &cg->tables[level];
+        codegen_cond_t *lo = NULL, *hi = NULL;
+        double cost = chidb_cost_scan(t->schema), fraction = 1, c_cost;
+        int column;
+        Expression_t *key;
+        enum CondType cmp;
+
+        /* A hash join uses the first conjunct it can, whatever the cost */
+        for(int i = 0; i < cg->nConds && t->hash; i++)
+        {
+            if(!codegen_hashable(cg, &cg->conds[i], level, &column, &key))
+                continue;
+            t->access = ACCESS_HASH;
+            t->seek = &cg->conds[i];
+            t->seek->done = true;
+            t->hash_cursor = cg->nCursors++;
+            break;
+        }
+        if(t->access == ACCESS_HASH)
+            continue;
+
+        for(int i = 0; i < cg->nConds; i++)
+        {
+            codegen_cond_t *c = &cg->conds[i];
+            chidb_schema_item_t *index;
+            Column_t *col;
+
+            if(!codegen_seekable(cg, c, level, &column, &col, &key, &cmp))
+                continue;
+
+            if(column == t->pkey && cmp == RA_COND_EQ)
+            {
+                if((c_cost = chidb_cost_pk_eq(t->schema)) < cost)
+                {
+                    cost = c_cost;
+                    t->access = ACCESS_PK_EQ;
+                    t->seek = c;
+                    t->index = NULL;
+                }
+            }
+            else if(column == t->pkey)
+            {
+                /* Range keys are always literals */
+                codegen_cond_t **bound = cmp == RA_COND_GT || cmp == RA_COND_GEQ ? &lo : &hi;
+                if(*bound == NULL)
+                {
+                    *bound = c;
+                    fraction *= chidb_stats_fraction(t->schema, cmp, key->expr.term.val->val.ival);
+                }
+            }
+            else if(cmp == RA_COND_EQ)
+            {
+                /* Index keys are integers, so only integer columns can be looked up */
+                index = chidb_schema_index(cg->db, t->schema->name, col->name);
+                if(index != NULL && col->type == TYPE_INT &&
+                   (c_cost = chidb_cost_index_eq(t->schema, index, codegen_covers(t, index))) < cost)
+                {
+                    cost = c_cost;
+                    t->access = ACCESS_INDEX_EQ;
+                    t->seek = c;
+                    t->index = index;
+                }
+            }
+        }
+
+        if((lo != NULL || hi != NULL) && chidb_cost_pk_range(t->schema, fraction) < cost)
+        {
+            t->access = ACCESS_PK_RANGE;
+            t->seek = lo;
+            t->seek_hi = hi;
+            t->index = NULL;
+        }
+        if(level == 0 && t->access == ACCESS_SCAN)
+            codegen_index_range(cg, project);
+        if(level == 0 && t->access == ACCESS_SCAN)
+            codegen_index_scan(cg, project);
+        if(t->access == ACCESS_INDEX_EQ || t->access == ACCESS_INDEX_RANGE || t->access == ACCESS_INDEX_SCAN)
+            t->index_cursor = cg->nCursors++;
+
+        if(t->seek != NULL)
+            t->seek->done = true;
+        if(t->seek_hi != NULL)
+            t->seek_hi->done = true;
+    }
+}
+
+/* Generates the code that loads the key of a seek into a register. If
+ * the key is a column or a parameter, jumps to label if it turns out
+ * not to be a valid key (e.g., NULL) */
+static int codegen_key(codegen_t *cg, Expression_t *key, int32_t reg, int32_t label)
+{
+    int err;
+
+    check_fail(codegen_expr(cg, key, reg));
+    if(key->expr.term.t == TERM_COLREF || (key->expr.term.t == TERM_LITERAL && key->expr.term.val->param))
+        check_fail(codegen_jump(cg, Op_MustBeKey, reg, label, 0));
+
+    return CHIDB_OK;
+}
+
+/* Generates a ResultRow instruction, and with LIMIT, the jump past the
+ * last result row once the limit is reached */
+static int codegen_result_row(codegen_t *cg, int32_t rr)
+{
+    int err;
+
+    check_fail(codegen_op(cg, Op_ResultRow, rr, cg->stmt->nCols, 0, NULL));
+    if(cg->rlimit >= 0)
+        check_fail(codegen_jump(cg, Op_DecrJumpZero, cg->rlimit, cg->done, 0));
+
+    return CHIDB_OK;
+}
+
+/* Generates the code that adds a record of the sort key and the result
+ * columns to the sorter */
+static int codegen_sorter_insert(codegen_t *cg)
+{
+    int err;
+    int32_t rrec = codegen_reg(cg, 1);
+
+    check_fail(codegen_op(cg, Op_MakeRecord, cg->rkey, cg->nKeys + cg->stmt->nCols, rrec, NULL));
+    return codegen_op(cg, Op_SorterInsert, cg->sorter, rrec, 0, NULL);
+}
+
+/* Do the result rows go through checks (see codegen_checks)? */
+static bool codegen_checked(codegen_t *cg)
+{
+    return cg->nChecks > cg->firstCheck || cg->fill >= 0;
+}
+
+/* Generates the code that puts the result row in registers rr.. through
+ * the checks of DISTINCT and the set operations, and jumps to skip if
+ * it's dropped. With fill, the row is then added to that set instead of
+ * being produced, so the code always jumps to skip. Otherwise, with
+ * OFFSET, the rows before the offset are dropped after the checks (the
+ * rows they drop don't count) */
+static int codegen_checks(codegen_t *cg, int32_t rr, int32_t skip)
+{
+    int err;
+    int32_t rrec;
+
+    if(!codegen_checked(cg))
+        return CHIDB_OK;
+
+    rrec = codegen_reg(cg, 1);
+    check_fail(codegen_op(cg, Op_MakeRecord, rr, cg->stmt->nCols, rrec, NULL));
+    for(int i = cg->nChecks - 1; i >= cg->firstCheck; i--)
+        check_fail(codegen_jump(cg, cg->checks[i].member ? Op_SetNotFound : Op_SetInsert,
+                                cg->checks[i].set, skip, rrec));
+
+    if(cg->fill >= 0)
+    {
+        check_fail(codegen_jump(cg, Op_SetInsert, cg->fill, skip, rrec));
+        return codegen_jump(cg, Op_Goto, 0, skip, 0);
+    }
+
+    if(cg->sorter < 0 && cg->roffset >= 0)
+        check_fail(codegen_jump(cg, Op_IfPos, cg->roffset, skip, 1));
+
+    return CHIDB_OK;
+}
+
+/* Generates the code that produces a result row (or, with ORDER BY,
+ * adds it to the sorter) */
+static int codegen_project(codegen_t *cg, SRA_Project_t *project, int32_t rr)
+{
+    int err;
+    int32_t reg = rr, skip;
+
+    check_fail(codegen_label(cg, &skip));
+
+    /* Rows before the OFFSET are skipped right away, unless they still
+     * have to be sorted or checked */
+    if(cg->sorter < 0 && cg->roffset >= 0 && !codegen_checked(cg))
+        check_fail(codegen_jump(cg, Op_IfPos, cg->roffset, skip, 1));
+
+    for(Expression_t *expr = project->expr_list; expr != NULL; expr = expr->next)
+    {
+        ColumnReference_t *ref = expr->t == EXPR_TERM && expr->expr.term.t == TERM_COLREF ? expr->expr.term.ref : NULL;
+
+        if(ref == NULL || strcmp(ref->columnName, "*"))
+        {
+            check_fail(codegen_expr(cg, expr, reg++));
+            continue;
+        }
+
+        for(int i = 0; i < cg->nTables; i++)
+        {
+            if(ref->tableName != NULL && strcasecmp(ref->tableName, cg->tables[i].name))
+                continue;
+            for(int col = 0; col < chidb_schema_ncolumns(cg->tables[i].schema); col++)
+                check_fail(codegen_column(cg, i, col, reg++));
+        }
+    }
+    check_fail(codegen_checks(cg, rr, skip));
+
+    if(cg->sorter < 0)
+        check_fail(codegen_result_row(cg, rr));
+    else
+    {
+        reg = cg->rkey;
+        for(Expression_t *expr = project->order_by; expr != NULL; expr = expr->next)
+            check_fail(codegen_expr(cg, expr, reg++));
+        check_fail(codegen_sorter_insert(cg));
+    }
+    codegen_bind(cg, skip);
+
+    return CHIDB_OK;
+}
+
+/* Generates the code that produces the result rows from the sorter, once
+ * all the rows have been added to it */
+static int codegen_sorted(codegen_t *cg, int32_t rr)
+{
+    int err;
+    int32_t top, next, end, mark;
+
+    check_fail(codegen_label(cg, &next));
+    check_fail(codegen_label(cg, &end));
+    check_fail(codegen_mark(cg, &mark));
+    check_fail(codegen_jump(cg, Op_SorterSort, cg->sorter, end, 0));
+    top = cg->pc;
+    if(cg->roffset >= 0)
+        check_fail(codegen_jump(cg, Op_IfPos, cg->roffset, next, 1));
+    for(int i = 0; i < cg->stmt->nCols; i++)
+        check_fail(codegen_op(cg, Op_Column, cg->sorter, cg->nKeys + i, rr + i, NULL));
+    check_fail(codegen_result_row(cg, rr));
+    codegen_bind(cg, next);
+    check_fail(codegen_op(cg, Op_ArenaRelease, mark, 0, 0, NULL));
+    check_fail(codegen_op(cg, Op_SorterNext, cg->sorter, top, 0, NULL));
+    codegen_bind(cg, end);
+
+    return CHIDB_OK;
+}
+
+
+/*** AGGREGATION ***/
+
+static bool codegen_is_agg(Expression_t *expr)
+{
+    return expr->t == EXPR_TERM && expr->expr.term.t == TERM_FUNC;
+}
+
+static bool codegen_is_star(Expression_t *expr)
+{
+    return expr->t == EXPR_TERM && expr->expr.term.t == TERM_COLREF && !strcmp(expr->expr.term.ref->columnName, "*");
+}
+
+/* Are two expressions the same? They are if they are the same column
+ * (even if referred to differently), or the same aggregate function of
+ * the same argument */
+static bool codegen_same_expr(codegen_t *cg, Expression_t *e1, Expression_t *e2)
+{
+    int table1, column1, table2, column2;
+
+    if(e1->t != EXPR_TERM || e2->t != EXPR_TERM || e1->expr.term.t != e2->expr.term.t)
+        return false;
+
+    switch(e1->expr.term.t)
+    {
+    case TERM_COLREF:
+        if(codegen_is_star(e1) || codegen_is_star(e2))
+            return codegen_is_star(e1) && codegen_is_star(e2);
+        return codegen_colref(cg, e1->expr.term.ref, cg->nTables, &table1, &column1, NULL) == CHIDB_OK &&
+               codegen_colref(cg, e2->expr.term.ref, cg->nTables, &table2, &column2, NULL) == CHIDB_OK &&
+               table1 == table2 && column1 == column2;
+    case TERM_FUNC:
+        return e1->expr.term.f.t == e2->expr.term.f.t &&
+               codegen_same_expr(cg, e1->expr.term.f.expr, e2->expr.term.f.expr);
+    default:
+        return false;
+    }
+}
+
+/* The result column an ORDER BY expression refers to by its alias (or
+ * the expression itself, if it isn't an alias) */
+static Expression_t *codegen_alias(SRA_Project_t *project, Expression_t *expr)
+{
+    ColumnReference_t *ref = expr->t == EXPR_TERM && expr->expr.term.t == TERM_COLREF ? expr->expr.term.ref : NULL;
+
+    if(ref == NULL || ref->tableName != NULL)
+        return expr;
+    for(Expression_t *item = project->expr_list; item != NULL; item = item->next)
+        if(item->alias != NULL && !strcasecmp(item->alias, ref->columnName))
+            return item;
+
+    return expr;
+}
+
+/* Generates the code that evaluates a result column (or a sort key) of
+ * an aggregate query into a register, from the group the aggregator's
+ * cursor is on. It has to be a literal, the group key, or one of the
+ * aggregate functions of the result columns */
+static int codegen_agg_value(codegen_t *cg, SRA_Project_t *project, Expression_t *expr, int32_t reg)
+{
+    int column = cg->nGroup;
+
+    if(expr->t == EXPR_NEG ||
+       (expr->t == EXPR_TERM && (expr->expr.term.t == TERM_LITERAL || expr->expr.term.t == TERM_NULL)))
+        return codegen_expr(cg, expr, reg);
+
+    if(project->group_by != NULL && codegen_same_expr(cg, expr, project->group_by))
+        return codegen_op(cg, Op_Column, cg->agg, 0, reg, NULL);
+
+    if(codegen_is_agg(expr))
+        for(Expression_t *item = project->expr_list; item != NULL; item = item->next)
+        {
+            if(!codegen_is_agg(item))
+                continue;
+            if(codegen_same_expr(cg, expr, item))
+                return codegen_op(cg, Op_Column, cg->agg, column, reg, NULL);
+            column++;
+        }
+
+    return CHIDB_EINVALIDSQL;
+}
+
+/* Generates the code that produces a result row from the group the
+ * aggregator's cursor is on (or, with ORDER BY, adds it to the sorter) */
+static int codegen_agg_row(codegen_t *cg, SRA_Project_t *project, int32_t rr)
+{
+    int err;
+    int32_t reg = rr, skip;
+
+    check_fail(codegen_label(cg, &skip));
+    if(cg->sorter < 0 && cg->roffset >= 0 && !codegen_checked(cg))
+        check_fail(codegen_jump(cg, Op_IfPos, cg->roffset, skip, 1));
+
+    for(Expression_t *expr = project->expr_list; expr != NULL; expr = expr->next)
+        check_fail(codegen_agg_value(cg, project, expr, reg++));
+    check_fail(codegen_checks(cg, rr, skip));
+
+    if(cg->sorter < 0)
+        check_fail(codegen_result_row(cg, rr));
+    else
+    {
+        reg = cg->rkey;
+        for(Expression_t *expr = project->order_by; expr != NULL; expr = expr->next)
+            check_fail(codegen_agg_value(cg, project, codegen_alias(project, expr), reg++));
+        check_fail(codegen_sorter_insert(cg));
+    }
+    codegen_bind(cg, skip);
+
+    return CHIDB_OK;
+}
+
+/* Generates the code that adds the current row of the loops to the
+ * aggregator: a record of the group key, followed by the argument of
+ * each aggregate function (1 for COUNT(*), which counts every row).
+ * When streaming, a row that starts a new group first produces the
+ * previous group, and is then added to the (now empty) aggregator. The
+ * previous group's key and values are read from the aggregator, which
+ * keeps its own copy of them, and the row's record is still valid once
+ * the program resumes after producing the group, since it is only
+ * released at the end of the iteration */
+static int codegen_agg_step(codegen_t *cg, SRA_Project_t *project, int32_t rr)
+{
+    int err;
+    int32_t reg = cg->ragg, rrec, same;
+    Expression_t *arg;
+
+    if(project->group_by != NULL)
+        check_fail(codegen_expr(cg, project->group_by, reg++));
+
+    for(Expression_t *expr = project->expr_list; expr != NULL; expr = expr->next)
+    {
+        if(!codegen_is_agg(expr))
+            continue;
+        arg = expr->expr.term.f.expr;
+        if(!codegen_is_star(arg))
+            check_fail(codegen_expr(cg, arg, reg++));
+        else if(expr->expr.term.f.t == FUNC_COUNT)
+            check_fail(codegen_op(cg, Op_Integer, 1, reg++, 0, NULL));
+        else
+            return CHIDB_EINVALIDSQL;
+    }
+
+    rrec = codegen_reg(cg, 1);
+    check_fail(codegen_op(cg, Op_MakeRecord, cg->ragg, cg->nGroup + cg->nAggs, rrec, NULL));
+    if(cg->stream)
+    {
+        check_fail(codegen_label(cg, &same));
+        check_fail(codegen_jump(cg, Op_AggBreak, cg->agg, same, rrec));
+        check_fail(codegen_agg_row(cg, project, rr));
+        codegen_bind(cg, same);
+    }
+    return codegen_op(cg, Op_AggStep, cg->agg, rrec, 0, NULL);
+}
+
+/* Generates the code that produces a result row from each group of the
+ * aggregator (or, with ORDER BY, adds it to the sorter), once all the
+ * rows have been added to it */
+static int codegen_aggregated(codegen_t *cg, SRA_Project_t *project, int32_t rr)
+{
+    int err;
+    int32_t top, end, mark;
+
+    check_fail(codegen_label(cg, &end));
+    check_fail(codegen_mark(cg, &mark));
+    check_fail(codegen_jump(cg, Op_AggFinal, cg->agg, end, 0));
+    top = cg->pc;
+    check_fail(codegen_agg_row(cg, project, rr));
+    check_fail(codegen_op(cg, Op_ArenaRelease, mark, 0, 0, NULL));
+    check_fail(codegen_op(cg, Op_AggNext, cg->agg, top, 0, NULL));
+    codegen_bind(cg, end);
+
+    return CHIDB_OK;
+}
+
+/* Can MIN or MAX be computed with a single seek? It can if it's the only
+ * aggregate function of a query on a single table without conditions
+ * or GROUP BY, and its argument is the INTEGER PRIMARY KEY or an indexed
+ * column: the loop then only reads the row with the smallest (or
+ * largest) value. NULL values are not indexed, and MIN and MAX ignore
+ * them anyway */
+static void codegen_plan_min_max(codegen_t *cg, SRA_Project_t *project)
+{
+    codegen_table_t *t = &cg->tables[0];
+    Expression_t *agg = NULL, *arg;
+    chidb_schema_item_t *index = NULL;
+    int table, column;
+    Column_t *col;
 
-int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+    if(cg->nTables != 1 || cg->nConds > 0 || project->group_by != NULL || t->access != ACCESS_SCAN)
+        return;
+
+    for(Expression_t *expr = project->expr_list; expr != NULL; expr = expr->next)
+    {
+        if(!codegen_is_agg(expr))
+            continue;
+        if(agg != NULL)
+            return;
+        agg = expr;
+    }
+    if(agg == NULL || (agg->expr.term.f.t != FUNC_MIN && agg->expr.term.f.t != FUNC_MAX))
+        return;
+
+    arg = agg->expr.term.f.expr;
+    if(arg->t != EXPR_TERM || arg->expr.term.t != TERM_COLREF || codegen_is_star(arg) ||
+       codegen_colref(cg, arg->expr.term.ref, cg->nTables, &table, &column, &col) != CHIDB_OK)
+        return;
+    if(column != t->pkey &&
+       (col->type != TYPE_INT || (index = chidb_schema_index(cg->db, t->schema->name, col->name)) == NULL))
+        return;
+
+    t->access = ACCESS_MIN_MAX;
+    t->max = agg->expr.term.f.t == FUNC_MAX;
+    t->index = index;
+    if(index != NULL)
+        t->index_cursor = cg->nCursors++;
+}
+
+/* Can a conjunct be applied to whole batches of rows of a table (see
+ * codegen_batch)? It has to compare two of its columns, or one of its
+ * columns and an integer literal */
+static bool codegen_batchable(codegen_t *cg, Condition_t *cond)
+{
+    Expression_t *exprs[2];
+    int table, column, ncols = 0;
+    int32_t k;
+
+    if(!IS_COMPARISON(cond->t))
+        return false;
+
+    exprs[0] = cond->cond.comp.expr1;
+    exprs[1] = cond->cond.comp.expr2;
+    for(int i = 0; i < 2; i++)
+    {
+        if(exprs[i]->t == EXPR_TERM && exprs[i]->expr.term.t == TERM_COLREF && !codegen_is_star(exprs[i]) &&
+           codegen_colref(cg, exprs[i]->expr.term.ref, cg->nTables, &table, &column, NULL) == CHIDB_OK)
+            ncols++;
+        else if(!codegen_int_const(exprs[i], &k))
+            return false;
+    }
+
+    return ncols > 0;
+}
+
+/* Chooses to read the table in batches (see codegen_batch) if it's the
+ * only one, it has to be scanned, and it has conditions that can all be
+ * applied to whole batches. With LIMIT, the rows are read one at a time
+ * instead, since the loop may stop after a few of them */
+static void codegen_plan_batch(codegen_t *cg, SRA_Project_t *project)
+{
+    codegen_table_t *t = &cg->tables[0];
+
+    if(cg->nTables != 1 || cg->nConds == 0 || project->limit >= 0 || t->access != ACCESS_SCAN ||
+       chidb_schema_ncolumns(t->schema) > DBRECORD_MAX_FIELDS)
+        return;
+
+    for(int i = 0; i < cg->nConds; i++)
+        if(!codegen_batchable(cg, cg->conds[i].cond))
+            return;
+
+    t->batch = true;
+}
+
+/* Sets the names of the columns of the result rows */
+static int codegen_result_columns(codegen_t *cg, SRA_Project_t *project)
+{
+    chidb_stmt *stmt = cg->stmt;
+    char **cols = NULL;
+    uint32_t n = 0;
+    char buf[32];
+
+    for(Expression_t *expr = project->expr_list; expr != NULL; expr = expr->next)
+    {
+        ColumnReference_t *ref = expr->t == EXPR_TERM && expr->expr.term.t == TERM_COLREF ? expr->expr.term.ref : NULL;
+        bool found = false;
+
+        if(ref != NULL && !strcmp(ref->columnName, "*"))
+        {
+            for(int i = 0; i < cg->nTables; i++)
+            {
+                if(ref->tableName != NULL && strcasecmp(ref->tableName, cg->tables[i].name))
+                    continue;
+                found = true;
+                for(Column_t *col = cg->tables[i].schema->stmt->stmt.create->table->columns; col != NULL; col = col->next)
+                {
+                    cols = realloc(cols, sizeof(char *) * (n + 1));
+                    cols[n++] = strdup(col->name);
+                }
+            }
+            if(!found)
+                return CHIDB_EINVALIDSQL;
+            continue;
+        }
+
+        cols = realloc(cols, sizeof(char *) * (n + 1));
+        if(expr->alias != NULL)
+            cols[n] = strdup(expr->alias);
+        else if(ref != NULL)
+            cols[n] = strdup(ref->columnName);
+        else if(codegen_is_agg(expr))
+        {
+            Expression_t *arg = expr->expr.term.f.expr;
+            if(arg->t == EXPR_TERM && arg->expr.term.t == TERM_COLREF)
+                snprintf(buf, sizeof(buf), "%s(%s)", codegen_agg_names[expr->expr.term.f.t], arg->expr.term.ref->columnName);
+            else
+                snprintf(buf, sizeof(buf), "%s", codegen_agg_names[expr->expr.term.f.t]);
+            cols[n] = strdup(buf);
+        }
+        else if(expr->t == EXPR_TERM && expr->expr.term.t == TERM_LITERAL)
+        {
+            Literal_t *val = expr->expr.term.val;
+            if(val->param && stmt->var_names[val->param - 1] != NULL)
+                snprintf(buf, sizeof(buf), ":%s", stmt->var_names[val->param - 1]);
+            else if(val->param)
+                snprintf(buf, sizeof(buf), "?");
+            else switch(val->t)
+            {
+            case TYPE_INT:
+                snprintf(buf, sizeof(buf), "%" PRId64, val->val.ival);
+                break;
+            case TYPE_DOUBLE:
+                snprintf(buf, sizeof(buf), "%g", val->val.dval);
+                break;
+            case TYPE_CHAR:
+                snprintf(buf, sizeof(buf), "%c", val->val.cval);
+                break;
+            case TYPE_TEXT:
+                snprintf(buf, sizeof(buf), "%s", val->val.strval);
+                break;
+            }
+            cols[n] = strdup(buf);
+        }
+        else
+            cols[n] = strdup("NULL");
+        n++;
+    }
+
+    stmt->cols = cols;
+    stmt->nCols = n;
+
+    return CHIDB_OK;
+}
+
+/* Generates the code that builds the hash table of table i, before any
+ * of the loops, and then makes the table's loop read from the hash table.
+ * The conjuncts of the loop that only use the table are applied as its
+ * rows are added, and are not evaluated again in the loop */
+static int codegen_hash_build(codegen_t *cg, int level)
+{
+    int err;
+    codegen_table_t *t = &cg->tables[level];
+    int32_t top, next, done, r, mark;
+    int column;
+    Expression_t *key;
+
+    codegen_hashable(cg, t->seek, level, &column, &key);
+    check_fail(codegen_label(cg, &next));
+    check_fail(codegen_label(cg, &done));
+    r = codegen_reg(cg, 1);
+
+    check_fail(codegen_op(cg, Op_HashOpen, t->hash_cursor, 0, 0, NULL));
+    check_fail(codegen_mark(cg, &mark));
+    check_fail(codegen_jump(cg, Op_Rewind, t->cursor, done, 0));
+    top = cg->pc;
+    for(int i = 0; i < cg->nConds; i++)
+    {
+        codegen_cond_t *c = &cg->conds[i];
+
+        if(c->level != level || c->done || !codegen_cond_only(cg, c->cond, level))
+            continue;
+        check_fail(codegen_cond_false(cg, c->cond, next));
+        c->done = true;
+    }
+    check_fail(codegen_column(cg, level, column, r));
+    check_fail(codegen_op(cg, Op_HashBuild, t->hash_cursor, t->cursor, r, NULL));
+    codegen_bind(cg, next);
+    check_fail(codegen_op(cg, Op_ArenaRelease, mark, 0, 0, NULL));
+    check_fail(codegen_op(cg, Op_Next, t->cursor, top, 0, NULL));
+    codegen_bind(cg, done);
+
+    t->cursor = t->hash_cursor;
+
+    return CHIDB_OK;
+}
+
+/* Generates loop i (and, inside it, loops i+1.. and the projection).
+ * When the table has no more rows, the loop jumps to label exit (or
+ * falls through to the instruction after it) */
+static int codegen_loop(codegen_t *cg, int level, int32_t exit, SRA_Project_t *project, int32_t rr);
+
+/* Generates the code that reads a column of a table read in batches into
+ * its vector, before the filters, and returns the vector */
+static int codegen_vector(codegen_t *cg, codegen_table_t *t, Expression_t *expr, int32_t *vec)
+{
+    int err;
+    int table, column;
+
+    check_fail(codegen_colref(cg, expr->expr.term.ref, cg->nTables, &table, &column, NULL));
+    *vec = t->vec + column;
+    if(t->vectors[column] != VECTOR_NONE)
+        return CHIDB_OK;
+
+    t->vectors[column] = VECTOR_FILTER;
+    if(column == t->pkey)
+        return codegen_op(cg, Op_VKey, t->cursor, 0, *vec, NULL);
+    else
+        return codegen_op(cg, Op_VColumn, t->cursor, column, *vec, NULL);
+}
+
+/* Generates the code that only keeps the rows of a batch that satisfy a
+ * conjunct (see codegen_batchable) */
+static int codegen_vector_filter(codegen_t *cg, codegen_table_t *t, Condition_t *cond)
+{
+    int err;
+    Expression_t *expr1 = cond->cond.comp.expr1, *expr2 = cond->cond.comp.expr2;
+    enum CondType cmp = cond->t;
+    int32_t k, v1, v2;
+
+    if(codegen_int_const(expr1, &k))
+    {
+        expr1 = expr2;
+        expr2 = cond->cond.comp.expr1;
+        cmp = codegen_cmp_swap[cmp];
+    }
+
+    check_fail(codegen_vector(cg, t, expr1, &v1));
+    if(codegen_int_const(expr2, &k))
+        return codegen_op(cg, codegen_cmp_vector_const[codegen_cmp_true[cmp]], k, 0, v1, NULL);
+
+    check_fail(codegen_vector(cg, t, expr2, &v2));
+    return codegen_op(cg, codegen_cmp_vector[codegen_cmp_true[cmp]], v2, 0, v1, NULL);
+}
+
+/* Generates the loop of a table read in batches: each batch is filtered
+ * as a whole, and then the body of the loop runs for each of the rows
+ * that are still selected. Only the columns the filters use are read
+ * before the filters. The other columns are read for the selected rows
+ * after them, but which ones is only known once the body has been
+ * generated, so they are read at the end of the loop:
+ *
+ *       Rewind    c    exit
+ *   top:
+ *       Batch     c    exit
+ *       VColumn   ...           (columns used by the filters)
+ *       V<Cmp>    ...           (filters)
+ *       Goto           fetch
+ *   row:
+ *       BatchRow  c    top
+ *       ...                     (body)
+ *       Goto           row
+ *   fetch:
+ *       VColumn   ...           (other columns used by the body)
+ *       Goto           row
+ */
+static int codegen_batch(codegen_t *cg, int level, int32_t exit, SRA_Project_t *project, int32_t rr)
+{
+    int err;
+    codegen_table_t *t = &cg->tables[level];
+    int ncols = chidb_schema_ncolumns(t->schema);
+    int32_t top, row, next, fetch, mark;
+
+    check_fail(codegen_label(cg, &row));
+    check_fail(codegen_label(cg, &next));
+    check_fail(codegen_label(cg, &fetch));
+    t->vec = codegen_reg(cg, ncols);
+    memset(t->vectors, VECTOR_NONE, sizeof(t->vectors));
+
+    check_fail(codegen_mark(cg, &mark));
+    check_fail(codegen_jump(cg, Op_Rewind, t->cursor, exit, 0));
+    top = cg->pc;
+    check_fail(codegen_jump(cg, Op_Batch, t->cursor, exit, 0));
+    for(int i = 0; i < cg->nConds; i++)
+        if(cg->conds[i].level == level && !cg->conds[i].done)
+            check_fail(codegen_vector_filter(cg, t, cg->conds[i].cond));
+    check_fail(codegen_jump(cg, Op_Goto, 0, fetch, 0));
+
+    codegen_bind(cg, row);
+    check_fail(codegen_op(cg, Op_BatchRow, t->cursor, top, 0, NULL));
+    check_fail(codegen_loop(cg, level + 1, next, project, rr));
+    codegen_bind(cg, next);
+    check_fail(codegen_op(cg, Op_ArenaRelease, mark, 0, 0, NULL));
+    check_fail(codegen_jump(cg, Op_Goto, 0, row, 0));
+
+    codegen_bind(cg, fetch);
+    for(int i = 0; i < ncols; i++)
+    {
+        if(t->vectors[i] != VECTOR_ROW)
+            continue;
+        if(i == t->pkey)
+            check_fail(codegen_op(cg, Op_VKey, t->cursor, 0, t->vec + i, NULL));
+        else
+            check_fail(codegen_op(cg, Op_VColumn, t->cursor, i, t->vec + i, NULL));
+    }
+    return codegen_jump(cg, Op_Goto, 0, row, 0);
+}
+
+/* Generates the loop that reads the rows with a NULL in the indexed
+ * column of an INDEX_SCAN loop (see codegen_index_scan), once the index
+ * has been walked. The rows are read from the table, even if the index
+ * covers the columns the statement reads */
+static int codegen_index_nulls(codegen_t *cg, int level, int32_t exit, SRA_Project_t *project, int32_t rr)
+{
+    int err;
+    codegen_table_t *t = &cg->tables[level];
+    int column = chidb_schema_column(t->schema, t->index->stmt->stmt.create->index->column_name, NULL);
+    int32_t top, next, null, r, mark;
+    bool covered = t->covered;
+
+    check_fail(codegen_label(cg, &next));
+    check_fail(codegen_label(cg, &null));
+    r = codegen_reg(cg, 1);
+    check_fail(codegen_mark(cg, &mark));
+    check_fail(codegen_jump(cg, Op_Rewind, t->cursor, exit, 0));
+    top = cg->pc;
+    check_fail(codegen_op(cg, Op_Column, t->cursor, column, r, NULL));
+    check_fail(codegen_jump(cg, Op_IsNull, r, null, 0));
+    check_fail(codegen_jump(cg, Op_Goto, 0, next, 0));
+    codegen_bind(cg, null);
+
+    t->covered = false;
+    for(int i = 0; i < cg->nConds && err == CHIDB_OK; i++)
+        if(cg->conds[i].level == level && !cg->conds[i].done)
+            err = codegen_cond_false(cg, cg->conds[i].cond, next);
+    if(err == CHIDB_OK)
+        err = codegen_loop(cg, level + 1, next, project, rr);
+    t->covered = covered;
+    check_fail(err);
+
+    codegen_bind(cg, next);
+    check_fail(codegen_op(cg, Op_ArenaRelease, mark, 0, 0, NULL));
+    return codegen_op(cg, Op_Next, t->cursor, top, 0, NULL);
+}
+
+static int codegen_loop(codegen_t *cg, int level, int32_t exit, SRA_Project_t *project, int32_t rr)
+{
+    int err;
+    codegen_table_t *t;
+    int32_t top = -1, next, rkey, rhi, r, other, found, nulls = -1, mark = -1;
+    int column;
+    Column_t *col;
+    Expression_t *key;
+    enum CondType cmp;
+
+    if(level == cg->nTables)
+        return cg->agg >= 0 ? codegen_agg_step(cg, project, rr) : codegen_project(cg, project, rr);
+
+    t = &cg->tables[level];
+    if(t->batch)
+        return codegen_batch(cg, level, exit, project, rr);
+
+    check_fail(codegen_label(cg, &next));
+
+    switch(t->access)
+    {
+    case ACCESS_SCAN:
+        check_fail(codegen_mark(cg, &mark));
+        check_fail(codegen_jump(cg, Op_Rewind, t->cursor, exit, 0));
+        top = cg->pc;
+        break;
+
+    case ACCESS_PK_EQ:
+        codegen_seekable(cg, t->seek, level, &column, &col, &key, &cmp);
+        rkey = codegen_reg(cg, 1);
+        check_fail(codegen_key(cg, key, rkey, exit));
+        check_fail(codegen_jump(cg, Op_Seek, t->cursor, exit, rkey));
+        break;
+
+    case ACCESS_PK_RANGE:
+        if(t->seek != NULL)
+        {
+            codegen_seekable(cg, t->seek, level, &column, &col, &key, &cmp);
+            rkey = codegen_reg(cg, 1);
+            check_fail(codegen_key(cg, key, rkey, exit));
+            check_fail(codegen_mark(cg, &mark));
+            check_fail(codegen_jump(cg, cmp == RA_COND_GT ? Op_SeekGt : Op_SeekGe, t->cursor, exit, rkey));
+        }
+        else
+        {
+            check_fail(codegen_mark(cg, &mark));
+            check_fail(codegen_jump(cg, Op_Rewind, t->cursor, exit, 0));
+        }
+
+        if(t->seek_hi != NULL)
+        {
+            codegen_seekable(cg, t->seek_hi, level, &column, &col, &key, &cmp);
+            rhi = codegen_reg(cg, 1);
+            r = codegen_reg(cg, 1);
+            check_fail(codegen_key(cg, key, rhi, exit));
+            top = cg->pc;
+            check_fail(codegen_op(cg, Op_Key, t->cursor, r, 0, NULL));
+            check_fail(codegen_jump(cg, cmp == RA_COND_LT ? Op_GeInt : Op_GtInt, rhi, exit, r));
+        }
+        else
+            top = cg->pc;
+        break;
+
+    case ACCESS_INDEX_EQ:
+        codegen_seekable(cg, t->seek, level, &column, &col, &key, &cmp);
+        rkey = codegen_reg(cg, 1);
+        r = codegen_reg(cg, 1);
+        check_fail(codegen_key(cg, key, rkey, exit));
+        check_fail(codegen_mark(cg, &mark));
+        check_fail(codegen_jump(cg, Op_SeekGe, t->index_cursor, exit, rkey));
+        top = cg->pc;
+        check_fail(codegen_jump(cg, Op_IdxGt, t->index_cursor, exit, rkey));
+        if(!t->covered)
+        {
+            check_fail(codegen_op(cg, Op_IdxPKey, t->index_cursor, r, 0, NULL));
+            check_fail(codegen_jump(cg, Op_Seek, t->cursor, next, r));
+        }
+        break;
+
+    case ACCESS_INDEX_RANGE:
+        codegen_seekable(cg, t->seek, level, &column, &col, &key, &cmp);
+        rkey = codegen_reg(cg, 1);
+        rhi = codegen_reg(cg, 1);
+        r = codegen_reg(cg, 1);
+        check_fail(codegen_key(cg, key, rkey, exit));
+        check_fail(codegen_mark(cg, &mark));
+        check_fail(codegen_jump(cg, cmp == RA_COND_GT ? Op_SeekGt : Op_SeekGe, t->index_cursor, exit, rkey));
+        /* Without an upper bound, the range ends before the negative
+         * values (see above) */
+        if(t->seek_hi != NULL)
+        {
+            codegen_seekable(cg, t->seek_hi, level, &column, &col, &key, &cmp);
+            check_fail(codegen_key(cg, key, rhi, exit));
+        }
+        else
+        {
+            cmp = RA_COND_LEQ;
+            check_fail(codegen_op(cg, Op_Integer, INT32_MAX, rhi, 0, NULL));
+        }
+        top = cg->pc;
+        check_fail(codegen_jump(cg, cmp == RA_COND_LT ? Op_IdxGe : Op_IdxGt, t->index_cursor, exit, rhi));
+        if(!t->covered)
+        {
+            check_fail(codegen_op(cg, Op_IdxPKey, t->index_cursor, r, 0, NULL));
+            check_fail(codegen_jump(cg, Op_Seek, t->cursor, next, r));
+        }
+        break;
+
+    case ACCESS_INDEX_SCAN:
+        r = codegen_reg(cg, 1);
+        if(t->nulls)
+            check_fail(codegen_label(cg, &nulls));
+        check_fail(codegen_mark(cg, &mark));
+        check_fail(codegen_jump(cg, Op_Rewind, t->index_cursor, t->nulls ? nulls : exit, 0));
+        top = cg->pc;
+        if(!t->covered)
+        {
+            check_fail(codegen_op(cg, Op_IdxPKey, t->index_cursor, r, 0, NULL));
+            check_fail(codegen_jump(cg, Op_Seek, t->cursor, next, r));
+        }
+        break;
+
+    case ACCESS_MIN_MAX:
+        r = codegen_reg(cg, 1);
+        if(t->index == NULL)
+        {
+            /* Keys are never negative */
+            check_fail(codegen_op(cg, Op_Integer, t->max ? INT32_MAX : 0, r, 0, NULL));
+            check_fail(codegen_jump(cg, t->max ? Op_SeekLe : Op_SeekGe, t->cursor, exit, r));
+            break;
+        }
+        /* Negative values are indexed as keys above INT32_MAX, so the
+         * smallest value is the first of those (if any), and the largest
+         * is the last of the others (if any) */
+        check_fail(codegen_label(cg, &other));
+        check_fail(codegen_label(cg, &found));
+        check_fail(codegen_op(cg, Op_Integer, t->max ? INT32_MAX : INT32_MIN, r, 0, NULL));
+        check_fail(codegen_jump(cg, t->max ? Op_SeekLe : Op_SeekGe, t->index_cursor, other, r));
+        check_fail(codegen_jump(cg, Op_Goto, 0, found, 0));
+        codegen_bind(cg, other);
+        check_fail(codegen_op(cg, Op_Integer, t->max ? -1 : 0, r, 0, NULL));
+        check_fail(codegen_jump(cg, t->max ? Op_SeekLe : Op_SeekGe, t->index_cursor, exit, r));
+        codegen_bind(cg, found);
+        if(!t->covered)
+        {
+            check_fail(codegen_op(cg, Op_IdxPKey, t->index_cursor, r, 0, NULL));
+            check_fail(codegen_jump(cg, Op_Seek, t->cursor, exit, r));
+        }
+        break;
+
+    case ACCESS_HASH:
+        codegen_hashable(cg, t->seek, level, &column, &key);
+        rkey = codegen_reg(cg, 1);
+        check_fail(codegen_expr(cg, key, rkey));
+        check_fail(codegen_mark(cg, &mark));
+        check_fail(codegen_jump(cg, Op_HashProbe, t->cursor, exit, rkey));
+        top = cg->pc;
+        break;
+    }
+
+    for(int i = 0; i < cg->nConds; i++)
+        if(cg->conds[i].level == level && !cg->conds[i].done)
+            check_fail(codegen_cond_false(cg, cg->conds[i].cond, next));
+
+    check_fail(codegen_loop(cg, level + 1, next, project, rr));
+
+    codegen_bind(cg, next);
+    if(mark >= 0)
+        check_fail(codegen_op(cg, Op_ArenaRelease, mark, 0, 0, NULL));
+    if(t->access == ACCESS_INDEX_EQ || t->access == ACCESS_INDEX_RANGE || t->access == ACCESS_INDEX_SCAN)
+        check_fail(codegen_op(cg, Op_Next, t->index_cursor, top, 0, NULL));
+    else if(t->access == ACCESS_HASH)
+        check_fail(codegen_op(cg, Op_HashNext, t->cursor, top, 0, NULL));
+    else if(t->access != ACCESS_PK_EQ && t->access != ACCESS_MIN_MAX)
+        check_fail(codegen_op(cg, Op_Next, t->cursor, top, 0, NULL));
+
+    if(nulls >= 0)
+    {
+        codegen_bind(cg, nulls);
+        check_fail(codegen_index_nulls(cg, level, exit, project, rr));
+    }
+
+    return CHIDB_OK;
+}
+
+/* Do the loops produce the rows in ascending order of an expression?
+ * They do if it's a column of the table of the outermost loop, and that
+ * loop reads the table in the order of the column: by key for its
+ * INTEGER PRIMARY KEY (unless through a hash table or an index), by the
+ * index for the column of an INDEX_RANGE loop, or any order for a column
+ * that has a single value in the rows it reads (the key of a PK_EQ
+ * loop, the column of an INDEX_EQ loop, or any column of the single row
+ * of a MIN_MAX loop) */
+static bool codegen_ordered_by(codegen_t *cg, Expression_t *expr)
+{
+    codegen_table_t *t = &cg->tables[0];
+    Expression_t *key;
+    int table, column, seek;
+    Column_t *col;
+    enum CondType cmp;
+
+    if(expr->t != EXPR_TERM || expr->expr.term.t != TERM_COLREF)
+        return false;
+    if(codegen_colref(cg, expr->expr.term.ref, cg->nTables, &table, &column, NULL) != CHIDB_OK || table != 0)
+        return false;
+
+    if(t->access == ACCESS_PK_EQ || t->access == ACCESS_MIN_MAX)
+        return true;
+    if(t->access == ACCESS_INDEX_EQ || t->access == ACCESS_INDEX_RANGE)
+    {
+        codegen_seekable(cg, t->seek, 0, &seek, &col, &key, &cmp);
+        if(column == seek)
+            return true;
+    }
+
+    return column == t->pkey && t->access != ACCESS_HASH && t->access != ACCESS_INDEX_RANGE &&
+           t->access != ACCESS_INDEX_SCAN;
+}
+
+/* Do the loops produce the rows of each group one after the other? They
+ * do if they produce them in the order of the group key, if the group
+ * key is the INTEGER PRIMARY KEY of the table of the outermost loop (each
+ * row of which is then a group of its own, along with the rows of the
+ * inner loops), or if the outermost loop walks the index on the group
+ * key (which puts the negative values and then NULL last, so the groups
+ * are not in the order of the key) */
+static bool codegen_grouped(codegen_t *cg, SRA_Project_t *project)
+{
+    Expression_t *expr = project->group_by;
+    codegen_table_t *t = &cg->tables[0];
+    int table, column;
+
+    if(expr == NULL)
+        return false;
+    if(codegen_ordered_by(cg, expr))
+        return true;
+
+    if(expr->t != EXPR_TERM || expr->expr.term.t != TERM_COLREF ||
+       codegen_colref(cg, expr->expr.term.ref, cg->nTables, &table, &column, NULL) != CHIDB_OK || table != 0)
+        return false;
+
+    if(t->access == ACCESS_INDEX_SCAN)
+        return column == chidb_schema_column(t->schema, t->index->stmt->stmt.create->index->column_name, NULL);
+
+    return column == t->pkey && t->access != ACCESS_HASH;
+}
+
+/* Do the loops already produce the rows in the order of the ORDER BY
+ * clause? They do if it's ascending on a single expression they produce
+ * the rows in the order of. With aggregation, the rows come from the
+ * aggregator instead, which only produces them in that order when
+ * streaming groups in the order of their key */
+static bool codegen_ordered(codegen_t *cg, SRA_Project_t *project)
+{
+    Expression_t *expr = project->order_by;
+
+    if(expr == NULL || expr->next != NULL || project->asc_desc != ORDER_BY_ASC)
+        return false;
+
+    if(cg->agg >= 0)
+        return cg->stream && codegen_same_expr(cg, codegen_alias(project, expr), project->group_by) &&
+               codegen_ordered_by(cg, project->group_by);
+
+    return codegen_ordered_by(cg, expr);
+}
+
+/* Adds a check to the ones the result rows go through */
+static int codegen_add_check(codegen_t *cg, int32_t set, bool member)
+{
+    codegen_check_t *checks = realloc(cg->checks, sizeof(codegen_check_t) * (cg->nChecks + 1));
+    if(checks == NULL)
+        return CHIDB_ENOMEM;
+
+    cg->checks = checks;
+    cg->checks[cg->nChecks].set = set;
+    cg->checks[cg->nChecks].member = member;
+    cg->nChecks++;
+
+    return CHIDB_OK;
+}
+
+/* Opens a new set, and returns its cursor */
+static int codegen_set_open(codegen_t *cg, int32_t *set)
+{
+    *set = cg->nCursors++;
+    return codegen_op(cg, Op_SetOpen, *set, 0, 0, NULL);
+}
+
+/* Sets the result columns of the statement, or, if another SELECT of the
+ * statement has already set them, checks that there are as many of them
+ * (the names are those of the first SELECT) */
+static int codegen_compound_columns(codegen_t *cg, SRA_Project_t *project, bool first)
+{
+    int err;
+    chidb_stmt *stmt = cg->stmt;
+    char **cols = stmt->cols, **drop;
+    uint32_t n = stmt->nCols, ndrop;
+    bool same;
+
+    check_fail(codegen_result_columns(cg, project));
+    if(cols == NULL)
+        return CHIDB_OK;
+
+    same = stmt->nCols == n;
+    if(first)
+    {
+        drop = cols;
+        ndrop = n;
+    }
+    else
+    {
+        drop = stmt->cols;
+        ndrop = stmt->nCols;
+        stmt->cols = cols;
+        stmt->nCols = n;
+    }
+    for(uint32_t i = 0; i < ndrop; i++)
+        free(drop[i]);
+    free(drop);
+
+    return same ? CHIDB_OK : CHIDB_EINVALIDSQL;
+}
+
+/* Generates the loops of a single SELECT, whose result rows go through
+ * the checks in cg (see codegen_compound). first is false if it isn't
+ * the first SELECT of a UNION, INTERSECT or EXCEPT */
+static int codegen_query(codegen_t *cg, SRA_Project_t *project, bool first)
+{
+    int err;
+    int32_t rr, r, end, set;
+    int level, nChecks = cg->nChecks;
+    char order[32], funcs[DBRECORD_MAX_FIELDS + 1];
+
+    /* The state of the previous SELECT, if any */
+    codegen_free_conds(cg);
+    cg->nTables = 0;
+    cg->sorter = cg->agg = -1;
+    cg->roffset = cg->rlimit = -1;
+    cg->nKeys = cg->nGroup = cg->nAggs = 0;
+    cg->stream = false;
+
+    check_fail(codegen_from(cg, project->sra));
+
+    /* A condition can only use the tables read in its loop and the
+     * loops around it */
+    for(int i = 0; i < cg->nConds; i++)
+    {
+        check_fail(codegen_cond_level(cg, cg->conds[i].cond, &level));
+        if(level > cg->conds[i].level)
+            return CHIDB_EINVALIDSQL;
+    }
+
+    codegen_plan(cg, project);
+    codegen_plan_min_max(cg, project);
+    codegen_plan_batch(cg, project);
+    for(int i = 0; i < cg->nTables; i++)
+    {
+        codegen_table_t *t = &cg->tables[i];
+        t->covered = t->index != NULL && codegen_covers(t, t->index);
+    }
+
+    /* The record added to the aggregator is made from the group key and
+     * the arguments of the aggregate functions, in that order */
+    cg->nGroup = project->group_by != NULL;
+    for(Expression_t *expr = project->expr_list; expr != NULL; expr = expr->next)
+    {
+        if(!codegen_is_agg(expr))
+            continue;
+        if(cg->nGroup + cg->nAggs == DBRECORD_MAX_FIELDS)
+            return CHIDB_EINVALIDSQL;
+        funcs[cg->nAggs++] = codegen_agg_funcs[expr->expr.term.f.t];
+    }
+    funcs[cg->nAggs] = '\0';
+    if(cg->nGroup + cg->nAggs > 0)
+    {
+        cg->agg = cg->nCursors++;
+        cg->ragg = codegen_reg(cg, cg->nGroup + cg->nAggs);
+        cg->stream = codegen_grouped(cg, project);
+    }
+
+    check_fail(codegen_compound_columns(cg, project, first));
+
+    /* The sort key goes right before the result columns, so the record
+     * added to the sorter can be made from both at once */
+    for(Expression_t *expr = codegen_ordered(cg, project) ? NULL : project->order_by; expr != NULL; expr = expr->next)
+    {
+        if(cg->nKeys == sizeof(order) - 1)
+            return CHIDB_EINVALIDSQL;
+        order[cg->nKeys++] = project->asc_desc == ORDER_BY_DESC ? '-' : '+';
+    }
+    order[cg->nKeys] = '\0';
+    if(cg->nKeys > 0)
+        cg->sorter = cg->nCursors++;
+
+    cg->rkey = codegen_reg(cg, cg->nKeys + cg->stmt->nCols);
+    rr = cg->rkey + cg->nKeys;
+
+    for(int i = 0; i < cg->nTables; i++)
+    {
+        codegen_table_t *t = &cg->tables[i];
+
+        /* A table read from an index alone is never opened (unless its
+         * rows with a NULL in the indexed column are read afterwards) */
+        if(!t->covered || t->nulls)
+        {
+            r = codegen_reg(cg, 1);
+            check_fail(codegen_op(cg, Op_Integer, t->schema->root_page, r, 0, NULL));
+            check_fail(codegen_op(cg, Op_OpenRead, t->cursor, r, chidb_schema_ncolumns(t->schema), NULL));
+        }
+        if(t->index != NULL)
+        {
+            r = codegen_reg(cg, 1);
+            check_fail(codegen_op(cg, Op_Integer, t->index->root_page, r, 0, NULL));
+            check_fail(codegen_op(cg, Op_OpenRead, t->index_cursor, r, 0, NULL));
+        }
+    }
+
+    check_fail(codegen_label(cg, &cg->done));
+    if(project->limit >= 0)
+    {
+        cg->rlimit = codegen_reg(cg, 1);
+        check_fail(codegen_op(cg, Op_Integer, project->limit, cg->rlimit, 0, NULL));
+        if(project->offset > 0)
+        {
+            cg->roffset = codegen_reg(cg, 1);
+            check_fail(codegen_op(cg, Op_Integer, project->offset, cg->roffset, 0, NULL));
+        }
+        if(project->limit == 0)
+            check_fail(codegen_jump(cg, Op_Goto, 0, cg->done, 0));
+    }
+
+    for(int i = 0; i < cg->nTables; i++)
+        if(cg->tables[i].access == ACCESS_HASH)
+            check_fail(codegen_hash_build(cg, i));
+
+    if(cg->sorter >= 0)
+        check_fail(codegen_op(cg, Op_SorterOpen, cg->sorter, 0,
+                              project->limit > 0 && project->limit <= INT32_MAX - project->offset ?
+                              project->limit + project->offset : 0,
+                              order));
+    if(cg->agg >= 0)
+        check_fail(codegen_op(cg, Op_AggOpen, cg->agg, 0, cg->nGroup, funcs));
+
+    /* With DISTINCT, the rows are checked against a set of their own
+     * before any other check */
+    if(project->distinct)
+    {
+        check_fail(codegen_set_open(cg, &set));
+        check_fail(codegen_add_check(cg, set, false));
+    }
+
+    check_fail(codegen_label(cg, &end));
+    check_fail(codegen_loop(cg, 0, end, project, rr));
+    codegen_bind(cg, end);
+
+    if(cg->agg >= 0)
+        check_fail(codegen_aggregated(cg, project, rr));
+    if(cg->sorter >= 0)
+        check_fail(codegen_sorted(cg, rr));
+    codegen_bind(cg, cg->done);
+
+    cg->nChecks = nChecks;
+    return CHIDB_OK;
+}
+
+/* Generates a UNION, INTERSECT or EXCEPT (or a single SELECT) as each of
+ * its SELECTs in turn, with their result rows going through sets:
+ *
+ *   - A UNION B       The rows of A and then B are produced if they are
+ *                     not in set S yet (and are added to it)
+ *   - A EXCEPT B      The rows of B are added to set S, without being
+ *                     produced. Then the rows of A are produced if they
+ *                     are not in S yet (and are added to it)
+ *   - A INTERSECT B   The rows of B are added to set S. Then the rows of
+ *                     A are produced if they are in S, and not in set T
+ *                     yet (and are added to it)
+ *
+ * A and B may be set operations themselves, so each row goes through the
+ * checks of the set operations it is part of, the innermost first. The
+ * rows a SELECT adds to a set are checked against the sets of the set
+ * operations inside the same side only.
+ *
+ * ORDER BY and LIMIT apply to a single SELECT, so they can't be used in a
+ * set operation.
+ */
+static int codegen_compound(codegen_t *cg, SRA_t *sra, bool first)
+{
+    int err;
+    int nChecks = cg->nChecks, firstCheck = cg->firstCheck;
+    int32_t fill = cg->fill, set, dedup;
+
+    if(sra->t == SRA_PROJECT)
+        return codegen_query(cg, &sra->project, first);
+
+    if(sra->t != SRA_UNION && sra->t != SRA_INTERSECT && sra->t != SRA_EXCEPT)
+        return CHIDB_EINVALIDSQL;
+
+    for(int i = 0; i < 2; i++)
+    {
+        SRA_t *side = i == 0 ? sra->binary.sra1 : sra->binary.sra2;
+        if(side->t == SRA_PROJECT && (side->project.order_by != NULL || side->project.limit >= 0))
+            return CHIDB_EINVALIDSQL;
+    }
+
+    check_fail(codegen_set_open(cg, &set));
+
+    if(sra->t != SRA_UNION)
+    {
+        cg->firstCheck = cg->nChecks;
+        cg->fill = set;
+        check_fail(codegen_compound(cg, sra->binary.sra2, false));
+        cg->firstCheck = firstCheck;
+        cg->fill = fill;
+    }
+
+    if(sra->t == SRA_INTERSECT)
+    {
+        check_fail(codegen_set_open(cg, &dedup));
+        check_fail(codegen_add_check(cg, dedup, false));
+        check_fail(codegen_add_check(cg, set, true));
+    }
+    else
+        check_fail(codegen_add_check(cg, set, false));
+
+    check_fail(codegen_compound(cg, sra->binary.sra1, first));
+    if(sra->t == SRA_UNION)
+        check_fail(codegen_compound(cg, sra->binary.sra2, false));
+
+    cg->nChecks = nChecks;
+    return CHIDB_OK;
+}
+
+static int codegen_select(codegen_t *cg, SRA_t *sra)
+{
+    int err;
+
+    check_fail(codegen_compound(cg, sra, true));
+
+    for(int i = 0; i < cg->nCursors; i++)
+        check_fail(codegen_op(cg, Op_Close, i, 0, 0, NULL));
+
+    return codegen_op(cg, Op_Halt, 0, 0, 0, NULL);
+}
+
+
+/*** INSERT ***/
+
+/* Can a literal be stored in a column? */
+static bool codegen_type_matches(Column_t *col, Literal_t *val)
+{
+    switch(col->type)
+    {
+    case TYPE_INT:
+        return val->t == TYPE_INT;
+    case TYPE_DOUBLE:
+        return val->t == TYPE_INT || val->t == TYPE_DOUBLE;
+    default:
+        return val->t == TYPE_CHAR || val->t == TYPE_TEXT;
+    }
+}
+
+/* If index is an index on table, returns the indexed column, unless the
+ * row being inserted has no value for it (rows with a NULL in the indexed
+ * column are not indexed). Otherwise, returns -1 */
+static int codegen_indexed_column(chidb_schema_item_t *table, chidb_schema_item_t *index, Literal_t **vals)
+{
+    int c, pkey = chidb_schema_pkey(table);
+
+    if(strcmp(index->type, "index") || strcasecmp(index->table_name, table->name))
+        return -1;
+
+    c = chidb_schema_column(table, index->stmt->stmt.create->index->column_name, NULL);
+    if(c < 0 || (c != pkey && vals[c] == NULL))
+        return -1;
+
+    return c;
+}
+
+/* Generates the code that adds the row being inserted to a covering
+ * index, whose entries also store a record of the included columns:
+ * IdxInsertRecord takes the key of the row followed by the record */
+static int codegen_insert_covering(codegen_t *cg, chidb_schema_item_t *table, chidb_schema_item_t *index,
+                                   int32_t cursor, int32_t rval, int32_t rvals, int32_t rkey)
+{
+    int err;
+    int ninc = chidb_schema_nincluded(index), pkey = chidb_schema_pkey(table), i = 0;
+    int32_t r = codegen_reg(cg, 2 + ninc);
+
+    check_fail(codegen_op(cg, Op_SCopy, rkey, r, 0, NULL));
+    for(StrList_t *inc = index->stmt->stmt.create->index->include; inc != NULL; inc = inc->next, i++)
+    {
+        int c = chidb_schema_column(table, inc->str, NULL);
+        check_fail(codegen_op(cg, Op_SCopy, c == pkey ? rkey : rvals + c, r + 2 + i, 0, NULL));
+    }
+    check_fail(codegen_op(cg, Op_MakeRecord, r + 2, ninc, r + 1, NULL));
+
+    return codegen_op(cg, Op_IdxInsertRecord, cursor, rval, r, NULL);
+}
+
+static int codegen_insert(codegen_t *cg, Insert_t *insert)
+{
+    int err;
+    chidb_schema_item_t *table = chidb_schema_table(cg->db, insert->table_name);
+    Literal_t **vals;
+    Literal_t *val;
+    StrList_t *name;
+    Column_t *col;
+    int ncols, pkey, i;
+    int32_t rroot, rvals, rrecord, rkey, r, have_key = -1, mismatch = -1;
+    bool params = false;
+
+    if(table == NULL)
+        return CHIDB_EINVALIDSQL;
+
+    ncols = chidb_schema_ncolumns(table);
+    pkey = chidb_schema_pkey(table);
+
+    /* Value of each column (NULL if it is not given one) */
+    vals = calloc(ncols, sizeof(Literal_t *));
+    if(vals == NULL)
+        return CHIDB_ENOMEM;
+
+    for(val = insert->values, name = insert->col_names, i = 0;
+        val != NULL;
+        val = val->next, i++)
+    {
+        int c = i;
+
+        if(insert->col_names != NULL)
+        {
+            c = name != NULL ? chidb_schema_column(table, name->str, NULL) : -1;
+            name = name != NULL ? name->next : NULL;
+        }
+        if(c < 0 || c >= ncols)
+        {
+            free(vals);
+            return CHIDB_EINVALIDSQL;
+        }
+        vals[c] = val;
+    }
+
+    if((insert->col_names == NULL && i != ncols) || name != NULL)
+    {
+        free(vals);
+        return CHIDB_EINVALIDSQL;
+    }
+
+    for(col = table->stmt->stmt.create->table->columns, i = 0; col != NULL; col = col->next, i++)
+    {
+        /* The values of parameters are only checked when they are keys
+         * (see below) */
+        if(vals[i] != NULL && vals[i]->param)
+            params = true;
+        else if(vals[i] != NULL && (!codegen_type_matches(col, vals[i]) || (i == pkey && (vals[i]->val.ival < 0 || vals[i]->val.ival > INT32_MAX))))
+        {
+            free(vals);
+            return CHIDB_EMISMATCH;
+        }
+    }
+
+    rroot = codegen_reg(cg, 1);
+    rvals = codegen_reg(cg, ncols);
+    rrecord = codegen_reg(cg, 1);
+    rkey = codegen_reg(cg, 1);
+    cg->nCursors = 1;
+
+    err = codegen_label(cg, &mismatch);
+    if(err == CHIDB_OK)
+        err = codegen_label(cg, &have_key);
+    if(err == CHIDB_OK)
+        err = codegen_op(cg, Op_Integer, table->root_page, rroot, 0, NULL);
+    if(err == CHIDB_OK)
+        err = codegen_op(cg, Op_OpenWrite, 0, rroot, ncols, NULL);
+
+    /* The INTEGER PRIMARY KEY is the key of the row, and is stored as NULL */
+    for(i = 0; i < ncols && err == CHIDB_OK; i++)
+    {
+        if(i == pkey || vals[i] == NULL)
+            err = codegen_op(cg, Op_Null, 0, rvals + i, 0, NULL);
+        else
+            err = codegen_literal(cg, vals[i], false, rvals + i);
+    }
+
+    if(err == CHIDB_OK)
+    {
+        /* A NULL parameter gets a new key, like a missing value */
+        if(pkey >= 0 && vals[pkey] != NULL && vals[pkey]->param)
+        {
+            int32_t new_key = -1;
+
+            err = codegen_label(cg, &new_key);
+            if(err == CHIDB_OK)
+                err = codegen_literal(cg, vals[pkey], false, rkey);
+            if(err == CHIDB_OK)
+                err = codegen_jump(cg, Op_IsNull, rkey, new_key, 0);
+            if(err == CHIDB_OK)
+                err = codegen_jump(cg, Op_MustBeKey, rkey, mismatch, 0);
+            if(err == CHIDB_OK)
+                err = codegen_jump(cg, Op_Goto, 0, have_key, 0);
+            codegen_bind(cg, new_key);
+        }
+        else if(pkey >= 0 && vals[pkey] != NULL)
+            err = codegen_op(cg, Op_Integer, vals[pkey]->val.ival, rkey, 0, NULL);
+        if(err == CHIDB_OK && (pkey < 0 || vals[pkey] == NULL || vals[pkey]->param))
+            err = codegen_op(cg, Op_NewRowid, 0, rkey, 0, NULL);
+        codegen_bind(cg, have_key);
+    }
+    if(err == CHIDB_OK)
+        err = codegen_op(cg, Op_MakeRecord, rvals, ncols, rrecord, NULL);
+    /* An index can't have two entries with the same value, so the
+     * table's indexes are checked before the row is inserted anywhere */
+    for(i = 0; i < list_size(&cg->db->schema) && err == CHIDB_OK; i++)
+    {
+        chidb_schema_item_t *index = list_get_at(&cg->db->schema, i);
+        int c = codegen_indexed_column(table, index, vals);
+        int32_t unique = -1;
+
+        if(c < 0)
+            continue;
+
+        /* Index keys are 32-bit integers */
+        if(c != pkey && !vals[c]->param && vals[c]->t == TYPE_INT && !codegen_is_int32(vals[c]->val.ival))
+        {
+            err = CHIDB_EMISMATCH;
+            break;
+        }
+
+        r = codegen_reg(cg, 1);
+        err = codegen_op(cg, Op_Integer, index->root_page, r, 0, NULL);
+        if(err == CHIDB_OK)
+            err = codegen_op(cg, Op_OpenWrite, cg->nCursors, r, 0, NULL);
+        if(err == CHIDB_OK)
+            err = codegen_label(cg, &unique);
+        /* A NULL parameter isn't indexed, like a missing value */
+        if(err == CHIDB_OK && c != pkey && vals[c]->param)
+            err = codegen_jump(cg, Op_IsNull, rvals + c, unique, 0);
+        if(err == CHIDB_OK && c != pkey && vals[c]->param)
+            err = codegen_jump(cg, Op_MustBeKey, rvals + c, mismatch, 0);
+        if(err == CHIDB_OK)
+            err = codegen_jump(cg, Op_Seek, cg->nCursors, unique, c == pkey ? rkey : rvals + c);
+        if(err == CHIDB_OK)
+            err = codegen_op(cg, Op_Halt, CHIDB_ECONSTRAINT, 0, 0, NULL);
+        codegen_bind(cg, unique);
+        cg->nCursors++;
+    }
+
+    if(err == CHIDB_OK)
+        err = codegen_op(cg, Op_Insert, 0, rrecord, rkey, NULL);
+
+    /* Add the row to the indexes (in the same order as above, so index
+     * cursors are numbered from 1) */
+    for(i = 0, r = 1; i < list_size(&cg->db->schema) && err == CHIDB_OK; i++)
+    {
+        chidb_schema_item_t *index = list_get_at(&cg->db->schema, i);
+        int c = codegen_indexed_column(table, index, vals);
+        int32_t skip = -1;
+
+        if(c < 0)
+            continue;
+
+        err = codegen_label(cg, &skip);
+        if(err == CHIDB_OK && c != pkey && vals[c]->param)
+            err = codegen_jump(cg, Op_IsNull, rvals + c, skip, 0);
+        if(err == CHIDB_OK && chidb_schema_nincluded(index) > 0)
+            err = codegen_insert_covering(cg, table, index, r, c == pkey ? rkey : rvals + c, rvals, rkey);
+        else if(err == CHIDB_OK)
+            err = codegen_op(cg, Op_IdxInsert, r, c == pkey ? rkey : rvals + c, rkey, NULL);
+        codegen_bind(cg, skip);
+        r++;
+    }
+
+    free(vals);
+    check_fail(err);
+
+    for(i = 0; i < cg->nCursors; i++)
+        check_fail(codegen_op(cg, Op_Close, i, 0, 0, NULL));
+
+    check_fail(codegen_op(cg, Op_Halt, 0, 0, 0, NULL));
+
+    /* Reached when a parameter used as a key isn't an integer */
+    if(params)
+    {
+        codegen_bind(cg, mismatch);
+        check_fail(codegen_op(cg, Op_Halt, CHIDB_EMISMATCH, 0, 0, NULL));
+    }
+
+    return CHIDB_OK;
+}
+
+
+/*** CREATE ***/
+
+/* Generates the code that creates a table or an index, and adds it to
+ * the schema table. Leaves cursors 0..nCursors-1 open, and the root page
+ * of the new B-Tree in register *root */
+static int codegen_create_entry(codegen_t *cg, chisql_statement_t *sql_stmt, int32_t *root)
 {
-    int opnum = 0;
-    int nOps;
+    int err;
+    Create_t *create = sql_stmt->stmt.create;
+    const char *name, *table_name;
+    chidb_schema_item_t *table = NULL;
+    Column_t *col;
+    int column = -1, ninc = 0;
+    int32_t r;
+    char *sql;
+    size_t len;
 
-    /* Manually load a program that just produces five result rows, with
-     * three columns: an integer identifier, the SQL query (text), and NULL. */
+    if(create->t == CREATE_TABLE)
+        name = table_name = create->table->name;
+    else
+    {
+        name = create->index->name;
+        table_name = create->index->table_name;
+        table = chidb_schema_table(cg->db, table_name);
+        if(table == NULL)
+            return CHIDB_EINVALIDSQL;
+        column = chidb_schema_column(table, create->index->column_name, &col);
+        if(column < 0)
+            return CHIDB_EINVALIDSQL;
+        /* Index keys are integers */
+        if(col->type != TYPE_INT)
+            return CHIDB_EMISMATCH;
+        /* Included columns are stored in a record */
+        for(StrList_t *inc = create->index->include; inc != NULL; inc = inc->next, ninc++)
+            if(chidb_schema_column(table, inc->str, NULL) < 0 || ninc == DBRECORD_MAX_FIELDS)
+                return CHIDB_EINVALIDSQL;
+    }
 
-    stmt->nCols = 3;
-    stmt->cols = malloc(sizeof(char *) * stmt->nCols);
-    stmt->cols[0] = strdup("id");
-    stmt->cols[1] = strdup("sql");
-    stmt->cols[2] = strdup("null");
+    /* Tables and indexes share the same namespace */
+    for(int i = 0; i < list_size(&cg->db->schema); i++)
+        if(!strcasecmp(((chidb_schema_item_t *) list_get_at(&cg->db->schema, i))->name, name))
+            return CHIDB_EINVALIDSQL;
 
-    chidb_dbm_op_t ops[] = {
-            {Op_Integer, 1, 0, 0, NULL},
-            {Op_String, strlen(sql_stmt->text), 1, 0, sql_stmt->text},
-            {Op_Null, 0, 2, 0, NULL},
-            {Op_ResultRow, 0, 3, 0, NULL},
-            {Op_Integer, 2, 0, 0, NULL},
-            {Op_ResultRow, 0, 3, 0, NULL},
-            {Op_Integer, 3, 0, 0, NULL},
-            {Op_ResultRow, 0, 3, 0, NULL},
-            {Op_Integer, 4, 0, 0, NULL},
-            {Op_ResultRow, 0, 3, 0, NULL},
-            {Op_Integer, 5, 0, 0, NULL},
-            {Op_ResultRow, 0, 3, 0, NULL},
-            {Op_Halt, 0, 0, 0, NULL},
-    };
+    /* The statement is stored in the schema table without its semicolon */
+    len = strlen(sql_stmt->text);
+    while(len > 0 && (sql_stmt->text[len - 1] == ';' || sql_stmt->text[len - 1] == ' '))
+        len--;
+    sql = strndup(sql_stmt->text, len);
+    if(sql == NULL)
+        return CHIDB_ENOMEM;
 
-    nOps = sizeof(ops) / sizeof(chidb_dbm_op_t);
+    /* Registers r..r+7: schema table root, the five fields of the schema
+     * record, the record, and its key */
+    r = codegen_reg(cg, 8);
+    cg->nCursors = 1;
 
-    for(int i=0; i < nOps; i++)
-        chidb_stmt_set_op(stmt, &ops[i], opnum++);
+    err = codegen_op(cg, Op_Integer, 1, r, 0, NULL);
+    if(err == CHIDB_OK)
+        err = codegen_op(cg, Op_OpenWrite, 0, r, 5, NULL);
+    if(err == CHIDB_OK)
+        err = codegen_op(cg, create->t == CREATE_TABLE ? Op_CreateTable : Op_CreateIndex, r + 4, 0, 0, NULL);
+    if(err == CHIDB_OK)
+        err = codegen_op(cg, Op_String, 5, r + 1, 0, create->t == CREATE_TABLE ? "table" : "index");
+    if(err == CHIDB_OK)
+        err = codegen_op(cg, Op_String, strlen(name), r + 2, 0, (char *) name);
+    if(err == CHIDB_OK)
+        err = codegen_op(cg, Op_String, strlen(table_name), r + 3, 0, (char *) table_name);
+    if(err == CHIDB_OK)
+        err = codegen_op(cg, Op_String, len, r + 5, 0, sql);
+    free(sql);
+    check_fail(err);
+
+    if(create->t == CREATE_INDEX)
+    {
+        /* Add the rows that are already in the table to the index, which
+         * IdxBuild does in bulk. p4 lists the included columns (with -1
+         * for the table's key). This is done before the index is added
+         * to the schema table, so it isn't if the build fails */
+        int32_t rtable = codegen_reg(cg, 1);
+        int pkey = chidb_schema_pkey(table);
+        char *included = NULL;
+
+        if(ninc > 0)
+        {
+            /* Room for a space and any int per column */
+            char *p = included = malloc(ninc * 12 + 1);
+            if(included == NULL)
+                return CHIDB_ENOMEM;
+            *p = '\0';
+            for(StrList_t *inc = create->index->include; inc != NULL; inc = inc->next)
+            {
+                int c = chidb_schema_column(table, inc->str, NULL);
+                p += sprintf(p, p == included ? "%d" : " %d", c == pkey ? -1 : c);
+            }
+        }
+
+        cg->nCursors = 3;
+        err = codegen_op(cg, Op_Integer, table->root_page, rtable, 0, NULL);
+        if(err == CHIDB_OK)
+            err = codegen_op(cg, Op_OpenRead, 1, rtable, chidb_schema_ncolumns(table), NULL);
+        if(err == CHIDB_OK)
+            err = codegen_op(cg, Op_OpenWrite, 2, r + 4, 0, NULL);
+        if(err == CHIDB_OK)
+            err = codegen_op(cg, Op_IdxBuild, 1, 2, column == pkey ? -1 : column, included);
+        free(included);
+        check_fail(err);
+    }
+
+    check_fail(codegen_op(cg, Op_MakeRecord, r + 1, 5, r + 6, NULL));
+    check_fail(codegen_op(cg, Op_NewRowid, 0, r + 7, 0, NULL));
+    check_fail(codegen_op(cg, Op_Insert, 0, r + 6, r + 7, NULL));
+    *root = r + 4;
 
     return CHIDB_OK;
+}
+
+static int codegen_create(codegen_t *cg, chisql_statement_t *sql_stmt)
+{
+    int err;
+    int32_t root;
+
+    check_fail(codegen_create_entry(cg, sql_stmt, &root));
+
+    for(int i = 0; i < cg->nCursors; i++)
+        check_fail(codegen_op(cg, Op_Close, i, 0, 0, NULL));
+
+    return codegen_op(cg, Op_Halt, 0, 0, 0, NULL);
+}
+
+
+/*** ANALYZE ***/
+
+/* Generates the code that adds the statistics of a table or index to
+ * the statistics table (open in cursor 0). Uses cursor 1, and registers
+ * r..r+5 */
+static int codegen_analyze_item(codegen_t *cg, chidb_schema_item_t *item, int32_t r)
+{
+    int err;
+    bool index = strcmp(item->type, "table");
+
+    check_fail(codegen_op(cg, Op_Integer, item->root_page, r, 0, NULL));
+    check_fail(codegen_op(cg, Op_OpenRead, 1, r, 0, NULL));
+    check_fail(codegen_op(cg, Op_Analyze, 1, r + 3, 0, NULL));
+    check_fail(codegen_op(cg, Op_Close, 1, 0, 0, NULL));
+    check_fail(codegen_op(cg, Op_String, strlen(item->table_name), r + 1, 0, item->table_name));
+    if(index)
+        check_fail(codegen_op(cg, Op_String, strlen(item->name), r + 2, 0, item->name));
+    else
+        check_fail(codegen_op(cg, Op_Null, 0, r + 2, 0, NULL));
+    check_fail(codegen_op(cg, Op_MakeRecord, r + 1, 3, r + 4, NULL));
+    check_fail(codegen_op(cg, Op_NewRowid, 0, r + 5, 0, NULL));
 
+    return codegen_op(cg, Op_Insert, 0, r + 4, r + 5, NULL);
 }
 
+/* ANALYZE reads every table (or just the given one) and its indexes,
+ * and adds their statistics to the statistics table. The table is
+ * created the first time ANALYZE runs */
+static int codegen_analyze(codegen_t *cg, chisql_statement_t *sql_stmt)
+{
+    int err;
+    const char *name = sql_stmt->stmt.analyze;
+    chidb_schema_item_t *stats = chidb_schema_table(cg->db, CHIDB_STATS_TABLE);
+    chisql_statement_t *create;
+    int32_t root, r;
+
+    if(name != NULL && (chidb_schema_table(cg->db, name) == NULL || !strcasecmp(name, CHIDB_STATS_TABLE)))
+        return CHIDB_EINVALIDSQL;
+
+    if(stats == NULL)
+    {
+        if(chisql_parser(CHIDB_STATS_SQL, &create) != CHIDB_OK)
+            return CHIDB_ENOMEM;
+        err = codegen_create_entry(cg, create, &root);
+        Create_free(create->stmt.create);
+        free(create->text);
+        free(create);
+        check_fail(err);
+
+        for(int i = 0; i < cg->nCursors; i++)
+            check_fail(codegen_op(cg, Op_Close, i, 0, 0, NULL));
+    }
+    else
+    {
+        root = codegen_reg(cg, 1);
+        check_fail(codegen_op(cg, Op_Integer, stats->root_page, root, 0, NULL));
+    }
+
+    if(cg->nCursors < 2)
+        cg->nCursors = 2;
+    r = codegen_reg(cg, 6);
+    check_fail(codegen_op(cg, Op_OpenWrite, 0, root, 3, NULL));
+
+    for(int i = 0; i < list_size(&cg->db->schema); i++)
+    {
+        chidb_schema_item_t *item = list_get_at(&cg->db->schema, i);
+
+        if(!strcasecmp(item->table_name, CHIDB_STATS_TABLE) ||
+           (name != NULL && strcasecmp(item->table_name, name)))
+            continue;
+        check_fail(codegen_analyze_item(cg, item, r));
+    }
+
+    /* Statements have to be compiled again to use the new statistics */
+    check_fail(codegen_op(cg, Op_IncrCookie, 0, 0, 0, NULL));
+    check_fail(codegen_op(cg, Op_Close, 0, 0, 0, NULL));
+
+    return codegen_op(cg, Op_Halt, 0, 0, 0, NULL);
+}
+
+
+/*** BEGIN, COMMIT and ROLLBACK ***/
+
+static int codegen_transaction(codegen_t *cg, chisql_statement_t *sql_stmt)
+{
+    int err;
+
+    check_fail(codegen_op(cg, Op_AutoCommit, sql_stmt->type != STMT_BEGIN,
+                          sql_stmt->type == STMT_ROLLBACK, 0, NULL));
+
+    return codegen_op(cg, Op_Halt, 0, 0, 0, NULL);
+}
+
+
+/* Generate a DBM program from a SQL statement
+ *
+ * Parameters
+ * - stmt: DBM to load the program into
+ * - sql_stmt: Parsed (and optimized) SQL statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: The statement refers to tables or columns that
+ *   don't exist, or uses a feature that isn't supported
+ * - CHIDB_EMISMATCH: A value doesn't match the type of its column
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The database schema could not be read
+ */
+int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
+{
+    codegen_t cg;
+    int rc;
+
+    memset(&cg, 0, sizeof(codegen_t));
+    cg.stmt = stmt;
+    cg.db = stmt->db;
+    cg.sorter = -1;
+    cg.agg = -1;
+    cg.roffset = -1;
+    cg.rlimit = -1;
+    cg.fill = -1;
+
+    /* The schema may have changed since the last statement was prepared */
+    if((rc = chidb_schema_load(stmt->db)) != CHIDB_OK)
+        return rc;
+
+    if((rc = chidb_stmt_set_vars(stmt, sql_stmt->nParams, sql_stmt->params)) != CHIDB_OK)
+        return rc;
+
+    switch(sql_stmt->type)
+    {
+    case STMT_SELECT:
+        rc = codegen_select(&cg, sql_stmt->stmt.select);
+        break;
+    case STMT_INSERT:
+        rc = codegen_insert(&cg, sql_stmt->stmt.insert);
+        break;
+    case STMT_CREATE:
+        /* The statement is stored in the schema table as it is */
+        rc = sql_stmt->nParams > 0 ? CHIDB_EINVALIDSQL : codegen_create(&cg, sql_stmt);
+        break;
+    case STMT_ANALYZE:
+        rc = codegen_analyze(&cg, sql_stmt);
+        break;
+    case STMT_BEGIN:
+    case STMT_COMMIT:
+    case STMT_ROLLBACK:
+        rc = codegen_transaction(&cg, sql_stmt);
+        break;
+    default:
+        rc = CHIDB_EINVALIDSQL;
+        break;
+    }
+
+    if(rc == CHIDB_OK)
+        rc = codegen_finish(&cg);
+
+    codegen_free(&cg);
+
+    return rc;
+}
@@ -0,0 +1,861 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine aggregators
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dbm-agg.h"
+
+/* Bytes taken by a group, including its accumulators and padding */
+#define GROUP_SIZE(agg, klen) ((sizeof(chidb_dbm_agg_group_t) + sizeof(chidb_dbm_agg_acc_t) * (agg)->nfuncs + \
+                                (klen) + 7) & ~(size_t) 7)
+
+#define GROUP(agg, offset) ((chidb_dbm_agg_group_t *) ((agg)->data + (offset)))
+#define GROUP_ACC(g) ((chidb_dbm_agg_acc_t *) ((g) + 1))
+#define GROUP_KEY(agg, g) ((uint8_t *) (GROUP_ACC(g) + (agg)->nfuncs))
+
+/* File a row is written to if its group doesn't fit in the table (the
+ * top bits of its hash; the table's slots use the bottom ones) */
+#define PARTITION(hash) ((hash) >> 28)
+
+#define INITIAL_SLOTS (64)
+
+
+/*** GROUP KEYS ***/
+
+/* Encodes the group key of a record (its first nkeys columns) into
+ * agg->key: each value as its register type, followed (unless it's NULL)
+ * by its length and its bytes. Integers are encoded the same way whatever
+ * their size, so two keys are equal if their encodings are. Strings are
+ * followed by a null byte, so they can be read from the encoding as they
+ * are.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The record is corrupt
+ */
+static int chidb_dbm_agg_encode(chidb_dbm_agg_t *agg, DBRecordView *view, uint32_t *klen)
+{
+    chidb_dbm_register_t v;
+    uint32_t len = 0;
+    int rc;
+
+    for(uint32_t i = 0; i < agg->nkeys; i++)
+    {
+        const void *bytes = NULL;
+        int64_t i64;
+        uint32_t n = 0, need;
+
+        if((rc = chidb_dbm_record_value(view, i, &v)) != CHIDB_OK)
+            return rc;
+
+        switch(v.type)
+        {
+        case REG_INT32:
+            i64 = v.value.i;
+            bytes = &i64;
+            n = sizeof(int64_t);
+            break;
+        case REG_INT64:
+            bytes = &v.value.i64;
+            n = sizeof(int64_t);
+            break;
+        case REG_DOUBLE:
+            bytes = &v.value.d;
+            n = sizeof(double);
+            break;
+        case REG_STRING:
+            bytes = v.value.s;
+            n = v.slen + 1;
+            break;
+        case REG_BINARY:
+            bytes = v.value.bin.bytes;
+            n = v.value.bin.nbytes;
+            break;
+        default:
+            break;
+        }
+
+        need = len + 1 + (v.type != REG_NULL ? sizeof(uint32_t) + n : 0);
+        if(need > agg->ksize)
+        {
+            uint32_t size = agg->ksize * 2 > need ? agg->ksize * 2 : need;
+            uint8_t *key = realloc(agg->key, size);
+
+            if(key == NULL)
+                return CHIDB_ENOMEM;
+            agg->key = key;
+            agg->ksize = size;
+        }
+
+        agg->key[len++] = (uint8_t) (v.type == REG_INT32 ? REG_INT64 : v.type);
+        if(v.type == REG_NULL)
+            continue;
+
+        memcpy(agg->key + len, &n, sizeof(uint32_t));
+        len += sizeof(uint32_t);
+        if(v.type == REG_STRING)
+        {
+            memcpy(agg->key + len, bytes, n - 1);
+            agg->key[len + n - 1] = '\0';
+        }
+        else
+            memcpy(agg->key + len, bytes, n);
+        len += n;
+    }
+
+    *klen = len;
+    return CHIDB_OK;
+}
+
+/* FNV-1a, with a different starting point at each level, and its bits
+ * mixed at the end so that the top ones depend on the whole key */
+static uint32_t chidb_dbm_agg_hash(const uint8_t *bytes, uint32_t len, uint32_t level)
+{
+    uint32_t h = 2166136261u ^ (level * 0x9e3779b9u);
+
+    for(uint32_t i = 0; i < len; i++)
+    {
+        h ^= bytes[i];
+        h *= 16777619u;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+
+    return h;
+}
+
+/* Adds a value to a record being built (integers with the smallest type
+ * that can hold them, like MakeRecord) */
+static int chidb_dbm_agg_append(DBRecordBuffer *dbrb, chidb_dbm_register_t *v)
+{
+    int64_t i;
+
+    switch(v->type)
+    {
+    case REG_INT32:
+    case REG_INT64:
+        i = v->type == REG_INT32 ? v->value.i : v->value.i64;
+        if(i >= INT8_MIN && i <= INT8_MAX)
+            return chidb_DBRecord_appendInt8(dbrb, i);
+        else if(i >= INT16_MIN && i <= INT16_MAX)
+            return chidb_DBRecord_appendInt16(dbrb, i);
+        else if(i >= INT32_MIN && i <= INT32_MAX)
+            return chidb_DBRecord_appendInt32(dbrb, i);
+        return chidb_DBRecord_appendInt64(dbrb, i);
+    case REG_DOUBLE:
+        return chidb_DBRecord_appendDouble(dbrb, v->value.d);
+    case REG_STRING:
+        return chidb_DBRecord_appendString(dbrb, v->value.s);
+    case REG_BINARY:
+        return chidb_DBRecord_appendBlob(dbrb, v->value.bin.bytes, v->value.bin.nbytes);
+    default:
+        return chidb_DBRecord_appendNull(dbrb);
+    }
+}
+
+
+/*** THE TABLE ***/
+
+static inline size_t chidb_dbm_agg_memory(chidb_dbm_agg_t *agg)
+{
+    return agg->used + sizeof(uint32_t) * agg->nslots + agg->copies;
+}
+
+/* Looks up the group with the key in agg->key. Returns it (NULL if there
+ * is no such group), and the slot it's in (or the empty slot it would be
+ * added to) */
+static chidb_dbm_agg_group_t *chidb_dbm_agg_lookup(chidb_dbm_agg_t *agg, uint32_t hash, uint32_t klen, uint32_t *slot)
+{
+    uint32_t mask = agg->nslots - 1;
+
+    for(*slot = hash & mask; agg->slots[*slot] != 0; *slot = (*slot + 1) & mask)
+    {
+        chidb_dbm_agg_group_t *g = GROUP(agg, agg->slots[*slot] - 1);
+
+        if(g->hash == hash && g->klen == klen && !memcmp(GROUP_KEY(agg, g), agg->key, klen))
+            return g;
+    }
+
+    return NULL;
+}
+
+/* Doubles the number of slots of the table */
+static int chidb_dbm_agg_grow(chidb_dbm_agg_t *agg)
+{
+    uint32_t nslots = agg->nslots * 2, mask = nslots - 1;
+    uint32_t *slots = calloc(nslots, sizeof(uint32_t));
+
+    if(slots == NULL)
+        return CHIDB_ENOMEM;
+
+    for(size_t offset = 0; offset < agg->used; offset += GROUP_SIZE(agg, GROUP(agg, offset)->klen))
+    {
+        uint32_t slot = GROUP(agg, offset)->hash & mask;
+
+        while(slots[slot] != 0)
+            slot = (slot + 1) & mask;
+        slots[slot] = offset + 1;
+    }
+
+    free(agg->slots);
+    agg->slots = slots;
+    agg->nslots = nslots;
+
+    return CHIDB_OK;
+}
+
+/* Adds a group with the key in agg->key to the table, in an empty slot.
+ * If the groups then take up more than the budget, the table is full */
+static int chidb_dbm_agg_add_group(chidb_dbm_agg_t *agg, uint32_t hash, uint32_t klen, uint32_t slot,
+                                   chidb_dbm_agg_group_t **group)
+{
+    size_t need = GROUP_SIZE(agg, klen);
+    chidb_dbm_agg_group_t *g;
+    int rc;
+
+    if(agg->used + need > agg->size)
+    {
+        size_t size = agg->size > 0 ? agg->size : 4096;
+        uint8_t *data;
+
+        while(size < agg->used + need)
+            size *= 2;
+        if((data = realloc(agg->data, size)) == NULL)
+            return CHIDB_ENOMEM;
+        agg->data = data;
+        agg->size = size;
+    }
+
+    g = GROUP(agg, agg->used);
+    g->hash = hash;
+    g->klen = klen;
+    memset(GROUP_ACC(g), 0, sizeof(chidb_dbm_agg_acc_t) * agg->nfuncs);
+    for(uint32_t i = 0; i < agg->nfuncs; i++)
+        GROUP_ACC(g)[i].value.type = REG_NULL;
+    memcpy(GROUP_KEY(agg, g), agg->key, klen);
+
+    agg->slots[slot] = agg->used + 1;
+    agg->used += need;
+    agg->ngroups++;
+
+    if(agg->ngroups * 2 > agg->nslots && (rc = chidb_dbm_agg_grow(agg)) != CHIDB_OK)
+        return rc;
+
+    if(chidb_dbm_agg_memory(agg) > agg->budget)
+        agg->full = true;
+
+    *group = g;
+    return CHIDB_OK;
+}
+
+/* Frees the copy of a value held by a MIN or MAX accumulator */
+static void chidb_dbm_agg_free_value(chidb_dbm_agg_t *agg, chidb_dbm_agg_acc_t *acc)
+{
+    if(acc->value.type == REG_STRING)
+    {
+        agg->copies -= acc->value.slen + 1;
+        free(acc->value.value.s);
+    }
+    else if(acc->value.type == REG_BINARY)
+    {
+        agg->copies -= acc->value.value.bin.nbytes;
+        free(acc->value.value.bin.bytes);
+    }
+    acc->value.type = REG_NULL;
+}
+
+/* Makes a value the one held by a MIN or MAX accumulator (copying it if
+ * it's a string or a BLOB, as records go away) */
+static int chidb_dbm_agg_set_value(chidb_dbm_agg_t *agg, chidb_dbm_agg_acc_t *acc, chidb_dbm_register_t *v)
+{
+    chidb_dbm_register_t copy = *v;
+
+    if(v->type == REG_STRING)
+    {
+        if((copy.value.s = malloc(v->slen + 1)) == NULL)
+            return CHIDB_ENOMEM;
+        memcpy(copy.value.s, v->value.s, v->slen);
+        copy.value.s[v->slen] = '\0';
+        agg->copies += v->slen + 1;
+    }
+    else if(v->type == REG_BINARY)
+    {
+        if((copy.value.bin.bytes = malloc(v->value.bin.nbytes > 0 ? v->value.bin.nbytes : 1)) == NULL)
+            return CHIDB_ENOMEM;
+        memcpy(copy.value.bin.bytes, v->value.bin.bytes, v->value.bin.nbytes);
+        agg->copies += v->value.bin.nbytes;
+    }
+
+    chidb_dbm_agg_free_value(agg, acc);
+    acc->value = copy;
+
+    return CHIDB_OK;
+}
+
+/* Adds the arguments of a row to the accumulators of its group */
+static int chidb_dbm_agg_accumulate(chidb_dbm_agg_t *agg, chidb_dbm_agg_group_t *g, DBRecordView *view)
+{
+    chidb_dbm_register_t v;
+    int rc, c;
+
+    for(uint32_t i = 0; i < agg->nfuncs; i++)
+    {
+        chidb_dbm_agg_acc_t *acc = &GROUP_ACC(g)[i];
+
+        if((rc = chidb_dbm_record_value(view, agg->nkeys + i, &v)) != CHIDB_OK)
+            return rc;
+        if(v.type == REG_NULL)
+            continue;
+        acc->count++;
+
+        switch(agg->funcs[i])
+        {
+        case DBM_AGG_SUM:
+        case DBM_AGG_AVG:
+            if(v.type == REG_INT32 || v.type == REG_INT64)
+            {
+                int64_t n = v.type == REG_INT32 ? v.value.i : v.value.i64;
+                acc->isum += n;
+                acc->dsum += n;
+            }
+            else if(v.type == REG_DOUBLE)
+            {
+                acc->dsum += v.value.d;
+                acc->real = true;
+            }
+            else
+                return CHIDB_EMISMATCH;
+            break;
+
+        case DBM_AGG_MIN:
+        case DBM_AGG_MAX:
+            /* The comparison is the sign of v - value */
+            if(acc->value.type != REG_NULL)
+            {
+                c = chidb_dbm_op_compare_reg(&acc->value, &v);
+                if(c == 0 || (c < 0) != (agg->funcs[i] == DBM_AGG_MIN))
+                    break;
+            }
+            if((rc = chidb_dbm_agg_set_value(agg, acc, &v)) != CHIDB_OK)
+                return rc;
+            break;
+        }
+    }
+
+    return CHIDB_OK;
+}
+
+/* Writes a row whose group isn't in the (full) table to a file */
+static int chidb_dbm_agg_spill(chidb_dbm_agg_t *agg, uint32_t hash, const uint8_t *record, uint32_t rlen)
+{
+    chidb_dbm_agg_file_t *f = &agg->spill[PARTITION(hash)];
+
+    if(f->file == NULL)
+    {
+        if((f->file = tmpfile()) == NULL)
+            return CHIDB_EIO;
+        f->nrows = 0;
+        f->level = agg->level + 1;
+    }
+
+    if(fwrite(&rlen, sizeof(uint32_t), 1, f->file) != 1 ||
+       (rlen > 0 && fwrite(record, rlen, 1, f->file) != 1))
+        return CHIDB_EIO;
+    f->nrows++;
+
+    return CHIDB_OK;
+}
+
+/* Adds a row to its group (adding the group if it isn't in the table
+ * yet, or writing the row to a file if the table is full) */
+static int chidb_dbm_agg_add(chidb_dbm_agg_t *agg, uint8_t *record, uint32_t rlen)
+{
+    DBRecordView view;
+    chidb_dbm_agg_group_t *g;
+    uint32_t klen, hash, slot;
+    int rc;
+
+    chidb_DBRecordView_init(&view, record);
+    if((rc = chidb_dbm_agg_encode(agg, &view, &klen)) != CHIDB_OK)
+        return rc;
+    hash = chidb_dbm_agg_hash(agg->key, klen, agg->level);
+
+    if((g = chidb_dbm_agg_lookup(agg, hash, klen, &slot)) == NULL)
+    {
+        if(agg->full)
+            return chidb_dbm_agg_spill(agg, hash, record, rlen);
+        if((rc = chidb_dbm_agg_add_group(agg, hash, klen, slot, &g)) != CHIDB_OK)
+            return rc;
+    }
+
+    return chidb_dbm_agg_accumulate(agg, g, &view);
+}
+
+/* Empties the table */
+static void chidb_dbm_agg_clear(chidb_dbm_agg_t *agg)
+{
+    for(size_t offset = 0; offset < agg->used; offset += GROUP_SIZE(agg, GROUP(agg, offset)->klen))
+        for(uint32_t i = 0; i < agg->nfuncs; i++)
+            chidb_dbm_agg_free_value(agg, &GROUP_ACC(GROUP(agg, offset))[i]);
+
+    memset(agg->slots, 0, sizeof(uint32_t) * agg->nslots);
+    agg->used = 0;
+    agg->ngroups = 0;
+    agg->copies = 0;
+    agg->full = false;
+}
+
+
+/*** READING THE GROUPS ***/
+
+/* Once all the groups in the table have been read, empties the table and
+ * aggregates the rows of the next file into it (the files written so far
+ * are added to the files still to aggregate first)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: There are no more files
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read or write a file
+ */
+static int chidb_dbm_agg_next_file(chidb_dbm_agg_t *agg)
+{
+    chidb_dbm_agg_file_t f;
+    uint8_t *record = NULL;
+    uint32_t rlen, rsize = 0;
+    int rc = CHIDB_OK;
+
+    for(int i = 0; i < DBM_AGG_PARTITIONS; i++)
+    {
+        chidb_dbm_agg_file_t *pending;
+
+        if(agg->spill[i].file == NULL)
+            continue;
+        if((pending = realloc(agg->pending, sizeof(chidb_dbm_agg_file_t) * (agg->npending + 1))) == NULL)
+            return CHIDB_ENOMEM;
+        agg->pending = pending;
+        agg->pending[agg->npending++] = agg->spill[i];
+        agg->spill[i].file = NULL;
+    }
+
+    if(agg->npending == 0)
+        return CHIDB_ENOTFOUND;
+
+    f = agg->pending[--agg->npending];
+    chidb_dbm_agg_clear(agg);
+    agg->level = f.level;
+    rewind(f.file);
+
+    for(uint32_t i = 0; i < f.nrows && rc == CHIDB_OK; i++)
+    {
+        if(fread(&rlen, sizeof(uint32_t), 1, f.file) != 1)
+        {
+            rc = CHIDB_EIO;
+            break;
+        }
+        if(rlen > rsize)
+        {
+            uint8_t *r = realloc(record, rlen);
+            if(r == NULL)
+            {
+                rc = CHIDB_ENOMEM;
+                break;
+            }
+            record = r;
+            rsize = rlen;
+        }
+        if(rlen > 0 && fread(record, rlen, 1, f.file) != 1)
+            rc = CHIDB_EIO;
+        else
+            rc = chidb_dbm_agg_add(agg, record, rlen);
+    }
+
+    free(record);
+    fclose(f.file);
+    agg->current = 0;
+
+    return rc;
+}
+
+/* Makes the record of the group being read: its group key, followed by
+ * the value of each function */
+static int chidb_dbm_agg_make_row(chidb_dbm_agg_t *agg)
+{
+    chidb_dbm_agg_group_t *g = GROUP(agg, agg->current);
+    uint8_t *p = GROUP_KEY(agg, g);
+    DBRecordBuffer dbrb;
+    DBRecord *dbr;
+    chidb_dbm_register_t v;
+    int rc = CHIDB_OK;
+
+    if(chidb_DBRecord_create_empty(&dbrb, agg->nkeys + agg->nfuncs) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    for(uint32_t i = 0; i < agg->nkeys && rc == CHIDB_OK; i++)
+    {
+        uint32_t n = 0;
+
+        v.type = *p++;
+        if(v.type != REG_NULL)
+        {
+            memcpy(&n, p, sizeof(uint32_t));
+            p += sizeof(uint32_t);
+        }
+
+        switch(v.type)
+        {
+        case REG_INT64:
+            memcpy(&v.value.i64, p, sizeof(int64_t));
+            break;
+        case REG_DOUBLE:
+            memcpy(&v.value.d, p, sizeof(double));
+            break;
+        case REG_STRING:
+            v.value.s = (char *) p;
+            break;
+        case REG_BINARY:
+            v.value.bin.bytes = p;
+            v.value.bin.nbytes = n;
+            break;
+        default:
+            break;
+        }
+        p += n;
+
+        rc = chidb_dbm_agg_append(&dbrb, &v);
+    }
+
+    for(uint32_t i = 0; i < agg->nfuncs && rc == CHIDB_OK; i++)
+    {
+        chidb_dbm_agg_acc_t *acc = &GROUP_ACC(g)[i];
+
+        v.type = REG_NULL;
+        switch(agg->funcs[i])
+        {
+        case DBM_AGG_COUNT:
+            v.type = REG_INT64;
+            v.value.i64 = acc->count;
+            break;
+        case DBM_AGG_SUM:
+            if(acc->count > 0 && acc->real)
+            {
+                v.type = REG_DOUBLE;
+                v.value.d = acc->dsum;
+            }
+            else if(acc->count > 0)
+            {
+                v.type = REG_INT64;
+                v.value.i64 = acc->isum;
+            }
+            break;
+        case DBM_AGG_AVG:
+            if(acc->count > 0)
+            {
+                v.type = REG_DOUBLE;
+                v.value.d = (acc->real ? acc->dsum : (double) acc->isum) / acc->count;
+            }
+            break;
+        case DBM_AGG_MIN:
+        case DBM_AGG_MAX:
+            v = acc->value;
+            break;
+        }
+
+        rc = chidb_dbm_agg_append(&dbrb, &v);
+    }
+
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+    if(rc == CHIDB_OK)
+    {
+        free(agg->row);
+        agg->row = NULL;
+        if(chidb_DBRecord_pack(dbr, &agg->row) != CHIDB_OK)
+            rc = CHIDB_ENOMEM;
+        agg->rlen = dbr->packed_len;
+    }
+    chidb_DBRecord_destroy(dbr);
+
+    return rc;
+}
+
+/* Makes the record of the group being read, moving on to the next file
+ * first if all the groups in the table have been read */
+static int chidb_dbm_agg_load(chidb_dbm_agg_t *agg)
+{
+    int rc;
+
+    while(agg->current >= agg->used)
+        if((rc = chidb_dbm_agg_next_file(agg)) != CHIDB_OK)
+            return rc;
+
+    return chidb_dbm_agg_make_row(agg);
+}
+
+
+/*** AGGREGATOR ***/
+
+/* Creates a new, empty, aggregator
+ *
+ * Parameters
+ * - agg: Out parameter. Used to return the new aggregator.
+ * - nkeys: Number of columns of the group key
+ * - funcs: Aggregate function of each of the following columns
+ *   (DBM_AGG_COUNT, etc.), one character per column
+ * - budget: Bytes the groups can take up in memory before rows are
+ *   written to disk (0 for DBM_AGG_BUDGET)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EMISUSE: Unknown aggregate function
+ */
+int chidb_dbm_agg_new(chidb_dbm_agg_t **agg, uint32_t nkeys, const char *funcs, size_t budget)
+{
+    chidb_dbm_agg_t *a;
+    const char known[] = {DBM_AGG_COUNT, DBM_AGG_SUM, DBM_AGG_AVG, DBM_AGG_MIN, DBM_AGG_MAX, '\0'};
+
+    funcs = funcs != NULL ? funcs : "";
+    if(funcs[strspn(funcs, known)] != '\0')
+        return CHIDB_EMISUSE;
+
+    if((a = calloc(1, sizeof(chidb_dbm_agg_t))) == NULL)
+        return CHIDB_ENOMEM;
+
+    a->nkeys = nkeys;
+    a->nfuncs = strlen(funcs);
+    a->budget = budget > 0 ? budget : DBM_AGG_BUDGET;
+    a->nslots = INITIAL_SLOTS;
+    a->ksize = 64;
+    a->funcs = strdup(funcs);
+    a->slots = calloc(a->nslots, sizeof(uint32_t));
+    a->key = malloc(a->ksize);
+
+    if(a->funcs == NULL || a->slots == NULL || a->key == NULL)
+    {
+        chidb_dbm_agg_free(a);
+        return CHIDB_ENOMEM;
+    }
+
+    *agg = a;
+    return CHIDB_OK;
+}
+
+
+/* Frees an aggregator, and removes its temporary files
+ *
+ * Parameters
+ * - agg: Aggregator to free
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_agg_free(chidb_dbm_agg_t *agg)
+{
+    if(agg->slots != NULL)
+        chidb_dbm_agg_clear(agg);
+
+    for(int i = 0; i < DBM_AGG_PARTITIONS; i++)
+        if(agg->spill[i].file != NULL)
+            fclose(agg->spill[i].file);
+    for(uint32_t i = 0; i < agg->npending; i++)
+        fclose(agg->pending[i].file);
+
+    free(agg->pending);
+    free(agg->row);
+    free(agg->key);
+    free(agg->slots);
+    free(agg->data);
+    free(agg->funcs);
+    free(agg);
+
+    return CHIDB_OK;
+}
+
+
+/* Add a row to an aggregator
+ *
+ * Rows can only be added before the aggregator is finished.
+ *
+ * Parameters
+ * - agg: Aggregator
+ * - record, rlen: Record with the row's group key, followed by the
+ *   argument of each function
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The aggregator has already been finished
+ * - CHIDB_EMISMATCH: The argument of SUM or AVG is not a number
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not write a row to disk
+ */
+int chidb_dbm_agg_step(chidb_dbm_agg_t *agg, uint8_t *record, uint32_t rlen)
+{
+    if(agg->finished)
+        return CHIDB_EMISUSE;
+
+    return chidb_dbm_agg_add(agg, record, rlen);
+}
+
+
+/* Finish the group of the rows added so far, if a row isn't in it
+ *
+ * When all the rows of each group are added one after the other (e.g.,
+ * because they are read in group key order), this is called before
+ * adding each row: if the row starts a new group, the record of the
+ * previous group is made (see chidb_dbm_agg_row) and the group is
+ * removed, so the aggregator only ever holds one group. The last group
+ * is then returned by chidb_dbm_agg_final as usual.
+ *
+ * Parameters
+ * - agg: Aggregator
+ * - record, rlen: Record of the row about to be added
+ *
+ * Return
+ * - CHIDB_OK: The row starts a new group, and the record of the previous
+ *   group is ready
+ * - CHIDB_ENOTFOUND: The row is in the group of the rows added so far
+ *   (or it's the first row)
+ * - CHIDB_EMISUSE: The aggregator has already been finished
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_agg_break(chidb_dbm_agg_t *agg, uint8_t *record, uint32_t rlen)
+{
+    DBRecordView view;
+    uint32_t klen, hash, slot;
+    int rc;
+
+    if(agg->finished)
+        return CHIDB_EMISUSE;
+    if(agg->ngroups == 0)
+        return CHIDB_ENOTFOUND;
+
+    chidb_DBRecordView_init(&view, record);
+    if((rc = chidb_dbm_agg_encode(agg, &view, &klen)) != CHIDB_OK)
+        return rc;
+    hash = chidb_dbm_agg_hash(agg->key, klen, agg->level);
+    if(chidb_dbm_agg_lookup(agg, hash, klen, &slot) != NULL)
+        return CHIDB_ENOTFOUND;
+
+    agg->current = 0;
+    if((rc = chidb_dbm_agg_make_row(agg)) != CHIDB_OK)
+        return rc;
+    chidb_dbm_agg_clear(agg);
+
+    return CHIDB_OK;
+}
+
+
+/* Finish an aggregator, and move to its first group
+ *
+ * Parameters
+ * - agg: Aggregator
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: There are no groups
+ * - CHIDB_EMISUSE: The aggregator has already been finished
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read or write a file
+ */
+int chidb_dbm_agg_final(chidb_dbm_agg_t *agg)
+{
+    chidb_dbm_agg_group_t *g;
+    uint32_t hash, slot;
+    int rc;
+
+    if(agg->finished)
+        return CHIDB_EMISUSE;
+    agg->finished = true;
+
+    /* Without a group key there is always a group (the key of which is
+     * empty) */
+    if(agg->nkeys == 0 && agg->ngroups == 0)
+    {
+        hash = chidb_dbm_agg_hash(agg->key, 0, agg->level);
+        chidb_dbm_agg_lookup(agg, hash, 0, &slot);
+        if((rc = chidb_dbm_agg_add_group(agg, hash, 0, slot, &g)) != CHIDB_OK)
+            return rc;
+    }
+
+    agg->current = 0;
+    return chidb_dbm_agg_load(agg);
+}
+
+
+/* Get the record of the group a finished aggregator is on
+ *
+ * Parameters
+ * - agg: Aggregator
+ * - record, rlen: Out parameters for the record, which is valid until
+ *   the aggregator moves on to the next group
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_agg_row(chidb_dbm_agg_t *agg, uint8_t **record, uint32_t *rlen)
+{
+    *record = agg->row;
+    *rlen = agg->rlen;
+
+    return CHIDB_OK;
+}
+
+
+/* Move a finished aggregator on to its next group
+ *
+ * Parameters
+ * - agg: Aggregator
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: There are no more groups
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read or write a file
+ */
+int chidb_dbm_agg_next(chidb_dbm_agg_t *agg)
+{
+    agg->current += GROUP_SIZE(agg, GROUP(agg, agg->current)->klen);
+
+    return chidb_dbm_agg_load(agg);
+}
@@ -0,0 +1,173 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine aggregators
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DBM_AGG_H_
+#define DBM_AGG_H_
+
+#include "chidbInt.h"
+#include "dbm-types.h"
+
+/* Aggregators for GROUP BY
+ *
+ * An aggregator computes aggregate functions (COUNT, SUM, AVG, MIN and
+ * MAX) over groups of rows. Each row is added by AggStep as a record with
+ * the row's group key in its first columns, followed by the argument of
+ * each function. Once all the rows have been added, AggFinal and AggNext
+ * position an aggregator cursor on each group in turn: a record with the
+ * group key followed by the value of each function, which can be read
+ * with Column like any other row.
+ *
+ * The groups are kept in an open-addressing hash table (with linear
+ * probing) on their group key, and each group has an accumulator for each
+ * function. Once the groups take up more than the aggregator's memory
+ * budget, no more groups are added to the table: the rows of the groups
+ * in it are still aggregated, but the rows of any other group are written
+ * to one of DBM_AGG_PARTITIONS temporary files, chosen by the hash of the
+ * group key. Once the groups in the table have been read, the table is
+ * emptied, and the rows in each file are aggregated in turn the same way
+ * (with a different hash function, in case they don't fit either). Only
+ * the rows of groups that didn't fit are written to disk, and all the rows
+ * of a group end up in the same file.
+ *
+ * Groups are returned in the order their first rows were added in (within
+ * the table, and then within each file). If there is no group key (for
+ * aggregate functions without GROUP BY), there is exactly one group, even
+ * if no rows were added. NULL arguments are ignored, and the value of
+ * SUM, AVG, MIN and MAX is NULL if there were only NULL arguments. NULL
+ * group keys are all in the same group.
+ *
+ * If the rows of each group are added one after the other (e.g., in the
+ * order of an index on the group key), AggBreak can be used before each
+ * AggStep to return each group as soon as a row of another group comes
+ * along. The aggregator then holds a single group, and never spills.
+ */
+#define DBM_AGG_PARTITIONS (16)
+
+/* Default memory budget, in bytes */
+#define DBM_AGG_BUDGET (8 * 1024 * 1024)
+
+/* Aggregate functions (as given to AggOpen) */
+#define DBM_AGG_COUNT 'n'
+#define DBM_AGG_SUM   's'
+#define DBM_AGG_AVG   'a'
+#define DBM_AGG_MIN   '<'
+#define DBM_AGG_MAX   '>'
+
+/* The state of an aggregate function for a group */
+typedef struct chidb_dbm_agg_acc
+{
+    int64_t count;      /* Number of non-NULL arguments */
+    int64_t isum;       /* SUM and AVG: sum of the integer arguments */
+    double dsum;        /* SUM and AVG: sum of all the arguments */
+    bool real;          /* SUM: whether any argument was a double */
+    /* MIN and MAX: smallest or largest argument so far (strings and
+     * BLOBs are copies, owned by the aggregator) */
+    chidb_dbm_register_t value;
+} chidb_dbm_agg_acc_t;
+
+/* Groups are stored one after the other, each of them followed by an
+ * accumulator for each function and its (encoded) group key, and padded
+ * to a multiple of 8 bytes */
+typedef struct chidb_dbm_agg_group
+{
+    uint32_t hash;
+    uint32_t klen;      /* Bytes in the encoded group key */
+} chidb_dbm_agg_group_t;
+
+/* A temporary file of rows that still have to be aggregated, each of
+ * them preceded by its length (a uint32_t) */
+typedef struct chidb_dbm_agg_file
+{
+    FILE *file;
+    uint32_t nrows;
+    uint32_t level;     /* Hash function to use when aggregating them */
+} chidb_dbm_agg_file_t;
+
+struct chidb_dbm_agg
+{
+    uint32_t nkeys;
+    char *funcs;        /* One DBM_AGG_* per function */
+    uint32_t nfuncs;
+
+    size_t budget;
+
+    /* Groups, and offset + 1 of a group in each slot of the table (0
+     * if empty) */
+    uint8_t *data;
+    size_t size;
+    size_t used;
+    uint32_t *slots;
+    uint32_t nslots;
+    uint32_t ngroups;
+
+    /* Bytes taken by the values copied by MIN and MAX */
+    size_t copies;
+
+    /* Whether the table is full (no more groups can be added to it),
+     * and the hash function it uses */
+    bool full;
+    uint32_t level;
+
+    /* Files the rows of the groups that didn't fit in the table are
+     * written to (NULL if none yet), and the files still to aggregate */
+    chidb_dbm_agg_file_t spill[DBM_AGG_PARTITIONS];
+    chidb_dbm_agg_file_t *pending;
+    uint32_t npending;
+
+    /* Encoded group key of the row being added */
+    uint8_t *key;
+    uint32_t ksize;
+
+    /* Once finished: offset of the group being read, and its record */
+    bool finished;
+    size_t current;
+    uint8_t *row;
+    uint32_t rlen;
+};
+typedef struct chidb_dbm_agg chidb_dbm_agg_t;
+
+int chidb_dbm_agg_new(chidb_dbm_agg_t **agg, uint32_t nkeys, const char *funcs, size_t budget);
+int chidb_dbm_agg_free(chidb_dbm_agg_t *agg);
+int chidb_dbm_agg_step(chidb_dbm_agg_t *agg, uint8_t *record, uint32_t rlen);
+int chidb_dbm_agg_break(chidb_dbm_agg_t *agg, uint8_t *record, uint32_t rlen);
+int chidb_dbm_agg_final(chidb_dbm_agg_t *agg);
+int chidb_dbm_agg_row(chidb_dbm_agg_t *agg, uint8_t **record, uint32_t *rlen);
+int chidb_dbm_agg_next(chidb_dbm_agg_t *agg);
+
+#endif /* DBM_AGG_H_ */
@@ -0,0 +1,244 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine batches and vectors
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dbm-batch.h"
+
+
+/* Creates a new, empty, batch
+ *
+ * Parameters
+ * - batch: Out parameter. Used to return the new batch.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_batch_new(chidb_dbm_batch_t **batch)
+{
+    *batch = calloc(1, sizeof(chidb_dbm_batch_t));
+    if(*batch == NULL)
+        return CHIDB_ENOMEM;
+
+    (*batch)->row = -1;
+    (*batch)->positioned = true;
+
+    return CHIDB_OK;
+}
+
+
+/* Tells a batch that its cursor has been moved to a new position
+ * (by a rewind or a seek), so the next batch starts at that position.
+ *
+ * Parameters
+ * - batch: Batch
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_batch_reposition(chidb_dbm_batch_t *batch)
+{
+    batch->nrows = 0;
+    batch->row = -1;
+    batch->positioned = true;
+    batch->eof = false;
+
+    return CHIDB_OK;
+}
+
+
+/* Adds the record in a cursor's current cell to a batch */
+static int chidb_dbm_batch_append(chidb_dbm_batch_t *batch, BTreeCell *cell)
+{
+    uint32_t size = cell->fields.tableLeaf.data_size;
+
+    if(batch->data_used + size > batch->data_size)
+    {
+        uint32_t new_size = batch->data_size ? batch->data_size : 4096;
+        while(new_size < batch->data_used + size)
+            new_size *= 2;
+
+        uint8_t *data = realloc(batch->data, new_size);
+        if(data == NULL)
+            return CHIDB_ENOMEM;
+
+        batch->data = data;
+        batch->data_size = new_size;
+    }
+
+    memcpy(batch->data + batch->data_used, cell->fields.tableLeaf.data, size);
+    batch->keys[batch->nrows] = cell->key;
+    batch->records[batch->nrows] = batch->data_used;
+    batch->data_used += size;
+    batch->nrows++;
+
+    return CHIDB_OK;
+}
+
+
+/* Fills a batch with the next (up to DBM_BATCH_SIZE) rows of a table
+ *
+ * If the cursor has just been positioned (see chidb_dbm_batch_reposition),
+ * the batch starts with the row the cursor is on. Otherwise, it starts
+ * with the row after it. The cursor is left on the last row of the batch.
+ * All the rows in the batch are selected.
+ *
+ * Parameters
+ * - tree: B-Tree the cursor is reading from
+ * - cursor: Cursor on a table B-Tree
+ * - batch: Batch to fill. Its previous rows are discarded.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful. The batch is empty if there were
+ *             no more rows.
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_batch_fill(BTree *tree, chidb_dbm_cursor_t *cursor, chidb_dbm_batch_t *batch)
+{
+    int rc;
+
+    batch->nrows = 0;
+    batch->data_used = 0;
+    batch->row = -1;
+
+    while(!batch->eof && batch->nrows < DBM_BATCH_SIZE)
+    {
+        if(batch->positioned)
+        {
+            list_t *trail = &cursor->root_trail;
+            chidb_dbm_trail_node_t *trail_node = list_get_at(trail, list_size(trail) - 1);
+
+            batch->positioned = false;
+
+            /* Rewinding an empty table leaves the cursor on an empty leaf */
+            if(trail_node == NULL || trail_node->node->n_cells == 0)
+            {
+                batch->eof = true;
+                break;
+            }
+        }
+        else
+        {
+            rc = chidb_dbm_cursor_table_move(tree, cursor, true);
+            if(rc == CHIDB_CANTMOVE)
+            {
+                batch->eof = true;
+                break;
+            }
+            else if(rc != CHIDB_OK)
+                return rc;
+        }
+
+        if((rc = chidb_dbm_batch_append(batch, &cursor->cell)) != CHIDB_OK)
+            return rc;
+    }
+
+    /* Select all the rows */
+    memset(batch->sel, 0, sizeof(batch->sel));
+    for(uint32_t w = 0; w < batch->nrows / 64; w++)
+        batch->sel[w] = ~UINT64_C(0);
+    if(batch->nrows % 64)
+        batch->sel[batch->nrows / 64] = (UINT64_C(1) << (batch->nrows % 64)) - 1;
+
+    return CHIDB_OK;
+}
+
+
+/* Frees a batch
+ *
+ * Parameters
+ * - batch: Batch to free
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_batch_free(chidb_dbm_batch_t *batch)
+{
+    free(batch->data);
+    free(batch);
+
+    return CHIDB_OK;
+}
+
+
+/* Allocates the arrays of a vector
+ *
+ * Parameters
+ * - vector: Vector to initialize
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_vector_init(chidb_dbm_vector_t *vector)
+{
+    vector->cursor = -1;
+    vector->nrows = 0;
+    vector->all_int32 = false;
+    vector->values = calloc(DBM_BATCH_SIZE, sizeof(chidb_dbm_register_t));
+    vector->i32 = calloc(DBM_BATCH_SIZE, sizeof(int32_t));
+
+    if(vector->values == NULL || vector->i32 == NULL)
+    {
+        chidb_dbm_vector_free(vector);
+        return CHIDB_ENOMEM;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Frees the arrays of a vector (but not the vector itself)
+ *
+ * Parameters
+ * - vector: Vector
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_vector_free(chidb_dbm_vector_t *vector)
+{
+    free(vector->values);
+    free(vector->i32);
+    vector->values = NULL;
+    vector->i32 = NULL;
+
+    return CHIDB_OK;
+}
@@ -0,0 +1,131 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine batches and vectors
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DBM_BATCH_H_
+#define DBM_BATCH_H_
+
+#include "chidbInt.h"
+#include "dbm-types.h"
+
+/* Number of rows in a batch. Must be a multiple of 64, since the
+ * selection bitmap is stored in 64-bit words */
+#define DBM_BATCH_SIZE (1024)
+#define DBM_BATCH_WORDS (DBM_BATCH_SIZE / 64)
+
+/* A batch of rows read from a cursor
+ *
+ * Batches are filled by the Batch instruction. Since the cursor moves
+ * on once a row has been added to the batch, the records are copied into
+ * a buffer owned by the batch (and valid until the batch is refilled).
+ */
+struct chidb_dbm_batch
+{
+    /* Number of rows in the batch */
+    uint32_t nrows;
+
+    /* Key and record (offset into data) of each row */
+    chidb_key_t keys[DBM_BATCH_SIZE];
+    uint32_t records[DBM_BATCH_SIZE];
+
+    /* Buffer with the records of all the rows */
+    uint8_t *data;
+    uint32_t data_size;
+    uint32_t data_used;
+
+    /* Selection bitmap. Bit i is set if row i hasn't been
+     * filtered out yet */
+    uint64_t sel[DBM_BATCH_WORDS];
+
+    /* Row that BatchRow last produced (-1 if none yet) */
+    int32_t row;
+
+    /* True if the cursor is on a row that hasn't been added to a batch
+     * yet (i.e., it has just been rewound or has just seeked) */
+    bool positioned;
+
+    /* True if there are no more rows to read from the cursor */
+    bool eof;
+};
+typedef struct chidb_dbm_batch chidb_dbm_batch_t;
+
+/* A vector holds the values of one column for all the rows in a batch
+ *
+ * Vectors share numbers with registers: the vector written by VColumn
+ * p1 p2 p3 is vector p3, and BatchRow copies its value for the current
+ * row into register p3.
+ *
+ * The values are stored as registers. Strings and BLOBs point into the
+ * batch's records (so strings are not null-terminated, and slen must be
+ * used). Additionally, if every value in the vector is a 32-bit integer,
+ * they are also stored in a plain array of integers, which lets
+ * comparisons run in a tight loop that the compiler can vectorise.
+ */
+struct chidb_dbm_vector
+{
+    /* Cursor whose batch this vector holds a column of (-1 if none) */
+    int32_t cursor;
+
+    /* Number of rows */
+    uint32_t nrows;
+
+    /* Values for each row */
+    chidb_dbm_register_t *values;
+
+    /* True if all the (selected) values are 32-bit integers, in which
+     * case they are also stored in i32 */
+    bool all_int32;
+    int32_t *i32;
+};
+typedef struct chidb_dbm_vector chidb_dbm_vector_t;
+
+int chidb_dbm_batch_new(chidb_dbm_batch_t **batch);
+int chidb_dbm_batch_reposition(chidb_dbm_batch_t *batch);
+int chidb_dbm_batch_fill(BTree *tree, chidb_dbm_cursor_t *cursor, chidb_dbm_batch_t *batch);
+int chidb_dbm_batch_free(chidb_dbm_batch_t *batch);
+
+int chidb_dbm_vector_init(chidb_dbm_vector_t *vector);
+int chidb_dbm_vector_free(chidb_dbm_vector_t *vector);
+
+/* Returns true if row i of a batch is selected */
+static inline bool chidb_dbm_batch_selected(chidb_dbm_batch_t *batch, uint32_t i)
+{
+    return (batch->sel[i / 64] >> (i % 64)) & 1;
+}
+
+#endif /* DBM_BATCH_H_ */
@@ -39,115 +39,275 @@
 
 
 #include "dbm-cursor.h"
+#include "dbm-batch.h"
+#include "dbm-hash.h"
+#include "dbm-sorter.h"
+#include "dbm-agg.h"
+#include "dbm-set.h"
 
 /* Creates a new trail node for the cursor
  * tree: the tree that this trail is for
  * page: the page that this node is contained in
+ *
+ * Returns CHIDB_EBUSY if other threads inserting into the tree kept
+ * changing the node while it was being read
  */
 int chidb_dbm_trail_node_new(BTree* tree, npage_t page, chidb_dbm_trail_node_t** trail_node)
 {
-    int err;
-    
-    *trail_node= malloc(sizeof(chidb_dbm_trail_node_t));
-    if(*trail_node == NULL)
-        return CHIDB_ENOMEM;
-    // Load the page in
+    int err, tries = 0;
     BTreeNode* node;
-    check_fail(chidb_Btree_getNodeByPage(tree, page, &node));
-    
+    uint32_t version;
+
+    // Load the page in. Cursors don't latch it, so they check that its
+    // latch's version didn't change meanwhile (see Latches in btree.c)
+    for(;;) {
+        version = chidb_Btree_latchVersion(tree, page);
+        check_fail(chidb_Btree_getNodeByPage(tree, page, &node));
+        if(!chidb_Btree_latchChanged(tree, page, version))
+            break;
+        chidb_Btree_freeMemNode(tree, node);
+        if(++tries == BTREE_OPTIMISTIC_TRIES)
+            return CHIDB_EBUSY;
+    }
+
+    *trail_node = malloc(sizeof(chidb_dbm_trail_node_t));
+    if(*trail_node == NULL) {
+        chidb_Btree_freeMemNode(tree, node);
+        return CHIDB_ENOMEM;
+    }
     (*trail_node)->node = node;
     (*trail_node)->cell_num = 0;
+    (*trail_node)->version = version;
     return CHIDB_OK;
 }
 
+static void chidb_dbm_trail_node_free(BTree* tree, chidb_dbm_trail_node_t* trail_node)
+{
+    chidb_Btree_freeMemNode(tree, trail_node->node);
+    free(trail_node);
+}
+
+/* Has a node of the trail been changed by another thread since it was
+ * read? Then, the child it points to may not be the right one anymore */
+static bool chidb_dbm_trail_node_changed(BTree* tree, chidb_dbm_trail_node_t* trail_node)
+{
+    return chidb_Btree_latchChanged(tree, trail_node->node->page->npage, trail_node->version);
+}
+
+/* Removes the last node of the cursor's trail, and frees it */
+static void chidb_dbm_cursor_trail_pop(BTree* tree, chidb_dbm_cursor_t* cursor)
+{
+    chidb_dbm_trail_node_free(tree, list_extract_at(&cursor->root_trail, list_size(&cursor->root_trail) - 1));
+}
+
+/* Removes (and frees) every node of the cursor's trail */
+static void chidb_dbm_cursor_trail_clear(BTree* tree, chidb_dbm_cursor_t* cursor)
+{
+    while(!list_empty(&cursor->root_trail))
+        chidb_dbm_cursor_trail_pop(tree, cursor);
+}
+
 int chidb_dbm_cursor_new(BTree* tree, npage_t root, chidb_dbm_cursor_t* cursor)
 {   
+    int err;
+
     // Initialize linked list for trail
     list_init(&cursor->root_trail);
     
     // Init first trail node
     chidb_dbm_trail_node_t* trail_node;
-    chidb_dbm_trail_node_new(tree, root, &trail_node);
+    if((err = chidb_dbm_trail_node_new(tree, root, &trail_node)) != CHIDB_OK) {
+        list_destroy(&cursor->root_trail);
+        return err;
+    }
 
     // Insert first node
     list_insert_at(&cursor->root_trail, trail_node, 0);
     
     cursor->root_page = root;
+    cursor->record_valid = false;
+    if(cursor->batch)
+        chidb_dbm_batch_reposition(cursor->batch);
 
     return CHIDB_OK;
 }
 
-int chidb_dbm_cursor_rewind(BTree* tree, chidb_dbm_cursor_t* cursor) 
+/* Frees the cursor's trail (or the hash table, sorter, aggregator or set
+ * of a hash, sorter, aggregator or set cursor). The cursor can't be moved
+ * again until chidb_dbm_cursor_new is called on it */
+int chidb_dbm_cursor_free(BTree* tree, chidb_dbm_cursor_t* cursor)
 {
-    // destroy our trail
-    list_destroy(&cursor->root_trail); 
-    list_init(&cursor->root_trail);
- 
-    chidb_dbm_trail_node_t* trail_node;
-    chidb_dbm_trail_node_new(tree, cursor->root_page, &trail_node);
+    if(cursor->type == CURSOR_HASH)
+    {
+        chidb_dbm_hash_free(cursor->hash);
+        cursor->hash = NULL;
+        return CHIDB_OK;
+    }
+    if(cursor->type == CURSOR_SORTER)
+    {
+        chidb_dbm_sorter_free(cursor->sorter);
+        cursor->sorter = NULL;
+        return CHIDB_OK;
+    }
+    if(cursor->type == CURSOR_AGG)
+    {
+        chidb_dbm_agg_free(cursor->agg);
+        cursor->agg = NULL;
+        return CHIDB_OK;
+    }
+    if(cursor->type == CURSOR_SET)
+    {
+        chidb_dbm_set_free(cursor->set);
+        cursor->set = NULL;
+        return CHIDB_OK;
+    }
 
-    list_append(&cursor->root_trail, trail_node);
-    
-    chidb_dbm_cursor_table_down(tree, cursor, true);
+    chidb_dbm_cursor_trail_clear(tree, cursor);
+    list_destroy(&cursor->root_trail);
+
+    return CHIDB_OK;
+}
+
+/* Leaf nodes of both table and index B-Trees */
+static inline bool chidb_dbm_node_is_leaf(BTreeNode* node)
+{
+    return node->type == PGTYPE_TABLE_LEAF || node->type == PGTYPE_INDEX_LEAF;
+}
+
+/* Unlike in table B-Trees, the cells in the internal nodes of an index
+ * B-Tree are entries too, so a cursor on an index can be positioned
+ * on an internal node (which is then the last node on its trail) */
+static inline bool chidb_dbm_node_is_index(BTreeNode* node)
+{
+    return node->type == PGTYPE_INDEX_INTERNAL || node->type == PGTYPE_INDEX_LEAF;
+}
+
+/* Child page of an internal node to the left of cell cell_num, or
+ * the right page if cell_num is the number of cells in the node */
+static int chidb_dbm_node_child(BTreeNode* node, ncell_t cell_num, npage_t* child)
+{
+    int err;
+    BTreeCell cell;
+
+    if(cell_num >= node->n_cells) {
+        *child = node->right_page;
+        return CHIDB_OK;
+    }
+
+    check_fail(chidb_Btree_getCell(node, cell_num, &cell));
+    if(node->type == PGTYPE_INDEX_INTERNAL)
+        *child = cell.fields.indexInternal.child_page;
+    else
+        *child = cell.fields.tableInternal.child_page;
 
     return CHIDB_OK;
 }
 
+/* Places the cell at the position of the last node of the trail in the cursor */
+static int chidb_dbm_cursor_set_cell(chidb_dbm_cursor_t* cursor, chidb_dbm_trail_node_t* trail_node)
+{
+    cursor->record_valid = false;
+    return chidb_Btree_getCell(trail_node->node, trail_node->cell_num, &cursor->cell);
+}
+
+/* Moves the cursor to the first entry of its B-Tree
+ *
+ * Returns CHIDB_OK, or CHIDB_CANTMOVE if the B-Tree is empty
+ */
+int chidb_dbm_cursor_rewind(BTree* tree, chidb_dbm_cursor_t* cursor) 
+{
+    int err, tries = 0;
+
+    do {
+        // destroy our trail
+        chidb_dbm_cursor_trail_clear(tree, cursor);
+
+        chidb_dbm_trail_node_t* trail_node;
+        check_fail(chidb_dbm_trail_node_new(tree, cursor->root_page, &trail_node));
+
+        list_append(&cursor->root_trail, trail_node);
+
+        cursor->record_valid = false;
+        if(cursor->batch)
+            chidb_dbm_batch_reposition(cursor->batch);
+
+        // Only the root can be empty
+        if(trail_node->node->n_cells == 0)
+            return CHIDB_CANTMOVE;
+
+        // Start again if other threads changed the nodes on the way
+        err = chidb_dbm_cursor_table_down(tree, cursor, true);
+    } while(err == CHIDB_EBUSY && ++tries < BTREE_OPTIMISTIC_TRIES);
+
+    return err;
+}
+
+/* Descends from the last node on the trail to the first (or, if moving
+ * backwards, the last) entry of the subtree to the left of its current cell.
+ * Returns CHIDB_EBUSY if another thread changed a node it goes down from */
 int chidb_dbm_cursor_table_down(BTree* tree, chidb_dbm_cursor_t* cursor, bool forward)
 {
+    int err;
     uint32_t end = list_size(&cursor->root_trail) - 1; 
     chidb_dbm_trail_node_t* trail_node = list_get_at(&cursor->root_trail, end);
-    if(trail_node->node->type == PGTYPE_TABLE_LEAF) {
+    if(chidb_dbm_node_is_leaf(trail_node->node)) {
         // Place the cell into the cursor and return
-        chidb_Btree_getCell(trail_node->node, trail_node->cell_num, &cursor->cell);
-        return CHIDB_OK;
+        return chidb_dbm_cursor_set_cell(cursor, trail_node);
     }
 
     npage_t next_page;
-    if(trail_node->cell_num < trail_node->node->n_cells) {
-        BTreeCell cell;
-        chidb_Btree_getCell(trail_node->node, trail_node->cell_num, &cell);
-        next_page = cell.fields.tableInternal.child_page;
-    } else { // unless something has gone wrong, this means we need to go down to right_page
-        next_page = trail_node->node->right_page;
-    }
+    check_fail(chidb_dbm_node_child(trail_node->node, trail_node->cell_num, &next_page));
 
     chidb_dbm_trail_node_t* next_trail_node;
-    chidb_dbm_trail_node_new(tree, next_page, &next_trail_node);
+    check_fail(chidb_dbm_trail_node_new(tree, next_page, &next_trail_node));
+    if(chidb_dbm_trail_node_changed(tree, trail_node)) {
+        chidb_dbm_trail_node_free(tree, next_trail_node);
+        return CHIDB_EBUSY;
+    }
 
-    if(!forward)
+    if(!forward) {
+        // Internal nodes start at the right page, leaves at their last cell
         next_trail_node->cell_num = next_trail_node->node->n_cells;
+        if(chidb_dbm_node_is_leaf(next_trail_node->node))
+            next_trail_node->cell_num--;
+    }
     
     list_append(&cursor->root_trail, next_trail_node);
     return chidb_dbm_cursor_table_down(tree, cursor, forward);
 }
 
-/*
- * We assume either seek or rewind has been called, therefore asserting that the node type is a Leaf
- * If the node type is not a Leaf, something has gone horribly wrong
- */
-int chidb_dbm_cursor_table_move(BTree* tree, chidb_dbm_cursor_t* cursor, bool forward) 
+/* Moves the cursor to the next (or previous) entry (see
+ * chidb_dbm_cursor_table_move), or returns CHIDB_EBUSY if another thread
+ * changed a node it goes down from */
+static int chidb_dbm_cursor_table_step(BTree* tree, chidb_dbm_cursor_t* cursor, bool forward)
 {
-    int err;
-
     // Get last object on trail, read the next child or go onto right page/child
-    uint32_t last = list_size(&cursor->root_trail) - 1;
+    uint32_t size = list_size(&cursor->root_trail);
+    if(size == 0)
+        return CHIDB_CANTMOVE;
+    uint32_t last = size - 1;
     chidb_dbm_trail_node_t* trail_node = list_get_at(&cursor->root_trail, last);
-    
-    // Get our cell
-    BTreeCell cell;
     BTreeNode* node = trail_node->node;
-    
+
+    if(!chidb_dbm_node_is_leaf(node)) {
+        // Positioned on an entry of an internal index node: the next entry
+        // is the first one in the subtree to its right (and the previous
+        // one, the last in the subtree to its left)
+        if(forward)
+            trail_node->cell_num++;
+        return chidb_dbm_cursor_table_down(tree, cursor, forward);
+    }
+
     bool up = false;
     if(forward) {
-       up = trail_node->cell_num == trail_node->node->n_cells - 1; 
+       up = trail_node->cell_num + 1 >= node->n_cells; 
     } else {
         up = trail_node->cell_num == 0;
     }
 
     if(up) {
         // Last cell
-        list_delete_at(&cursor->root_trail, last); // Delete current node, we're moving
+        chidb_dbm_cursor_trail_pop(tree, cursor); // Delete current node, we're moving
         return chidb_dbm_cursor_table_up(tree, cursor, forward);
     }
 
@@ -155,45 +315,214 @@ int chidb_dbm_cursor_table_move(BTree* tree, chidb_dbm_cursor_t* cursor, bool fo
         trail_node->cell_num++;
     else
         trail_node->cell_num--;
-    check_fail(chidb_Btree_getCell(node, trail_node->cell_num, &cell));
-    
-    cursor->cell = cell;
 
-    return CHIDB_OK;
+    return chidb_dbm_cursor_set_cell(cursor, trail_node);
 }
 
 
 int chidb_dbm_cursor_table_up(BTree* tree, chidb_dbm_cursor_t* cursor, bool forward)
 {
     // We assume current node on trail is the one above where we were
-    uint32_t last = list_size(&cursor->root_trail) - 1;
+    uint32_t size = list_size(&cursor->root_trail);
 
     // This means we are at the root and trying to go further up
-    if(last == -1)
+    if(size == 0)
         return CHIDB_CANTMOVE;
 
+    uint32_t last = size - 1;
     chidb_dbm_trail_node_t* trail_node = list_get_at(&cursor->root_trail, last);
+    bool index = chidb_dbm_node_is_index(trail_node->node);
 
-    if(forward)
-        trail_node->cell_num++; // move onto next cell
-    else
-        trail_node->cell_num--;
-
+    // cell_num is unsigned, so check whether there is a next/previous
+    // child before moving onto it
     bool down = false; 
 
-    if(forward)
-        down = trail_node->cell_num <= trail_node->node->n_cells;
-    else
-        down = trail_node->cell_num >= 0;
+    if(forward) {
+        down = trail_node->cell_num < trail_node->node->n_cells;
+        // In an index, the next entry is the cell to the right of the
+        // child we came from, so we stop here instead of going down
+        if(down && index)
+            return chidb_dbm_cursor_set_cell(cursor, trail_node);
+        if(down)
+            trail_node->cell_num++; // move onto next cell
+    } else {
+        down = trail_node->cell_num > 0;
+        if(down)
+            trail_node->cell_num--;
+        if(down && index)
+            return chidb_dbm_cursor_set_cell(cursor, trail_node);
+    }
 
     if(down) {
         // We can head down to child or right_page
         return chidb_dbm_cursor_table_down(tree, cursor, forward);
     } else {
         // We have passed through all children, we must go up again
-        list_delete_at(&cursor->root_trail, last);
+        chidb_dbm_cursor_trail_pop(tree, cursor);
         return chidb_dbm_cursor_table_up(tree, cursor, forward);
     }
 
     return CHIDB_OK;
 }
+
+/*
+ * Moves the cursor to the next (or previous) entry. We assume either seek
+ * or rewind has been called, so the last node on the trail is the one the
+ * cursor is positioned on: a leaf or, in index B-Trees, an internal node.
+ * If other threads inserting into the B-Tree changed the nodes the cursor
+ * goes down from, the entry is looked for from the root instead.
+ *
+ * Returns CHIDB_OK, or CHIDB_CANTMOVE if there are no more entries
+ */
+int chidb_dbm_cursor_table_move(BTree* tree, chidb_dbm_cursor_t* cursor, bool forward) 
+{
+    chidb_key_t key = cursor->cell.key;
+    int err = chidb_dbm_cursor_table_step(tree, cursor, forward);
+
+    if(err == CHIDB_EBUSY)
+        err = chidb_dbm_cursor_table_seek(tree, cursor, key, forward ? SEEK_GT : SEEK_LT);
+
+    return err;
+}
+
+/*
+ * Positions the cursor on an entry of a B-Tree, descending from the root.
+ * At each level we look for the first cell with a key >= the one we're seeking;
+ * in internal nodes that gives us the child to descend into, and in the leaf it
+ * gives us the entry that SEEK_EQ/SEEK_GE want (the others are one step away).
+ * In an index B-Tree, the key can also be found in an internal node, and
+ * the cursor is then positioned there.
+ *
+ * Returns CHIDB_OK if the cursor was positioned, CHIDB_ENOTFOUND or
+ * CHIDB_CANTMOVE if there is no entry that satisfies the seek, and
+ * CHIDB_EBUSY if another thread changed a node it goes down from
+ */
+static int chidb_dbm_cursor_table_find(BTree* tree, chidb_dbm_cursor_t* cursor, chidb_key_t key, chidb_dbm_seek_t seek)
+{
+    int err;
+
+    // Start a new trail from the root
+    chidb_dbm_cursor_trail_clear(tree, cursor);
+
+    chidb_dbm_trail_node_t* trail_node;
+    npage_t page = cursor->root_page;
+    BTreeCell cell;
+    bool exact = false;
+    while(true) {
+        check_fail(chidb_dbm_trail_node_new(tree, page, &trail_node));
+        if(!list_empty(&cursor->root_trail) &&
+           chidb_dbm_trail_node_changed(tree, list_get_at(&cursor->root_trail, list_size(&cursor->root_trail) - 1))) {
+            chidb_dbm_trail_node_free(tree, trail_node);
+            return CHIDB_EBUSY;
+        }
+        list_append(&cursor->root_trail, trail_node);
+
+        BTreeNode* node = trail_node->node;
+        ncell_t i;
+        for(i = 0; i < node->n_cells; i++) {
+            check_fail(chidb_Btree_getCell(node, i, &cell));
+            if(key <= cell.key)
+                break;
+        }
+        trail_node->cell_num = i;
+
+        if(chidb_dbm_node_is_leaf(node)) {
+            exact = i < node->n_cells && cell.key == key;
+            break;
+        }
+
+        if(node->type == PGTYPE_INDEX_INTERNAL && i < node->n_cells && cell.key == key) {
+            exact = true;
+            break;
+        }
+
+        check_fail(chidb_dbm_node_child(node, i, &page));
+    }
+
+    BTreeNode* node = trail_node->node;
+    cursor->record_valid = false;
+    if(cursor->batch)
+        chidb_dbm_batch_reposition(cursor->batch);
+
+    // Empty table
+    if(node->n_cells == 0)
+        return CHIDB_CANTMOVE;
+
+    // Every key in this leaf is smaller than the one we're seeking
+    bool past_end = trail_node->cell_num == node->n_cells;
+    if(!past_end)
+        cursor->cell = cell;
+
+    switch(seek) {
+    case SEEK_EQ:
+        return exact ? CHIDB_OK : CHIDB_ENOTFOUND;
+
+    case SEEK_GE:
+    case SEEK_GT:
+        if(past_end) {
+            // The next key is in the next leaf
+            trail_node->cell_num = node->n_cells - 1;
+            return chidb_dbm_cursor_table_step(tree, cursor, true);
+        }
+        if(seek == SEEK_GT && exact)
+            return chidb_dbm_cursor_table_step(tree, cursor, true);
+        return CHIDB_OK;
+
+    case SEEK_LE:
+        if(exact)
+            return CHIDB_OK;
+        // Otherwise, same as SEEK_LT
+    case SEEK_LT:
+        if(past_end) {
+            // Keys in the next leaf are larger than the one we're
+            // seeking, so the last cell in this leaf is the one we want
+            trail_node->cell_num = node->n_cells - 1;
+            return chidb_dbm_cursor_set_cell(cursor, trail_node);
+        }
+        return chidb_dbm_cursor_table_step(tree, cursor, false);
+    }
+
+    return CHIDB_OK;
+}
+
+/* Positions the cursor (see chidb_dbm_cursor_table_find), starting again
+ * from the root if other threads inserting into the B-Tree changed the
+ * nodes on the way. Returns CHIDB_EBUSY if they kept changing them */
+int chidb_dbm_cursor_table_seek(BTree* tree, chidb_dbm_cursor_t* cursor, chidb_key_t key, chidb_dbm_seek_t seek)
+{
+    int err, tries = 0;
+
+    do
+        err = chidb_dbm_cursor_table_find(tree, cursor, key, seek);
+    while(err == CHIDB_EBUSY && ++tries < BTREE_OPTIMISTIC_TRIES);
+
+    return err;
+}
+
+/*
+ * Returns a view over the record in the cursor's current cell. The view points
+ * directly into the in-memory page, so no copy is made, and it is only built once
+ * per cell (subsequent calls return the same, partially parsed, view). On an
+ * index, the record is the one of the included columns of a covering index
+ */
+int chidb_dbm_cursor_record(chidb_dbm_cursor_t* cursor, DBRecordView** record)
+{
+    if(!cursor->record_valid) {
+        uint8_t *data;
+
+        if(cursor->cell.type == PGTYPE_INDEX_INTERNAL)
+            data = cursor->cell.fields.indexInternal.data;
+        else if(cursor->cell.type == PGTYPE_INDEX_LEAF)
+            data = cursor->cell.fields.indexLeaf.data;
+        else
+            data = cursor->cell.fields.tableLeaf.data;
+
+        if(data == NULL)
+            return CHIDB_EMISUSE;
+        chidb_DBRecordView_init(&cursor->record, data);
+        cursor->record_valid = true;
+    }
+
+    *record = &cursor->record;
+    return CHIDB_OK;
+}
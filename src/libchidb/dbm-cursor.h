@@ -43,21 +43,36 @@
 
 #include "chidbInt.h"
 #include "btree.h"
+#include "record.h"
 #include "simclist.h"
 
 typedef enum chidb_dbm_cursor_type
 {
     CURSOR_UNSPECIFIED,
     CURSOR_READ,
-    CURSOR_WRITE
+    CURSOR_WRITE,
+    CURSOR_HASH,
+    CURSOR_SORTER,
+    CURSOR_AGG,
+    CURSOR_SET
 } chidb_dbm_cursor_type_t;
 
+typedef enum chidb_dbm_seek
+{
+    SEEK_EQ,
+    SEEK_GT,
+    SEEK_GE,
+    SEEK_LT,
+    SEEK_LE
+} chidb_dbm_seek_t;
+
 // This struct will store a BTreeNode and information about it
 // We can use a list of these to hold a trail back to the root
 typedef struct chidb_dbm_trail_node
 {
     BTreeNode* node;
     ncell_t cell_num;
+    uint32_t version;   // Version of the node's latch when it was read
 
 } chidb_dbm_trail_node_t;
 
@@ -69,6 +84,32 @@ typedef struct chidb_dbm_cursor
     list_t root_trail; // a list back to the root
     BTreeCell cell; // The current cell
 
+    // Lazily-parsed view over the current cell's record. Only valid
+    // if record_valid is true; moving the cursor invalidates it.
+    DBRecordView record;
+    bool record_valid;
+
+    // Batch of rows read by the Batch instruction (see dbm-batch.h).
+    // NULL if the cursor has never been used to read batches.
+    struct chidb_dbm_batch *batch;
+
+    // Hash table of a CURSOR_HASH cursor (see dbm-hash.h). The cell of
+    // a hash cursor points at the row HashProbe or HashNext found.
+    struct chidb_dbm_hash *hash;
+
+    // Sorter of a CURSOR_SORTER cursor (see dbm-sorter.h). Once sorted,
+    // the cell of a sorter cursor points at the record it's on.
+    struct chidb_dbm_sorter *sorter;
+
+    // Aggregator of a CURSOR_AGG cursor (see dbm-agg.h). Once finished,
+    // the cell of an aggregator cursor points at the record of the group
+    // it's on.
+    struct chidb_dbm_agg *agg;
+
+    // Set of rows of a CURSOR_SET cursor (see dbm-set.h). A set cursor
+    // is never positioned on a row.
+    struct chidb_dbm_set *set;
+
 } chidb_dbm_cursor_t;
 
 /* Trail functions */
@@ -77,6 +118,8 @@ int chidb_dbm_trail_node_new(BTree* tree, npage_t page, chidb_dbm_trail_node_t**
 /* Cursor function definitions go here */
 int chidb_dbm_cursor_new(BTree* tree, npage_t root, chidb_dbm_cursor_t* cursor);
 
+int chidb_dbm_cursor_free(BTree* tree, chidb_dbm_cursor_t* cursor);
+
 int chidb_dbm_cursor_rewind(BTree* tree, chidb_dbm_cursor_t* cursor);
 
 int chidb_dbm_cursor_table_move(BTree* tree, chidb_dbm_cursor_t* cursor, bool forward);
@@ -85,5 +128,9 @@ int chidb_dbm_cursor_table_up(BTree* tree, chidb_dbm_cursor_t* cursor, bool forw
 
 int chidb_dbm_cursor_table_down(BTree* tree, chidb_dbm_cursor_t* cursor, bool forward);
 
+int chidb_dbm_cursor_table_seek(BTree* tree, chidb_dbm_cursor_t* cursor, chidb_key_t key, chidb_dbm_seek_t seek);
+
+int chidb_dbm_cursor_record(chidb_dbm_cursor_t* cursor, DBRecordView** record);
+
 
 #endif /* DBM_CURSOR_H_ */
@@ -75,7 +75,7 @@ typedef enum dbm_file_program_type
 int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt);
 
 /* Implemented in optimizer.c */
-int chidb_stmt_optimize(chidb_stmt *stmt, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt);
+int chidb_stmt_optimize(chidb *db, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt);
 
 
 int __chidb_dbm_file_read_line(FILE *f, char* line)
@@ -290,6 +290,25 @@ int __chidb_dbm_file_parse_register(char *line, chidb_dbm_file_register_t *reg)
         if(ntokens == 3)
         {
             reg->reg.value.s = strdup(tokens[2]);
+            reg->reg.slen = strlen(tokens[2]);
+            reg->has_value = true;
+        }
+    }
+    else if (strcmp(tokens[1], "int64") == 0)
+    {
+        reg->reg.type = REG_INT64;
+        if(ntokens == 3)
+        {
+            reg->reg.value.i64 = strtoll(tokens[2], NULL, 10);
+            reg->has_value = true;
+        }
+    }
+    else if (strcmp(tokens[1], "double") == 0)
+    {
+        reg->reg.type = REG_DOUBLE;
+        if(ntokens == 3)
+        {
+            reg->reg.value.d = strtod(tokens[2], NULL);
             reg->has_value = true;
         }
     }
@@ -347,13 +366,54 @@ int __chidb_dbm_file_read_rr(char *line, char **rr, int *nCols)
 
 
 
+/* Runs a SQL statement that sets up the database for the one that is checked */
+int __chidb_dbm_file_exec_sql(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+    int rc;
+
+    rc = chidb_prepare(db, sql, &stmt);
+    if(rc != CHIDB_OK)
+        return rc;
+
+    while((rc = chidb_step(stmt)) == CHIDB_ROW)
+        ;
+
+    chidb_finalize(stmt);
+
+    return rc == CHIDB_DONE ? CHIDB_OK : rc;
+}
+
+/* Generates the program of the SQL statement that is checked */
+int __chidb_dbm_file_codegen(chidb_dbm_file_t *dbmf, const char *sql)
+{
+    chisql_statement_t *sql_stmt, *sql_stmt_opt;
+    int rc;
+
+    rc = chisql_parser(sql, &sql_stmt);
+
+    if(rc != CHIDB_OK)
+    {
+        return rc;
+    }
+
+    rc = chidb_stmt_optimize(dbmf->stmt.db, sql_stmt, &sql_stmt_opt);
+
+    if(rc != CHIDB_OK)
+    {
+        return rc;
+    }
+
+    return chidb_stmt_codegen(&dbmf->stmt, sql_stmt_opt);
+}
+
 int __chidb_dbm_file_load(const char* filename, chidb_dbm_file_t **_dbmf, chidb *db,
                           const char* dbfiledir, const char* genfiledir, bool copyOnUse)
 {
     FILE *f;
     chidb_dbm_op_t op;
     chidb_dbm_file_register_t *reg;
-    char line[MAX_LINE_LEN + 1], *row;
+    char line[MAX_LINE_LEN + 1], *row, *sql = NULL;
     int rc, opnum = 0, nCols;
     dbm_file_sections_t section = CHIDB_FILE;
     dbm_file_program_type_t program_type = UNKNOWN;
@@ -383,6 +443,17 @@ int __chidb_dbm_file_load(const char* filename, chidb_dbm_file_t **_dbmf, chidb
         while((rc = __chidb_dbm_file_read_line(f, line)) == LINE_SKIP)
             ;
 
+        if((rc == LINE_EOF || rc == LINE_NEW_SECTION) && sql != NULL)
+        {
+            rc = __chidb_dbm_file_codegen(dbmf, sql);
+            free(sql);
+            sql = NULL;
+            if(rc != CHIDB_OK)
+                return rc;
+            section++;
+            continue;
+        }
+
         if(rc == LINE_EOF)
             break;
 
@@ -436,28 +507,18 @@ int __chidb_dbm_file_load(const char* filename, chidb_dbm_file_t **_dbmf, chidb
         	}
         	else
         	{
-        		chisql_statement_t *sql_stmt, *sql_stmt_opt;
-
-        		rc = chisql_parser(line, &sql_stmt);
-
-        	    if(rc != CHIDB_OK)
-        	    {
-        	        return rc;
-        	    }
-
-        	    rc = chidb_stmt_optimize(&dbmf->stmt, sql_stmt, &sql_stmt_opt);
-
-        	    if(rc != CHIDB_OK)
-        	    {
-        	        return rc;
-        	    }
-
-        	    rc = chidb_stmt_codegen(&dbmf->stmt, sql_stmt_opt);
-
-        	    if(rc != CHIDB_OK)
-        	    {
-        	        return rc;
-        	    }
+        		/* Only the last SQL statement is checked. The ones before
+        		 * it are run when they are read, to set up the database */
+        		if(sql != NULL)
+        		{
+        			rc = __chidb_dbm_file_exec_sql(dbmf->db, sql);
+        			free(sql);
+        			if(rc != CHIDB_OK)
+        				return rc;
+        		}
+        		sql = strdup(line);
+        		if(sql == NULL)
+        			return CHIDB_ENOMEM;
         	}
             break;
         case QUERY_RESULT:
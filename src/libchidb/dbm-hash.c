@@ -0,0 +1,519 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine hash tables
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dbm-hash.h"
+
+/* Bytes taken by an entry, including its padding */
+#define ENTRY_SIZE(vlen, rlen) ((sizeof(chidb_dbm_hash_entry_t) + (vlen) + (rlen) + 3) & ~3u)
+
+#define ENTRY(part, offset) ((chidb_dbm_hash_entry_t *) ((part)->data + (offset)))
+#define ENTRY_VALUE(e) ((uint8_t *) ((e) + 1))
+#define ENTRY_RECORD(e) (ENTRY_VALUE(e) + (e)->vlen)
+
+#define INITIAL_BUCKETS (64)
+
+#define PART_BIT(p) ((uint32_t) 1 << (p))
+
+
+/* Encodes a value as its register type followed by its bytes, so two
+ * values are equal if their encodings are. NULLs can't be encoded,
+ * since they are never equal to anything.
+ *
+ * Parameters
+ * - value: Value to encode
+ * - buf, size: Buffer to encode the value into, which is grown if
+ *   it's not big enough
+ * - len: Out parameter for the length of the encoding
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The value is NULL
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+static int chidb_dbm_hash_encode(chidb_dbm_register_t *value, uint8_t **buf, uint32_t *size, uint32_t *len)
+{
+    const void *bytes;
+    int64_t i64;
+    uint32_t n;
+
+    switch(value->type)
+    {
+    case REG_INT32:
+        /* Integers are encoded the same way whatever their size */
+        i64 = value->value.i;
+        bytes = &i64;
+        n = sizeof(int64_t);
+        break;
+    case REG_INT64:
+        bytes = &value->value.i64;
+        n = sizeof(int64_t);
+        break;
+    case REG_DOUBLE:
+        bytes = &value->value.d;
+        n = sizeof(double);
+        break;
+    case REG_STRING:
+        bytes = value->value.s;
+        n = value->slen;
+        break;
+    case REG_BINARY:
+        bytes = value->value.bin.bytes;
+        n = value->value.bin.nbytes;
+        break;
+    default:
+        return CHIDB_ENOTFOUND;
+    }
+
+    if(*size < n + 1)
+    {
+        uint8_t *b = realloc(*buf, n + 1);
+        if(b == NULL)
+            return CHIDB_ENOMEM;
+        *buf = b;
+        *size = n + 1;
+    }
+
+    (*buf)[0] = (uint8_t) (value->type == REG_INT32 ? REG_INT64 : value->type);
+    memcpy(*buf + 1, bytes, n);
+    *len = n + 1;
+
+    return CHIDB_OK;
+}
+
+/* FNV-1a */
+static uint32_t chidb_dbm_hash_bytes(const uint8_t *bytes, uint32_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for(uint32_t i = 0; i < len; i++)
+    {
+        h ^= bytes[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/* Partition of a hash (its top bits; buckets use the bottom ones) */
+static inline int32_t chidb_dbm_hash_part(uint32_t hash)
+{
+    return hash >> 28;
+}
+
+
+/* Creates a new, empty, hash table
+ *
+ * Parameters
+ * - hash: Out parameter. Used to return the new hash table.
+ * - budget: Bytes of rows the hash table can keep in memory before it
+ *   starts spilling partitions to disk (0 for DBM_HASH_BUDGET)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_hash_new(chidb_dbm_hash_t **hash, size_t budget)
+{
+    *hash = calloc(1, sizeof(chidb_dbm_hash_t));
+    if(*hash == NULL)
+        return CHIDB_ENOMEM;
+
+    (*hash)->budget = budget > 0 ? budget : DBM_HASH_BUDGET;
+    (*hash)->part = -1;
+
+    return CHIDB_OK;
+}
+
+
+/* Frees a partition's entries and buckets (but not its file) */
+static void chidb_dbm_hash_unload(chidb_dbm_hash_t *hash, chidb_dbm_hash_partition_t *part)
+{
+    hash->memory -= part->size + sizeof(uint32_t) * part->nbuckets;
+    free(part->data);
+    free(part->buckets);
+    part->data = NULL;
+    part->buckets = NULL;
+    part->size = part->used = part->nbuckets = 0;
+}
+
+
+/* Frees a hash table, and removes its temporary files
+ *
+ * Parameters
+ * - hash: Hash table to free
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_hash_free(chidb_dbm_hash_t *hash)
+{
+    for(int i = 0; i < DBM_HASH_PARTITIONS; i++)
+    {
+        chidb_dbm_hash_unload(hash, &hash->parts[i]);
+        if(hash->parts[i].file != NULL)
+            fclose(hash->parts[i].file);
+    }
+
+    free(hash->probe);
+    free(hash);
+
+    return CHIDB_OK;
+}
+
+
+/* Adds the entries of a partition (which are in memory) to its buckets,
+ * making room for at least nentries entries */
+static int chidb_dbm_hash_rebucket(chidb_dbm_hash_t *hash, chidb_dbm_hash_partition_t *part, uint32_t nentries)
+{
+    uint32_t nbuckets = INITIAL_BUCKETS;
+    uint32_t *buckets;
+
+    while(nbuckets < nentries)
+        nbuckets *= 2;
+
+    if((buckets = calloc(nbuckets, sizeof(uint32_t))) == NULL)
+        return CHIDB_ENOMEM;
+
+    hash->memory += sizeof(uint32_t) * nbuckets;
+    hash->memory -= sizeof(uint32_t) * part->nbuckets;
+    free(part->buckets);
+    part->buckets = buckets;
+    part->nbuckets = nbuckets;
+
+    for(uint32_t offset = 0; offset < part->used; )
+    {
+        chidb_dbm_hash_entry_t *e = ENTRY(part, offset);
+        uint32_t b = e->hash & (nbuckets - 1);
+
+        e->next = buckets[b];
+        buckets[b] = offset + 1;
+        offset += ENTRY_SIZE(e->vlen, e->rlen);
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Writes a partition to a temporary file, and frees its memory */
+static int chidb_dbm_hash_spill(chidb_dbm_hash_t *hash, chidb_dbm_hash_partition_t *part)
+{
+    if((part->file = tmpfile()) == NULL)
+        return CHIDB_EIO;
+
+    if(part->used > 0 && fwrite(part->data, part->used, 1, part->file) != 1)
+        return CHIDB_EIO;
+    part->file_size = part->used;
+
+    chidb_dbm_hash_unload(hash, part);
+
+    return CHIDB_OK;
+}
+
+
+/* Spills the largest partitions in memory until the rows in memory fit
+ * in the budget again */
+static int chidb_dbm_hash_enforce_budget(chidb_dbm_hash_t *hash)
+{
+    int rc;
+
+    while(hash->memory > hash->budget)
+    {
+        chidb_dbm_hash_partition_t *largest = NULL;
+
+        for(int i = 0; i < DBM_HASH_PARTITIONS; i++)
+        {
+            chidb_dbm_hash_partition_t *part = &hash->parts[i];
+            if(part->file == NULL && part->used > 0 && (largest == NULL || part->used > largest->used))
+                largest = part;
+        }
+
+        if(largest == NULL)
+            break;
+        if((rc = chidb_dbm_hash_spill(hash, largest)) != CHIDB_OK)
+            return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Add a row to a hash table
+ *
+ * Rows can only be added before the hash table is first probed.
+ *
+ * Parameters
+ * - hash: Hash table
+ * - value: Value to add the row under. Rows with a NULL value are not
+ *   added, since they can't match any value.
+ * - key: Key of the row
+ * - record, rlen: Record of the row (which is copied)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not spill a partition to disk
+ */
+int chidb_dbm_hash_insert(chidb_dbm_hash_t *hash, chidb_dbm_register_t *value,
+                          chidb_key_t key, const uint8_t *record, uint32_t rlen)
+{
+    chidb_dbm_hash_partition_t *part;
+    chidb_dbm_hash_entry_t *e;
+    uint32_t vlen, h, size;
+    int rc;
+
+    rc = chidb_dbm_hash_encode(value, &hash->probe, &hash->psize, &vlen);
+    if(rc == CHIDB_ENOTFOUND)
+        return CHIDB_OK;
+    else if(rc != CHIDB_OK)
+        return rc;
+
+    h = chidb_dbm_hash_bytes(hash->probe, vlen);
+    part = &hash->parts[chidb_dbm_hash_part(h)];
+    size = ENTRY_SIZE(vlen, rlen);
+    part->nentries++;
+
+    /* Rows added to a spilled partition go straight to its file */
+    if(part->file != NULL)
+    {
+        chidb_dbm_hash_entry_t entry = {0, h, key, vlen, rlen};
+        uint32_t pad = 0;
+        uint32_t npad = size - sizeof(entry) - vlen - rlen;
+
+        if(fwrite(&entry, sizeof(entry), 1, part->file) != 1
+           || fwrite(hash->probe, vlen, 1, part->file) != 1
+           || (rlen > 0 && fwrite(record, rlen, 1, part->file) != 1)
+           || (npad > 0 && fwrite(&pad, npad, 1, part->file) != 1))
+            return CHIDB_EIO;
+        part->file_size += size;
+        return CHIDB_OK;
+    }
+
+    if(part->used + size > part->size)
+    {
+        uint32_t new_size = part->size > 0 ? part->size : 1024;
+        uint8_t *data;
+
+        while(new_size < part->used + size)
+            new_size *= 2;
+        if((data = realloc(part->data, new_size)) == NULL)
+            return CHIDB_ENOMEM;
+        hash->memory += new_size - part->size;
+        part->data = data;
+        part->size = new_size;
+    }
+
+    e = ENTRY(part, part->used);
+    memset(e, 0, size);
+    e->hash = h;
+    e->key = key;
+    e->vlen = vlen;
+    e->rlen = rlen;
+    memcpy(ENTRY_VALUE(e), hash->probe, vlen);
+    memcpy(ENTRY_RECORD(e), record, rlen);
+    part->used += size;
+
+    if(part->nentries > part->nbuckets)
+    {
+        if((rc = chidb_dbm_hash_rebucket(hash, part, part->nentries)) != CHIDB_OK)
+            return rc;
+    }
+    else
+    {
+        uint32_t b = h & (part->nbuckets - 1);
+        e->next = part->buckets[b];
+        part->buckets[b] = part->used - size + 1;
+    }
+
+    return chidb_dbm_hash_enforce_budget(hash);
+}
+
+
+/* Makes room in memory for a spilled partition to be read back, which
+ * takes about the given number of bytes: drops the spilled partitions
+ * that were read back, the least recently probed first, and then spills
+ * the largest partitions that are still in memory, until it fits in the
+ * budget (or there is nothing left to free) */
+static int chidb_dbm_hash_make_room(chidb_dbm_hash_t *hash, size_t bytes)
+{
+    int rc;
+
+    while(hash->memory + bytes > hash->budget)
+    {
+        chidb_dbm_hash_partition_t *victim = NULL;
+        int32_t lru = -1;
+
+        for(int i = 0; i < DBM_HASH_PARTITIONS; i++)
+            if((hash->loaded & PART_BIT(i)) && (lru < 0 || hash->parts[i].probed < hash->parts[lru].probed))
+                lru = i;
+        if(lru >= 0)
+        {
+            chidb_dbm_hash_unload(hash, &hash->parts[lru]);
+            hash->loaded &= ~PART_BIT(lru);
+            continue;
+        }
+
+        for(int i = 0; i < DBM_HASH_PARTITIONS; i++)
+        {
+            chidb_dbm_hash_partition_t *part = &hash->parts[i];
+            if(part->file == NULL && part->used > 0 && (victim == NULL || part->used > victim->used))
+                victim = part;
+        }
+        if(victim == NULL)
+            break;
+        if((rc = chidb_dbm_hash_spill(hash, victim)) != CHIDB_OK)
+            return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Makes sure a partition's entries are in memory, reading them back from
+ * its file if it has been spilled (see chidb_dbm_hash_make_room) */
+static int chidb_dbm_hash_load(chidb_dbm_hash_t *hash, int32_t p)
+{
+    chidb_dbm_hash_partition_t *part = &hash->parts[p];
+    int rc;
+
+    part->probed = ++hash->clock;
+    if(part->file == NULL || (hash->loaded & PART_BIT(p)))
+        return CHIDB_OK;
+
+    if((rc = chidb_dbm_hash_make_room(hash, part->file_size + sizeof(uint32_t) * part->nentries)) != CHIDB_OK)
+        return rc;
+
+    if((part->data = malloc(part->file_size > 0 ? part->file_size : 1)) == NULL)
+        return CHIDB_ENOMEM;
+    part->size = part->used = part->file_size;
+    hash->memory += part->size;
+    hash->loaded |= PART_BIT(p);
+
+    rewind(part->file);
+    if(part->file_size > 0 && fread(part->data, part->file_size, 1, part->file) != 1)
+        return CHIDB_EIO;
+    fseek(part->file, 0, SEEK_END);
+
+    return chidb_dbm_hash_rebucket(hash, part, part->nentries);
+}
+
+
+/* Finds the first entry, starting with the one at offset+1 "entry"
+ * in the current probe's bucket chain, whose value is the probe's */
+static int chidb_dbm_hash_find(chidb_dbm_hash_t *hash, uint32_t entry,
+                               chidb_key_t *key, uint8_t **record, uint32_t *rlen)
+{
+    chidb_dbm_hash_partition_t *part = &hash->parts[hash->part];
+
+    for(; entry != 0; entry = ENTRY(part, entry - 1)->next)
+    {
+        chidb_dbm_hash_entry_t *e = ENTRY(part, entry - 1);
+
+        if(e->hash != hash->phash || e->vlen != hash->plen || memcmp(ENTRY_VALUE(e), hash->probe, e->vlen))
+            continue;
+
+        hash->entry = entry;
+        *key = e->key;
+        *record = ENTRY_RECORD(e);
+        *rlen = e->rlen;
+        return CHIDB_OK;
+    }
+
+    hash->entry = 0;
+    return CHIDB_ENOTFOUND;
+}
+
+
+/* Look up the rows with a given value
+ *
+ * Parameters
+ * - hash: Hash table
+ * - value: Value to look up
+ * - key, record, rlen: Out parameters for the key and the record of the
+ *   first row with the value. The record is valid until the hash table
+ *   is probed again or freed.
+ *
+ * Return
+ * - CHIDB_OK: A row was found
+ * - CHIDB_ENOTFOUND: There are no rows with that value (which is always
+ *   the case for NULL)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read a spilled partition
+ */
+int chidb_dbm_hash_probe(chidb_dbm_hash_t *hash, chidb_dbm_register_t *value,
+                         chidb_key_t *key, uint8_t **record, uint32_t *rlen)
+{
+    chidb_dbm_hash_partition_t *part;
+    int rc;
+
+    hash->entry = 0;
+    if((rc = chidb_dbm_hash_encode(value, &hash->probe, &hash->psize, &hash->plen)) != CHIDB_OK)
+        return rc;
+
+    hash->phash = chidb_dbm_hash_bytes(hash->probe, hash->plen);
+    hash->part = chidb_dbm_hash_part(hash->phash);
+    part = &hash->parts[hash->part];
+
+    if(part->nentries == 0)
+        return CHIDB_ENOTFOUND;
+    if((rc = chidb_dbm_hash_load(hash, hash->part)) != CHIDB_OK)
+        return rc;
+
+    return chidb_dbm_hash_find(hash, part->buckets[hash->phash & (part->nbuckets - 1)], key, record, rlen);
+}
+
+
+/* Move on to the next row with the value that was last looked up
+ *
+ * Parameters
+ * - hash: Hash table
+ * - key, record, rlen: Out parameters for the key and the record of the
+ *   row (see chidb_dbm_hash_probe)
+ *
+ * Return
+ * - CHIDB_OK: A row was found
+ * - CHIDB_ENOTFOUND: There are no more rows with the value
+ */
+int chidb_dbm_hash_next(chidb_dbm_hash_t *hash, chidb_key_t *key, uint8_t **record, uint32_t *rlen)
+{
+    if(hash->entry == 0)
+        return CHIDB_ENOTFOUND;
+
+    return chidb_dbm_hash_find(hash, ENTRY(&hash->parts[hash->part], hash->entry - 1)->next, key, record, rlen);
+}
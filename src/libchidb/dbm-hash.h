@@ -0,0 +1,144 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine hash tables
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DBM_HASH_H_
+#define DBM_HASH_H_
+
+#include "chidbInt.h"
+#include "dbm-types.h"
+
+/* Hash tables for hash joins
+ *
+ * A hash table holds rows of a table (their key and a copy of their
+ * record), each of them under a value (the value of the column the
+ * table is joined on). It is filled by HashBuild, and then looked up by
+ * HashProbe and HashNext, which position a hash cursor on the matching
+ * rows so they can be read with Column and Key like any other row.
+ *
+ * The rows are split into DBM_HASH_PARTITIONS partitions by the hash of
+ * their value. Once the rows held in memory take up more than the table's
+ * memory budget, the largest partition in memory is spilled to a temporary
+ * file, and any rows added to it later are written to the file too. When
+ * a value is looked up in a spilled partition, the partition is read back
+ * into memory, and kept there for later probes. To make room for it
+ * within the budget, the spilled partitions that were read back are
+ * dropped from memory again (the least recently probed first), and then,
+ * if that is not enough, more partitions are spilled. Only a partition
+ * that doesn't fit in the budget on its own goes over it.
+ *
+ * The rows being looked up come one at a time from the loops the hash
+ * table is probed in, so they are not partitioned themselves: a join that
+ * spills is still correct, but a probe may have to read a partition back
+ * again. The optimizer counts that in the cost of a hash join (see
+ * chidb_cost_hash_spill), and reads the table in nested loops instead if
+ * that is expected to be cheaper.
+ */
+#define DBM_HASH_PARTITIONS (16)
+
+/* Default memory budget, in bytes */
+#define DBM_HASH_BUDGET (8 * 1024 * 1024)
+
+/* Entries of a partition are stored one after the other, each of them
+ * followed by its (encoded) value and its record, and padded to a
+ * multiple of 4 bytes */
+typedef struct chidb_dbm_hash_entry
+{
+    uint32_t next;      /* Offset + 1 of the next entry in the bucket (0 if none) */
+    uint32_t hash;
+    chidb_key_t key;    /* Key of the row */
+    uint32_t vlen;      /* Bytes in the encoded value */
+    uint32_t rlen;      /* Bytes in the record */
+} chidb_dbm_hash_entry_t;
+
+typedef struct chidb_dbm_hash_partition
+{
+    /* Entries (only if the partition is in memory) */
+    uint8_t *data;
+    uint32_t size;
+    uint32_t used;
+
+    /* Offset + 1 of the first entry in each bucket (0 if empty) */
+    uint32_t *buckets;
+    uint32_t nbuckets;
+
+    uint32_t nentries;
+
+    /* File the partition has been spilled to (NULL if it hasn't), and
+     * the number of bytes in it */
+    FILE *file;
+    uint32_t file_size;
+
+    /* When the partition was last probed (see chidb_dbm_hash_load) */
+    uint32_t probed;
+} chidb_dbm_hash_partition_t;
+
+struct chidb_dbm_hash
+{
+    chidb_dbm_hash_partition_t parts[DBM_HASH_PARTITIONS];
+
+    /* Bytes of entries and buckets in memory, and how many there can
+     * be before a partition is spilled */
+    size_t memory;
+    size_t budget;
+
+    /* Spilled partitions that have been read back into memory (one bit
+     * per partition), and the number of probes so far */
+    uint32_t loaded;
+    uint32_t clock;
+
+    /* Value being looked up (encoded), and the entry it was last found in
+     * (offset + 1 into partition part, 0 if none) */
+    uint8_t *probe;
+    uint32_t plen;
+    uint32_t psize;
+    uint32_t phash;
+    int32_t part;
+    uint32_t entry;
+};
+typedef struct chidb_dbm_hash chidb_dbm_hash_t;
+
+int chidb_dbm_hash_new(chidb_dbm_hash_t **hash, size_t budget);
+int chidb_dbm_hash_free(chidb_dbm_hash_t *hash);
+int chidb_dbm_hash_insert(chidb_dbm_hash_t *hash, chidb_dbm_register_t *value,
+                          chidb_key_t key, const uint8_t *record, uint32_t rlen);
+int chidb_dbm_hash_probe(chidb_dbm_hash_t *hash, chidb_dbm_register_t *value,
+                         chidb_key_t *key, uint8_t **record, uint32_t *rlen);
+int chidb_dbm_hash_next(chidb_dbm_hash_t *hash, chidb_key_t *key, uint8_t **record, uint32_t *rlen);
+
+#endif /* DBM_HASH_H_ */
@@ -0,0 +1,483 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine index builds
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "dbm-idxbuild.h"
+#include "record.h"
+#include "arena.h"
+
+typedef struct idxbuild idxbuild_t;
+
+/* A worker thread */
+typedef struct idxbuild_worker
+{
+    idxbuild_t *build;
+    pthread_t thread;
+    bool started;
+    int rc;
+
+    /* The worker's entries, and the arena their records are made in */
+    chidb_dbm_sorter_t *sorter;
+    uint32_t nentries;
+    Arena arena;
+
+    /* While merging: keyIdx of the worker's current entry (unless it's
+     * run out of entries) */
+    chidb_key_t key;
+    bool done;
+} idxbuild_worker_t;
+
+struct idxbuild
+{
+    BTree *bt;
+    chidb_dbm_idxbuild_t *spec;
+
+    /* Subtrees of the table, and the next one to be taken by a worker */
+    npage_t *subtrees;
+    uint32_t nsubtrees;
+    uint32_t next;
+    /* Set once a worker fails, so the others stop early */
+    volatile bool failed;
+
+    idxbuild_worker_t *workers;
+    uint32_t nworkers;
+
+    /* While merging: the worker whose entry was returned last, and that
+     * entry's keyIdx */
+    idxbuild_worker_t *last;
+    chidb_key_t last_key;
+};
+
+
+/* Splits the table into at least DBM_IDXBUILD_SPLIT subtrees per worker
+ * (or into its leaves), by replacing each subtree with its children */
+static int idxbuild_split(idxbuild_t *build, uint32_t nthreads)
+{
+    BTreeNode *node;
+    BTreeCell cell;
+    int err;
+
+    if((build->subtrees = malloc(sizeof(npage_t))) == NULL)
+        return CHIDB_ENOMEM;
+    build->subtrees[0] = build->spec->table_root;
+    build->nsubtrees = 1;
+
+    while(build->nsubtrees < nthreads * DBM_IDXBUILD_SPLIT)
+    {
+        npage_t *children = NULL;
+        uint32_t nchildren = 0;
+        bool internal = false;
+
+        for(uint32_t i = 0; i < build->nsubtrees; i++)
+        {
+            npage_t *grown;
+
+            if((err = chidb_Btree_getNodeByPage(build->bt, build->subtrees[i], &node)) != CHIDB_OK)
+            {
+                free(children);
+                return err;
+            }
+            grown = realloc(children, sizeof(npage_t) * (nchildren + node->n_cells + 1));
+            if(grown == NULL)
+            {
+                free(children);
+                chidb_Btree_freeMemNode(build->bt, node);
+                return CHIDB_ENOMEM;
+            }
+            children = grown;
+
+            if(node->type == PGTYPE_TABLE_INTERNAL)
+            {
+                internal = true;
+                for(ncell_t j = 0; j < node->n_cells; j++)
+                {
+                    chidb_Btree_getCell(node, j, &cell);
+                    children[nchildren++] = cell.fields.tableInternal.child_page;
+                }
+                children[nchildren++] = node->right_page;
+            }
+            else
+                children[nchildren++] = build->subtrees[i];
+
+            chidb_Btree_freeMemNode(build->bt, node);
+        }
+
+        free(build->subtrees);
+        build->subtrees = children;
+        build->nsubtrees = nchildren;
+
+        if(!internal)
+            break;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Reads column c of a row (c is -1 for its key) into a register. Strings
+ * are copied into the worker's arena, so they're null-terminated */
+static int idxbuild_value(idxbuild_worker_t *w, DBRecordView *row, chidb_key_t key, int32_t c,
+                          chidb_dbm_register_t *value)
+{
+    int rc;
+
+    if(c < 0)
+    {
+        value->type = REG_INT32;
+        value->value.i = key;
+        return CHIDB_OK;
+    }
+
+    if((rc = chidb_dbm_record_value(row, c, value)) != CHIDB_OK)
+        return rc;
+    if(value->type == REG_STRING &&
+       chidb_Arena_strndup(&w->arena, value->value.s, value->slen, &value->value.s) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    return CHIDB_OK;
+}
+
+/* Reads an integer field of a record made by idxbuild_row */
+static chidb_key_t idxbuild_key(DBRecordView *record, uint8_t field)
+{
+    chidb_dbm_register_t value;
+
+    chidb_dbm_record_value(record, field, &value);
+
+    return value.type == REG_INT64 ? (chidb_key_t) value.value.i64 : (chidb_key_t) value.value.i;
+}
+
+/* Adds the entry of a row to the worker's sorter, as a record of its
+ * keyIdx, its keyPk, and the record of its included columns (if any) */
+static int idxbuild_row(idxbuild_worker_t *w, BTreeCell *cell)
+{
+    chidb_dbm_idxbuild_t *spec = w->build->spec;
+    DBRecordView row;
+    DBRecordBuffer dbrb;
+    DBRecord *dbr;
+    chidb_dbm_register_t value;
+    chidb_key_t key;
+    uint8_t *included = NULL, *raw;
+    uint32_t size = 0;
+    int rc;
+
+    chidb_Arena_reset(&w->arena);
+    chidb_DBRecordView_init(&row, cell->fields.tableLeaf.data);
+
+    /* keyIdx is the value as IdxInsert would store it: a 32-bit integer
+     * (read from a register's value.i), taken as an unsigned key, so a
+     * negative value comes after all the others */
+    if((rc = idxbuild_value(w, &row, cell->key, spec->column, &value)) != CHIDB_OK)
+        return rc;
+    if(value.type == REG_NULL)
+        return CHIDB_OK;
+    else if(value.type == REG_INT32)
+        key = (chidb_key_t) value.value.i;
+    else if(value.type == REG_INT64 && value.value.i64 >= INT32_MIN && value.value.i64 <= INT32_MAX)
+        key = (chidb_key_t) (int32_t) value.value.i64;
+    else
+        return CHIDB_EMISMATCH;
+
+    if(spec->nincluded > 0)
+    {
+        if(chidb_DBRecord_create_empty_arena(&dbrb, spec->nincluded, &w->arena) != CHIDB_OK)
+            return CHIDB_ENOMEM;
+        chidb_DBRecord_setFormat(&dbrb, w->build->bt->record_format);
+        for(uint32_t i = 0; i < spec->nincluded; i++)
+        {
+            if((rc = idxbuild_value(w, &row, cell->key, spec->included[i], &value)) != CHIDB_OK)
+                return rc;
+            if((rc = chidb_dbm_record_append(&dbrb, &value)) != CHIDB_OK)
+                return rc;
+        }
+        chidb_DBRecord_finalize(&dbrb, &dbr);
+        if(chidb_DBRecord_pack(dbr, &included) != CHIDB_OK)
+            return CHIDB_ENOMEM;
+        size = dbr->packed_len;
+        if(size > INDEXCELL_MAX_DATA)
+            return CHIDB_ECONSTRAINT;
+    }
+
+    /* The compact format stores keys in as few bytes as it can. Both
+     * keys are stored as non-negative integers, so the sorter's signed
+     * comparison orders them like the B-Tree does */
+    if(chidb_DBRecord_create_empty_arena(&dbrb, included != NULL ? 3 : 2, &w->arena) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    chidb_DBRecord_setFormat(&dbrb, RECORD_FORMAT_COMPACT);
+    if(chidb_DBRecord_appendInt64(&dbrb, (int64_t) key) != CHIDB_OK ||
+       chidb_DBRecord_appendInt64(&dbrb, (int64_t) cell->key) != CHIDB_OK ||
+       (included != NULL && chidb_DBRecord_appendBlob(&dbrb, included, size) != CHIDB_OK))
+        return CHIDB_ENOMEM;
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+    if(chidb_DBRecord_pack(dbr, &raw) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    w->nentries++;
+    return chidb_dbm_sorter_insert(w->sorter, raw, dbr->packed_len);
+}
+
+/* Adds the entries of the rows in a subtree of the table */
+static int idxbuild_scan(idxbuild_worker_t *w, npage_t npage)
+{
+    BTreeNode *node;
+    BTreeCell cell;
+    int err;
+
+    check_fail(chidb_Btree_getNodeByPage(w->build->bt, npage, &node));
+
+    for(ncell_t i = 0; i < node->n_cells && err == CHIDB_OK && !w->build->failed; i++)
+    {
+        chidb_Btree_getCell(node, i, &cell);
+        if(node->type == PGTYPE_TABLE_LEAF)
+            err = idxbuild_row(w, &cell);
+        else
+            err = idxbuild_scan(w, cell.fields.tableInternal.child_page);
+    }
+    if(err == CHIDB_OK && node->type == PGTYPE_TABLE_INTERNAL)
+        err = idxbuild_scan(w, node->right_page);
+
+    chidb_Btree_freeMemNode(w->build->bt, node);
+    return err;
+}
+
+/* Body of a worker: scans subtrees until there are none left, and then
+ * sorts its entries */
+static void *idxbuild_work(void *arg)
+{
+    idxbuild_worker_t *w = arg;
+    idxbuild_t *build = w->build;
+    uint32_t i;
+
+    while(w->rc == CHIDB_OK && !build->failed &&
+          (i = __sync_fetch_and_add(&build->next, 1)) < build->nsubtrees)
+        w->rc = idxbuild_scan(w, build->subtrees[i]);
+
+    if(w->rc == CHIDB_OK && !build->failed)
+    {
+        w->rc = chidb_dbm_sorter_sort(w->sorter);
+        if(w->rc == CHIDB_ENOTFOUND)
+        {
+            w->done = true;
+            w->rc = CHIDB_OK;
+        }
+    }
+
+    if(w->rc != CHIDB_OK)
+        build->failed = true;
+
+    return NULL;
+}
+
+
+/* Reads the keyIdx of a worker's current entry */
+static void idxbuild_head(idxbuild_worker_t *w)
+{
+    DBRecordView record;
+    uint8_t *raw;
+    uint32_t rlen;
+
+    chidb_dbm_sorter_row(w->sorter, &raw, &rlen);
+    chidb_DBRecordView_init(&record, raw);
+    w->key = idxbuild_key(&record, 0);
+}
+
+/* Returns the next entry of the merge of the workers' sorted entries
+ * (see chidb_Btree_indexSource) */
+static int idxbuild_next(void *ctx, BTreeCell *cell)
+{
+    idxbuild_t *build = ctx;
+    idxbuild_worker_t *w = NULL;
+    DBRecordView record;
+    uint8_t *raw;
+    uint32_t rlen;
+    int rc;
+
+    /* The entry returned last time is only moved past now, since its
+     * record had to remain valid until this call */
+    if(build->last != NULL)
+    {
+        rc = chidb_dbm_sorter_next(build->last->sorter);
+        if(rc == CHIDB_ENOTFOUND)
+            build->last->done = true;
+        else if(rc != CHIDB_OK)
+            return rc;
+        else
+            idxbuild_head(build->last);
+    }
+
+    /* There are few workers, so the smallest entry is simply searched for */
+    for(uint32_t i = 0; i < build->nworkers; i++)
+        if(!build->workers[i].done && (w == NULL || build->workers[i].key < w->key))
+            w = &build->workers[i];
+    if(w == NULL)
+        return CHIDB_ENOTFOUND;
+
+    /* Index B-Trees are keyed on keyIdx alone, so keys must be strictly
+     * increasing: equal keys are duplicates, which are always adjacent
+     * in the merge, and smaller ones would make a B-Tree that can't be
+     * searched */
+    if(build->last != NULL && w->key <= build->last_key)
+        return w->key == build->last_key ? CHIDB_ECONSTRAINT : CHIDB_ECORRUPT;
+    build->last = w;
+    build->last_key = w->key;
+
+    chidb_dbm_sorter_row(w->sorter, &raw, &rlen);
+    chidb_DBRecordView_init(&record, raw);
+    cell->type = PGTYPE_INDEX_LEAF;
+    cell->key = w->key;
+    cell->fields.indexLeaf.keyPk = idxbuild_key(&record, 1);
+    cell->fields.indexLeaf.data_size = 0;
+    cell->fields.indexLeaf.data = NULL;
+    if(build->spec->nincluded > 0)
+    {
+        const uint8_t *data;
+        int size;
+
+        chidb_DBRecordView_getBlob(&record, 2, &data, &size);
+        cell->fields.indexLeaf.data_size = size;
+        cell->fields.indexLeaf.data = (uint8_t *) data;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Build an index from its table
+ *
+ * Adds an entry for every row of a table to an empty index B-Tree,
+ * using several worker threads (see dbm-idxbuild.h).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - spec: Index to build
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECONSTRAINT: Two rows have the same value in the indexed
+ *                      column, or the record of a row's included columns
+ *                      is larger than INDEXCELL_MAX_DATA
+ * - CHIDB_EMISMATCH: A value in the indexed column is not a 32-bit
+ *                    integer
+ * - CHIDB_EMISUSE: The index B-Tree is not empty
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_dbm_idxbuild(BTree *bt, chidb_dbm_idxbuild_t *spec)
+{
+    idxbuild_t build;
+    uint32_t nthreads = spec->nthreads, nentries = 0;
+    int rc;
+
+    memset(&build, 0, sizeof(build));
+    build.bt = bt;
+    build.spec = spec;
+
+    if(nthreads == 0)
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = n > 0 ? n : 1;
+    }
+    if(nthreads > DBM_IDXBUILD_MAX_THREADS)
+        nthreads = DBM_IDXBUILD_MAX_THREADS;
+
+    if((rc = idxbuild_split(&build, nthreads)) != CHIDB_OK)
+    {
+        free(build.subtrees);
+        return rc;
+    }
+
+    build.nworkers = nthreads < build.nsubtrees ? nthreads : build.nsubtrees;
+    if((build.workers = calloc(build.nworkers, sizeof(idxbuild_worker_t))) == NULL)
+    {
+        free(build.subtrees);
+        return CHIDB_ENOMEM;
+    }
+    for(uint32_t i = 0; i < build.nworkers && rc == CHIDB_OK; i++)
+    {
+        build.workers[i].build = &build;
+        chidb_Arena_init(&build.workers[i].arena);
+        rc = chidb_dbm_sorter_new(&build.workers[i].sorter, "+", DBM_IDXBUILD_BUDGET, 0);
+    }
+
+    /* This thread is the first worker. If a thread can't be started,
+     * its worker runs here afterwards (and finds nothing left to scan) */
+    if(rc == CHIDB_OK)
+    {
+        for(uint32_t i = 1; i < build.nworkers; i++)
+            build.workers[i].started =
+                pthread_create(&build.workers[i].thread, NULL, idxbuild_work, &build.workers[i]) == 0;
+        idxbuild_work(&build.workers[0]);
+        for(uint32_t i = 1; i < build.nworkers; i++)
+        {
+            if(build.workers[i].started)
+                pthread_join(build.workers[i].thread, NULL);
+            else
+                idxbuild_work(&build.workers[i]);
+        }
+
+        for(uint32_t i = 0; i < build.nworkers; i++)
+        {
+            if(rc == CHIDB_OK)
+                rc = build.workers[i].rc;
+            nentries += build.workers[i].nentries;
+        }
+    }
+
+    if(rc == CHIDB_OK)
+    {
+        for(uint32_t i = 0; i < build.nworkers; i++)
+            if(!build.workers[i].done)
+                idxbuild_head(&build.workers[i]);
+        rc = chidb_Btree_loadIndex(bt, spec->index_root, nentries, spec->nincluded > 0, idxbuild_next, &build);
+    }
+
+    for(uint32_t i = 0; i < build.nworkers; i++)
+    {
+        if(build.workers[i].sorter != NULL)
+            chidb_dbm_sorter_free(build.workers[i].sorter);
+        chidb_Arena_free(&build.workers[i].arena);
+    }
+    free(build.workers);
+    free(build.subtrees);
+
+    return rc;
+}
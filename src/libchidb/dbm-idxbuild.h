@@ -0,0 +1,96 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine index builds
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DBM_IDXBUILD_H_
+#define DBM_IDXBUILD_H_
+
+#include "chidbInt.h"
+#include "dbm-types.h"
+#include "dbm-sorter.h"
+#include "btree.h"
+
+/* Building an index from its table (for CREATE INDEX)
+ *
+ * Adding the rows of a table to a new index one at a time would search
+ * the index (and often split one of its nodes) for every row. Instead,
+ * the index is built in three steps:
+ *
+ * 1. The table B-Tree is split into subtrees (that is, into key ranges),
+ *    by going down from its root until there are at least
+ *    DBM_IDXBUILD_SPLIT of them per worker thread. The workers take
+ *    them one at a time, so a worker that gets a smaller subtree just
+ *    takes another one sooner.
+ *
+ * 2. Each worker reads the rows of its subtrees, and adds an entry
+ *    (keyIdx, keyPk, and the record of the included columns of a covering
+ *    index) for each of them to a sorter of its own, which is then
+ *    sorted by keyIdx (see dbm-sorter.h). Pages are read with pread, so
+ *    the workers don't have to take turns reading them.
+ *
+ * 3. The sorted entries of all the workers are merged, and the index
+ *    B-Tree is written bottom-up from them (see chidb_Btree_loadIndex).
+ *
+ * Rows with a NULL in the indexed column are not added to the index. Since
+ * index B-Trees are keyed on keyIdx alone, the build fails if two rows
+ * have the same value in the indexed column.
+ */
+
+/* Most worker threads used to build an index */
+#define DBM_IDXBUILD_MAX_THREADS (64)
+
+/* Fewest subtrees the table is split into per worker (if it's that large) */
+#define DBM_IDXBUILD_SPLIT (4)
+
+/* Memory budget of each worker's sorter, in bytes */
+#define DBM_IDXBUILD_BUDGET DBM_SORTER_BUDGET
+
+/* An index to build */
+typedef struct chidb_dbm_idxbuild
+{
+    npage_t table_root;
+    npage_t index_root;     /* Root of an empty index B-Tree */
+    int32_t column;         /* Column the index is on (-1 for the table's key) */
+    int32_t *included;      /* Included columns (-1 for the table's key) */
+    uint32_t nincluded;
+    uint32_t nthreads;      /* Number of worker threads (0 for one per processor) */
+} chidb_dbm_idxbuild_t;
+
+int chidb_dbm_idxbuild(BTree *bt, chidb_dbm_idxbuild_t *build);
+
+#endif /* DBM_IDXBUILD_H_ */
@@ -41,6 +41,13 @@
 #include "dbm.h"
 #include "btree.h"
 #include "record.h"
+#include "dbm-batch.h"
+#include "dbm-hash.h"
+#include "dbm-sorter.h"
+#include "dbm-agg.h"
+#include "dbm-set.h"
+#include "dbm-idxbuild.h"
+#include "stats.h"
 
 
 /* Function pointer for dispatch table */
@@ -60,12 +67,12 @@ struct handler_entry
  * ...
  * int chidb_dbm_op_Halt(chidb_stmt *stmt, chidb_dbm_op_t *op);
  */
-#define HANDLER_PROTOTYPE(OP) int chidb_dbm_op_## OP (chidb_stmt *stmt, chidb_dbm_op_t *op);
+#define HANDLER_PROTOTYPE(OP, JUMP) int chidb_dbm_op_## OP (chidb_stmt *stmt, chidb_dbm_op_t *op);
 FOREACH_OP(HANDLER_PROTOTYPE)
 
 
 /* Ladies and gentlemen, the dispatch table. */
-#define HANDLER_ENTRY(OP) { Op_ ## OP, chidb_dbm_op_## OP},
+#define HANDLER_ENTRY(OP, JUMP) { Op_ ## OP, chidb_dbm_op_## OP},
 
 struct handler_entry dbm_handlers[] =
 {
@@ -78,6 +85,92 @@ int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* The interpreter loop.
+ *
+ * Instead of going through the dispatch table for every instruction,
+ * the loop calls each handler directly. When compiled with GCC (or any
+ * compiler that supports labels as values) every handler gets its own
+ * label, and each one jumps straight to the label of the next
+ * instruction (direct threading), so there is no central loop and the
+ * branch predictor can learn the sequence of instructions in the program.
+ * Other compilers (or defining CHIDB_DBM_NO_COMPUTED_GOTO) get an
+ * equivalent loop with a switch.
+ *
+ * The program counter is kept in a local variable, and is only written
+ * back to the statement around a handler call (handlers jump by setting
+ * stmt->pc).
+ *
+ * Parameters
+ * - stmt: DBM to run.
+ *
+ * Returns
+ * - CHIDB_OK: The end of the program was reached.
+ * - Anything other than CHIDB_OK returned by an instruction handler
+ *   (including CHIDB_ROW and CHIDB_DONE)
+ */
+#if defined(__GNUC__) && !defined(CHIDB_DBM_NO_COMPUTED_GOTO)
+#define DBM_COMPUTED_GOTO
+#endif
+
+/* Runs the handler for an instruction, and moves on to the next one */
+#define HANDLER_CALL(OP)                        \
+        stmt->pc = pc;                          \
+        rc = chidb_dbm_op_## OP (stmt, op);     \
+        pc = stmt->pc;                          \
+        if (rc != CHIDB_OK)                     \
+            goto done;                          \
+        DISPATCH();
+
+#ifdef DBM_COMPUTED_GOTO
+#define HANDLER_LABEL_ENTRY(OP, JUMP) [Op_ ## OP] = &&handler_ ## OP,
+#define HANDLER_LABEL(OP, JUMP) handler_ ## OP: HANDLER_CALL(OP)
+#define DISPATCH()                              \
+        do {                                    \
+            if (pc >= endOp)                    \
+                goto done;                      \
+            op = &ops[pc++];                    \
+            goto *handler_labels[op->opcode];   \
+        } while(0)
+#else
+#define HANDLER_LABEL(OP, JUMP) case Op_ ## OP: HANDLER_CALL(OP)
+#define DISPATCH() continue
+#endif
+
+int chidb_dbm_op_exec (chidb_stmt *stmt)
+{
+    chidb_dbm_op_t *ops = stmt->ops;
+    chidb_dbm_op_t *op;
+    uint32_t pc = stmt->pc;
+    uint32_t endOp = stmt->endOp;
+    int rc = CHIDB_OK;
+
+#ifdef DBM_COMPUTED_GOTO
+    static void *handler_labels[] =
+    {
+        FOREACH_OP(HANDLER_LABEL_ENTRY)
+    };
+
+    DISPATCH();
+
+    FOREACH_OP(HANDLER_LABEL)
+#else
+    while (pc < endOp)
+    {
+        op = &ops[pc++];
+
+        switch (op->opcode)
+        {
+            FOREACH_OP(HANDLER_LABEL)
+        }
+    }
+#endif
+
+done:
+    stmt->pc = pc;
+    return rc;
+}
+
+
 /*** INSTRUCTION HANDLER IMPLEMENTATIONS ***/
 
 
@@ -91,7 +184,13 @@ int chidb_dbm_op_OpenRead (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
 
     chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1]; 
-    chidb_dbm_cursor_new(stmt->db->bt, stmt->reg[op->p2].value.i, cursor);
+    int rc;
+    if(cursor->type != CURSOR_UNSPECIFIED)
+        chidb_dbm_cursor_free(stmt->db->bt, cursor);
+    if((rc = chidb_dbm_cursor_new(stmt->db->bt, stmt->reg[op->p2].value.i, cursor)) != CHIDB_OK) {
+        cursor->type = CURSOR_UNSPECIFIED;
+        return rc;
+    }
 
     cursor->type = CURSOR_READ; 
 
@@ -103,26 +202,55 @@ int chidb_dbm_op_OpenWrite (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
 
     chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1]; 
-    chidb_dbm_cursor_new(stmt->db->bt, stmt->reg[op->p2].value.i, cursor);
+    int rc;
+    if(cursor->type != CURSOR_UNSPECIFIED)
+        chidb_dbm_cursor_free(stmt->db->bt, cursor);
+    if((rc = chidb_dbm_cursor_new(stmt->db->bt, stmt->reg[op->p2].value.i, cursor)) != CHIDB_OK) {
+        cursor->type = CURSOR_UNSPECIFIED;
+        return rc;
+    }
     
     cursor->type = CURSOR_WRITE;
     return CHIDB_OK;
 }
 
 
+/* Close p1 * * *
+ *
+ * p1: cursor
+ *
+ * Close cursor p1 and free up any resources associated with it.
+ */
 int chidb_dbm_op_Close (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+
+    if(cursor->type != CURSOR_UNSPECIFIED)
+        chidb_dbm_cursor_free(stmt->db->bt, cursor);
+    cursor->type = CURSOR_UNSPECIFIED;
+    cursor->record_valid = false;
 
     return CHIDB_OK;
 }
 
 
+/* Rewind p1 p2 * *
+ *
+ * p1: cursor
+ * p2: jump addr
+ *
+ * Make cursor p1 point to the first entry in its B-Tree. If the
+ * B-Tree is empty, jump to p2.
+ */
 int chidb_dbm_op_Rewind (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-
     chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
-    chidb_dbm_cursor_rewind(stmt->db->bt, cursor);
+    int rc = chidb_dbm_cursor_rewind(stmt->db->bt, cursor);
+
+    if(rc == CHIDB_CANTMOVE)
+        stmt->pc = op->p2;
+    else if(rc != CHIDB_OK)
+        return rc;
 
     return CHIDB_OK;
 }
@@ -152,55 +280,182 @@ int chidb_dbm_op_Prev (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
-int chidb_dbm_op_Seek (chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* Common implementation of the Seek* instructions */
+static int chidb_dbm_op_seek (chidb_stmt *stmt, chidb_dbm_op_t *op, chidb_dbm_seek_t seek)
 {
-    /* Your code goes here */
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_key_t key = stmt->reg[op->p3].value.i;
+
+    if(chidb_dbm_cursor_table_seek(stmt->db->bt, cursor, key, seek) != CHIDB_OK) {
+        stmt->pc = op->p2;
+    }
 
     return CHIDB_OK;
 }
 
 
-int chidb_dbm_op_SeekGt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* Seek p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: jump addr
+ * p3: register containing the key
+ *
+ * Move cursor p1 to the entry with the key in p3. If there is
+ * no such entry, jump to p2. The SeekGt, SeekGe, SeekLt and SeekLe
+ * variants move the cursor to the first entry that is greater than
+ * (greater than or equal to, etc.) the key instead.
+ */
+int chidb_dbm_op_Seek (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    return chidb_dbm_op_seek(stmt, op, SEEK_EQ);
+}
 
-    return CHIDB_OK;
+
+int chidb_dbm_op_SeekGt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_op_seek(stmt, op, SEEK_GT);
 }
 
 
 int chidb_dbm_op_SeekGe (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
-
-    return CHIDB_OK;
+    return chidb_dbm_op_seek(stmt, op, SEEK_GE);
 }
 
 int chidb_dbm_op_SeekLt (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
-
-    return CHIDB_OK;
+    return chidb_dbm_op_seek(stmt, op, SEEK_LT);
 }
 
 
 int chidb_dbm_op_SeekLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    return chidb_dbm_op_seek(stmt, op, SEEK_LE);
+}
+
+/* Reads a field of a record into a register. Only the header entries
+ * up to the field are parsed, and only the value of the field is read.
+ * Strings and BLOBs are not copied: the register points into the
+ * record (so strings are not null-terminated) */
+int chidb_dbm_record_value (DBRecordView *record, uint8_t field, chidb_dbm_register_t *reg)
+{
+    switch(chidb_DBRecordView_getType(record, field)) {
+    case SQL_NULL:
+        reg->type = REG_NULL;
+        break;
+    case SQL_INTEGER_1BYTE: {
+        int8_t v;
+        chidb_DBRecordView_getInt8(record, field, &v);
+        reg->type = REG_INT32;
+        reg->value.i = v;
+        break;
+    }
+    case SQL_INTEGER_2BYTE: {
+        int16_t v;
+        chidb_DBRecordView_getInt16(record, field, &v);
+        reg->type = REG_INT32;
+        reg->value.i = v;
+        break;
+    }
+    case SQL_INTEGER_4BYTE:
+        reg->type = REG_INT32;
+        chidb_DBRecordView_getInt32(record, field, &reg->value.i);
+        break;
+    case SQL_INTEGER_8BYTE:
+        reg->type = REG_INT64;
+        chidb_DBRecordView_getInt64(record, field, &reg->value.i64);
+        break;
+    case SQL_DOUBLE:
+        reg->type = REG_DOUBLE;
+        chidb_DBRecordView_getDouble(record, field, &reg->value.d);
+        break;
+    case SQL_TEXT: {
+        const uint8_t* s;
+        int len;
+        chidb_DBRecordView_getString(record, field, &s, &len);
+        reg->type = REG_STRING;
+        reg->value.s = (char*) s;
+        reg->slen = len;
+        break;
+    }
+    case SQL_BLOB: {
+        const uint8_t* b;
+        int len;
+        chidb_DBRecordView_getBlob(record, field, &b, &len);
+        reg->type = REG_BINARY;
+        reg->value.bin.bytes = (uint8_t*) b;
+        reg->value.bin.nbytes = len;
+        break;
+    }
+    default:
+        return CHIDB_ECORRUPT;
+    }
 
     return CHIDB_OK;
 }
 
-int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* Copies the string or BLOB a register points to into the statement's
+ * arena (strings are null-terminated in the process). Registers hold
+ * copies because the data they point to goes away when the cursor moves
+ * (or the batch is refilled); since the arena is released in bulk,
+ * this is the one copy we make */
+static int chidb_dbm_reg_own (chidb_stmt *stmt, chidb_dbm_register_t *reg)
 {
-    /* Your code goes here */
+    if(reg->type == REG_STRING) {
+        if(chidb_Arena_strndup(&stmt->arena, reg->value.s, reg->slen, &reg->value.s) != CHIDB_OK)
+            return CHIDB_ENOMEM;
+    } else if(reg->type == REG_BINARY) {
+        void* copy;
+        if(chidb_Arena_alloc(&stmt->arena, reg->value.bin.nbytes, &copy) != CHIDB_OK)
+            return CHIDB_ENOMEM;
+        memcpy(copy, reg->value.bin.bytes, reg->value.bin.nbytes);
+        reg->value.bin.bytes = copy;
+    }
 
     return CHIDB_OK;
 }
 
+/* Reads column p2 of a record into register p3 */
+static int chidb_dbm_column (chidb_stmt *stmt, DBRecordView *record, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t* reg = &stmt->reg[op->p3];
+    int rc;
+
+    if((rc = chidb_dbm_record_value(record, op->p2, reg)) != CHIDB_OK)
+        return rc;
+
+    return chidb_dbm_reg_own(stmt, reg);
+}
+
+int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+
+    DBRecordView* record;
+    int rc;
+
+    /* On an index, reads an included column of a covering index */
+    if((rc = chidb_dbm_cursor_record(cursor, &record)) != CHIDB_OK)
+        return rc;
+
+    return chidb_dbm_column(stmt, record, op);
+}
+
 
+/* Key p1 p2 * *
+ *
+ * p1: cursor
+ * p2: register
+ *
+ * Store the key of the entry cursor p1 is pointing at in register p2
+ */
 int chidb_dbm_op_Key (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_register_t* reg = &stmt->reg[op->p2];
+
+    reg->type = REG_INT32;
+    reg->value.i = cursor->cell.key;
 
     return CHIDB_OK;
 }
@@ -222,6 +477,42 @@ int chidb_dbm_op_Integer (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Int64 * p2 * p4 *
+ *
+ * p2: register
+ * p4: the value, as a string
+ *
+ * Store a 64-bit integer in register p2
+ */
+int chidb_dbm_op_Int64 (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t* reg = &stmt->reg[op->p2];
+
+    reg->type = REG_INT64;
+    reg->value.i64 = strtoll(op->p4, NULL, 10);
+
+    return CHIDB_OK;
+}
+
+
+/* Real * p2 * p4 *
+ *
+ * p2: register
+ * p4: the value, as a string
+ *
+ * Store a double in register p2
+ */
+int chidb_dbm_op_Real (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t* reg = &stmt->reg[op->p2];
+
+    reg->type = REG_DOUBLE;
+    reg->value.d = strtod(op->p4, NULL);
+
+    return CHIDB_OK;
+}
+
+
 int chidb_dbm_op_String (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     // Seperate the operators
@@ -233,6 +524,7 @@ int chidb_dbm_op_String (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     reg->type = REG_STRING;
     reg->value.s = string;
+    reg->slen = op->p1;
 
     return CHIDB_OK;
 }
@@ -254,25 +546,151 @@ int chidb_dbm_op_Null (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
 int chidb_dbm_op_ResultRow (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    stmt->startRR = op->p1;
+    stmt->nRR = op->p2;
 
-    return CHIDB_OK;
+    return CHIDB_ROW;
+}
+
+
+/* Appends the value of a register to a record (strings must be
+ * null-terminated) */
+int chidb_dbm_record_append (DBRecordBuffer *dbrb, chidb_dbm_register_t *reg)
+{
+    switch(reg->type) {
+    case REG_NULL:
+        return chidb_DBRecord_appendNull(dbrb);
+    case REG_INT32:
+        // Use the smallest integer type that can hold the value (the
+        // compact format picks its own integer types regardless)
+        if(reg->value.i >= INT8_MIN && reg->value.i <= INT8_MAX)
+            return chidb_DBRecord_appendInt8(dbrb, reg->value.i);
+        else if(reg->value.i >= INT16_MIN && reg->value.i <= INT16_MAX)
+            return chidb_DBRecord_appendInt16(dbrb, reg->value.i);
+        else
+            return chidb_DBRecord_appendInt32(dbrb, reg->value.i);
+    case REG_INT64:
+        return chidb_DBRecord_appendInt64(dbrb, reg->value.i64);
+    case REG_DOUBLE:
+        return chidb_DBRecord_appendDouble(dbrb, reg->value.d);
+    case REG_STRING:
+        return chidb_DBRecord_appendString(dbrb, reg->value.s);
+    case REG_BINARY:
+        return chidb_DBRecord_appendBlob(dbrb, reg->value.bin.bytes, reg->value.bin.nbytes);
+    default:
+        return CHIDB_EMISMATCH;
+    }
 }
 
 
+/* MakeRecord p1 p2 p3 *
+ *
+ * p1: first register
+ * p2: number of registers
+ * p3: register to store the record in
+ *
+ * The record, and the register's binary value, are allocated in the
+ * statement's arena, so nothing has to be freed once it's been inserted.
+ */
 int chidb_dbm_op_MakeRecord (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    DBRecordBuffer dbrb;
+    DBRecord* dbr;
+    uint8_t* raw;
+
+    if(chidb_DBRecord_create_empty_arena(&dbrb, op->p2, &stmt->arena) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    chidb_DBRecord_setFormat(&dbrb, stmt->db->bt->record_format);
+
+    for(int i = op->p1; i < op->p1 + op->p2; i++) {
+        int rc;
+
+        if((rc = chidb_dbm_record_append(&dbrb, &stmt->reg[i])) != CHIDB_OK)
+            return rc;
+    }
+
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+    if(chidb_DBRecord_pack(dbr, &raw) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+
+    chidb_dbm_register_t* reg = &stmt->reg[op->p3];
+    reg->type = REG_BINARY;
+    reg->value.bin.bytes = raw;
+    reg->value.bin.nbytes = dbr->packed_len;
 
     return CHIDB_OK;
 }
 
 
+/* Insert p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: register containing the record
+ * p3: register containing the key
+ *
+ * Fails with CHIDB_ECONSTRAINT if the table already has an entry
+ * with that key.
+ */
 int chidb_dbm_op_Insert (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_register_t* record = &stmt->reg[op->p2];
+    chidb_key_t key = stmt->reg[op->p3].value.i;
+    int rc;
 
-    return CHIDB_OK;
+    rc = chidb_Btree_insertInTable(stmt->db->bt, cursor->root_page, key,
+                                   record->value.bin.bytes, record->value.bin.nbytes);
+
+    return rc == CHIDB_EDUPLICATE ? CHIDB_ECONSTRAINT : rc;
+}
+
+/* Orders register types the way values of different storage classes
+ * are ordered: numbers < strings < BLOBs */
+static inline int chidb_dbm_reg_class(register_type_t type)
+{
+    switch(type) {
+    case REG_INT32:
+    case REG_INT64:
+    case REG_DOUBLE:
+        return 1;
+    case REG_STRING:
+        return 2;
+    case REG_BINARY:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+/* Returns the value of a numeric register as a double */
+static inline double chidb_dbm_reg_double(const chidb_dbm_register_t* reg)
+{
+    switch(reg->type) {
+    case REG_INT32:
+        return reg->value.i;
+    case REG_INT64:
+        return reg->value.i64;
+    default:
+        return reg->value.d;
+    }
+}
+
+/* Compares two strings using their cached lengths. Returns a negative
+ * number, zero, or a positive number if s1 is less than, equal
+ * to, or greater than s2 */
+static inline int chidb_dbm_reg_strcmp(const chidb_dbm_register_t *s1, const chidb_dbm_register_t *s2)
+{
+    uint32_t n1 = s1->slen, n2 = s2->slen;
+    int c = memcmp(s1->value.s, s2->value.s, n1 < n2 ? n1 : n2);
+    return c != 0 ? c : (n1 > n2) - (n1 < n2);
+}
+
+/* Like chidb_dbm_reg_strcmp, but only tells whether two strings are
+ * equal (zero) or not (non-zero), which is cheaper when their
+ * lengths are different */
+static inline int chidb_dbm_reg_strneq(const chidb_dbm_register_t *s1, const chidb_dbm_register_t *s2)
+{
+    return s1->slen != s2->slen || memcmp(s1->value.s, s2->value.s, s1->slen) != 0;
 }
 
 /**
@@ -280,24 +698,43 @@ int chidb_dbm_op_Insert (chidb_stmt *stmt, chidb_dbm_op_t *op)
  * 0: r1 == r2
  * 1: r2 > r1
 **/
-int chidb_dbm_op_compare_reg(chidb_dbm_register_t reg1, chidb_dbm_register_t reg2)
+int chidb_dbm_op_compare_reg(const chidb_dbm_register_t *reg1, const chidb_dbm_register_t *reg2)
 {
+    int class1 = chidb_dbm_reg_class(reg1->type);
+    int class2 = chidb_dbm_reg_class(reg2->type);
 
-    if(reg1.type == REG_INT32) {
-        if(reg1.value.i < reg2.value.i)
-            return 1;
-        else if(reg1.value.i == reg2.value.i)
-            return 0;
-        else
-            return -1;
-    } else if(reg1.type == REG_STRING) {
-        return strcmp(reg2.value.s, reg1.value.s);
-    } else {
+    if(class1 == 0 || class2 == 0) {
         return 0; // NULL is undefined
+    } else if(class1 != class2) {
+        return (class1 < class2) - (class1 > class2);
     }
 
+    if(reg1->type == REG_INT32 && reg2->type == REG_INT32) {
+        return (reg1->value.i < reg2->value.i) - (reg1->value.i > reg2->value.i);
+    } else if(class1 == 1 && reg1->type != REG_DOUBLE && reg2->type != REG_DOUBLE) {
+        int64_t i1 = reg1->type == REG_INT32 ? reg1->value.i : reg1->value.i64;
+        int64_t i2 = reg2->type == REG_INT32 ? reg2->value.i : reg2->value.i64;
+        return (i1 < i2) - (i1 > i2);
+    } else if(class1 == 1) {
+        double d1 = chidb_dbm_reg_double(reg1);
+        double d2 = chidb_dbm_reg_double(reg2);
+        return (d1 < d2) - (d1 > d2);
+    } else if(reg1->type == REG_STRING) {
+        return chidb_dbm_reg_strcmp(reg2, reg1);
+    } else {
+        uint32_t n1 = reg1->value.bin.nbytes, n2 = reg2->value.bin.nbytes;
+        int c = memcmp(reg2->value.bin.bytes, reg1->value.bin.bytes, n1 < n2 ? n1 : n2);
+        return c != 0 ? c : (n1 < n2) - (n1 > n2);
+    }
 }
 
+/* Eq p1 p2 p3 (Ne, Lt, Le, Gt, Ge) *
+ *
+ * Compares registers p1 and p3, and jumps to p2 if the contents of p3
+ * are equal to (not equal to, less than, etc.) the contents of p1.
+ * A comparison with NULL is never true, so these never jump if either
+ * register is NULL, whatever the operator.
+ */
 int chidb_dbm_op_Eq (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     int32_t reg1_add = op->p1;
@@ -309,7 +746,11 @@ int chidb_dbm_op_Eq (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     int32_t jmp = op->p2;
 
-    if(chidb_dbm_op_compare_reg(*reg1, *reg2) == 0) {
+    if(reg1->type == REG_NULL || reg2->type == REG_NULL) {
+        return CHIDB_OK;
+    }
+
+    if(chidb_dbm_op_compare_reg(reg1, reg2) == 0) {
         stmt->pc = jmp;
     }
 
@@ -328,7 +769,11 @@ int chidb_dbm_op_Ne (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     int32_t jmp = op->p2;
 
-    if(chidb_dbm_op_compare_reg(*reg1, *reg2) != 0) {
+    if(reg1->type == REG_NULL || reg2->type == REG_NULL) {
+        return CHIDB_OK;
+    }
+
+    if(chidb_dbm_op_compare_reg(reg1, reg2) != 0) {
         stmt->pc = jmp;
     }
     return CHIDB_OK;
@@ -346,7 +791,11 @@ int chidb_dbm_op_Lt (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     int32_t jmp = op->p2;
 
-    if(chidb_dbm_op_compare_reg(*reg1, *reg2) < 0) {
+    if(reg1->type == REG_NULL || reg2->type == REG_NULL) {
+        return CHIDB_OK;
+    }
+
+    if(chidb_dbm_op_compare_reg(reg1, reg2) < 0) {
         stmt->pc = jmp;
     }
 
@@ -365,7 +814,11 @@ int chidb_dbm_op_Le (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     int32_t jmp = op->p2;
 
-    if(chidb_dbm_op_compare_reg(*reg1, *reg2) <= 0) {
+    if(reg1->type == REG_NULL || reg2->type == REG_NULL) {
+        return CHIDB_OK;
+    }
+
+    if(chidb_dbm_op_compare_reg(reg1, reg2) <= 0) {
         stmt->pc = jmp;
     }
 
@@ -384,7 +837,11 @@ int chidb_dbm_op_Gt (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     int32_t jmp = op->p2;
 
-    if(chidb_dbm_op_compare_reg(*reg1, *reg2) > 0) {
+    if(reg1->type == REG_NULL || reg2->type == REG_NULL) {
+        return CHIDB_OK;
+    }
+
+    if(chidb_dbm_op_compare_reg(reg1, reg2) > 0) {
         stmt->pc = jmp;
     }
 
@@ -403,7 +860,11 @@ int chidb_dbm_op_Ge (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
     int32_t jmp = op->p2;
 
-    if(chidb_dbm_op_compare_reg(*reg1, *reg2) >= 0) {
+    if(reg1->type == REG_NULL || reg2->type == REG_NULL) {
+        return CHIDB_OK;
+    }
+
+    if(chidb_dbm_op_compare_reg(reg1, reg2) >= 0) {
         stmt->pc = jmp;
     }
 
@@ -411,6 +872,104 @@ int chidb_dbm_op_Ge (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Type-specialised comparisons
+ *
+ * The code generator emits these instead of Eq, Ne, etc. when it knows
+ * the types of the values being compared. They have the same operands
+ * and jump under the same conditions as the generic instructions, but
+ * skip the type dispatch in chidb_dbm_op_compare_reg. If a register
+ * turns out not to have the expected type, they fall back to the
+ * generic comparison.
+ *
+ * Like the generic instructions, these never jump if either value is
+ * NULL, whatever the operator: a comparison with NULL is never true.
+ *
+ * EqInt p1 p2 p3 (NeInt, LtInt, etc.)
+ *
+ * Compares two registers containing 32-bit integers. Does not jump if
+ * either register is NULL.
+ *
+ * EqStr p1 p2 p3 (NeStr, LtStr, etc.)
+ *
+ * Compares two registers containing strings, using their cached length.
+ * Does not jump if either register is NULL.
+ *
+ * EqConst p1 p2 p3 (NeConst, LtConst, etc.)
+ *
+ * p1: constant k
+ * p2: jump addr
+ * p3: register containing a 32-bit integer
+ *
+ * Compares the contents of register p3 with the constant k, and jumps
+ * if the contents of p3 are equal to (not equal to, less than, etc.) k.
+ * Does not jump if register p3 is NULL.
+ */
+#define FOREACH_CMP(CMP)                        \
+        CMP(Eq, ==, chidb_dbm_reg_strneq)       \
+        CMP(Ne, !=, chidb_dbm_reg_strneq)       \
+        CMP(Lt, <,  chidb_dbm_reg_strcmp)       \
+        CMP(Le, <=, chidb_dbm_reg_strcmp)       \
+        CMP(Gt, >,  chidb_dbm_reg_strcmp)       \
+        CMP(Ge, >=, chidb_dbm_reg_strcmp)
+
+#define CMP_HANDLERS(NAME, OPERATOR, STRCMP)                                    \
+int chidb_dbm_op_ ## NAME ## Int (chidb_stmt *stmt, chidb_dbm_op_t *op)        \
+{                                                                               \
+    chidb_dbm_register_t* reg1 = &stmt->reg[op->p1];                            \
+    chidb_dbm_register_t* reg2 = &stmt->reg[op->p3];                            \
+                                                                                \
+    if(reg1->type == REG_NULL || reg2->type == REG_NULL)                        \
+        return CHIDB_OK;                                                        \
+                                                                                \
+    if(reg1->type != REG_INT32 || reg2->type != REG_INT32)                      \
+        return chidb_dbm_op_ ## NAME (stmt, op);                                \
+                                                                                \
+    if(reg2->value.i OPERATOR reg1->value.i)                                    \
+        stmt->pc = op->p2;                                                      \
+                                                                                \
+    return CHIDB_OK;                                                            \
+}                                                                               \
+                                                                                \
+int chidb_dbm_op_ ## NAME ## Str (chidb_stmt *stmt, chidb_dbm_op_t *op)        \
+{                                                                               \
+    chidb_dbm_register_t* reg1 = &stmt->reg[op->p1];                            \
+    chidb_dbm_register_t* reg2 = &stmt->reg[op->p3];                            \
+                                                                                \
+    if(reg1->type == REG_NULL || reg2->type == REG_NULL)                        \
+        return CHIDB_OK;                                                        \
+                                                                                \
+    if(reg1->type != REG_STRING || reg2->type != REG_STRING)                    \
+        return chidb_dbm_op_ ## NAME (stmt, op);                                \
+                                                                                \
+    if(STRCMP(reg2, reg1) OPERATOR 0)                                           \
+        stmt->pc = op->p2;                                                      \
+                                                                                \
+    return CHIDB_OK;                                                            \
+}                                                                               \
+                                                                                \
+int chidb_dbm_op_ ## NAME ## Const (chidb_stmt *stmt, chidb_dbm_op_t *op)      \
+{                                                                               \
+    chidb_dbm_register_t* reg = &stmt->reg[op->p3];                             \
+    bool jump;                                                                  \
+                                                                                \
+    if(reg->type == REG_INT32) {                                                \
+        jump = reg->value.i OPERATOR op->p1;                                    \
+    } else if(reg->type == REG_NULL) {                                          \
+        jump = false;                                                           \
+    } else {                                                                    \
+        chidb_dbm_register_t k = { .type = REG_INT32, .value.i = op->p1 };      \
+        jump = chidb_dbm_op_compare_reg(&k, reg) OPERATOR 0;                    \
+    }                                                                           \
+                                                                                \
+    if(jump)                                                                    \
+        stmt->pc = op->p2;                                                      \
+                                                                                \
+    return CHIDB_OK;                                                            \
+}
+
+FOREACH_CMP(CMP_HANDLERS)
+
+
 /* IdxGt p1 p2 p3 *
  *
  * p1: cursor
@@ -421,8 +980,12 @@ int chidb_dbm_op_Ge (chidb_stmt *stmt, chidb_dbm_op_t *op)
  */
 int chidb_dbm_op_IdxGt (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-  fprintf(stderr,"todo: chidb_dbm_op_IdxGt\n");
-  exit(1);
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+
+    if(cursor->cell.key > (chidb_key_t) stmt->reg[op->p3].value.i)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
 }
 
 /* IdxGe p1 p2 p3 *
@@ -435,8 +998,12 @@ int chidb_dbm_op_IdxGt (chidb_stmt *stmt, chidb_dbm_op_t *op)
  */
 int chidb_dbm_op_IdxGe (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-  fprintf(stderr,"todo: chidb_dbm_op_IdxGe\n");
-  exit(1);
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+
+    if(cursor->cell.key >= (chidb_key_t) stmt->reg[op->p3].value.i)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
 }
 
 /* IdxLt p1 p2 p3 *
@@ -449,8 +1016,12 @@ int chidb_dbm_op_IdxGe (chidb_stmt *stmt, chidb_dbm_op_t *op)
  */
 int chidb_dbm_op_IdxLt (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-  fprintf(stderr,"todo: chidb_dbm_op_IdxLt\n");
-  exit(1);
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+
+    if(cursor->cell.key < (chidb_key_t) stmt->reg[op->p3].value.i)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
 }
 
 /* IdxLe p1 p2 p3 *
@@ -463,8 +1034,12 @@ int chidb_dbm_op_IdxLt (chidb_stmt *stmt, chidb_dbm_op_t *op)
  */
 int chidb_dbm_op_IdxLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-  fprintf(stderr,"todo: chidb_dbm_op_IdxLe\n");
-  exit(1);
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+
+    if(cursor->cell.key <= (chidb_key_t) stmt->reg[op->p3].value.i)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
 }
 
 
@@ -477,59 +1052,1452 @@ int chidb_dbm_op_IdxLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
  */
 int chidb_dbm_op_IdxPKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-  fprintf(stderr,"todo: chidb_dbm_op_IdxKey\n");
-  exit(1);
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_register_t* reg = &stmt->reg[op->p2];
+
+    reg->type = REG_INT32;
+    if(cursor->cell.type == PGTYPE_INDEX_INTERNAL)
+        reg->value.i = cursor->cell.fields.indexInternal.keyPk;
+    else
+        reg->value.i = cursor->cell.fields.indexLeaf.keyPk;
+
+    return CHIDB_OK;
 }
 
 /* IdxInsert p1 p2 p3 *
  *
  * p1: cursor
  * p2: register containing IdxKey
- * p2: register containing PKey
+ * p3: register containing PKey
  *
- * add new (IdkKey,PKey) entry in index BTree pointed at by cursor at p1
+ * add new (IdkKey,PKey) entry in index BTree pointed at by cursor at p1.
+ * Index B-Trees are keyed on IdxKey alone, so this fails with
+ * CHIDB_ECONSTRAINT if the index already has an entry with that IdxKey.
  */
 int chidb_dbm_op_IdxInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-  fprintf(stderr,"todo: chidb_dbm_op_IdxInsert\n");
-  exit(1);
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    int rc;
+
+    rc = chidb_Btree_insertInIndex(stmt->db->bt, cursor->root_page,
+                                   stmt->reg[op->p2].value.i, stmt->reg[op->p3].value.i);
+
+    return rc == CHIDB_EDUPLICATE ? CHIDB_ECONSTRAINT : rc;
 }
 
+/* IdxInsertRecord p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: register containing IdxKey
+ * p3: register containing PKey, followed by a register containing
+ *     the record of the included columns
+ *
+ * Same as IdxInsert, for a covering index. Fails with CHIDB_ECONSTRAINT
+ * if the index already has an entry with that IdxKey, or if the record
+ * is too large to be stored in the index (see INDEXCELL_MAX_DATA).
+ */
+int chidb_dbm_op_IdxInsertRecord (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_register_t* record = &stmt->reg[op->p3 + 1];
+    int rc;
+
+    if(record->type != REG_BINARY)
+        return CHIDB_EMISUSE;
+    if(record->value.bin.nbytes > INDEXCELL_MAX_DATA)
+        return CHIDB_ECONSTRAINT;
 
-int chidb_dbm_op_CreateTable (chidb_stmt *stmt, chidb_dbm_op_t *op)
+    rc = chidb_Btree_insertInCoveringIndex(stmt->db->bt, cursor->root_page,
+                                           stmt->reg[op->p2].value.i, stmt->reg[op->p3].value.i,
+                                           record->value.bin.bytes, record->value.bin.nbytes);
+
+    return rc == CHIDB_EDUPLICATE ? CHIDB_ECONSTRAINT : rc;
+}
+
+/* IdxBuild p1 p2 p3 p4
+ *
+ * p1: cursor on a table
+ * p2: cursor on an empty index
+ * p3: column the index is on (-1 for the table's key)
+ * p4: columns included in the index, separated by spaces (-1 for the
+ *     table's key), or NULL
+ *
+ * Add an entry for every row of the table pointed at by cursor p1 to the
+ * index pointed at by cursor p2 (except for rows with a NULL in column
+ * p3), using a worker thread per processor (see dbm-idxbuild.h). Fails
+ * with CHIDB_ECONSTRAINT if two rows have the same value in column p3,
+ * or if the record of a row's included columns is too large to be stored
+ * in the index (see INDEXCELL_MAX_DATA).
+ */
+int chidb_dbm_op_IdxBuild (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    chidb_dbm_idxbuild_t build;
+    int32_t included[DBRECORD_MAX_FIELDS];
+    char *s = op->p4, *end;
+
+    build.table_root = stmt->cursors[op->p1].root_page;
+    build.index_root = stmt->cursors[op->p2].root_page;
+    build.column = op->p3;
+    build.included = included;
+    build.nincluded = 0;
+    build.nthreads = 0;
+
+    while(s != NULL && build.nincluded < DBRECORD_MAX_FIELDS) {
+        int32_t c = strtol(s, &end, 10);
+        if(end == s)
+            break;
+        included[build.nincluded++] = c;
+        s = end;
+    }
 
-    return CHIDB_OK;
+    return chidb_dbm_idxbuild(stmt->db->bt, &build);
 }
 
 
-int chidb_dbm_op_CreateIndex (chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* Common implementation of CreateTable and CreateIndex. Since they
+ * change the schema, they also increment the schema cookie */
+static int chidb_dbm_op_create (chidb_stmt *stmt, chidb_dbm_op_t *op, uint8_t type)
 {
-    /* Your code goes here */
+    chidb_dbm_register_t* reg = &stmt->reg[op->p1];
+    npage_t npage;
+    int rc;
+
+    if((rc = chidb_Btree_newNode(stmt->db->bt, &npage, type)) != CHIDB_OK)
+        return rc;
+
+    if((rc = chidb_Btree_incrSchemaCookie(stmt->db->bt)) != CHIDB_OK)
+        return rc;
+
+    reg->type = REG_INT32;
+    reg->value.i = npage;
 
     return CHIDB_OK;
 }
 
-
-int chidb_dbm_op_Copy (chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* CreateTable p1 * * *
+ *
+ * p1: register
+ *
+ * Create a new (empty) table B-Tree and store its root page in register p1
+ */
+int chidb_dbm_op_CreateTable (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    return chidb_dbm_op_create(stmt, op, PGTYPE_TABLE_LEAF);
+}
 
-    return CHIDB_OK;
+
+/* CreateIndex p1 * * *
+ *
+ * p1: register
+ *
+ * Create a new (empty) index B-Tree and store its root page in register p1
+ */
+int chidb_dbm_op_CreateIndex (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    return chidb_dbm_op_create(stmt, op, PGTYPE_INDEX_LEAF);
 }
 
 
-int chidb_dbm_op_SCopy (chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* Analyze p1 p2 * *
+ *
+ * p1: cursor
+ * p2: register
+ *
+ * Read every entry of the B-Tree pointed at by cursor p1, and store
+ * its statistics in register p2, as a string (see stats.h)
+ */
+int chidb_dbm_op_Analyze (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_register_t* reg = &stmt->reg[op->p2];
+    chidb_key_t *keys = NULL, *more;
+    uint32_t n = 0, size = 0;
+    char *stat;
+    int rc;
+
+    for(rc = chidb_dbm_cursor_rewind(stmt->db->bt, cursor);
+        rc == CHIDB_OK;
+        rc = chidb_dbm_cursor_table_move(stmt->db->bt, cursor, true)) {
+        if(n == size) {
+            size = size == 0 ? 64 : 2 * size;
+            if((more = realloc(keys, sizeof(chidb_key_t) * size)) == NULL) {
+                free(keys);
+                return CHIDB_ENOMEM;
+            }
+            keys = more;
+        }
+        keys[n++] = cursor->cell.key;
+    }
 
-    return CHIDB_OK;
+    if(rc == CHIDB_CANTMOVE)
+        rc = chidb_stats_format(keys, n, &stat);
+    free(keys);
+    if(rc != CHIDB_OK)
+        return rc;
+
+    reg->type = REG_STRING;
+    reg->slen = strlen(stat);
+    rc = chidb_Arena_strndup(&stmt->arena, stat, reg->slen, &reg->value.s);
+    free(stat);
+
+    return rc == CHIDB_OK ? CHIDB_OK : CHIDB_ENOMEM;
 }
 
 
-int chidb_dbm_op_Halt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+/* IncrCookie * * * *
+ *
+ * Increment the schema cookie, so that statements that were prepared
+ * before are compiled again (e.g., to use new statistics)
+ */
+int chidb_dbm_op_IncrCookie (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
+    return chidb_Btree_incrSchemaCookie(stmt->db->bt);
+}
+
+
+/* AutoCommit p1 p2 * *
+ *
+ * p1: 0 to begin a transaction, 1 to end it
+ * p2: 1 to roll the transaction back instead of committing it
+ *
+ * Begin, commit or roll back a transaction. Outside a transaction,
+ * every change is written to the file as soon as it is made. Fails
+ * with CHIDB_EMISUSE when beginning a transaction inside another one,
+ * or ending a transaction when there is none.
+ */
+int chidb_dbm_op_AutoCommit (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if(op->p1 == 0)
+        return chidb_Btree_begin(stmt->db->bt);
+    else if(op->p2)
+        return chidb_Btree_rollback(stmt->db->bt);
+    else
+        return chidb_Btree_commit(stmt->db->bt);
+}
+
+
+/* Copy p1 p2 * *
+ *
+ * p1: source register
+ * p2: destination register
+ *
+ * Make a copy of register p1 in register p2. Strings and BLOBs
+ * are copied too (into the statement's arena).
+ */
+int chidb_dbm_op_Copy (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t* reg = &stmt->reg[op->p2];
+
+    *reg = stmt->reg[op->p1];
+
+    return chidb_dbm_reg_own(stmt, reg);
+}
+
+
+/* SCopy p1 p2 * *
+ *
+ * p1: source register
+ * p2: destination register
+ *
+ * Make a shallow copy of register p1 in register p2: strings and
+ * BLOBs are shared by both registers.
+ */
+int chidb_dbm_op_SCopy (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    stmt->reg[op->p2] = stmt->reg[op->p1];
+
+    return CHIDB_OK;
+}
+
+
+/* NewRowid p1 p2 * *
+ *
+ * p1: cursor
+ * p2: register
+ *
+ * Store in register p2 a key that is larger than every key in the
+ * table pointed at by cursor p1 (or 1, if the table is empty). The
+ * cursor is moved to the last entry of the table.
+ */
+int chidb_dbm_op_NewRowid (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_key_t key = 1;
+
+    if(chidb_dbm_cursor_table_seek(stmt->db->bt, cursor, UINT32_MAX, SEEK_LE) == CHIDB_OK) {
+        if(cursor->cell.key == UINT32_MAX)
+            return CHIDB_ECONSTRAINT;
+        key = cursor->cell.key + 1;
+    }
+
+    stmt->reg[op->p2].type = REG_INT32;
+    stmt->reg[op->p2].value.i = key;
+
+    return CHIDB_OK;
+}
+
+
+/* IsNull p1 p2 * *
+ *
+ * p1: register
+ * p2: jump addr
+ *
+ * Jump to p2 if register p1 is NULL.
+ */
+int chidb_dbm_op_IsNull (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if(stmt->reg[op->p1].type == REG_NULL)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* MustBeKey p1 p2 * *
+ *
+ * p1: register
+ * p2: jump addr
+ *
+ * Jump to p2 if register p1 doesn't hold a key (a non-negative
+ * integer), i.e., if it can't be the key of any entry in a B-Tree.
+ */
+int chidb_dbm_op_MustBeKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t* reg = &stmt->reg[op->p1];
+
+    if(reg->type != REG_INT32 || reg->value.i < 0)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* Variable p1 p2 * *
+ *
+ * p1: parameter (numbered from 1)
+ * p2: register
+ *
+ * Store the value bound to parameter p1 in register p2 (NULL if no
+ * value has been bound to it). Strings are not copied: they belong
+ * to the statement, and can't change while the program is running.
+ */
+int chidb_dbm_op_Variable (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t* reg = &stmt->reg[op->p2];
+
+    if(op->p1 < 1 || op->p1 > stmt->nVars)
+        reg->type = REG_NULL;
+    else
+        *reg = stmt->vars[op->p1 - 1];
+
+    return CHIDB_OK;
+}
+
+
+/* Goto _ p2 _ *
+ *
+ * p2: jump addr
+ *
+ * Jump to p2.
+ */
+int chidb_dbm_op_Goto (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* IfPos p1 p2 p3 *
+ *
+ * p1: register
+ * p2: jump addr
+ * p3: integer
+ *
+ * If register p1 holds a positive integer, subtract p3 from it and
+ * jump to p2. Used to skip the rows before an OFFSET.
+ */
+int chidb_dbm_op_IfPos (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t* reg = &stmt->reg[op->p1];
+
+    if(reg->type != REG_INT32)
+        return CHIDB_EMISMATCH;
+
+    if(reg->value.i > 0)
+    {
+        reg->value.i -= op->p3;
+        stmt->pc = op->p2;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* DecrJumpZero p1 p2 * *
+ *
+ * p1: register
+ * p2: jump addr
+ *
+ * Subtract 1 from the integer in register p1. If it is then zero, jump
+ * to p2. Used to stop once the rows of a LIMIT have been produced.
+ */
+int chidb_dbm_op_DecrJumpZero (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t* reg = &stmt->reg[op->p1];
+
+    if(reg->type != REG_INT32)
+        return CHIDB_EMISMATCH;
+
+    if(--reg->value.i == 0)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* ArenaMark p1 * * *
+ *
+ * p1: mark number
+ *
+ * Remember the current position of the statement's arena as mark p1.
+ * Used right before a loop starts, once the values its iterations
+ * depend on (e.g., the row of an outer loop) have been computed.
+ */
+int chidb_dbm_op_ArenaMark (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if(op->p1 < 0)
+        return CHIDB_EMISUSE;
+
+    if(op->p1 >= stmt->nMarks) {
+        ArenaMark *marks = realloc(stmt->marks, sizeof(ArenaMark) * (op->p1 + 1));
+        if(marks == NULL)
+            return CHIDB_ENOMEM;
+        stmt->marks = marks;
+        stmt->nMarks = op->p1 + 1;
+    }
+
+    return chidb_Arena_mark(&stmt->arena, &stmt->marks[op->p1]);
+}
+
+
+/* ArenaRelease p1 * * *
+ *
+ * p1: mark number
+ *
+ * Release everything allocated from the statement's arena since mark p1
+ * was set by ArenaMark. Used at the end of each iteration of a loop:
+ * the strings, BLOBs and records in the registers that the iteration
+ * filled in are no longer valid, but values computed before the loop
+ * started are. A row returned by ResultRow inside the loop is therefore
+ * valid until the program is resumed and its iteration ends.
+ */
+int chidb_dbm_op_ArenaRelease (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if(op->p1 < 0 || op->p1 >= stmt->nMarks)
+        return CHIDB_EMISUSE;
+
+    return chidb_Arena_release(&stmt->arena, &stmt->marks[op->p1]);
+}
+
+
+/*** BATCH INSTRUCTIONS ***/
+
+/* These instructions implement an alternate way of running a query:
+ * instead of moving a cursor one row at a time, the cursor reads a batch
+ * of (up to DBM_BATCH_SIZE) rows, and columns are read into vectors that
+ * hold that column's values for the whole batch. Filters are applied to
+ * whole vectors at once, and only clear bits in the batch's selection
+ * bitmap. Finally, BatchRow iterates over the rows that are still selected,
+ * copying their values into registers (so that the usual ResultRow
+ * instruction can produce them). For example:
+ *
+ *   Rewind     0  end  _
+ *   loop:
+ *   Batch      0  end  _        Read up to 1024 rows from cursor 0
+ *   VColumn    0  3    2        Vector 2 <- column 3
+ *   VLtConst   50 _    2        Only keep rows where column 3 < 50
+ *   VColumn    0  1    3        Vector 3 <- column 1
+ *   VKey       0  _    4        Vector 4 <- key
+ *   row:
+ *   BatchRow   0  loop _        Registers 2-4 <- next selected row
+ *   ResultRow  2  3    _
+ *   Goto       _  row  _
+ *   end:
+ *
+ * A cursor that is read with Batch shouldn't also be moved with Next/Prev.
+ */
+
+/* Returns vector n, allocating it if necessary */
+static int chidb_dbm_vector_get(chidb_stmt *stmt, int32_t n, chidb_dbm_vector_t **vector)
+{
+    int rc;
+
+    if(stmt->vec == NULL) {
+        stmt->vec = calloc(stmt->nReg, sizeof(chidb_dbm_vector_t));
+        if(stmt->vec == NULL)
+            return CHIDB_ENOMEM;
+    }
+
+    if(stmt->vec[n].values == NULL && (rc = chidb_dbm_vector_init(&stmt->vec[n])) != CHIDB_OK)
+        return rc;
+
+    *vector = &stmt->vec[n];
+    return CHIDB_OK;
+}
+
+/* Returns vector n (which must have been written by VColumn)
+ * and the batch it belongs to */
+static int chidb_dbm_vector_batch(chidb_stmt *stmt, int32_t n, chidb_dbm_vector_t **vector, chidb_dbm_batch_t **batch)
+{
+    if(stmt->vec == NULL || stmt->vec[n].values == NULL || stmt->vec[n].cursor < 0)
+        return CHIDB_EMISUSE;
+
+    *vector = &stmt->vec[n];
+    *batch = stmt->cursors[(*vector)->cursor].batch;
+
+    return CHIDB_OK;
+}
+
+
+/* Batch p1 p2 _ *
+ *
+ * p1: cursor
+ * p2: jump addr
+ *
+ * Read the next batch of rows from cursor p1. The first batch after
+ * a Rewind or a Seek starts with the row the cursor is on. All the rows
+ * in the batch are selected. If there are no more rows, jump to p2.
+ */
+int chidb_dbm_op_Batch (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    int rc;
+
+    if(cursor->batch == NULL && (rc = chidb_dbm_batch_new(&cursor->batch)) != CHIDB_OK)
+        return rc;
+
+    if((rc = chidb_dbm_batch_fill(stmt->db->bt, cursor, cursor->batch)) != CHIDB_OK)
+        return rc;
+
+    if(cursor->batch->nrows == 0)
+        stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* VColumn p1 p2 p3 *
+ *
+ * p1: cursor
+ * p2: column number
+ * p3: vector
+ *
+ * Read column p2 of every selected row in the current batch of
+ * cursor p1 into vector p3.
+ */
+int chidb_dbm_op_VColumn (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_batch_t* batch = stmt->cursors[op->p1].batch;
+    chidb_dbm_vector_t* vector;
+    DBRecordView record;
+    int rc;
+
+    if(batch == NULL)
+        return CHIDB_EMISUSE;
+
+    if((rc = chidb_dbm_vector_get(stmt, op->p3, &vector)) != CHIDB_OK)
+        return rc;
+
+    vector->cursor = op->p1;
+    vector->nrows = batch->nrows;
+    vector->all_int32 = true;
+
+    for(uint32_t i = 0; i < batch->nrows; i++) {
+        if(!chidb_dbm_batch_selected(batch, i))
+            continue;
+
+        chidb_DBRecordView_init(&record, batch->data + batch->records[i]);
+        if((rc = chidb_dbm_record_value(&record, op->p2, &vector->values[i])) != CHIDB_OK)
+            return rc;
+
+        if(vector->values[i].type == REG_INT32)
+            vector->i32[i] = vector->values[i].value.i;
+        else
+            vector->all_int32 = false;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* VKey p1 _ p3 *
+ *
+ * p1: cursor
+ * p3: vector
+ *
+ * Read the key of every selected row in the current batch of cursor p1
+ * into vector p3.
+ */
+int chidb_dbm_op_VKey (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_batch_t* batch = stmt->cursors[op->p1].batch;
+    chidb_dbm_vector_t* vector;
+    int rc;
+
+    if(batch == NULL)
+        return CHIDB_EMISUSE;
+
+    if((rc = chidb_dbm_vector_get(stmt, op->p3, &vector)) != CHIDB_OK)
+        return rc;
+
+    vector->cursor = op->p1;
+    vector->nrows = batch->nrows;
+    vector->all_int32 = true;
+
+    for(uint32_t i = 0; i < batch->nrows; i++) {
+        if(!chidb_dbm_batch_selected(batch, i))
+            continue;
+
+        vector->values[i].type = REG_INT32;
+        vector->values[i].value.i = batch->keys[i];
+        vector->i32[i] = batch->keys[i];
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* VEq p1 _ p3 (VNe, VLt, etc.) *
+ *
+ * p1: vector
+ * p3: vector
+ *
+ * Only keep the selected rows where the value in vector p3 is equal to
+ * (not equal to, less than, etc.) the value in vector p1. Both vectors
+ * must have been read from the same batch.
+ *
+ * VEqConst p1 _ p3 (VNeConst, VLtConst, etc.) *
+ *
+ * p1: constant k
+ * p3: vector
+ *
+ * Only keep the selected rows where the value in vector p3 is equal to
+ * (not equal to, less than, etc.) k.
+ *
+ * Values are compared like the EqInt, NeInt, etc. instructions do: a row
+ * where either value is NULL is never kept, whatever the operator, so a
+ * batched scan filters out the same rows as a row-at-a-time one. If all
+ * the values are 32-bit integers, the comparisons are done 64 rows at a time
+ * in a branch-free loop, producing a whole word of the selection bitmap.
+ */
+#define VCMP_HANDLERS(NAME, OPERATOR, STRCMP)                                   \
+int chidb_dbm_op_V ## NAME (chidb_stmt *stmt, chidb_dbm_op_t *op)               \
+{                                                                               \
+    chidb_dbm_vector_t *v1, *v2;                                                \
+    chidb_dbm_batch_t *batch;                                                   \
+    int rc;                                                                     \
+                                                                                \
+    if((rc = chidb_dbm_vector_batch(stmt, op->p3, &v2, &batch)) != CHIDB_OK)    \
+        return rc;                                                              \
+    if((rc = chidb_dbm_vector_batch(stmt, op->p1, &v1, &batch)) != CHIDB_OK)    \
+        return rc;                                                              \
+    if(v1->cursor != v2->cursor)                                                \
+        return CHIDB_EMISUSE;                                                   \
+                                                                                \
+    if(v1->all_int32 && v2->all_int32) {                                        \
+        for(uint32_t w = 0; w * 64 < batch->nrows; w++) {                       \
+            const int32_t *a = v2->i32 + w * 64, *b = v1->i32 + w * 64;         \
+            uint64_t mask = 0;                                                  \
+            for(uint32_t j = 0; j < 64; j++)                                    \
+                mask |= (uint64_t) (a[j] OPERATOR b[j]) << j;                   \
+            batch->sel[w] &= mask;                                              \
+        }                                                                       \
+    } else {                                                                    \
+        for(uint32_t i = 0; i < batch->nrows; i++)                              \
+            if(chidb_dbm_batch_selected(batch, i) &&                            \
+               (v1->values[i].type == REG_NULL ||                               \
+                v2->values[i].type == REG_NULL ||                               \
+                !(chidb_dbm_op_compare_reg(&v1->values[i], &v2->values[i]) OPERATOR 0))) \
+                batch->sel[i / 64] &= ~(UINT64_C(1) << (i % 64));              \
+    }                                                                           \
+                                                                                \
+    return CHIDB_OK;                                                            \
+}                                                                               \
+                                                                                \
+int chidb_dbm_op_V ## NAME ## Const (chidb_stmt *stmt, chidb_dbm_op_t *op)      \
+{                                                                               \
+    chidb_dbm_vector_t *v;                                                      \
+    chidb_dbm_batch_t *batch;                                                   \
+    int32_t k = op->p1;                                                         \
+    int rc;                                                                     \
+                                                                                \
+    if((rc = chidb_dbm_vector_batch(stmt, op->p3, &v, &batch)) != CHIDB_OK)     \
+        return rc;                                                              \
+                                                                                \
+    if(v->all_int32) {                                                          \
+        for(uint32_t w = 0; w * 64 < batch->nrows; w++) {                       \
+            const int32_t *a = v->i32 + w * 64;                                 \
+            uint64_t mask = 0;                                                  \
+            for(uint32_t j = 0; j < 64; j++)                                    \
+                mask |= (uint64_t) (a[j] OPERATOR k) << j;                      \
+            batch->sel[w] &= mask;                                              \
+        }                                                                       \
+    } else {                                                                    \
+        chidb_dbm_register_t kreg = { .type = REG_INT32, .value.i = k };        \
+        for(uint32_t i = 0; i < batch->nrows; i++)                              \
+            if(chidb_dbm_batch_selected(batch, i) &&                            \
+               (v->values[i].type == REG_NULL ||                                \
+                !(chidb_dbm_op_compare_reg(&kreg, &v->values[i]) OPERATOR 0)))  \
+                batch->sel[i / 64] &= ~(UINT64_C(1) << (i % 64));              \
+    }                                                                           \
+                                                                                \
+    return CHIDB_OK;                                                            \
+}
+
+FOREACH_CMP(VCMP_HANDLERS)
+
+
+/* BatchRow p1 p2 _ *
+ *
+ * p1: cursor
+ * p2: jump addr
+ *
+ * Move on to the next selected row in the current batch of cursor p1,
+ * and copy its values in all the vectors read from p1 into the registers
+ * with the same number. If there are no more selected rows, jump to p2.
+ */
+int chidb_dbm_op_BatchRow (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_batch_t* batch = stmt->cursors[op->p1].batch;
+    uint32_t i;
+    int rc;
+
+    if(batch == NULL)
+        return CHIDB_EMISUSE;
+
+    /* Find the next set bit in the selection bitmap, skipping
+     * over whole words that have no selected rows */
+    for(i = batch->row + 1; i < batch->nrows; i++) {
+        uint64_t word = batch->sel[i / 64] >> (i % 64);
+        if(word == 0)
+            i = (i / 64) * 64 + 63;
+        else if(word & 1)
+            break;
+    }
+
+    if(i >= batch->nrows) {
+        batch->row = batch->nrows;
+        stmt->pc = op->p2;
+        return CHIDB_OK;
+    }
+
+    batch->row = i;
+
+    for(uint32_t n = 0; stmt->vec != NULL && n < stmt->nReg; n++) {
+        chidb_dbm_vector_t* vector = &stmt->vec[n];
+
+        if(vector->values == NULL || vector->cursor != op->p1)
+            continue;
+
+        stmt->reg[n] = vector->values[i];
+        if((rc = chidb_dbm_reg_own(stmt, &stmt->reg[n])) != CHIDB_OK)
+            return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/*** SUPERINSTRUCTIONS ***/
+
+/* The following instructions are never produced by codegen. Instead,
+ * chidb_stmt_peephole replaces the first instruction of a common
+ * sequence with one of them. The rest of the sequence is left in
+ * place (and is skipped over), so the superinstruction can read its
+ * operands from it, and jumps into the middle of the sequence still
+ * land on a valid instruction.
+ */
+
+
+/* ColumnCmpInt p1 p2 p3 *
+ *
+ * Fuses the following sequence:
+ *
+ *   Column  p1 p2 p3       (read column p2 of cursor p1 into register p3)
+ *   Integer k  r  _        (store constant k in register r)
+ *   Eq/Ne/Lt/Le/Gt/Ge      (compare registers p3 and r, jump if true,
+ *                           or EqInt/NeInt/etc.)
+ *
+ * or this one:
+ *
+ *   Column  p1 p2 p3       (read column p2 of cursor p1 into register p3)
+ *   EqConst/NeConst/etc.   (compare register p3 with a constant, jump if
+ *                           true)
+ *
+ * The comparison is inlined for 32-bit integers. The instructions after
+ * ColumnCmpInt are left in the program and skipped (see dbm-peephole.c).
+ */
+#define CMP_CASES(NAME, OPERATOR, STRCMP)                                       \
+    case Op_ ## NAME ## Const:                                                  \
+        reg1 = &stmt->reg[cmp->p3];                                             \
+        if(reg1->type != REG_INT32)                                             \
+            return chidb_dbm_op_ ## NAME ## Const (stmt, cmp);                  \
+        if(reg1->value.i OPERATOR cmp->p1)                                      \
+            stmt->pc = cmp->p2;                                                 \
+        return CHIDB_OK;                                                        \
+    case Op_ ## NAME:                                                           \
+    case Op_ ## NAME ## Int:                                                    \
+        reg1 = &stmt->reg[cmp->p1];                                             \
+        reg2 = &stmt->reg[cmp->p3];                                             \
+        if(reg1->type != REG_INT32 || reg2->type != REG_INT32)                  \
+            return chidb_dbm_op_ ## NAME (stmt, cmp);                           \
+        if(reg2->value.i OPERATOR reg1->value.i)                                \
+            stmt->pc = cmp->p2;                                                 \
+        return CHIDB_OK;
+
+int chidb_dbm_op_ColumnCmpInt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_register_t *reg1, *reg2;
+    chidb_dbm_op_t *cmp;
+    int rc;
+
+    if((rc = chidb_dbm_op_Column(stmt, op)) != CHIDB_OK)
+        return rc;
+
+    if(op[1].opcode == Op_Integer) {
+        chidb_dbm_register_t* reg = &stmt->reg[op[1].p2];
+
+        reg->type = REG_INT32;
+        reg->value.i = op[1].p1;
+        cmp = op + 2;
+    } else {
+        cmp = op + 1;
+    }
+
+    stmt->pc += cmp - op;
+
+    /* The comparison is done here, not through dbm_handlers, so the
+     * whole sequence costs a single dispatch. Only values that aren't
+     * both 32-bit integers (including NULLs) go through the comparison's
+     * own handler, which is called directly */
+    switch(cmp->opcode)
+    {
+    FOREACH_CMP(CMP_CASES)
+    default:
+        return CHIDB_EMISUSE;
+    }
+}
+
+#undef CMP_CASES
+
+
+/* ColumnRun p1 p2 p3 *
+ *
+ * Fuses a sequence of Column instructions on cursor p1 (the first of
+ * which is this instruction). The cursor's record is only fetched once.
+ */
+int chidb_dbm_op_ColumnRun (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_op_t *end = &stmt->ops[stmt->endOp];
+    int32_t nCursor = op->p1;
+    int rc;
+
+    DBRecordView* record;
+    if((rc = chidb_dbm_cursor_record(cursor, &record)) != CHIDB_OK)
+        return rc;
+
+    do {
+        if((rc = chidb_dbm_column(stmt, record, op)) != CHIDB_OK)
+            return rc;
+        op++;
+    } while(op < end && op->opcode == Op_Column && op->p1 == nCursor);
+
+    stmt->pc = op - stmt->ops;
+
+    return CHIDB_OK;
+}
+
+
+/* NextColumn p1 p2 _ *
+ *
+ * Fuses Next p1 p2 with the instruction at p2, which must be a Column
+ * or ColumnRun instruction on cursor p1 (i.e., the first instruction
+ * of the loop body reads from the cursor that was just moved).
+ */
+int chidb_dbm_op_NextColumn (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_op_t *target = &stmt->ops[op->p2];
+
+    if(chidb_dbm_cursor_table_move(stmt->db->bt, cursor, true) == CHIDB_CANTMOVE)
+        return CHIDB_OK;
+
+    stmt->pc = op->p2 + 1;
+
+    if(target->opcode == Op_ColumnRun)
+        return chidb_dbm_op_ColumnRun(stmt, target);
+    else
+        return chidb_dbm_op_Column(stmt, target);
+}
+
+
+/* Hash joins
+ *
+ * The inner table of a hash join is read once, and each of its rows is
+ * added to a hash table (held by a hash cursor) under the value of the
+ * column it is joined on. Each row of the outer table then looks up its
+ * own value, and the hash cursor is positioned on each of the matching
+ * rows in turn, so they can be read with Column and Key as if they were
+ * read from the table itself. See dbm-hash.h.
+ */
+
+/* Positions a hash, sorter or aggregator cursor on a row it holds, so
+ * that Column and Key read the row */
+static void chidb_dbm_position_row(chidb_dbm_cursor_t* cursor, chidb_key_t key, uint8_t *record, uint32_t rlen)
+{
+    cursor->cell.type = PGTYPE_TABLE_LEAF;
+    cursor->cell.key = key;
+    cursor->cell.fields.tableLeaf.data = record;
+    cursor->cell.fields.tableLeaf.data_size = rlen;
+    cursor->record_valid = false;
+}
+
+
+/* HashOpen p1 p2 * *
+ *
+ * p1: cursor
+ * p2: memory budget, in bytes (0 for the default)
+ *
+ * Open hash cursor p1 on a new, empty, hash table.
+ */
+int chidb_dbm_op_HashOpen (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    int rc;
+
+    if(cursor->type != CURSOR_UNSPECIFIED)
+        chidb_dbm_cursor_free(stmt->db->bt, cursor);
+    cursor->type = CURSOR_UNSPECIFIED;
+
+    if((rc = chidb_dbm_hash_new(&cursor->hash, op->p2 > 0 ? (size_t) op->p2 : 0)) != CHIDB_OK)
+        return rc;
+
+    cursor->type = CURSOR_HASH;
+    cursor->record_valid = false;
+
+    return CHIDB_OK;
+}
+
+
+/* HashBuild p1 p2 p3 *
+ *
+ * p1: hash cursor
+ * p2: cursor
+ * p3: register
+ *
+ * Add the entry cursor p2 is pointing at to the hash table of cursor p1,
+ * under the value in register p3. Entries under a NULL value are not
+ * added, since they can't match anything.
+ */
+int chidb_dbm_op_HashBuild (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_cursor_t* table = &stmt->cursors[op->p2];
+
+    if(cursor->type != CURSOR_HASH)
+        return CHIDB_EMISUSE;
+
+    return chidb_dbm_hash_insert(cursor->hash, &stmt->reg[op->p3], table->cell.key,
+                                 table->cell.fields.tableLeaf.data,
+                                 table->cell.fields.tableLeaf.data_size);
+}
+
+
+/* HashProbe p1 p2 p3 *
+ *
+ * p1: hash cursor
+ * p2: jump addr
+ * p3: register
+ *
+ * Make hash cursor p1 point to the first entry in its hash table under
+ * the value in register p3. If there is no such entry (which is always
+ * the case if the value is NULL), jump to p2.
+ */
+int chidb_dbm_op_HashProbe (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_key_t key;
+    uint8_t *record;
+    uint32_t rlen;
+    int rc;
+
+    if(cursor->type != CURSOR_HASH)
+        return CHIDB_EMISUSE;
+
+    rc = chidb_dbm_hash_probe(cursor->hash, &stmt->reg[op->p3], &key, &record, &rlen);
+    if(rc == CHIDB_ENOTFOUND)
+    {
+        stmt->pc = op->p2;
+        return CHIDB_OK;
+    }
+    else if(rc != CHIDB_OK)
+        return rc;
+
+    chidb_dbm_position_row(cursor, key, record, rlen);
+
+    return CHIDB_OK;
+}
+
+
+/* HashNext p1 p2 * *
+ *
+ * p1: hash cursor
+ * p2: jump addr
+ *
+ * Make hash cursor p1 point to the next entry under the value it was
+ * last probed with. If there is one, jump to p2.
+ */
+int chidb_dbm_op_HashNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_key_t key;
+    uint8_t *record;
+    uint32_t rlen;
+
+    if(cursor->type != CURSOR_HASH)
+        return CHIDB_EMISUSE;
+
+    if(chidb_dbm_hash_next(cursor->hash, &key, &record, &rlen) != CHIDB_OK)
+        return CHIDB_OK;
+
+    chidb_dbm_position_row(cursor, key, record, rlen);
+    stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* Sorting
+ *
+ * Rows are sorted by making a record of each of them, with the sort key
+ * in its first columns, and adding it to a sorter (held by a sorter cursor).
+ * Once sorted, the sorter cursor is positioned on each record in turn, so
+ * its columns can be read with Column. See dbm-sorter.h.
+ */
+
+/* SorterOpen p1 p2 p3 p4
+ *
+ * p1: cursor
+ * p2: memory budget, in bytes (0 for the default)
+ * p3: number of records that will be read (0 for all of them)
+ * p4: order of each column of the sort key: '+' for ascending,
+ *     '-' for descending
+ *
+ * Open sorter cursor p1 on a new, empty, sorter. The records added to
+ * it are sorted on their first strlen(p4) columns. If p3 is not 0, only
+ * the first p3 records are kept.
+ */
+int chidb_dbm_op_SorterOpen (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    int rc;
+
+    if(cursor->type != CURSOR_UNSPECIFIED)
+        chidb_dbm_cursor_free(stmt->db->bt, cursor);
+    cursor->type = CURSOR_UNSPECIFIED;
+
+    if((rc = chidb_dbm_sorter_new(&cursor->sorter, op->p4, op->p2 > 0 ? (size_t) op->p2 : 0,
+                                   op->p3 > 0 ? (uint32_t) op->p3 : 0)) != CHIDB_OK)
+        return rc;
+
+    cursor->type = CURSOR_SORTER;
+    cursor->record_valid = false;
+
+    return CHIDB_OK;
+}
+
+
+/* SorterInsert p1 p2 * *
+ *
+ * p1: sorter cursor
+ * p2: register containing the record
+ *
+ * Add a record to the sorter of cursor p1.
+ */
+int chidb_dbm_op_SorterInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_register_t* record = &stmt->reg[op->p2];
+
+    if(cursor->type != CURSOR_SORTER || record->type != REG_BINARY)
+        return CHIDB_EMISUSE;
+
+    return chidb_dbm_sorter_insert(cursor->sorter, record->value.bin.bytes, record->value.bin.nbytes);
+}
+
+
+/* SorterSort p1 p2 * *
+ *
+ * p1: sorter cursor
+ * p2: jump addr
+ *
+ * Sort the records of the sorter of cursor p1, and make the cursor
+ * point to the first one. If there are no records, jump to p2.
+ */
+int chidb_dbm_op_SorterSort (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    uint8_t *record;
+    uint32_t rlen;
+    int rc;
+
+    if(cursor->type != CURSOR_SORTER)
+        return CHIDB_EMISUSE;
+
+    rc = chidb_dbm_sorter_sort(cursor->sorter);
+    if(rc == CHIDB_ENOTFOUND)
+    {
+        stmt->pc = op->p2;
+        return CHIDB_OK;
+    }
+    else if(rc != CHIDB_OK)
+        return rc;
+
+    chidb_dbm_sorter_row(cursor->sorter, &record, &rlen);
+    chidb_dbm_position_row(cursor, 0, record, rlen);
+
+    return CHIDB_OK;
+}
+
+
+/* SorterData p1 p2 * *
+ *
+ * p1: sorter cursor
+ * p2: register
+ *
+ * Store the record sorter cursor p1 is pointing at in register p2.
+ * Like MakeRecord, the record is copied into the statement's arena.
+ */
+int chidb_dbm_op_SorterData (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_register_t* reg = &stmt->reg[op->p2];
+
+    if(cursor->type != CURSOR_SORTER)
+        return CHIDB_EMISUSE;
+
+    reg->type = REG_BINARY;
+    reg->value.bin.bytes = cursor->cell.fields.tableLeaf.data;
+    reg->value.bin.nbytes = cursor->cell.fields.tableLeaf.data_size;
+
+    return chidb_dbm_reg_own(stmt, reg);
+}
+
+
+/* SorterNext p1 p2 * *
+ *
+ * p1: sorter cursor
+ * p2: jump addr
+ *
+ * Make sorter cursor p1 point to the next record of its sorter. If
+ * there is one, jump to p2.
+ */
+int chidb_dbm_op_SorterNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    uint8_t *record;
+    uint32_t rlen;
+    int rc;
+
+    if(cursor->type != CURSOR_SORTER)
+        return CHIDB_EMISUSE;
+
+    rc = chidb_dbm_sorter_next(cursor->sorter);
+    if(rc == CHIDB_ENOTFOUND)
+        return CHIDB_OK;
+    else if(rc != CHIDB_OK)
+        return rc;
+
+    chidb_dbm_sorter_row(cursor->sorter, &record, &rlen);
+    chidb_dbm_position_row(cursor, 0, record, rlen);
+    stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* Aggregation
+ *
+ * Aggregate functions are computed by making a record of each row, with
+ * the row's group key in its first columns followed by the argument of
+ * each function, and adding it to an aggregator (held by an aggregator
+ * cursor). Once finished, the aggregator cursor is positioned on a record
+ * of each group in turn (the group key followed by the value of each
+ * function), so its columns can be read with Column. See dbm-agg.h.
+ */
+
+/* AggOpen p1 p2 p3 p4
+ *
+ * p1: cursor
+ * p2: memory budget, in bytes (0 for the default)
+ * p3: number of columns of the group key
+ * p4: aggregate function of each of the following columns: 'n' for
+ *     COUNT, 's' for SUM, 'a' for AVG, '<' for MIN, '>' for MAX
+ *
+ * Open aggregator cursor p1 on a new, empty, aggregator.
+ */
+int chidb_dbm_op_AggOpen (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    int rc;
+
+    if(cursor->type != CURSOR_UNSPECIFIED)
+        chidb_dbm_cursor_free(stmt->db->bt, cursor);
+    cursor->type = CURSOR_UNSPECIFIED;
+
+    if(op->p3 < 0)
+        return CHIDB_EMISUSE;
+    if((rc = chidb_dbm_agg_new(&cursor->agg, op->p3, op->p4, op->p2 > 0 ? (size_t) op->p2 : 0)) != CHIDB_OK)
+        return rc;
+
+    cursor->type = CURSOR_AGG;
+    cursor->record_valid = false;
+
+    return CHIDB_OK;
+}
+
+
+/* AggStep p1 p2 * *
+ *
+ * p1: aggregator cursor
+ * p2: register containing the record
+ *
+ * Add a row to the group of the aggregator of cursor p1 that its
+ * group key belongs to.
+ */
+int chidb_dbm_op_AggStep (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_register_t* record = &stmt->reg[op->p2];
+
+    if(cursor->type != CURSOR_AGG || record->type != REG_BINARY)
+        return CHIDB_EMISUSE;
+
+    return chidb_dbm_agg_step(cursor->agg, record->value.bin.bytes, record->value.bin.nbytes);
+}
+
+
+/* AggBreak p1 p2 p3 *
+ *
+ * p1: aggregator cursor
+ * p2: jump addr
+ * p3: register containing the record
+ *
+ * If the row in p3 isn't in the group of the rows added to the
+ * aggregator of cursor p1 so far, compute the aggregate functions of
+ * that group, remove it from the aggregator, and make the cursor point
+ * to it. Otherwise (or if no rows have been added yet), jump to p2.
+ */
+int chidb_dbm_op_AggBreak (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_register_t* record = &stmt->reg[op->p3];
+    uint8_t *row;
+    uint32_t rlen;
+    int rc;
+
+    if(cursor->type != CURSOR_AGG || record->type != REG_BINARY)
+        return CHIDB_EMISUSE;
+
+    rc = chidb_dbm_agg_break(cursor->agg, record->value.bin.bytes, record->value.bin.nbytes);
+    if(rc == CHIDB_ENOTFOUND)
+    {
+        stmt->pc = op->p2;
+        return CHIDB_OK;
+    }
+    else if(rc != CHIDB_OK)
+        return rc;
+
+    chidb_dbm_agg_row(cursor->agg, &row, &rlen);
+    chidb_dbm_position_row(cursor, 0, row, rlen);
+
+    return CHIDB_OK;
+}
+
+
+/* AggFinal p1 p2 * *
+ *
+ * p1: aggregator cursor
+ * p2: jump addr
+ *
+ * Compute the aggregate functions of each group of the aggregator of
+ * cursor p1, and make the cursor point to the first group. If there
+ * are no groups, jump to p2.
+ */
+int chidb_dbm_op_AggFinal (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    uint8_t *record;
+    uint32_t rlen;
+    int rc;
+
+    if(cursor->type != CURSOR_AGG)
+        return CHIDB_EMISUSE;
+
+    rc = chidb_dbm_agg_final(cursor->agg);
+    if(rc == CHIDB_ENOTFOUND)
+    {
+        stmt->pc = op->p2;
+        return CHIDB_OK;
+    }
+    else if(rc != CHIDB_OK)
+        return rc;
+
+    chidb_dbm_agg_row(cursor->agg, &record, &rlen);
+    chidb_dbm_position_row(cursor, 0, record, rlen);
+
+    return CHIDB_OK;
+}
+
+
+/* AggNext p1 p2 * *
+ *
+ * p1: aggregator cursor
+ * p2: jump addr
+ *
+ * Make aggregator cursor p1 point to the next group of its aggregator.
+ * If there is one, jump to p2.
+ */
+int chidb_dbm_op_AggNext (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    uint8_t *record;
+    uint32_t rlen;
+    int rc;
+
+    if(cursor->type != CURSOR_AGG)
+        return CHIDB_EMISUSE;
+
+    rc = chidb_dbm_agg_next(cursor->agg);
+    if(rc == CHIDB_ENOTFOUND)
+        return CHIDB_OK;
+    else if(rc != CHIDB_OK)
+        return rc;
+
+    chidb_dbm_agg_row(cursor->agg, &record, &rlen);
+    chidb_dbm_position_row(cursor, 0, record, rlen);
+    stmt->pc = op->p2;
+
+    return CHIDB_OK;
+}
+
+
+/* Sets of rows
+ *
+ * DISTINCT, UNION, INTERSECT and EXCEPT are computed by making a record of
+ * each result row, and looking it up in (or adding it to) a set of rows
+ * (held by a set cursor). See dbm-set.h.
+ */
+
+/* SetOpen p1 p2 * *
+ *
+ * p1: cursor
+ * p2: memory budget, in bytes (0 for the default)
+ *
+ * Open set cursor p1 on a new, empty, set of rows.
+ */
+int chidb_dbm_op_SetOpen (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    int rc;
+
+    if(cursor->type != CURSOR_UNSPECIFIED)
+        chidb_dbm_cursor_free(stmt->db->bt, cursor);
+    cursor->type = CURSOR_UNSPECIFIED;
+
+    if((rc = chidb_dbm_set_new(&cursor->set, op->p2 > 0 ? (size_t) op->p2 : 0)) != CHIDB_OK)
+        return rc;
+
+    cursor->type = CURSOR_SET;
+    cursor->record_valid = false;
+
+    return CHIDB_OK;
+}
+
+
+/* SetInsert p1 p2 p3 *
+ *
+ * p1: set cursor
+ * p2: jump addr
+ * p3: register containing the record
+ *
+ * Add the row in p3 to the set of cursor p1. If it was already in
+ * the set, jump to p2.
+ */
+int chidb_dbm_op_SetInsert (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_register_t* record = &stmt->reg[op->p3];
+    int rc;
+
+    if(cursor->type != CURSOR_SET || record->type != REG_BINARY)
+        return CHIDB_EMISUSE;
+
+    rc = chidb_dbm_set_insert(cursor->set, record->value.bin.bytes);
+    if(rc == CHIDB_EDUPLICATE)
+    {
+        stmt->pc = op->p2;
+        return CHIDB_OK;
+    }
+
+    return rc;
+}
+
+
+/* SetNotFound p1 p2 p3 *
+ *
+ * p1: set cursor
+ * p2: jump addr
+ * p3: register containing the record
+ *
+ * If the row in p3 is not in the set of cursor p1, jump to p2.
+ */
+int chidb_dbm_op_SetNotFound (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_dbm_cursor_t* cursor = &stmt->cursors[op->p1];
+    chidb_dbm_register_t* record = &stmt->reg[op->p3];
+    int rc;
+
+    if(cursor->type != CURSOR_SET || record->type != REG_BINARY)
+        return CHIDB_EMISUSE;
+
+    rc = chidb_dbm_set_find(cursor->set, record->value.bin.bytes);
+    if(rc == CHIDB_ENOTFOUND)
+    {
+        stmt->pc = op->p2;
+        return CHIDB_OK;
+    }
+
+    return rc;
+}
+
+
+/* Halt p1 * * p4
+ *
+ * p1: error code
+ * p4: error message
+ *
+ * Terminate the program. If p1 is not zero, the program is
+ * terminated because of an error: p1 is the error code, and
+ * p4 describes the error.
+ */
+int chidb_dbm_op_Halt (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if(op->p1 != 0)
+        return op->p1;
+
     return CHIDB_DONE;
 }
 
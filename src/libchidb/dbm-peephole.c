@@ -0,0 +1,267 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine peephole optimizer
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include "dbm.h"
+
+
+/* Returns true if p2 of an instruction is a jump address (see
+ * FOREACH_OP in dbm-types.h) */
+static bool chidb_peephole_is_jump(opcode_t opcode)
+{
+    return opcode_p2_is_jump(opcode);
+}
+
+
+/* Comparisons of two registers (generic, or of two integers) */
+static bool chidb_peephole_is_compare(opcode_t opcode)
+{
+    return opcode >= Op_Eq && opcode <= Op_GeInt;
+}
+
+
+/* Comparisons of a register with a constant */
+static bool chidb_peephole_is_compare_const(opcode_t opcode)
+{
+    return opcode >= Op_EqConst && opcode <= Op_GeConst;
+}
+
+
+/* Jump threading
+ *
+ * Any jump to a Goto instruction is replaced by a jump to the Goto's
+ * destination (following chains of Gotos). Gotos that jump to the
+ * instruction right after them are turned into Noops.
+ */
+static void chidb_peephole_thread_jumps(chidb_stmt *stmt)
+{
+    chidb_dbm_op_t *ops = stmt->ops;
+
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        if(!chidb_peephole_is_jump(ops[i].opcode))
+            continue;
+
+        /* A chain can't be longer than the program, unless it's an
+         * infinite loop (which we leave alone) */
+        int32_t target = ops[i].p2;
+        for(uint32_t hops = 0; hops < stmt->endOp; hops++)
+        {
+            if(target < 0 || target >= stmt->endOp || ops[target].opcode != Op_Goto)
+                break;
+            target = ops[target].p2;
+        }
+
+        if(target >= 0 && target < stmt->endOp && ops[target].opcode == Op_Goto)
+            continue;
+
+        ops[i].p2 = target;
+    }
+
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+        if(ops[i].opcode == Op_Goto && ops[i].p2 == i + 1)
+            ops[i].opcode = Op_Noop;
+}
+
+
+/* Noop removal
+ *
+ * Removes all Noop instructions from the program, and updates all the
+ * jump addresses accordingly. A jump to a Noop becomes a jump to the
+ * first instruction after it.
+ */
+static int chidb_peephole_remove_noops(chidb_stmt *stmt)
+{
+    chidb_dbm_op_t *ops = stmt->ops;
+    uint32_t *newpos, n = 0;
+
+    /* newpos[i] is the position of instruction i once the Noops have been
+     * removed (or of the instruction that follows it, if it is a Noop) */
+    newpos = malloc(sizeof(uint32_t) * (stmt->endOp + 1));
+    if(newpos == NULL)
+        return CHIDB_ENOMEM;
+
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        newpos[i] = n;
+        if(ops[i].opcode != Op_Noop)
+            n++;
+    }
+    newpos[stmt->endOp] = n;
+
+    if(n == stmt->endOp)
+    {
+        free(newpos);
+        return CHIDB_OK;
+    }
+
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        if(ops[i].opcode == Op_Noop)
+        {
+            free(ops[i].p4);
+            continue;
+        }
+
+        if(chidb_peephole_is_jump(ops[i].opcode))
+        {
+            /* Jumps past the end of the program still end the program */
+            if(ops[i].p2 >= 0 && ops[i].p2 <= stmt->endOp)
+                ops[i].p2 = newpos[ops[i].p2];
+            else if(ops[i].p2 > stmt->endOp)
+                ops[i].p2 = n;
+        }
+
+        ops[newpos[i]] = ops[i];
+    }
+
+    /* The now unused instructions at the end of the array are
+     * reset, like when the array is first allocated */
+    for(uint32_t i = n; i < stmt->endOp; i++)
+    {
+        ops[i].opcode = Op_Noop;
+        ops[i].p1 = ops[i].p2 = ops[i].p3 = 0;
+        ops[i].p4 = NULL;
+    }
+
+    stmt->endOp = n;
+    free(newpos);
+
+    return CHIDB_OK;
+}
+
+
+/* Superinstructions
+ *
+ * Replaces the first instruction of common sequences with a
+ * superinstruction (see dbm-ops.c), which does the work of the whole
+ * sequence and then jumps past it. The rest of the sequence is left in
+ * the program, untouched: it is dead code, unless some other jump lands
+ * in the middle of the sequence, in which case it runs as usual.
+ */
+static void chidb_peephole_fuse(chidb_stmt *stmt)
+{
+    chidb_dbm_op_t *ops = stmt->ops;
+
+    /* Column + comparison of its register with a constant, or
+     * Column + Integer + comparison of the two registers */
+    for(uint32_t i = 0; i + 1 < stmt->endOp; i++)
+    {
+        chidb_dbm_op_t *cmp = &ops[i + 2];
+        int32_t rCol = ops[i].p3, rInt = ops[i + 1].p2;
+
+        if(ops[i].opcode == Op_Column && chidb_peephole_is_compare_const(ops[i + 1].opcode) &&
+           ops[i + 1].p3 == rCol)
+        {
+            ops[i].opcode = Op_ColumnCmpInt;
+            i += 1;
+            continue;
+        }
+
+        if(i + 2 >= stmt->endOp || ops[i].opcode != Op_Column || ops[i + 1].opcode != Op_Integer ||
+           !chidb_peephole_is_compare(cmp->opcode) || rCol == rInt)
+            continue;
+
+        if((cmp->p1 == rCol && cmp->p3 == rInt) || (cmp->p1 == rInt && cmp->p3 == rCol))
+        {
+            ops[i].opcode = Op_ColumnCmpInt;
+            i += 2;
+        }
+    }
+
+    /* Consecutive Column instructions on the same cursor */
+    for(uint32_t i = 0; i + 1 < stmt->endOp; i++)
+    {
+        if(ops[i].opcode != Op_Column || ops[i + 1].opcode != Op_Column || ops[i].p1 != ops[i + 1].p1)
+            continue;
+
+        ops[i].opcode = Op_ColumnRun;
+        while(i + 1 < stmt->endOp && ops[i + 1].opcode == Op_Column && ops[i + 1].p1 == ops[i].p1)
+            i++;
+    }
+
+    /* Next jumping back to a loop body that starts by reading
+     * from the same cursor */
+    for(uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        int32_t target = ops[i].p2;
+
+        if(ops[i].opcode != Op_Next || target < 0 || target >= stmt->endOp)
+            continue;
+
+        if((ops[target].opcode == Op_Column || ops[target].opcode == Op_ColumnRun) &&
+            ops[target].p1 == ops[i].p1)
+            ops[i].opcode = Op_NextColumn;
+    }
+}
+
+
+/* Peephole optimizer
+ *
+ * Rewrites a DBM program so it runs fewer instructions (and, thus,
+ * does fewer dispatches) per row, without changing its results:
+ *
+ *  - Jumps to Goto instructions are threaded to their final destination.
+ *  - Noop instructions are removed.
+ *  - Common sequences of instructions are fused into superinstructions.
+ *    The instructions they fuse stay in the program, and are skipped.
+ *
+ * This must be run once the program is complete (i.e., right after
+ * codegen) and before it starts running.
+ *
+ * Parameters
+ * - stmt: DBM with the program to optimize.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_peephole(chidb_stmt *stmt)
+{
+    int rc;
+
+    chidb_peephole_thread_jumps(stmt);
+
+    if((rc = chidb_peephole_remove_noops(stmt)) != CHIDB_OK)
+        return rc;
+
+    chidb_peephole_fuse(stmt);
+
+    return CHIDB_OK;
+}
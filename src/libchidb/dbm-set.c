@@ -0,0 +1,393 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine sets of rows
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dbm-set.h"
+#include "record.h"
+
+/* Bytes taken by a row, including its padding */
+#define ENTRY_SIZE(len) ((sizeof(chidb_dbm_set_entry_t) + (len) + 3) & ~(size_t) 3)
+
+#define ENTRY(set, offset) ((chidb_dbm_set_entry_t *) ((set)->data + (offset)))
+#define ENTRY_BYTES(e) ((uint8_t *) ((e) + 1))
+
+#define INITIAL_SLOTS (64)
+
+
+/*** ENCODING ***/
+
+/* FNV-1a, with its bits mixed at the end */
+static uint32_t chidb_dbm_set_hash(const uint8_t *bytes, uint32_t len)
+{
+    uint32_t h = 2166136261u;
+
+    for(uint32_t i = 0; i < len; i++)
+    {
+        h ^= bytes[i];
+        h *= 16777619u;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+
+    return h;
+}
+
+/* Encodes a record into set->enc, and hashes it into set->hash: the
+ * record is made again in the compact format, which picks the size of
+ * each integer itself (see dbm-set.h)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The record is corrupt
+ */
+static int chidb_dbm_set_encode(chidb_dbm_set_t *set, uint8_t *record)
+{
+    DBRecordView view;
+    DBRecordBuffer dbrb;
+    DBRecord *dbr;
+    chidb_dbm_register_t v;
+    char *s;
+    int nfields, rc;
+
+    chidb_Arena_reset(&set->arena);
+    chidb_DBRecordView_init(&view, record);
+    nfields = chidb_DBRecordView_getNFields(&view);
+
+    if(chidb_DBRecord_create_empty_arena(&dbrb, nfields, &set->arena) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    chidb_DBRecord_setFormat(&dbrb, RECORD_FORMAT_COMPACT);
+
+    for(int i = 0; i < nfields; i++)
+    {
+        if((rc = chidb_dbm_record_value(&view, i, &v)) != CHIDB_OK)
+            return rc;
+
+        switch(v.type)
+        {
+        case REG_INT32:
+            rc = chidb_DBRecord_appendInt64(&dbrb, v.value.i);
+            break;
+        case REG_INT64:
+            rc = chidb_DBRecord_appendInt64(&dbrb, v.value.i64);
+            break;
+        case REG_DOUBLE:
+            rc = chidb_DBRecord_appendDouble(&dbrb, v.value.d);
+            break;
+        case REG_STRING:
+            /* Strings in a record aren't null-terminated */
+            if((rc = chidb_Arena_strndup(&set->arena, v.value.s, v.slen, &s)) == CHIDB_OK)
+                rc = chidb_DBRecord_appendString(&dbrb, s);
+            break;
+        case REG_BINARY:
+            rc = chidb_DBRecord_appendBlob(&dbrb, v.value.bin.bytes, v.value.bin.nbytes);
+            break;
+        default:
+            rc = chidb_DBRecord_appendNull(&dbrb);
+            break;
+        }
+        if(rc != CHIDB_OK)
+            return rc;
+    }
+
+    chidb_DBRecord_finalize(&dbrb, &dbr);
+    if(chidb_DBRecord_pack(dbr, &set->enc) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    set->elen = dbr->packed_len;
+    set->hash = chidb_dbm_set_hash(set->enc, set->elen);
+
+    return CHIDB_OK;
+}
+
+
+/*** THE TABLE ***/
+
+static inline size_t chidb_dbm_set_memory(chidb_dbm_set_t *set)
+{
+    return set->used + sizeof(uint32_t) * set->nslots;
+}
+
+/* Looks up the encoding in set->enc in the table. Returns whether it's
+ * there, and the slot it's in (or the empty slot it would be added to) */
+static bool chidb_dbm_set_lookup(chidb_dbm_set_t *set, uint32_t *slot)
+{
+    uint32_t mask = set->nslots - 1;
+
+    for(*slot = set->hash & mask; set->slots[*slot] != 0; *slot = (*slot + 1) & mask)
+    {
+        chidb_dbm_set_entry_t *e = ENTRY(set, set->slots[*slot] - 1);
+
+        if(e->hash == set->hash && e->len == set->elen && !memcmp(ENTRY_BYTES(e), set->enc, set->elen))
+            return true;
+    }
+
+    return false;
+}
+
+/* Doubles the number of slots of the table */
+static int chidb_dbm_set_grow(chidb_dbm_set_t *set)
+{
+    uint32_t nslots = set->nslots * 2, mask = nslots - 1;
+    uint32_t *slots = calloc(nslots, sizeof(uint32_t));
+
+    if(slots == NULL)
+        return CHIDB_ENOMEM;
+
+    for(size_t offset = 0; offset < set->used; offset += ENTRY_SIZE(ENTRY(set, offset)->len))
+    {
+        uint32_t slot = ENTRY(set, offset)->hash & mask;
+
+        while(slots[slot] != 0)
+            slot = (slot + 1) & mask;
+        slots[slot] = offset + 1;
+    }
+
+    free(set->slots);
+    set->slots = slots;
+    set->nslots = nslots;
+
+    return CHIDB_OK;
+}
+
+/* Adds the encoding in set->enc to the table, in an empty slot. If the
+ * rows then take up more than the budget, the table is full */
+static int chidb_dbm_set_add(chidb_dbm_set_t *set, uint32_t slot)
+{
+    size_t need = ENTRY_SIZE(set->elen);
+    chidb_dbm_set_entry_t *e;
+    int rc;
+
+    if(set->used + need > set->size)
+    {
+        size_t size = set->size > 0 ? set->size : 4096;
+        uint8_t *data;
+
+        while(size < set->used + need)
+            size *= 2;
+        if((data = realloc(set->data, size)) == NULL)
+            return CHIDB_ENOMEM;
+        set->data = data;
+        set->size = size;
+    }
+
+    e = ENTRY(set, set->used);
+    e->hash = set->hash;
+    e->len = set->elen;
+    memcpy(ENTRY_BYTES(e), set->enc, set->elen);
+
+    set->slots[slot] = set->used + 1;
+    set->used += need;
+    set->nrows++;
+
+    if(set->nrows * 2 > set->nslots && (rc = chidb_dbm_set_grow(set)) != CHIDB_OK)
+        return rc;
+
+    if(chidb_dbm_set_memory(set) > set->budget)
+        set->full = true;
+
+    return CHIDB_OK;
+}
+
+
+/*** THE B-TREE ***/
+
+/* Looks up the encoding in set->enc in the B-Tree, starting at the key
+ * of its hash. Returns CHIDB_OK if it's there, and CHIDB_ENOTFOUND if
+ * it isn't, in which case *key is the free key it would be added under */
+static int chidb_dbm_set_spilled(chidb_dbm_set_t *set, chidb_key_t *key)
+{
+    uint8_t *data;
+    uint16_t size;
+    bool equal;
+    int rc;
+
+    for(*key = set->hash & DBM_SET_KEY_MASK; ; *key = (*key + 1) & DBM_SET_KEY_MASK)
+    {
+        if((rc = chidb_Btree_find(set->bt, 1, *key, &data, &size)) != CHIDB_OK)
+            return rc;
+
+        equal = size == set->elen && !memcmp(data, set->enc, size);
+        free(data);
+        if(equal)
+            return CHIDB_OK;
+    }
+}
+
+
+/*** SETS ***/
+
+/* Create a set
+ *
+ * Parameters
+ * - set: Out parameter. Used to return the new set.
+ * - budget: Bytes the rows can take up in memory before they are
+ *   written to disk (0 for DBM_SET_BUDGET)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_set_new(chidb_dbm_set_t **set, size_t budget)
+{
+    chidb_dbm_set_t *s;
+
+    if((s = calloc(1, sizeof(chidb_dbm_set_t))) == NULL)
+        return CHIDB_ENOMEM;
+
+    s->budget = budget > 0 ? budget : DBM_SET_BUDGET;
+    s->nslots = INITIAL_SLOTS;
+    chidb_Arena_init(&s->arena);
+
+    if((s->slots = calloc(s->nslots, sizeof(uint32_t))) == NULL)
+    {
+        chidb_dbm_set_free(s);
+        return CHIDB_ENOMEM;
+    }
+
+    *set = s;
+    return CHIDB_OK;
+}
+
+
+/* Frees a set, and removes its temporary B-Tree
+ *
+ * Parameters
+ * - set: Set to free
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_set_free(chidb_dbm_set_t *set)
+{
+    if(set->bt != NULL)
+        chidb_Btree_close(set->bt);
+    chidb_Arena_free(&set->arena);
+    free(set->slots);
+    free(set->data);
+    free(set);
+
+    return CHIDB_OK;
+}
+
+
+/* Add a row to a set
+ *
+ * Adds a row to a set, unless it's already in it.
+ *
+ * Parameters
+ * - set: Set
+ * - record: Record of the row
+ *
+ * Return
+ * - CHIDB_OK: The row was added
+ * - CHIDB_EDUPLICATE: The row was already in the set
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The record is corrupt
+ * - CHIDB_EIO: An I/O error has occurred when accessing the temporary B-Tree
+ */
+int chidb_dbm_set_insert(chidb_dbm_set_t *set, uint8_t *record)
+{
+    uint32_t slot;
+    chidb_key_t key;
+    int rc;
+
+    if((rc = chidb_dbm_set_encode(set, record)) != CHIDB_OK)
+        return rc;
+
+    if(chidb_dbm_set_lookup(set, &slot))
+        return CHIDB_EDUPLICATE;
+
+    if(set->bt != NULL)
+    {
+        rc = chidb_dbm_set_spilled(set, &key);
+        if(rc == CHIDB_OK)
+            return CHIDB_EDUPLICATE;
+        else if(rc != CHIDB_ENOTFOUND)
+            return rc;
+    }
+
+    if(!set->full || set->elen > DBM_SET_MAX_SPILL)
+        return chidb_dbm_set_add(set, slot);
+
+    if(set->bt == NULL)
+    {
+        if((rc = chidb_Btree_openTemp(&set->bt)) != CHIDB_OK)
+            return rc;
+        key = set->hash & DBM_SET_KEY_MASK;
+    }
+    if((rc = chidb_Btree_insertInTable(set->bt, 1, key, set->enc, set->elen)) != CHIDB_OK)
+        return rc;
+    set->nspilled++;
+
+    return CHIDB_OK;
+}
+
+
+/* Look up a row in a set
+ *
+ * Parameters
+ * - set: Set
+ * - record: Record of the row
+ *
+ * Return
+ * - CHIDB_OK: The row is in the set
+ * - CHIDB_ENOTFOUND: The row isn't in the set
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The record is corrupt
+ * - CHIDB_EIO: An I/O error has occurred when accessing the temporary B-Tree
+ */
+int chidb_dbm_set_find(chidb_dbm_set_t *set, uint8_t *record)
+{
+    uint32_t slot;
+    chidb_key_t key;
+    int rc;
+
+    if((rc = chidb_dbm_set_encode(set, record)) != CHIDB_OK)
+        return rc;
+
+    if(chidb_dbm_set_lookup(set, &slot))
+        return CHIDB_OK;
+
+    return set->bt != NULL ? chidb_dbm_set_spilled(set, &key) : CHIDB_ENOTFOUND;
+}
@@ -0,0 +1,123 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine sets of rows
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DBM_SET_H_
+#define DBM_SET_H_
+
+#include "chidbInt.h"
+#include "dbm-types.h"
+#include "arena.h"
+#include "btree.h"
+
+/* Sets of rows for DISTINCT, UNION, INTERSECT and EXCEPT
+ *
+ * A set holds distinct rows, each of them given as a record of the whole
+ * row. SetInsert adds a row to a set unless it's already in it (which is
+ * all DISTINCT and UNION need), and SetNotFound checks whether a row is
+ * in a set without adding it (for INTERSECT and EXCEPT, whose right side
+ * is added to a set first).
+ *
+ * Rows are compared by their encoding: the record is built again with
+ * record.c in the compact format, which stores each integer in the
+ * smallest number of bytes that can hold it, so two rows are equal if
+ * (and only if) their encodings are, however their records were made.
+ *
+ * The encodings are kept in an open-addressing hash table (with linear
+ * probing) on their hash. Once they take up more than the set's memory
+ * budget, no more rows are added to the table, and any other row is
+ * added to a temporary table B-Tree instead, under its hash (or, if that
+ * key is taken by another row, the next free key after it), so a row is
+ * looked up in the table first and then in the B-Tree. Rows whose
+ * encoding is too large to fit in a B-Tree cell are always kept in
+ * memory.
+ */
+
+/* Default memory budget, in bytes */
+#define DBM_SET_BUDGET (8 * 1024 * 1024)
+
+/* Largest encoding that is written to the B-Tree (a quarter of a page,
+ * so that a node split always leaves room for the row) */
+#define DBM_SET_MAX_SPILL (DEFAULT_PAGE_SIZE / 4)
+
+/* Keys of a table B-Tree are 28-bit varints, so only the low bits of a
+ * hash are used as a key */
+#define DBM_SET_KEY_MASK (0x0FFFFFFF)
+
+/* Rows are stored one after the other, each of them followed by its
+ * encoding, and padded to a multiple of 4 bytes */
+typedef struct chidb_dbm_set_entry
+{
+    uint32_t hash;
+    uint32_t len;       /* Bytes in the encoding */
+} chidb_dbm_set_entry_t;
+
+struct chidb_dbm_set
+{
+    size_t budget;
+
+    /* Rows, and offset + 1 of a row in each slot of the table (0 if
+     * empty) */
+    uint8_t *data;
+    size_t size;
+    size_t used;
+    uint32_t *slots;
+    uint32_t nslots;
+    uint32_t nrows;
+
+    /* Whether the table is full (no more rows can be added to it), and
+     * the B-Tree the other rows are added to (NULL until then) */
+    bool full;
+    BTree *bt;
+    uint32_t nspilled;
+
+    /* Encoding of the row being looked up (allocated from the arena,
+     * which is reset for every row) */
+    Arena arena;
+    uint8_t *enc;
+    uint32_t elen;
+    uint32_t hash;
+};
+typedef struct chidb_dbm_set chidb_dbm_set_t;
+
+int chidb_dbm_set_new(chidb_dbm_set_t **set, size_t budget);
+int chidb_dbm_set_free(chidb_dbm_set_t *set);
+int chidb_dbm_set_insert(chidb_dbm_set_t *set, uint8_t *record);
+int chidb_dbm_set_find(chidb_dbm_set_t *set, uint8_t *record);
+
+#endif /* DBM_SET_H_ */
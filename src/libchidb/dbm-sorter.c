@@ -0,0 +1,709 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine sorters
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dbm-sorter.h"
+
+/* Records in memory are preceded by their length, and padded to a
+ * multiple of 4 bytes */
+#define ROW_LEN(sorter, offset) (*(uint32_t *) ((sorter)->data + (offset)))
+#define ROW_RECORD(sorter, offset) ((sorter)->data + (offset) + sizeof(uint32_t))
+
+
+/* Compares the sort keys of two records. Returns a negative number, zero,
+ * or a positive number if r1 comes before, together with, or after r2 */
+static int chidb_dbm_sorter_cmp(chidb_dbm_sorter_t *sorter, uint8_t *r1, uint8_t *r2)
+{
+    DBRecordView v1, v2;
+    chidb_dbm_register_t k1, k2;
+    int c;
+
+    chidb_DBRecordView_init(&v1, r1);
+    chidb_DBRecordView_init(&v2, r2);
+
+    for(uint32_t i = 0; i < sorter->nkeys; i++)
+    {
+        if(chidb_dbm_record_value(&v1, i, &k1) != CHIDB_OK || chidb_dbm_record_value(&v2, i, &k2) != CHIDB_OK)
+            return 0;
+
+        if(k1.type == REG_NULL || k2.type == REG_NULL)
+            c = (k2.type == REG_NULL) - (k1.type == REG_NULL);
+        else
+            c = chidb_dbm_op_compare_reg(&k2, &k1);
+
+        if(c != 0)
+            return sorter->order[i] == '-' ? -c : c;
+    }
+
+    return 0;
+}
+
+/* Sorts the offsets of n records in memory (a merge sort, so records
+ * with equal keys stay in the order they were added in) */
+static void chidb_dbm_sorter_sort_rows(chidb_dbm_sorter_t *sorter, uint32_t *rows, uint32_t *tmp, uint32_t n)
+{
+    uint32_t m = n / 2, i = 0, j = m, k = 0;
+
+    if(n < 2)
+        return;
+
+    chidb_dbm_sorter_sort_rows(sorter, rows, tmp, m);
+    chidb_dbm_sorter_sort_rows(sorter, rows + m, tmp, n - m);
+
+    while(i < m && j < n)
+    {
+        if(chidb_dbm_sorter_cmp(sorter, ROW_RECORD(sorter, rows[j]), ROW_RECORD(sorter, rows[i])) < 0)
+            tmp[k++] = rows[j++];
+        else
+            tmp[k++] = rows[i++];
+    }
+    while(i < m)
+        tmp[k++] = rows[i++];
+    while(j < n)
+        tmp[k++] = rows[j++];
+
+    memcpy(rows, tmp, sizeof(uint32_t) * n);
+}
+
+/* Sorts the records in memory */
+static int chidb_dbm_sorter_sort_memory(chidb_dbm_sorter_t *sorter)
+{
+    uint32_t *tmp = malloc(sizeof(uint32_t) * (sorter->nrows > 0 ? sorter->nrows : 1));
+
+    if(tmp == NULL)
+        return CHIDB_ENOMEM;
+
+    chidb_dbm_sorter_sort_rows(sorter, sorter->rows, tmp, sorter->nrows);
+    free(tmp);
+
+    return CHIDB_OK;
+}
+
+
+/*** RUNS ***/
+
+/* Adds a run (in a new temporary file) after the existing ones */
+static int chidb_dbm_sorter_run_new(chidb_dbm_sorter_t *sorter, uint32_t level, chidb_dbm_sorter_run_t **run)
+{
+    chidb_dbm_sorter_run_t *runs = realloc(sorter->runs, sizeof(chidb_dbm_sorter_run_t) * (sorter->nruns + 1));
+
+    if(runs == NULL)
+        return CHIDB_ENOMEM;
+    sorter->runs = runs;
+
+    *run = &sorter->runs[sorter->nruns];
+    memset(*run, 0, sizeof(chidb_dbm_sorter_run_t));
+    if(((*run)->file = tmpfile()) == NULL)
+        return CHIDB_EIO;
+    (*run)->level = level;
+    sorter->nruns++;
+
+    return CHIDB_OK;
+}
+
+/* Appends a record to a run */
+static int chidb_dbm_sorter_run_write(chidb_dbm_sorter_run_t *run, const uint8_t *record, uint32_t rlen)
+{
+    if(fwrite(&rlen, sizeof(uint32_t), 1, run->file) != 1 ||
+       (rlen > 0 && fwrite(record, rlen, 1, run->file) != 1))
+        return CHIDB_EIO;
+    run->nrows++;
+
+    return CHIDB_OK;
+}
+
+/* Reads the next record of a run (while merging) */
+static int chidb_dbm_sorter_run_read(chidb_dbm_sorter_run_t *run)
+{
+    if(run->left == 0)
+    {
+        run->done = true;
+        return CHIDB_OK;
+    }
+
+    if(fread(&run->rlen, sizeof(uint32_t), 1, run->file) != 1)
+        return CHIDB_EIO;
+    if(run->rlen > run->rsize)
+    {
+        uint8_t *row = realloc(run->row, run->rlen);
+        if(row == NULL)
+            return CHIDB_ENOMEM;
+        run->row = row;
+        run->rsize = run->rlen;
+    }
+    if(run->rlen > 0 && fread(run->row, run->rlen, 1, run->file) != 1)
+        return CHIDB_EIO;
+    run->left--;
+
+    return CHIDB_OK;
+}
+
+static void chidb_dbm_sorter_run_free(chidb_dbm_sorter_run_t *run)
+{
+    if(run->file != NULL)
+        fclose(run->file);
+    free(run->row);
+}
+
+
+/*** MERGING ***/
+
+/* Does the current record of run a come before the current record of
+ * run b? A run that has been read to the end comes after every other
+ * run, and ties go to the run with the earlier records */
+static bool chidb_dbm_sorter_less(chidb_dbm_sorter_t *sorter, chidb_dbm_sorter_run_t *runs, uint32_t a, uint32_t b)
+{
+    int c;
+
+    if(runs[a].done || runs[b].done)
+        return !runs[a].done;
+
+    c = chidb_dbm_sorter_cmp(sorter, runs[a].row, runs[b].row);
+    return c < 0 || (c == 0 && a < b);
+}
+
+/* Starts merging k runs, building their loser tree. Leaf i of the tree
+ * (node k + i) is run i, each internal node n (1 <= n < k, with children
+ * 2n and 2n + 1) holds the run that lost the match played there, and
+ * tree[0] holds the run that won the whole tree, whose record comes first */
+static int chidb_dbm_sorter_merge_start(chidb_dbm_sorter_t *sorter, chidb_dbm_sorter_run_t *runs, uint32_t k, uint32_t *tree)
+{
+    uint32_t *winners = malloc(sizeof(uint32_t) * 2 * k);
+    int rc;
+
+    if(winners == NULL)
+        return CHIDB_ENOMEM;
+
+    for(uint32_t i = 0; i < k; i++)
+    {
+        rewind(runs[i].file);
+        runs[i].left = runs[i].nrows;
+        runs[i].done = false;
+        if((rc = chidb_dbm_sorter_run_read(&runs[i])) != CHIDB_OK)
+        {
+            free(winners);
+            return rc;
+        }
+        winners[k + i] = i;
+    }
+
+    for(uint32_t n = k - 1; n >= 1; n--)
+    {
+        uint32_t l = winners[2 * n], r = winners[2 * n + 1];
+
+        if(chidb_dbm_sorter_less(sorter, runs, r, l))
+        {
+            winners[n] = r;
+            tree[n] = l;
+        }
+        else
+        {
+            winners[n] = l;
+            tree[n] = r;
+        }
+    }
+    tree[0] = winners[1];
+
+    free(winners);
+    return CHIDB_OK;
+}
+
+/* Moves on from the record that won the loser tree: the record after it
+ * in its run replays the matches on the way from its leaf to the root */
+static int chidb_dbm_sorter_merge_next(chidb_dbm_sorter_t *sorter, chidb_dbm_sorter_run_t *runs, uint32_t k, uint32_t *tree)
+{
+    uint32_t w = tree[0];
+    int rc;
+
+    if((rc = chidb_dbm_sorter_run_read(&runs[w])) != CHIDB_OK)
+        return rc;
+
+    for(uint32_t n = (k + w) / 2; n >= 1; n /= 2)
+    {
+        if(chidb_dbm_sorter_less(sorter, runs, tree[n], w))
+        {
+            uint32_t loser = w;
+            w = tree[n];
+            tree[n] = loser;
+        }
+    }
+    tree[0] = w;
+
+    return CHIDB_OK;
+}
+
+/* Merges the last k runs into a single run */
+static int chidb_dbm_sorter_merge_runs(chidb_dbm_sorter_t *sorter, uint32_t k)
+{
+    uint32_t first = sorter->nruns - k;
+    uint32_t tree[DBM_SORTER_FANIN];
+    chidb_dbm_sorter_run_t *runs, merged;
+    int rc;
+
+    memset(&merged, 0, sizeof(merged));
+    if((merged.file = tmpfile()) == NULL)
+        return CHIDB_EIO;
+    merged.level = sorter->runs[first].level + 1;
+
+    runs = &sorter->runs[first];
+    rc = chidb_dbm_sorter_merge_start(sorter, runs, k, tree);
+    while(rc == CHIDB_OK && !runs[tree[0]].done)
+    {
+        if((rc = chidb_dbm_sorter_run_write(&merged, runs[tree[0]].row, runs[tree[0]].rlen)) != CHIDB_OK)
+            break;
+        rc = chidb_dbm_sorter_merge_next(sorter, runs, k, tree);
+    }
+
+    if(rc != CHIDB_OK)
+    {
+        fclose(merged.file);
+        return rc;
+    }
+
+    for(uint32_t i = first; i < sorter->nruns; i++)
+        chidb_dbm_sorter_run_free(&sorter->runs[i]);
+    sorter->runs[first] = merged;
+    sorter->nruns = first + 1;
+
+    return CHIDB_OK;
+}
+
+/* Sorts the records in memory and writes them to a new run. Then, while
+ * the last DBM_SORTER_FANIN runs have been through the same number of
+ * merges, merges them */
+static int chidb_dbm_sorter_spill(chidb_dbm_sorter_t *sorter)
+{
+    chidb_dbm_sorter_run_t *run;
+    int rc;
+
+    if((rc = chidb_dbm_sorter_sort_memory(sorter)) != CHIDB_OK)
+        return rc;
+    if((rc = chidb_dbm_sorter_run_new(sorter, 0, &run)) != CHIDB_OK)
+        return rc;
+
+    for(uint32_t i = 0; i < sorter->nrows; i++)
+    {
+        uint32_t offset = sorter->rows[i];
+        if((rc = chidb_dbm_sorter_run_write(run, ROW_RECORD(sorter, offset), ROW_LEN(sorter, offset))) != CHIDB_OK)
+            return rc;
+    }
+    sorter->nrows = 0;
+    sorter->used = 0;
+
+    while(sorter->nruns >= DBM_SORTER_FANIN &&
+          sorter->runs[sorter->nruns - DBM_SORTER_FANIN].level == sorter->runs[sorter->nruns - 1].level)
+    {
+        if((rc = chidb_dbm_sorter_merge_runs(sorter, DBM_SORTER_FANIN)) != CHIDB_OK)
+            return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/*** TOP-N HEAP ***/
+
+/* Does heap entry a come after heap entry b? Entries with equal keys
+ * come in the order they were added in */
+static bool chidb_dbm_sorter_after(chidb_dbm_sorter_t *sorter, chidb_dbm_sorter_entry_t *a, chidb_dbm_sorter_entry_t *b)
+{
+    int c = chidb_dbm_sorter_cmp(sorter, a->record, b->record);
+
+    return c > 0 || (c == 0 && a->seq > b->seq);
+}
+
+/* Moves entry i of the first n entries of the heap down, until the
+ * entries below it come before it */
+static void chidb_dbm_sorter_sift_down(chidb_dbm_sorter_t *sorter, uint32_t i, uint32_t n)
+{
+    chidb_dbm_sorter_entry_t **heap = sorter->heap, *e = heap[i];
+
+    for(uint32_t child = 2 * i + 1; child < n; i = child, child = 2 * i + 1)
+    {
+        if(child + 1 < n && chidb_dbm_sorter_after(sorter, heap[child + 1], heap[child]))
+            child++;
+        if(!chidb_dbm_sorter_after(sorter, heap[child], e))
+            break;
+        heap[i] = heap[child];
+    }
+    heap[i] = e;
+}
+
+/* Moves entry i of the heap up, until the entry above it comes after it */
+static void chidb_dbm_sorter_sift_up(chidb_dbm_sorter_t *sorter, uint32_t i)
+{
+    chidb_dbm_sorter_entry_t **heap = sorter->heap, *e = heap[i];
+
+    while(i > 0 && chidb_dbm_sorter_after(sorter, e, heap[(i - 1) / 2]))
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = e;
+}
+
+static int chidb_dbm_sorter_seq_cmp(const void *a, const void *b)
+{
+    uint64_t s1 = (*(chidb_dbm_sorter_entry_t **) a)->seq, s2 = (*(chidb_dbm_sorter_entry_t **) b)->seq;
+
+    return (s1 > s2) - (s1 < s2);
+}
+
+static void chidb_dbm_sorter_heap_free(chidb_dbm_sorter_t *sorter)
+{
+    for(uint32_t i = 0; i < sorter->nheap; i++)
+        free(sorter->heap[i]);
+    free(sorter->heap);
+
+    sorter->heap = NULL;
+    sorter->nheap = sorter->heap_size = 0;
+    sorter->heap_used = 0;
+}
+
+/* Stops limiting the sorter: the records in the heap are added to it
+ * again, in the order they were first added in, as unlimited records */
+static int chidb_dbm_sorter_unlimit(chidb_dbm_sorter_t *sorter)
+{
+    int rc = CHIDB_OK;
+
+    qsort(sorter->heap, sorter->nheap, sizeof(chidb_dbm_sorter_entry_t *), chidb_dbm_sorter_seq_cmp);
+    sorter->limit = 0;
+
+    for(uint32_t i = 0; i < sorter->nheap && rc == CHIDB_OK; i++)
+        rc = chidb_dbm_sorter_insert(sorter, sorter->heap[i]->record, sorter->heap[i]->rlen);
+    chidb_dbm_sorter_heap_free(sorter);
+
+    return rc;
+}
+
+/* Adds a record to a limited sorter. If the heap is full, the record
+ * either replaces the one that comes last, or is thrown away */
+static int chidb_dbm_sorter_heap_insert(chidb_dbm_sorter_t *sorter, const uint8_t *record, uint32_t rlen)
+{
+    chidb_dbm_sorter_entry_t *e;
+    uint64_t seq = sorter->seq++;
+    bool replace = sorter->nheap == sorter->limit;
+
+    if(replace)
+    {
+        /* A record that ties with the last one comes after it, as it
+         * was added later */
+        if(chidb_dbm_sorter_cmp(sorter, (uint8_t *) record, sorter->heap[0]->record) >= 0)
+            return CHIDB_OK;
+
+        if((e = realloc(sorter->heap[0], sizeof(chidb_dbm_sorter_entry_t) + rlen)) == NULL)
+            return CHIDB_ENOMEM;
+        sorter->heap_used += rlen;
+        sorter->heap_used -= e->rlen;
+        sorter->heap[0] = e;
+    }
+    else
+    {
+        if(sorter->nheap == sorter->heap_size)
+        {
+            uint32_t size = sorter->heap_size > 0 ? sorter->heap_size * 2 : 64;
+            chidb_dbm_sorter_entry_t **heap;
+
+            if(size > sorter->limit)
+                size = sorter->limit;
+            if((heap = realloc(sorter->heap, sizeof(chidb_dbm_sorter_entry_t *) * size)) == NULL)
+                return CHIDB_ENOMEM;
+            sorter->heap = heap;
+            sorter->heap_size = size;
+        }
+        if((e = malloc(sizeof(chidb_dbm_sorter_entry_t) + rlen)) == NULL)
+            return CHIDB_ENOMEM;
+        sorter->heap_used += sizeof(chidb_dbm_sorter_entry_t) + sizeof(chidb_dbm_sorter_entry_t *) + rlen;
+        sorter->heap[sorter->nheap++] = e;
+    }
+
+    e->seq = seq;
+    e->rlen = rlen;
+    memcpy(e->record, record, rlen);
+
+    if(replace)
+        chidb_dbm_sorter_sift_down(sorter, 0, sorter->nheap);
+    else
+        chidb_dbm_sorter_sift_up(sorter, sorter->nheap - 1);
+
+    if(sorter->heap_used > sorter->budget)
+        return chidb_dbm_sorter_unlimit(sorter);
+
+    return CHIDB_OK;
+}
+
+/* Sorts the heap in place (a heap sort, which leaves the records in the
+ * order they come in) */
+static void chidb_dbm_sorter_heap_sort(chidb_dbm_sorter_t *sorter)
+{
+    for(uint32_t n = sorter->nheap; n > 1; n--)
+    {
+        chidb_dbm_sorter_entry_t *e = sorter->heap[0];
+        sorter->heap[0] = sorter->heap[n - 1];
+        sorter->heap[n - 1] = e;
+        chidb_dbm_sorter_sift_down(sorter, 0, n - 1);
+    }
+}
+
+
+/*** SORTER ***/
+
+/* Creates a new, empty, sorter
+ *
+ * Parameters
+ * - sorter: Out parameter. Used to return the new sorter.
+ * - order: Order of each column of the sort key: '+' (ascending)
+ *   or '-' (descending), one character per column
+ * - budget: Bytes of records the sorter can keep in memory before it
+ *   starts writing them to disk (0 for DBM_SORTER_BUDGET)
+ * - limit: Number of records that will be read from the sorter once it
+ *   is sorted (0 for all of them). Only the records that come first
+ *   are kept.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_dbm_sorter_new(chidb_dbm_sorter_t **sorter, const char *order, size_t budget, uint32_t limit)
+{
+    *sorter = calloc(1, sizeof(chidb_dbm_sorter_t));
+    if(*sorter == NULL)
+        return CHIDB_ENOMEM;
+
+    if(((*sorter)->order = strdup(order != NULL ? order : "")) == NULL)
+    {
+        free(*sorter);
+        return CHIDB_ENOMEM;
+    }
+    (*sorter)->nkeys = strlen((*sorter)->order);
+    (*sorter)->budget = budget > 0 ? budget : DBM_SORTER_BUDGET;
+    (*sorter)->limit = limit;
+
+    return CHIDB_OK;
+}
+
+
+/* Frees a sorter, and removes its temporary files
+ *
+ * Parameters
+ * - sorter: Sorter to free
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_sorter_free(chidb_dbm_sorter_t *sorter)
+{
+    for(uint32_t i = 0; i < sorter->nruns; i++)
+        chidb_dbm_sorter_run_free(&sorter->runs[i]);
+
+    chidb_dbm_sorter_heap_free(sorter);
+    free(sorter->runs);
+    free(sorter->tree);
+    free(sorter->rows);
+    free(sorter->data);
+    free(sorter->order);
+    free(sorter);
+
+    return CHIDB_OK;
+}
+
+
+/* Add a record to a sorter
+ *
+ * Records can only be added before the sorter is sorted.
+ *
+ * Parameters
+ * - sorter: Sorter
+ * - record, rlen: Record (which is copied)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The sorter has already been sorted
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not write a run to disk
+ */
+int chidb_dbm_sorter_insert(chidb_dbm_sorter_t *sorter, const uint8_t *record, uint32_t rlen)
+{
+    size_t need = (sizeof(uint32_t) + rlen + 3) & ~(size_t) 3;
+
+    if(sorter->sorted)
+        return CHIDB_EMISUSE;
+    if(sorter->limit > 0)
+        return chidb_dbm_sorter_heap_insert(sorter, record, rlen);
+
+    if(sorter->used + need > sorter->size)
+    {
+        size_t size = sorter->size > 0 ? sorter->size : 4096;
+        uint8_t *data;
+
+        while(size < sorter->used + need)
+            size *= 2;
+        if((data = realloc(sorter->data, size)) == NULL)
+            return CHIDB_ENOMEM;
+        sorter->data = data;
+        sorter->size = size;
+    }
+    if(sorter->nrows == sorter->rows_size)
+    {
+        uint32_t size = sorter->rows_size > 0 ? sorter->rows_size * 2 : 256;
+        uint32_t *rows = realloc(sorter->rows, sizeof(uint32_t) * size);
+
+        if(rows == NULL)
+            return CHIDB_ENOMEM;
+        sorter->rows = rows;
+        sorter->rows_size = size;
+    }
+
+    ROW_LEN(sorter, sorter->used) = rlen;
+    memcpy(ROW_RECORD(sorter, sorter->used), record, rlen);
+    sorter->rows[sorter->nrows++] = sorter->used;
+    sorter->used += need;
+
+    if(sorter->used + sizeof(uint32_t) * sorter->nrows > sorter->budget)
+        return chidb_dbm_sorter_spill(sorter);
+
+    return CHIDB_OK;
+}
+
+
+/* Sort the records of a sorter, and move to the first one
+ *
+ * Parameters
+ * - sorter: Sorter
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The sorter is empty
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read or write a run
+ */
+int chidb_dbm_sorter_sort(chidb_dbm_sorter_t *sorter)
+{
+    int rc;
+
+    if(sorter->sorted)
+        return CHIDB_EMISUSE;
+    sorter->sorted = true;
+
+    if(sorter->limit > 0)
+    {
+        chidb_dbm_sorter_heap_sort(sorter);
+        sorter->current = 0;
+        return sorter->nheap > 0 ? CHIDB_OK : CHIDB_ENOTFOUND;
+    }
+
+    /* Everything fits in memory */
+    if(sorter->nruns == 0)
+    {
+        if((rc = chidb_dbm_sorter_sort_memory(sorter)) != CHIDB_OK)
+            return rc;
+        sorter->current = 0;
+        return sorter->nrows > 0 ? CHIDB_OK : CHIDB_ENOTFOUND;
+    }
+
+    if(sorter->nrows > 0 && (rc = chidb_dbm_sorter_spill(sorter)) != CHIDB_OK)
+        return rc;
+
+    if((sorter->tree = malloc(sizeof(uint32_t) * sorter->nruns)) == NULL)
+        return CHIDB_ENOMEM;
+    if((rc = chidb_dbm_sorter_merge_start(sorter, sorter->runs, sorter->nruns, sorter->tree)) != CHIDB_OK)
+        return rc;
+
+    return sorter->runs[sorter->tree[0]].done ? CHIDB_ENOTFOUND : CHIDB_OK;
+}
+
+
+/* Get the record a sorted sorter is on
+ *
+ * Parameters
+ * - sorter: Sorter
+ * - record, rlen: Out parameters for the record, which is valid until
+ *   the sorter moves on to the next record
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_dbm_sorter_row(chidb_dbm_sorter_t *sorter, uint8_t **record, uint32_t *rlen)
+{
+    if(sorter->limit > 0)
+    {
+        *record = sorter->heap[sorter->current]->record;
+        *rlen = sorter->heap[sorter->current]->rlen;
+    }
+    else if(sorter->nruns == 0)
+    {
+        *record = ROW_RECORD(sorter, sorter->rows[sorter->current]);
+        *rlen = ROW_LEN(sorter, sorter->rows[sorter->current]);
+    }
+    else
+    {
+        *record = sorter->runs[sorter->tree[0]].row;
+        *rlen = sorter->runs[sorter->tree[0]].rlen;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Move a sorted sorter on to its next record
+ *
+ * Parameters
+ * - sorter: Sorter
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: There are no more records
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: Could not read a run
+ */
+int chidb_dbm_sorter_next(chidb_dbm_sorter_t *sorter)
+{
+    int rc;
+
+    if(sorter->limit > 0)
+        return ++sorter->current < sorter->nheap ? CHIDB_OK : CHIDB_ENOTFOUND;
+    if(sorter->nruns == 0)
+        return ++sorter->current < sorter->nrows ? CHIDB_OK : CHIDB_ENOTFOUND;
+
+    if((rc = chidb_dbm_sorter_merge_next(sorter, sorter->runs, sorter->nruns, sorter->tree)) != CHIDB_OK)
+        return rc;
+
+    return sorter->runs[sorter->tree[0]].done ? CHIDB_ENOTFOUND : CHIDB_OK;
+}
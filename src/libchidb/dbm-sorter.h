@@ -0,0 +1,153 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database Machine sorters
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef DBM_SORTER_H_
+#define DBM_SORTER_H_
+
+#include "chidbInt.h"
+#include "dbm-types.h"
+
+/* Sorters for ORDER BY
+ *
+ * A sorter holds records (made by MakeRecord), which are sorted on their
+ * first few columns (the sort key, each in ascending or descending order).
+ * Records are added by SorterInsert, and read back in order by SorterSort
+ * and SorterNext, which position a sorter cursor on each of them so they
+ * can be read with Column like any other row.
+ *
+ * Records are kept in memory until they take up more than the sorter's
+ * memory budget. Then they are sorted, and written to a temporary file as
+ * a sorted run. Once all the records have been added, the runs (and the
+ * records still in memory, as one last run) are merged with a loser tree,
+ * which finds the smallest of the k runs' next records with log2(k)
+ * comparisons. To keep the number of runs (and of open files) down, the
+ * last DBM_SORTER_FANIN runs are merged into a single run whenever they
+ * have all been through the same number of merges, so each record is
+ * written about log(n) / log(DBM_SORTER_FANIN) times.
+ *
+ * Records with equal keys are returned in the order they were added in.
+ * NULLs are sorted before any other value.
+ *
+ * A sorter can also be limited to the first N records (for ORDER BY with
+ * LIMIT). Then it only keeps the N records that come first so far, in a
+ * heap with the one that comes last at its top: each new record is only
+ * compared with that one, and either replaces it or is thrown away right
+ * away, so the records are never all sorted (or written to disk). If the
+ * N records don't fit in the memory budget after all, the sorter goes
+ * back to keeping every record from then on.
+ */
+
+/* Default memory budget, in bytes */
+#define DBM_SORTER_BUDGET (8 * 1024 * 1024)
+
+/* Most runs merged at once before the final merge */
+#define DBM_SORTER_FANIN (16)
+
+/* A sorted run, stored in a temporary file as a sequence of records,
+ * each of them preceded by its length (a uint32_t) */
+typedef struct chidb_dbm_sorter_run
+{
+    FILE *file;
+    uint32_t nrows;
+    uint32_t level;     /* Number of merges the run's records have been through */
+
+    /* While merging: the run's current record, and the number of records
+     * that haven't been read yet */
+    uint8_t *row;
+    uint32_t rlen;
+    uint32_t rsize;
+    uint32_t left;
+    bool done;
+} chidb_dbm_sorter_run_t;
+
+/* A record in the heap of a limited sorter */
+typedef struct chidb_dbm_sorter_entry
+{
+    uint64_t seq;       /* Number of records added before it */
+    uint32_t rlen;
+    uint8_t record[];
+} chidb_dbm_sorter_entry_t;
+
+struct chidb_dbm_sorter
+{
+    /* Order of each column of the sort key ('+' ascending, '-' descending) */
+    char *order;
+    uint32_t nkeys;
+
+    size_t budget;
+
+    /* Records in memory, each of them preceded by its length, and the
+     * offset of each of them into data */
+    uint8_t *data;
+    size_t size;
+    size_t used;
+    uint32_t *rows;
+    uint32_t nrows;
+    uint32_t rows_size;
+
+    /* Runs, in the order their records were added */
+    chidb_dbm_sorter_run_t *runs;
+    uint32_t nruns;
+
+    /* If the sorter is limited to its first limit records (0 if it
+     * isn't, or no longer is): those records, in a heap */
+    uint32_t limit;
+    chidb_dbm_sorter_entry_t **heap;
+    uint32_t nheap;
+    uint32_t heap_size;
+    size_t heap_used;
+    uint64_t seq;
+
+    /* Once sorted: the record being read (an index into heap if the sorter
+     * is limited, or into rows if there are no runs), and the loser tree
+     * used to merge the runs otherwise */
+    bool sorted;
+    uint32_t current;
+    uint32_t *tree;
+};
+typedef struct chidb_dbm_sorter chidb_dbm_sorter_t;
+
+int chidb_dbm_sorter_new(chidb_dbm_sorter_t **sorter, const char *order, size_t budget, uint32_t limit);
+int chidb_dbm_sorter_free(chidb_dbm_sorter_t *sorter);
+int chidb_dbm_sorter_insert(chidb_dbm_sorter_t *sorter, const uint8_t *record, uint32_t rlen);
+int chidb_dbm_sorter_sort(chidb_dbm_sorter_t *sorter);
+int chidb_dbm_sorter_row(chidb_dbm_sorter_t *sorter, uint8_t **record, uint32_t *rlen);
+int chidb_dbm_sorter_next(chidb_dbm_sorter_t *sorter);
+
+#endif /* DBM_SORTER_H_ */
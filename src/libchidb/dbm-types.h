@@ -53,46 +53,120 @@
 /* We define a "for each" macro to generate the various portions
  * of code that relate to opcodes. This is based on the solution
  * shown at http://stackoverflow.com/questions/9907160/how-to-convert-enum-names-to-string-in-c
+ *
+ * The second column tells whether p2 of the instruction is a jump
+ * address (which the peephole optimizer has to keep up to date when
+ * it moves or removes instructions).
  */
 
 #define FOREACH_OP(OP)  \
-        OP(Noop)        \
-        OP(OpenRead)    \
-        OP(OpenWrite)   \
-        OP(Close)       \
-        OP(Rewind)      \
-        OP(Next)        \
-        OP(Prev)        \
-        OP(Seek)        \
-        OP(SeekGt)      \
-        OP(SeekGe)      \
-        OP(SeekLt)      \
-        OP(SeekLe)      \
-        OP(Column)      \
-        OP(Key)         \
-        OP(Integer)     \
-        OP(String)      \
-        OP(Null)        \
-        OP(ResultRow)   \
-        OP(MakeRecord)  \
-        OP(Insert)      \
-        OP(Eq)          \
-        OP(Ne)          \
-        OP(Lt)          \
-        OP(Le)          \
-        OP(Gt)          \
-        OP(Ge)          \
-        OP(IdxGt)       \
-        OP(IdxGe)       \
-        OP(IdxLt)       \
-        OP(IdxLe)       \
-        OP(IdxPKey)     \
-        OP(IdxInsert)   \
-        OP(CreateTable) \
-        OP(CreateIndex) \
-        OP(Copy)        \
-        OP(SCopy)       \
-        OP(Halt)
+        OP(Noop,             false) \
+        OP(OpenRead,         false) \
+        OP(OpenWrite,        false) \
+        OP(Close,            false) \
+        OP(Rewind,           true)  \
+        OP(Next,             true)  \
+        OP(Prev,             true)  \
+        OP(Seek,             true)  \
+        OP(SeekGt,           true)  \
+        OP(SeekGe,           true)  \
+        OP(SeekLt,           true)  \
+        OP(SeekLe,           true)  \
+        OP(Column,           false) \
+        OP(Key,              false) \
+        OP(Integer,          false) \
+        OP(Int64,            false) \
+        OP(Real,             false) \
+        OP(String,           false) \
+        OP(Null,             false) \
+        OP(ResultRow,        false) \
+        OP(MakeRecord,       false) \
+        OP(Insert,           false) \
+        OP(Eq,               true)  \
+        OP(Ne,               true)  \
+        OP(Lt,               true)  \
+        OP(Le,               true)  \
+        OP(Gt,               true)  \
+        OP(Ge,               true)  \
+        OP(EqInt,            true)  \
+        OP(NeInt,            true)  \
+        OP(LtInt,            true)  \
+        OP(LeInt,            true)  \
+        OP(GtInt,            true)  \
+        OP(GeInt,            true)  \
+        OP(EqStr,            true)  \
+        OP(NeStr,            true)  \
+        OP(LtStr,            true)  \
+        OP(LeStr,            true)  \
+        OP(GtStr,            true)  \
+        OP(GeStr,            true)  \
+        OP(EqConst,          true)  \
+        OP(NeConst,          true)  \
+        OP(LtConst,          true)  \
+        OP(LeConst,          true)  \
+        OP(GtConst,          true)  \
+        OP(GeConst,          true)  \
+        OP(IdxGt,            true)  \
+        OP(IdxGe,            true)  \
+        OP(IdxLt,            true)  \
+        OP(IdxLe,            true)  \
+        OP(IdxPKey,          false) \
+        OP(IdxInsert,        false) \
+        OP(IdxInsertRecord,  false) \
+        OP(IdxBuild,         false) \
+        OP(CreateTable,      false) \
+        OP(CreateIndex,      false) \
+        OP(Analyze,          false) \
+        OP(IncrCookie,       false) \
+        OP(AutoCommit,       false) \
+        OP(Copy,             false) \
+        OP(SCopy,            false) \
+        OP(NewRowid,         false) \
+        OP(IsNull,           true)  \
+        OP(MustBeKey,        true)  \
+        OP(Variable,         false) \
+        OP(Goto,             true)  \
+        OP(IfPos,            true)  \
+        OP(DecrJumpZero,     true)  \
+        OP(ArenaMark,        false) \
+        OP(ArenaRelease,     false) \
+        OP(Batch,            true)  \
+        OP(VColumn,          false) \
+        OP(VKey,             false) \
+        OP(VEq,              false) \
+        OP(VNe,              false) \
+        OP(VLt,              false) \
+        OP(VLe,              false) \
+        OP(VGt,              false) \
+        OP(VGe,              false) \
+        OP(VEqConst,         false) \
+        OP(VNeConst,         false) \
+        OP(VLtConst,         false) \
+        OP(VLeConst,         false) \
+        OP(VGtConst,         false) \
+        OP(VGeConst,         false) \
+        OP(BatchRow,         true)  \
+        OP(ColumnCmpInt,     false) \
+        OP(ColumnRun,        false) \
+        OP(NextColumn,       true)  \
+        OP(HashOpen,         false) \
+        OP(HashBuild,        false) \
+        OP(HashProbe,        true)  \
+        OP(HashNext,         true)  \
+        OP(SorterOpen,       false) \
+        OP(SorterInsert,     false) \
+        OP(SorterSort,       true)  \
+        OP(SorterData,       false) \
+        OP(SorterNext,       true)  \
+        OP(AggOpen,          false) \
+        OP(AggStep,          false) \
+        OP(AggBreak,         true)  \
+        OP(AggFinal,         true)  \
+        OP(AggNext,          true)  \
+        OP(SetOpen,          false) \
+        OP(SetInsert,        true)  \
+        OP(SetNotFound,      true)  \
+        OP(Halt,             false)
 
 /* The following generates an enum type for the opcode. It expands to:
  *
@@ -106,7 +180,7 @@
  * } opcode_t;
  */
 
-#define GENERATE_ENUM(ENUM) Op_ ## ENUM,
+#define GENERATE_ENUM(ENUM, JUMP) Op_ ## ENUM,
 typedef enum opcode
 {
     FOREACH_OP(GENERATE_ENUM)
@@ -125,12 +199,29 @@ typedef enum opcode
  * } opcode_t;
  */
 
-#define GENERATE_ENUM_STR(ENUM) [Op_ ## ENUM] = #ENUM,
+#define GENERATE_ENUM_STR(ENUM, JUMP) [Op_ ## ENUM] = #ENUM,
 static const char* op_str[] =
 {
     FOREACH_OP(GENERATE_ENUM_STR)
 };
 
+/* The following generates an array telling, for each opcode, whether
+ * p2 is a jump address. It expands to:
+ *
+ * static const bool op_p2_jump[] = {
+ *    [Op_Noop] = false,
+ *    [Op_OpenRead] = false,
+ *    ...
+ *    [Op_Halt] = false,
+ * };
+ */
+
+#define GENERATE_P2_JUMP(ENUM, JUMP) [Op_ ## ENUM] = JUMP,
+static const bool op_p2_jump[] =
+{
+    FOREACH_OP(GENERATE_P2_JUMP)
+};
+
 /* Functions to map opcodes to strings, and viceverse */
 
 static inline const char* opcode_to_str(int opcode)
@@ -138,6 +229,11 @@ static inline const char* opcode_to_str(int opcode)
     return (opcode >=0 && opcode <= Op_Halt)? op_str[opcode] : NULL;
 }
 
+static inline bool opcode_p2_is_jump(int opcode)
+{
+    return opcode >= 0 && opcode <= Op_Halt && op_p2_jump[opcode];
+}
+
 static inline int str_to_opcode(const char *s)
 {
     for(int i=0; i<=Op_Halt; i++)
@@ -158,16 +254,18 @@ typedef struct chidb_dbm_op
 } chidb_dbm_op_t;
 
 
-/* A register can be of type integer, string, null or binary.
- * Additionally we define a REG_UNSPECIFIED type, which is
- * the type of any new register than hasn't been assigned a value. */
+/* A register can be of type integer (32 or 64 bits), double, string,
+ * null or binary (a BLOB). Additionally we define a REG_UNSPECIFIED type,
+ * which is the type of any new register than hasn't been assigned a value. */
 typedef enum register_type
 {
     REG_UNSPECIFIED    = 0,
     REG_NULL           = 1,
     REG_INT32          = 2,
     REG_STRING         = 3,
-    REG_BINARY         = 4
+    REG_BINARY         = 4,
+    REG_INT64          = 5,
+    REG_DOUBLE         = 6
 } register_type_t;
 
 static inline const char* regtype_to_str(register_type_t regtype)
@@ -184,6 +282,10 @@ static inline const char* regtype_to_str(register_type_t regtype)
         return "string";
     case REG_BINARY:
         return "binary";
+    case REG_INT64:
+        return "int64";
+    case REG_DOUBLE:
+        return "double";
     default:
         return "unknown";
     }
@@ -197,6 +299,8 @@ typedef struct chidb_dbm_register
     union
     {
         int32_t i;
+        int64_t i64;
+        double d;
         char* s;
         struct
         {
@@ -205,8 +309,18 @@ typedef struct chidb_dbm_register
         } bin;
     } value;
 
+    /* Length of value.s (only if type is REG_STRING), so string
+     * comparisons don't have to find the end of the string */
+    uint32_t slen;
+
 } chidb_dbm_register_t;
 
+/* Reading a field of a record into a register, appending a register to
+ * a record, and comparing the values of two registers (see dbm-ops.c) */
+int chidb_dbm_record_value(DBRecordView *record, uint8_t field, chidb_dbm_register_t *reg);
+int chidb_dbm_record_append(DBRecordBuffer *dbrb, chidb_dbm_register_t *reg);
+int chidb_dbm_op_compare_reg(const chidb_dbm_register_t *reg1, const chidb_dbm_register_t *reg2);
+
 /*  This is the struct that represents a single DBM program.
  *
  *  Notice how a single DBM program has its own registers and cursors;
@@ -239,6 +353,10 @@ struct chidb_stmt
     chidb_dbm_register_t *reg;
     uint32_t nReg;
 
+    /* Vectors (see dbm-batch.h). There is one for each register, but the
+     * array is only allocated if the program uses vectors */
+    struct chidb_dbm_vector *vec;
+
     /* Cursors */
     /* Cursors are stored in a dynamically allocated array of chidb_dbm_cursor_t's */
     chidb_dbm_cursor_t *cursors;
@@ -259,6 +377,36 @@ struct chidb_stmt
      * per operation */
     bool explain;
 
+    /* Memory for values produced while computing a row (strings read
+     * by Column, records built by MakeRecord, etc.). It is reset when the
+     * program starts, and released to a mark by ArenaRelease at the end
+     * of each iteration of a loop (see dbm-ops.c), so a value is valid
+     * until the iteration of the innermost loop that produced it ends. */
+    Arena arena;
+    ArenaMark *marks;
+    uint32_t nMarks;
+
+    /* Normalised SQL text the program was compiled from (NULL if it
+     * wasn't compiled from SQL), and the schema cookie at the time.
+     * Used to cache the program, see stmtcache.h */
+    char *cache_key;
+    uint32_t cookie;
+
+    /* Values bound to the statement's parameters (see chidb_bind_int),
+     * and the parameters' names (NULL for a "?"). Parameters are
+     * numbered from 1, so parameter i is vars[i - 1]. Bound strings
+     * belong to the statement. Parameters that haven't been bound
+     * are NULL. */
+    chidb_dbm_register_t *vars;
+    char **var_names;
+    uint32_t nVars;
+
+    /* Lock on the database that the program needs (see chidb_stmt_access),
+     * and the lock it holds while it runs (BTREE_LOCK_NONE if it isn't
+     * running, or doesn't need one) */
+    uint8_t access;
+    uint8_t lock;
+
     /* Additional fields go here */
 };
 
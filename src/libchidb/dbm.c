@@ -40,11 +40,11 @@
 #include <assert.h>
 #include <stdbool.h>
 #include "dbm.h"
+#include "dbm-batch.h"
+#include "btree.h"
 
 /* Forward declaration of auxiliary functions. */
 int realloc_ops(chidb_stmt *stmt, uint32_t size);
-int realloc_reg(chidb_stmt *stmt, uint32_t size);
-int realloc_cur(chidb_stmt *stmt, uint32_t size);
 
 
 
@@ -74,6 +74,13 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
     stmt->db = db;
     stmt->sql = NULL;
     stmt->explain = false;
+    stmt->cache_key = NULL;
+    stmt->cookie = 0;
+    stmt->vars = NULL;
+    stmt->var_names = NULL;
+    stmt->nVars = 0;
+    stmt->access = BTREE_LOCK_NONE;
+    stmt->lock = BTREE_LOCK_NONE;
 
     /* The program starts running in instruction 0 */
     stmt->pc = 0;
@@ -93,6 +100,7 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
     /* Same as above, but with registers. */
     stmt->reg = NULL;
     stmt->nReg = 0;
+    stmt->vec = NULL;
     rc = realloc_reg(stmt, DEFAULT_REG_SIZE);
     if(rc != CHIDB_OK)
         return rc;
@@ -110,6 +118,10 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
     stmt->cols = NULL;
     stmt->nCols = 0;
 
+    chidb_Arena_init(&stmt->arena);
+    stmt->marks = NULL;
+    stmt->nMarks = 0;
+
     return CHIDB_OK;
 }
 
@@ -125,13 +137,175 @@ int chidb_stmt_init(chidb_stmt *stmt, chidb *db)
  */
 int chidb_stmt_free(chidb_stmt *stmt)
 {
+	for(int i=0; i < stmt->nCursors; i++)
+	{
+		/* Cursors left open by a statement that didn't run to completion */
+		if(stmt->cursors[i].type != CURSOR_UNSPECIFIED)
+			chidb_dbm_cursor_free(stmt->db->bt, &stmt->cursors[i]);
+		if(stmt->cursors[i].batch != NULL)
+			chidb_dbm_batch_free(stmt->cursors[i].batch);
+	}
+
+	if(stmt->vec != NULL)
+	{
+		for(int i=0; i < stmt->nReg; i++)
+			chidb_dbm_vector_free(&stmt->vec[i]);
+		free(stmt->vec);
+	}
+
 	free(stmt->ops);
 	free(stmt->reg);
 	free(stmt->cursors);
+	free(stmt->cache_key);
+	chidb_Arena_free(&stmt->arena);
+	free(stmt->marks);
+
+	chidb_stmt_unbind(stmt);
+	for(int i=0; i < stmt->nVars; i++)
+		free(stmt->var_names[i]);
+	free(stmt->vars);
+	free(stmt->var_names);
+    return CHIDB_OK;
+}
+
+
+/* Reset a DBM
+ *
+ * Gets the DBM ready to run its program again from the start: open
+ * cursors are closed, and registers and the result row are cleared.
+ * The program itself is kept.
+ *
+ * Parameters
+ * - stmt: DBM to reset
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_stmt_reset(chidb_stmt *stmt)
+{
+    chidb_Btree_unlock(stmt->db->bt, stmt->lock);
+    stmt->lock = BTREE_LOCK_NONE;
+
+    for(int i=0; i < stmt->nCursors; i++)
+    {
+        if(stmt->cursors[i].type != CURSOR_UNSPECIFIED)
+            chidb_dbm_cursor_free(stmt->db->bt, &stmt->cursors[i]);
+        stmt->cursors[i].type = CURSOR_UNSPECIFIED;
+        stmt->cursors[i].record_valid = false;
+    }
+
+    for(int i=0; i < stmt->nReg; i++)
+        stmt->reg[i].type = REG_UNSPECIFIED;
+
+    chidb_Arena_reset(&stmt->arena);
+
+    stmt->pc = 0;
+    stmt->startRR = 0;
+    stmt->nRR = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Set up a DBM's parameters
+ *
+ * Makes room for the values of a program's parameters, all of which
+ * start out unbound (NULL).
+ *
+ * Parameters
+ * - stmt: DBM
+ * - n: Number of parameters
+ * - names: Names of the parameters (NULL for a parameter without a
+ *          name). They are copied.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_set_vars(chidb_stmt *stmt, uint32_t n, char **names)
+{
+    stmt->vars = calloc(n, sizeof(chidb_dbm_register_t));
+    stmt->var_names = calloc(n, sizeof(char *));
+    if(n > 0 && (stmt->vars == NULL || stmt->var_names == NULL))
+        return CHIDB_ENOMEM;
+    stmt->nVars = n;
+
+    for(int i=0; i < n; i++)
+    {
+        stmt->vars[i].type = REG_NULL;
+        if(names[i] != NULL && (stmt->var_names[i] = strdup(names[i])) == NULL)
+            return CHIDB_ENOMEM;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Bind a value to a parameter
+ *
+ * The value is loaded by the Variable instruction every time the
+ * program runs, until another value is bound to the parameter.
+ * Values can't be bound while the program is running (i.e., only
+ * before it is first run, or after it is reset).
+ *
+ * Parameters
+ * - stmt: DBM
+ * - var: Parameter (numbered from 1)
+ * - value: Value to bind (of any type but REG_UNSPECIFIED). Strings
+ *          and BLOBs are copied.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no such parameter, or the program is running
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stmt_bind(chidb_stmt *stmt, int var, chidb_dbm_register_t *value)
+{
+    chidb_dbm_register_t copy = *value;
+
+    if(var < 1 || var > stmt->nVars || stmt->pc != 0)
+        return CHIDB_EMISUSE;
+
+    if(copy.type == REG_STRING && (copy.value.s = strndup(value->value.s, value->slen)) == NULL)
+        return CHIDB_ENOMEM;
+    if(copy.type == REG_BINARY)
+    {
+        /* malloc(0) may return NULL, so there is always at least a byte */
+        if((copy.value.bin.bytes = malloc(value->value.bin.nbytes + 1)) == NULL)
+            return CHIDB_ENOMEM;
+        memcpy(copy.value.bin.bytes, value->value.bin.bytes, value->value.bin.nbytes);
+    }
+
+    if(stmt->vars[var - 1].type == REG_STRING)
+        free(stmt->vars[var - 1].value.s);
+    else if(stmt->vars[var - 1].type == REG_BINARY)
+        free(stmt->vars[var - 1].value.bin.bytes);
+    stmt->vars[var - 1] = copy;
+
     return CHIDB_OK;
 }
 
 
+/* Unbind a DBM's parameters
+ *
+ * Sets every parameter back to NULL.
+ *
+ * Parameters
+ * - stmt: DBM
+ */
+void chidb_stmt_unbind(chidb_stmt *stmt)
+{
+    for(int i=0; i < stmt->nVars; i++)
+    {
+        if(stmt->vars[i].type == REG_STRING)
+            free(stmt->vars[i].value.s);
+        else if(stmt->vars[i].type == REG_BINARY)
+            free(stmt->vars[i].value.bin.bytes);
+        stmt->vars[i].type = REG_NULL;
+    }
+}
+
+
 /* Set the value of a specific instruction
  *
  * Given an instruction (of type chidb_dbm_op_t, which includes
@@ -170,8 +344,8 @@ int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos)
     return CHIDB_OK;
 }
 
-/* Forward declaration of instruction handler. See dbm-ops.c for details */
-int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op);
+/* Forward declaration of the interpreter loop. See dbm-ops.c for details */
+int chidb_dbm_op_exec (chidb_stmt *stmt);
 
 
 /* Run the DBM
@@ -187,6 +361,20 @@ int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op);
  *    or CHIDB_ROW. The program stops executing and and the return
  *    value of the instruction handler is returned.
  *
+ * The DBM's arena is reset when the program starts. While it runs,
+ * the values allocated from the arena for each iteration of a loop are
+ * released by ArenaRelease at the end of the iteration, so the values of
+ * a row stay valid until the program is resumed and moves past the row,
+ * and values computed outside a loop stay valid throughout it.
+ *
+ * Outside a transaction, the lock the program needs (stmt->access) is
+ * acquired when it starts running, and released when it stops. The
+ * changes a program makes with BTREE_LOCK_WRITE are committed when it
+ * finishes, or rolled back if it fails.
+ *
+ * If the schema has changed since the program was compiled from SQL,
+ * it is compiled again (see chidb_stmt_recompile) when it starts.
+ *
  * Parameters
  * - stmt: DBM to run.
  *
@@ -197,25 +385,97 @@ int chidb_dbm_op_handle (chidb_stmt *stmt, chidb_dbm_op_t *op);
  */
 int chidb_stmt_exec(chidb_stmt *stmt)
 {
-    int rc = CHIDB_OK;
+    int rc;
+
+    /* Whatever was allocated by a previous run is no longer needed, so
+     * we release it in one go */
+    if (stmt->pc == 0)
+        chidb_Arena_reset(&stmt->arena);
 
-    while(stmt->pc < stmt->endOp)
+    if (stmt->lock == BTREE_LOCK_NONE && stmt->access != BTREE_LOCK_NONE &&
+        chidb_get_autocommit(stmt->db))
     {
-        chidb_dbm_op_t *op = &stmt->ops[stmt->pc++];
-        rc = chidb_dbm_op_handle(stmt, op);
+        if ((rc = chidb_Btree_lock(stmt->db->bt, stmt->access)) != CHIDB_OK)
+            return rc;
+        stmt->lock = stmt->access;
+    }
 
-        if (rc != CHIDB_OK)
-            break;
+    /* A program compiled before the schema changed may use tables and
+     * indexes that no longer exist, or miss new ones (e.g., an INSERT
+     * that doesn't update an index created since), so it is compiled
+     * again before it starts */
+    if (stmt->pc == 0 && stmt->cache_key != NULL && stmt->access != BTREE_LOCK_NONE &&
+        stmt->cookie != stmt->db->bt->schema_cookie &&
+        (rc = chidb_stmt_recompile(stmt)) != CHIDB_OK)
+    {
+        chidb_Btree_unlock(stmt->db->bt, stmt->lock);
+        stmt->lock = BTREE_LOCK_NONE;
+        return rc;
     }
 
-    assert(stmt->nRR == stmt->nCols);
+    rc = chidb_dbm_op_exec(stmt);
+
+    assert(rc != CHIDB_ROW || stmt->nRR == stmt->nCols);
 
     if (rc == CHIDB_OK || rc == CHIDB_DONE)
         rc = CHIDB_DONE;
 
+    /* A statement that fails outside a transaction leaves the
+     * database as it was */
+    if (rc != CHIDB_ROW && rc != CHIDB_DONE && stmt->lock == BTREE_LOCK_WRITE)
+    {
+        chidb_Btree_rollback(stmt->db->bt);
+        stmt->lock = BTREE_LOCK_NONE;
+    }
+    else if (rc != CHIDB_ROW)
+    {
+        int err = chidb_Btree_unlock(stmt->db->bt, stmt->lock);
+        if (rc == CHIDB_DONE && err != CHIDB_OK)
+            rc = err;
+        stmt->lock = BTREE_LOCK_NONE;
+    }
+
     return rc;
 }
 
+
+/* Works out the lock on the database that a DBM needs while it runs
+ *
+ * Programs that begin or end a transaction don't need a lock (and
+ * they mustn't wait for the write lock while holding a read lock).
+ * Programs that change the database need BTREE_LOCK_WRITE, and any
+ * other program needs BTREE_LOCK_READ.
+ *
+ * Parameters
+ * - stmt: DBM with a program
+ *
+ * Returns
+ * - BTREE_LOCK_NONE, BTREE_LOCK_READ or BTREE_LOCK_WRITE
+ */
+uint8_t chidb_stmt_access(chidb_stmt *stmt)
+{
+    uint8_t lock = BTREE_LOCK_READ;
+
+    for (uint32_t i = 0; i < stmt->endOp; i++)
+    {
+        switch (stmt->ops[i].opcode)
+        {
+        case Op_AutoCommit:
+            return BTREE_LOCK_NONE;
+        case Op_OpenWrite:
+        case Op_CreateTable:
+        case Op_CreateIndex:
+        case Op_IncrCookie:
+            lock = BTREE_LOCK_WRITE;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return lock;
+}
+
 /* Prints a human-readable representation of an instruction */
 int chidb_stmt_op_print(chidb_dbm_op_t *op)
 {
@@ -258,6 +518,12 @@ char* chidb_stmt_reg_str(chidb_dbm_register_t *r)
     case REG_BINARY:
         snprintf(s, MAX_STR_LEN, "(%i bytes)", r->value.bin.nbytes);
         break;
+    case REG_INT64:
+        snprintf(s, MAX_STR_LEN, "%lli", (long long) r->value.i64);
+        break;
+    case REG_DOUBLE:
+        snprintf(s, MAX_STR_LEN, "%.15g", r->value.d);
+        break;
     }
 
     return strdup(s);
@@ -391,6 +657,16 @@ int realloc_reg(chidb_stmt *stmt, uint32_t size)
         stmt->reg[i].type = REG_UNSPECIFIED;
     }
 
+    /* Vectors share numbers with registers */
+    if(stmt->vec != NULL)
+    {
+        stmt->vec = realloc(stmt->vec, sizeof(chidb_dbm_vector_t) * size);
+        if(stmt->vec == NULL)
+            return CHIDB_ENOMEM;
+
+        memset(&stmt->vec[stmt->nReg], 0, sizeof(chidb_dbm_vector_t) * (size - stmt->nReg));
+    }
+
     stmt->nReg = size;
 
     return CHIDB_OK;
@@ -407,6 +683,10 @@ int realloc_cur(chidb_stmt *stmt, uint32_t size)
     for(int i=stmt->nCursors; i < size; i++)
     {
         stmt->cursors[i].type = CURSOR_UNSPECIFIED;
+        stmt->cursors[i].batch = NULL;
+        stmt->cursors[i].hash = NULL;
+        stmt->cursors[i].sorter = NULL;
+        stmt->cursors[i].agg = NULL;
     }
 
     stmt->nCursors = size;
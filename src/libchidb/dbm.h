@@ -46,10 +46,19 @@
 
 int chidb_stmt_init(chidb_stmt *stmt, chidb *db);
 int chidb_stmt_free(chidb_stmt *stmt);
+int chidb_stmt_reset(chidb_stmt *stmt);
+int chidb_stmt_set_vars(chidb_stmt *stmt, uint32_t n, char **names);
+int chidb_stmt_bind(chidb_stmt *stmt, int var, chidb_dbm_register_t *value);
+void chidb_stmt_unbind(chidb_stmt *stmt);
 int chidb_stmt_set_op(chidb_stmt *stmt, chidb_dbm_op_t *op, uint32_t pos);
 int chidb_stmt_exec(chidb_stmt *stmt);
+int chidb_stmt_recompile(chidb_stmt *stmt);
+uint8_t chidb_stmt_access(chidb_stmt *stmt);
+int chidb_stmt_peephole(chidb_stmt *stmt);
 char* chidb_stmt_rr_str(chidb_stmt *stmt, char sep);
 int chidb_stmt_rr_print(chidb_stmt *stmt, char sep);
 int chidb_stmt_print(chidb_stmt *stmt);
+int realloc_reg(chidb_stmt *stmt, uint32_t size);
+int realloc_cur(chidb_stmt *stmt, uint32_t size);
 
 #endif /* DBM_H_ */
@@ -37,18 +37,967 @@
  *
  */
 
+#include <strings.h>
 #include <chidb/chidb.h>
 #include "dbm-types.h"
+#include "schema.h"
 
-int chidb_stmt_optimize(chidb *db, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt)
+/* The optimizer rewrites the SRA tree of a SELECT statement. The code
+ * generator reads the tables as nested loops in the order they appear
+ * in the FROM clause, and applies each condition in the innermost loop
+ * of the tables below it (see codegen.c), so the shape of the tree is
+ * the plan. The tree is rewritten in four passes:
+ *
+ *   1. Split: the WHERE condition, the ON conditions and the columns of
+ *      USING and NATURAL joins are split into conjuncts, and the tables
+ *      each conjunct uses are found.
+ *   2. Order: the tables are put in the order that is expected to be
+ *      cheapest (see below).
+ *   3. Push down: each conjunct is moved to the first point at which
+ *      all the tables it uses have been read. A conjunct on a single
+ *      table becomes a Select directly on that table, so it filters the
+ *      table's rows as they are read, and a conjunct on several tables
+ *      becomes part of the ON condition of the join that reads the
+ *      last of them.
+ *   4. Prune: each table is wrapped in a Project of the columns that
+ *      the statement actually uses (after expanding `*`), and the code
+ *      generator only reads those columns.
+ *
+ * For example, for tables t0, t1 and t2 (in the chosen order):
+ *
+ *   Project(expr_list,
+ *      Join(
+ *         Join(
+ *            Project(t0's columns, Select(conjuncts on t0, Table(t0))),
+ *            Project(t1's columns, Select(conjuncts on t1, Table(t1))),
+ *            On(conjuncts on t0 and t1)),
+ *         Project(t2's columns, Table(t2)),
+ *         On(conjuncts on t2 and t0 and/or t1)))
+ *
+ * The cost of an order is the number of B-Tree entries the loops are
+ * expected to read (see stats.h): each loop is run once for each row
+ * produced by the loops around it, and reads its table in the cheapest
+ * way the conjuncts applied in it allow, which is either a full scan or
+ * a seek on the table's primary key or on an index (this is the same
+ * choice that the code generator makes for each loop). Orders are
+ * searched exhaustively (as left-deep trees, with dynamic programming
+ * over sets of tables) for up to OPT_MAX_EXHAUSTIVE tables, and greedily
+ * for more.
+ *
+ * A table that is joined on an equality with a column of a table read
+ * before it can also be read through a hash table instead (a hash join):
+ * the table is read once, before any of the loops, to build a hash table
+ * of its rows, and each row of the loops around it then looks up its
+ * matching rows in the hash table. This is chosen whenever it's expected
+ * to read fewer entries, which is the case when the outer loops produce
+ * many rows and the table can't be sought on the column it's joined on.
+ * The choice is marked in the Join for the code generator.
+ *
+ * Statements the optimizer doesn't know how to rewrite (including those
+ * with errors, which the code generator reports) are returned as they are.
+ */
+
+#define OPT_MAX_TABLES (32)
+#define OPT_MAX_EXHAUSTIVE (12)
+
+/* Selectivities of conjuncts the statistics can't estimate */
+#define OPT_SEL_EQ (0.1)
+#define OPT_SEL_RANGE (1.0 / 3)
+#define OPT_SEL_OTHER (0.25)
+
+typedef uint32_t opt_set_t;
+
+typedef struct opt_table
+{
+    TableReference_t *ref;
+    chidb_schema_item_t *schema;
+    const char *name;   /* Name (or alias) the table is referred to by */
+    bool *used;         /* Columns used by the statement */
+} opt_table_t;
+
+/* A conjunct, the set of tables it uses, and the fraction of the rows
+ * it is expected to let through */
+typedef struct opt_cond
+{
+    Condition_t *cond;
+    opt_set_t tables;
+    double sel;
+} opt_cond_t;
+
+/* Best order found for a set of tables: the cost of joining them, the
+ * number of rows they produce, the table that is read last, and whether
+ * it is read through a hash table */
+typedef struct opt_plan
+{
+    double cost;
+    double rows;
+    int last;
+    bool hash;
+} opt_plan_t;
+
+typedef struct opt
+{
+    chidb *db;
+    opt_table_t tables[OPT_MAX_TABLES];
+    int nTables;
+    opt_cond_t *conds;
+    int nConds;
+} opt_t;
+
+static const enum CondType opt_cmp_swap[] =
+{
+    [RA_COND_EQ] = RA_COND_EQ, [RA_COND_LT] = RA_COND_GT, [RA_COND_GT] = RA_COND_LT,
+    [RA_COND_LEQ] = RA_COND_GEQ, [RA_COND_GEQ] = RA_COND_LEQ
+};
+
+#define IS_COMPARISON(t) ((t) == RA_COND_EQ || (t) == RA_COND_LT || (t) == RA_COND_GT || \
+                          (t) == RA_COND_LEQ || (t) == RA_COND_GEQ)
+
+#define OPT_BIT(i) ((opt_set_t) 1 << (i))
+
+
+/*** CONJUNCTS ***/
+
+/* Finds the table and column a column reference refers to, with the
+ * same rules as the code generator */
+static int opt_colref(opt_t *opt, ColumnReference_t *ref, int ntables, int *table, int *column, Column_t **coldef)
+{
+    int found = 0;
+
+    for(int i = 0; i < ntables; i++)
+    {
+        opt_table_t *t = &opt->tables[i];
+        int col;
+
+        if(ref->tableName != NULL && strcasecmp(ref->tableName, t->name))
+            continue;
+        if((col = chidb_schema_column(t->schema, ref->columnName, coldef)) < 0)
+            continue;
+
+        *table = i;
+        *column = col;
+        found++;
+    }
+
+    return found == 1 ? CHIDB_OK : CHIDB_EINVALIDSQL;
+}
+
+/* Set of tables an expression uses */
+static int opt_expr_tables(opt_t *opt, Expression_t *expr, opt_set_t *tables)
+{
+    int err;
+    int table, column;
+    opt_set_t t1, t2;
+
+    switch(expr->t)
+    {
+    case EXPR_TERM:
+        *tables = 0;
+        if(expr->expr.term.t == TERM_FUNC)
+            return CHIDB_EINVALIDSQL;
+        if(expr->expr.term.t == TERM_COLREF)
+        {
+            check_fail(opt_colref(opt, expr->expr.term.ref, opt->nTables, &table, &column, NULL));
+            *tables = OPT_BIT(table);
+        }
+        return CHIDB_OK;
+    case EXPR_NEG:
+        return opt_expr_tables(opt, expr->expr.unary.expr, tables);
+    default:
+        check_fail(opt_expr_tables(opt, expr->expr.binary.expr1, &t1));
+        check_fail(opt_expr_tables(opt, expr->expr.binary.expr2, &t2));
+        *tables = t1 | t2;
+        return CHIDB_OK;
+    }
+}
+
+/* Same as opt_expr_tables, for a condition */
+static int opt_cond_tables(opt_t *opt, Condition_t *cond, opt_set_t *tables)
+{
+    int err;
+    opt_set_t t1, t2;
+
+    switch(cond->t)
+    {
+    case RA_COND_AND:
+    case RA_COND_OR:
+        check_fail(opt_cond_tables(opt, cond->cond.binary.cond1, &t1));
+        check_fail(opt_cond_tables(opt, cond->cond.binary.cond2, &t2));
+        break;
+    case RA_COND_NOT:
+        return opt_cond_tables(opt, cond->cond.unary.cond, tables);
+    case RA_COND_IN:
+        return opt_expr_tables(opt, cond->cond.in.expr, tables);
+    default:
+        check_fail(opt_expr_tables(opt, cond->cond.comp.expr1, &t1));
+        check_fail(opt_expr_tables(opt, cond->cond.comp.expr2, &t2));
+        break;
+    }
+
+    *tables = t1 | t2;
+    return CHIDB_OK;
+}
+
+/* Adds the conjuncts of a condition. Their tables are found once all
+ * the tables have been collected */
+static int opt_add_cond(opt_t *opt, Condition_t *cond)
+{
+    int err;
+
+    if(cond->t == RA_COND_AND)
+    {
+        check_fail(opt_add_cond(opt, cond->cond.binary.cond1));
+        return opt_add_cond(opt, cond->cond.binary.cond2);
+    }
+
+    opt_cond_t *conds = realloc(opt->conds, sizeof(opt_cond_t) * (opt->nConds + 1));
+    if(conds == NULL)
+        return CHIDB_ENOMEM;
+
+    opt->conds = conds;
+    opt->conds[opt->nConds].cond = cond;
+    /* Tables read so far, which is all the condition may use */
+    opt->conds[opt->nConds].tables = OPT_BIT(opt->nTables) - 1;
+    opt->conds[opt->nConds].sel = 1;
+    opt->nConds++;
+
+    return CHIDB_OK;
+}
+
+/* Adds the condition "t1.column = t2.column" (for USING and NATURAL joins) */
+static int opt_add_join_column(opt_t *opt, int t1, int t2, const char *column)
+{
+    Expression_t *e1 = TermColumnReference(ColumnReference_make(opt->tables[t1].name, column));
+    Expression_t *e2 = TermColumnReference(ColumnReference_make(opt->tables[t2].name, column));
+
+    return opt_add_cond(opt, Eq(e1, e2));
+}
+
+/* Collects the tables below a node of the SRA tree, and the conjuncts
+ * of its conditions */
+static int opt_from(opt_t *opt, SRA_t *sra)
+{
+    int err;
+    int first, left, col;
+    opt_table_t *t;
+
+    switch(sra->t)
+    {
+    case SRA_TABLE:
+        if(opt->nTables == OPT_MAX_TABLES)
+            return CHIDB_EINVALIDSQL;
+        t = &opt->tables[opt->nTables];
+        t->ref = sra->table.ref;
+        t->schema = chidb_schema_table(opt->db, sra->table.ref->table_name);
+        t->name = t->ref->alias != NULL ? t->ref->alias : t->ref->table_name;
+        if(t->schema == NULL)
+            return CHIDB_EINVALIDSQL;
+        /* Columns of tables with the same name can't be told apart */
+        for(int i = 0; i < opt->nTables; i++)
+            if(!strcasecmp(opt->tables[i].name, t->name))
+                return CHIDB_EINVALIDSQL;
+        opt->nTables++;
+        return CHIDB_OK;
+
+    case SRA_SELECT:
+        check_fail(opt_from(opt, sra->select.sra));
+        return opt_add_cond(opt, sra->select.cond);
+
+    case SRA_JOIN:
+    case SRA_NATURAL_JOIN:
+        check_fail(opt_from(opt, sra->join.sra1));
+        first = opt->nTables;
+        check_fail(opt_from(opt, sra->join.sra2));
+        if(opt->nTables != first + 1 && (sra->t == SRA_NATURAL_JOIN ||
+           (sra->join.opt_cond != NULL && sra->join.opt_cond->t == JOIN_COND_USING)))
+            return CHIDB_EINVALIDSQL;
+
+        if(sra->t == SRA_NATURAL_JOIN)
+        {
+            for(Column_t *column = opt->tables[first].schema->stmt->stmt.create->table->columns; column != NULL; column = column->next)
+                for(int i = 0; i < first; i++)
+                    if(chidb_schema_column(opt->tables[i].schema, column->name, NULL) >= 0)
+                    {
+                        check_fail(opt_add_join_column(opt, i, first, column->name));
+                        break;
+                    }
+            return CHIDB_OK;
+        }
+
+        if(sra->join.opt_cond == NULL)
+            return CHIDB_OK;
+
+        if(sra->join.opt_cond->t == JOIN_COND_ON)
+            return opt_add_cond(opt, sra->join.opt_cond->on);
+
+        for(StrList_t *name = sra->join.opt_cond->col_list; name != NULL; name = name->next)
+        {
+            ColumnReference_t ref = { NULL, name->str, NULL };
+
+            check_fail(opt_colref(opt, &ref, first, &left, &col, NULL));
+            if(chidb_schema_column(opt->tables[first].schema, name->str, NULL) < 0)
+                return CHIDB_EINVALIDSQL;
+            check_fail(opt_add_join_column(opt, left, first, name->str));
+        }
+        return CHIDB_OK;
+
+    default:
+        return CHIDB_EINVALIDSQL;
+    }
+}
+
+
+/*** ESTIMATES ***/
+
+/* If an expression is a column, returns its table and column */
+static bool opt_is_column(opt_t *opt, Expression_t *expr, int *table, int *column, Column_t **coldef)
+{
+    return expr->t == EXPR_TERM && expr->expr.term.t == TERM_COLREF &&
+           opt_colref(opt, expr->expr.term.ref, opt->nTables, table, column, coldef) == CHIDB_OK;
+}
+
+/* Is an expression an integer literal that can be a key (a non-negative
+ * integer that fits in 32 bits)? */
+static bool opt_is_literal_key(Expression_t *expr)
+{
+    return expr->t == EXPR_TERM && expr->expr.term.t == TERM_LITERAL && !expr->expr.term.val->param &&
+           expr->expr.term.val->t == TYPE_INT && expr->expr.term.val->val.ival >= 0 &&
+           expr->expr.term.val->val.ival <= INT32_MAX;
+}
+
+/* Index on a column of a table that can be used to look up its values
+ * (index keys are integers), or NULL */
+static chidb_schema_item_t *opt_index(opt_t *opt, int table, Column_t *coldef)
+{
+    if(coldef->type != TYPE_INT)
+        return NULL;
+    return chidb_schema_index(opt->db, opt->tables[table].schema->name, coldef->name);
+}
+
+/* Fraction of the rows of a table with a given value in a column */
+static double opt_sel_eq(opt_t *opt, int table, int column, Column_t *coldef)
+{
+    chidb_schema_item_t *schema = opt->tables[table].schema, *index;
+    double rows = chidb_stats_rows(schema);
+
+    if(rows < 1)
+        return 1;
+    if(column == chidb_schema_pkey(schema))
+        return 1 / rows;
+    if((index = opt_index(opt, table, coldef)) != NULL)
+        return chidb_stats_eq_rows(index) / rows;
+    return OPT_SEL_EQ;
+}
+
+/* Number of distinct values in a column (0 if unknown) */
+static double opt_distinct(opt_t *opt, int table, int column, Column_t *coldef)
+{
+    chidb_schema_item_t *schema = opt->tables[table].schema, *index;
+    double eq;
+
+    if(column == chidb_schema_pkey(schema))
+        return chidb_stats_rows(schema);
+    if((index = opt_index(opt, table, coldef)) != NULL && (eq = chidb_stats_eq_rows(index)) > 0)
+        return chidb_stats_rows(index) / eq;
+    return 0;
+}
+
+/* Fraction of the rows that satisfy a conjunct */
+static double opt_selectivity(opt_t *opt, Condition_t *cond)
+{
+    int t1, c1, t2, c2;
+    Column_t *col1, *col2;
+    chidb_schema_item_t *item;
+    double d1, d2, sel;
+
+    if(cond->t == RA_COND_IN)
+    {
+        if(!opt_is_column(opt, cond->cond.in.expr, &t1, &c1, &col1))
+            return OPT_SEL_OTHER;
+        sel = 0;
+        for(Literal_t *val = cond->cond.in.values_list; val != NULL; val = val->next)
+            sel += opt_sel_eq(opt, t1, c1, col1);
+        return sel < 1 ? sel : 1;
+    }
+
+    if(!IS_COMPARISON(cond->t))
+        return OPT_SEL_OTHER;
+
+    /* column = column */
+    if(opt_is_column(opt, cond->cond.comp.expr1, &t1, &c1, &col1) &&
+       opt_is_column(opt, cond->cond.comp.expr2, &t2, &c2, &col2))
+    {
+        if(cond->t != RA_COND_EQ)
+            return OPT_SEL_RANGE;
+        if(t1 == t2)
+            return OPT_SEL_EQ;
+        d1 = opt_distinct(opt, t1, c1, col1);
+        d2 = opt_distinct(opt, t2, c2, col2);
+        d1 = d1 > d2 ? d1 : d2;
+        return d1 >= 1 ? 1 / d1 : OPT_SEL_EQ;
+    }
+
+    /* column OP value */
+    for(int i = 0; i < 2; i++)
+    {
+        Expression_t *e1 = i == 0 ? cond->cond.comp.expr1 : cond->cond.comp.expr2;
+        Expression_t *e2 = i == 0 ? cond->cond.comp.expr2 : cond->cond.comp.expr1;
+        enum CondType cmp = i == 0 ? cond->t : opt_cmp_swap[cond->t];
+
+        if(!opt_is_column(opt, e1, &t1, &c1, &col1))
+            continue;
+        if(cmp == RA_COND_EQ)
+            return opt_sel_eq(opt, t1, c1, col1);
+        if(!opt_is_literal_key(e2))
+            return OPT_SEL_RANGE;
+
+        /* Ranges can be estimated with the histogram of the table's
+         * keys, or of an index on the column */
+        if(c1 == chidb_schema_pkey(opt->tables[t1].schema))
+            item = opt->tables[t1].schema;
+        else
+            item = opt_index(opt, t1, col1);
+        if(item == NULL)
+            return OPT_SEL_RANGE;
+        return chidb_stats_fraction(item, cmp, e2->expr.term.val->val.ival);
+    }
+
+    return OPT_SEL_OTHER;
+}
+
+/* Cost of reading table t in a loop nested inside the loops of the
+ * tables in outer: the cheapest of a scan and the seeks that the
+ * conjuncts on t can be used for (see codegen_plan) */
+static double opt_access_cost(opt_t *opt, int t, opt_set_t outer)
+{
+    chidb_schema_item_t *schema = opt->tables[t].schema, *index;
+    double cost = chidb_cost_scan(schema), c_cost, fraction = 1;
+    int pkey = chidb_schema_pkey(schema);
+    bool range = false;
+    int t1, c1, t2, c2;
+    Column_t *col1, *col2;
+
+    for(int i = 0; i < opt->nConds; i++)
+    {
+        Condition_t *cond = opt->conds[i].cond;
+
+        if(!IS_COMPARISON(cond->t) || !(opt->conds[i].tables & OPT_BIT(t)) ||
+           (opt->conds[i].tables & ~(outer | OPT_BIT(t))))
+            continue;
+
+        for(int j = 0; j < 2; j++)
+        {
+            Expression_t *e1 = j == 0 ? cond->cond.comp.expr1 : cond->cond.comp.expr2;
+            Expression_t *e2 = j == 0 ? cond->cond.comp.expr2 : cond->cond.comp.expr1;
+            enum CondType cmp = j == 0 ? cond->t : opt_cmp_swap[cond->t];
+            bool key;
+
+            if(!opt_is_column(opt, e1, &t1, &c1, &col1) || t1 != t)
+                continue;
+
+            /* The key is a literal, a parameter, or an integer column of
+             * an outer table */
+            if(opt_is_column(opt, e2, &t2, &c2, &col2))
+                key = t2 != t && col2->type == TYPE_INT && cmp == RA_COND_EQ;
+            else if(e2->t == EXPR_TERM && e2->expr.term.t == TERM_LITERAL && e2->expr.term.val->param)
+                key = cmp == RA_COND_EQ;
+            else
+                key = opt_is_literal_key(e2);
+            if(!key)
+                continue;
+
+            if(c1 == pkey && cmp == RA_COND_EQ)
+                c_cost = chidb_cost_pk_eq(schema);
+            else if(c1 == pkey)
+            {
+                range = true;
+                fraction *= chidb_stats_fraction(schema, cmp, e2->expr.term.val->val.ival);
+                continue;
+            }
+            /* Which columns are read is only known once the tables are
+             * pruned, so the index is assumed not to cover them */
+            else if(cmp == RA_COND_EQ && (index = opt_index(opt, t, col1)) != NULL)
+                c_cost = chidb_cost_index_eq(schema, index, false);
+            else
+                continue;
+
+            if(c_cost < cost)
+                cost = c_cost;
+        }
+    }
+
+    if(range && (c_cost = chidb_cost_pk_range(schema, fraction)) < cost)
+        cost = c_cost;
+
+    return cost;
+}
+
+/* Is a conjunct an equality between a column of table t and a column
+ * of one of the tables in outer? (which a hash join can look up) */
+static bool opt_is_hash_cond(opt_t *opt, Condition_t *cond, int t, opt_set_t outer)
+{
+    int t1, c1, t2, c2;
+    Column_t *col1, *col2;
+
+    if(cond->t != RA_COND_EQ ||
+       !opt_is_column(opt, cond->cond.comp.expr1, &t1, &c1, &col1) ||
+       !opt_is_column(opt, cond->cond.comp.expr2, &t2, &c2, &col2))
+        return false;
+
+    return (t1 == t && (outer & OPT_BIT(t2))) || (t2 == t && (outer & OPT_BIT(t1)));
+}
+
+/* Cost of reading table t through a hash table, in a loop nested inside
+ * the loops of the tables in outer (which produce outer_rows rows): t is
+ * read once to build the hash table, keeping the rows that satisfy the
+ * conjuncts on t alone, and each outer row then looks up the rows that
+ * satisfy the first conjunct the hash table can be used for (the same one
+ * the code generator uses). If the rows kept don't fit in the hash
+ * table's memory budget, reading spilled partitions back is counted too,
+ * so a join that would spill heavily is read in nested loops instead.
+ * Negative if there is no such conjunct */
+static double opt_hash_cost(opt_t *opt, int t, opt_set_t outer, double outer_rows)
 {
-    /* Your code goes here */
+    chidb_schema_item_t *schema = opt->tables[t].schema;
+    double rows = chidb_stats_rows(schema), sel = -1;
 
-    /* Right now, the "optimizer" simply returns a copy of the provided statement */
+    for(int i = 0; i < opt->nConds; i++)
+    {
+        if(opt->conds[i].tables == OPT_BIT(t))
+            rows *= opt->conds[i].sel;
+        else if(sel < 0 && opt_is_hash_cond(opt, opt->conds[i].cond, t, outer))
+            sel = opt->conds[i].sel;
+    }
+
+    if(sel < 0)
+        return -1;
+
+    return chidb_cost_hash_build(schema) + outer_rows * chidb_cost_hash_probe(rows * sel) +
+           chidb_cost_hash_spill(schema, rows, outer_rows);
+}
+
+/* Adds table t to the best order found for the tables in set s, reading
+ * it in nested loops or through a hash table, whichever is cheaper */
+static opt_plan_t opt_extend(opt_t *opt, opt_plan_t *plan, opt_set_t s, int t)
+{
+    opt_plan_t p;
+    double loops = plan->rows * opt_access_cost(opt, t, s);
+    double hash = opt_hash_cost(opt, t, s, plan->rows);
+
+    p.hash = hash >= 0 && hash < loops;
+    p.cost = plan->cost + (p.hash ? hash : loops);
+    p.rows = plan->rows * chidb_stats_rows(opt->tables[t].schema);
+    p.last = t;
+
+    /* Conjuncts that can be applied once t has been read */
+    for(int i = 0; i < opt->nConds; i++)
+        if((opt->conds[i].tables & OPT_BIT(t)) && !(opt->conds[i].tables & ~(s | OPT_BIT(t))))
+            p.rows *= opt->conds[i].sel;
+
+    return p;
+}
+
+
+/*** JOIN ORDER ***/
+
+/* Finds the cheapest order of the tables by considering the best order
+ * of every subset of them. Ties are broken in favor of the order the
+ * tables are written in (the table written last is read last) */
+static int opt_order_exhaustive(opt_t *opt, int *order, bool *hash)
+{
+    opt_set_t all = OPT_BIT(opt->nTables) - 1;
+    opt_plan_t *plans = malloc(sizeof(opt_plan_t) * ((size_t) all + 1));
+    opt_plan_t p;
+
+    if(plans == NULL)
+        return CHIDB_ENOMEM;
+
+    plans[0].cost = 0;
+    plans[0].rows = 1;
+    plans[0].last = -1;
+    plans[0].hash = false;
+    for(opt_set_t s = 1; s <= all; s++)
+    {
+        plans[s].cost = -1;
+        for(int t = 0; t < opt->nTables; t++)
+        {
+            if(!(s & OPT_BIT(t)))
+                continue;
+            p = opt_extend(opt, &plans[s & ~OPT_BIT(t)], s & ~OPT_BIT(t), t);
+            if(plans[s].cost < 0 || p.cost <= plans[s].cost)
+                plans[s] = p;
+        }
+    }
+
+    for(int i = opt->nTables - 1; i >= 0; i--)
+    {
+        order[i] = plans[all].last;
+        hash[i] = plans[all].hash;
+        all &= ~OPT_BIT(order[i]);
+    }
+
+    free(plans);
+    return CHIDB_OK;
+}
+
+/* Builds the order one table at a time, adding the table that is
+ * cheapest to join next */
+static void opt_order_greedy(opt_t *opt, int *order, bool *hash)
+{
+    opt_plan_t plan = { 0, 1, -1, false }, best, p;
+    opt_set_t s = 0;
+
+    for(int i = 0; i < opt->nTables; i++)
+    {
+        best.cost = -1;
+        for(int t = 0; t < opt->nTables; t++)
+        {
+            if(s & OPT_BIT(t))
+                continue;
+            p = opt_extend(opt, &plan, s, t);
+            if(best.cost < 0 || p.cost < best.cost)
+                best = p;
+        }
+        plan = best;
+        s |= OPT_BIT(best.last);
+        order[i] = best.last;
+        hash[i] = best.hash;
+    }
+}
+
+
+/*** REWRITING ***/
+
+/* Conjuncts that only use table t (and, for the first table, the ones
+ * that don't use any tables), which filter t's rows as they are read */
+static Condition_t *opt_table_cond(opt_t *opt, int t, bool first)
+{
+    Condition_t *cond = NULL;
+
+    for(int i = 0; i < opt->nConds; i++)
+    {
+        opt_set_t tables = opt->conds[i].tables;
+
+        if(tables == OPT_BIT(t) || (tables == 0 && first))
+            cond = cond == NULL ? opt->conds[i].cond : And(cond, opt->conds[i].cond);
+    }
+
+    return cond;
+}
+
+/* Conjuncts that use table t and some of the tables in outer, which are
+ * applied when t is joined with them */
+static Condition_t *opt_join_cond(opt_t *opt, opt_set_t outer, int t)
+{
+    Condition_t *cond = NULL;
+
+    for(int i = 0; i < opt->nConds; i++)
+    {
+        opt_set_t tables = opt->conds[i].tables;
+
+        if((tables & OPT_BIT(t)) && (tables & outer) && !(tables & ~(outer | OPT_BIT(t))))
+            cond = cond == NULL ? opt->conds[i].cond : And(cond, opt->conds[i].cond);
+    }
+
+    return cond;
+}
+
+/* Marks the columns an expression uses */
+static void opt_mark_expr(opt_t *opt, Expression_t *expr)
+{
+    int table, column;
+
+    switch(expr->t)
+    {
+    case EXPR_TERM:
+        if(expr->expr.term.t == TERM_COLREF &&
+           opt_colref(opt, expr->expr.term.ref, opt->nTables, &table, &column, NULL) == CHIDB_OK)
+            opt->tables[table].used[column] = true;
+        else if(expr->expr.term.t == TERM_FUNC)
+            opt_mark_expr(opt, expr->expr.term.f.expr);
+        break;
+    case EXPR_NEG:
+        opt_mark_expr(opt, expr->expr.unary.expr);
+        break;
+    default:
+        opt_mark_expr(opt, expr->expr.binary.expr1);
+        opt_mark_expr(opt, expr->expr.binary.expr2);
+        break;
+    }
+}
+
+/* Same as opt_mark_expr, for a condition */
+static void opt_mark_cond(opt_t *opt, Condition_t *cond)
+{
+    switch(cond->t)
+    {
+    case RA_COND_AND:
+    case RA_COND_OR:
+        opt_mark_cond(opt, cond->cond.binary.cond1);
+        opt_mark_cond(opt, cond->cond.binary.cond2);
+        break;
+    case RA_COND_NOT:
+        opt_mark_cond(opt, cond->cond.unary.cond);
+        break;
+    case RA_COND_IN:
+        opt_mark_expr(opt, cond->cond.in.expr);
+        break;
+    default:
+        opt_mark_expr(opt, cond->cond.comp.expr1);
+        opt_mark_expr(opt, cond->cond.comp.expr2);
+        break;
+    }
+}
+
+/* Copies the result columns of a projection, replacing each `*` (or
+ * `table.*`) with the columns of the tables in the FROM clause */
+static int opt_expand_columns(opt_t *opt, Expression_t *expr_list, Expression_t **expanded)
+{
+    Expression_t *list = NULL, *e;
+
+    for(Expression_t *expr = expr_list; expr != NULL; expr = expr->next)
+    {
+        ColumnReference_t *ref = expr->t == EXPR_TERM && expr->expr.term.t == TERM_COLREF ? expr->expr.term.ref : NULL;
+        bool found = false;
+
+        if(ref == NULL || strcmp(ref->columnName, "*"))
+        {
+            if((e = malloc(sizeof(Expression_t))) == NULL)
+                return CHIDB_ENOMEM;
+            memcpy(e, expr, sizeof(Expression_t));
+            e->next = NULL;
+            list = append_expression(list, e);
+            continue;
+        }
+
+        for(int i = 0; i < opt->nTables; i++)
+        {
+            opt_table_t *t = &opt->tables[i];
+
+            if(ref->tableName != NULL && strcasecmp(ref->tableName, t->name))
+                continue;
+            found = true;
+            for(Column_t *col = t->schema->stmt->stmt.create->table->columns; col != NULL; col = col->next)
+                list = append_expression(list, TermColumnReference(ColumnReference_make(t->name, col->name)));
+        }
+        if(!found)
+            return CHIDB_EINVALIDSQL;
+    }
+
+    *expanded = list;
+    return CHIDB_OK;
+}
+
+/* Wraps the subtree that reads table t in a projection of the columns
+ * of t that the statement uses */
+static SRA_t *opt_prune(opt_t *opt, int t, SRA_t *sra)
+{
+    opt_table_t *table = &opt->tables[t];
+    Expression_t *columns = NULL;
+    int i = 0;
+
+    for(Column_t *col = table->schema->stmt->stmt.create->table->columns; col != NULL; col = col->next, i++)
+        if(table->used[i])
+            columns = append_expression(columns, TermColumnReference(ColumnReference_make(table->name, col->name)));
+
+    return SRAProject(sra, columns);
+}
+
+/* Pass 1: collects the tables and splits the conditions into conjuncts */
+static int opt_split(opt_t *opt, SRA_t *sra)
+{
+    int err;
+
+    check_fail(opt_from(opt, sra));
+
+    for(int i = 0; i < opt->nConds; i++)
+    {
+        opt_set_t tables;
+
+        /* A condition can only use the tables that were read before it */
+        check_fail(opt_cond_tables(opt, opt->conds[i].cond, &tables));
+        if(tables & ~opt->conds[i].tables)
+            return CHIDB_EINVALIDSQL;
+        opt->conds[i].tables = tables;
+        opt->conds[i].sel = opt_selectivity(opt, opt->conds[i].cond);
+    }
+
+    return CHIDB_OK;
+}
+
+/* Pass 2: chooses the order of the tables, and which of them are read
+ * through a hash table */
+static int opt_order(opt_t *opt, int *order, bool *hash)
+{
+    if(opt->nTables <= OPT_MAX_EXHAUSTIVE)
+        return opt_order_exhaustive(opt, order, hash);
+
+    opt_order_greedy(opt, order, hash);
+    return CHIDB_OK;
+}
+
+/* Passes 3 and 4: builds the join tree, with each conjunct pushed down
+ * to the first point at which it can be applied, and each table pruned
+ * to the columns that are used */
+static int opt_push_down(opt_t *opt, const int *order, const bool *hash, Expression_t *expr_list,
+                         Expression_t *order_by, Expression_t *group_by, SRA_t **from)
+{
+    opt_set_t outer = 0;
+    SRA_t *table;
+    Condition_t *cond;
+
+    for(int i = 0; i < opt->nTables; i++)
+    {
+        int n = chidb_schema_ncolumns(opt->tables[i].schema);
+
+        if((opt->tables[i].used = calloc(n > 0 ? n : 1, sizeof(bool))) == NULL)
+            return CHIDB_ENOMEM;
+    }
+    for(Expression_t *expr = expr_list; expr != NULL; expr = expr->next)
+        opt_mark_expr(opt, expr);
+    for(Expression_t *expr = order_by; expr != NULL; expr = expr->next)
+        opt_mark_expr(opt, expr);
+    for(Expression_t *expr = group_by; expr != NULL; expr = expr->next)
+        opt_mark_expr(opt, expr);
+    for(int i = 0; i < opt->nConds; i++)
+        opt_mark_cond(opt, opt->conds[i].cond);
+
+    *from = NULL;
+    for(int i = 0; i < opt->nTables; i++)
+    {
+        int t = order[i];
+
+        table = SRASelect(SRATable(opt->tables[t].ref), opt_table_cond(opt, t, i == 0));
+        table = opt_prune(opt, t, table);
+
+        if(*from == NULL)
+            *from = table;
+        else
+        {
+            cond = opt_join_cond(opt, outer, t);
+            *from = SRAJoin(*from, table, cond != NULL ? On(cond) : NULL);
+            (*from)->join.hash = hash[i];
+        }
+        outer |= OPT_BIT(t);
+    }
+
+    return CHIDB_OK;
+}
+
+/* Rewrites a SELECT statement */
+static int opt_select(opt_t *opt, SRA_t *sra, SRA_t **sra_opt)
+{
+    int err;
+    int order[OPT_MAX_TABLES];
+    bool hash[OPT_MAX_TABLES];
+    SRA_t *from;
+    Expression_t *expr_list;
+
+    if(sra->t != SRA_PROJECT)
+        return CHIDB_EINVALIDSQL;
+
+    check_fail(opt_split(opt, sra->project.sra));
+    check_fail(opt_order(opt, order, hash));
+    check_fail(opt_expand_columns(opt, sra->project.expr_list, &expr_list));
+    check_fail(opt_push_down(opt, order, hash, expr_list, sra->project.order_by,
+                             sra->project.group_by, &from));
+
+    if((*sra_opt = malloc(sizeof(SRA_t))) == NULL)
+        return CHIDB_ENOMEM;
+    memcpy(*sra_opt, sra, sizeof(SRA_t));
+    (*sra_opt)->project.sra = from;
+    (*sra_opt)->project.expr_list = expr_list;
+
+    return CHIDB_OK;
+}
+
+/* Optimizes a SELECT, or each SELECT of a UNION, INTERSECT or EXCEPT on
+ * its own. A SELECT that can't be rewritten is left as it is, for the
+ * code generator */
+static int opt_statement(chidb *db, SRA_t *sra, SRA_t **sra_opt)
+{
+    opt_t opt;
+    SRA_t *sra1, *sra2;
+    int rc;
+
+    if(sra->t == SRA_UNION || sra->t == SRA_INTERSECT || sra->t == SRA_EXCEPT)
+    {
+        if((rc = opt_statement(db, sra->binary.sra1, &sra1)) != CHIDB_OK ||
+           (rc = opt_statement(db, sra->binary.sra2, &sra2)) != CHIDB_OK)
+            return rc;
+
+        if((*sra_opt = malloc(sizeof(SRA_t))) == NULL)
+            return CHIDB_ENOMEM;
+        memcpy(*sra_opt, sra, sizeof(SRA_t));
+        (*sra_opt)->binary.sra1 = sra1;
+        (*sra_opt)->binary.sra2 = sra2;
+        return CHIDB_OK;
+    }
+
+    memset(&opt, 0, sizeof(opt_t));
+    opt.db = db;
+
+    rc = opt_select(&opt, sra, sra_opt);
+    for(int i = 0; i < opt.nTables; i++)
+        free(opt.tables[i].used);
+    free(opt.conds);
+
+    if(rc == CHIDB_ENOMEM)
+        return rc;
+    if(rc != CHIDB_OK)
+        *sra_opt = sra;
+
+    return CHIDB_OK;
+}
+
+
+/* Optimize a SQL statement
+ *
+ * Rewrites a SELECT statement so that its tables are joined in the order
+ * that is expected to be cheapest, its conditions are applied as early
+ * as possible, and only the columns it uses are read (each SELECT of a
+ * UNION, INTERSECT or EXCEPT on its own). Other statements are not
+ * changed.
+ *
+ * The optimized statement shares the parts it doesn't change with the
+ * original statement, so only the statement itself has to be freed
+ * (with free) once it's no longer needed.
+ *
+ * Parameters
+ * - db: Database
+ * - sql_stmt: Parsed SQL statement
+ * - sql_stmt_opt: Out parameter for the optimized statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The database schema could not be read
+ */
+int chidb_stmt_optimize(chidb *db, chisql_statement_t *sql_stmt, chisql_statement_t **sql_stmt_opt)
+{
+    SRA_t *sra_opt = NULL;
+    int rc;
 
     *sql_stmt_opt = malloc(sizeof(chisql_statement_t));
+    if(*sql_stmt_opt == NULL)
+        return CHIDB_ENOMEM;
     memcpy(*sql_stmt_opt, sql_stmt, sizeof(chisql_statement_t));
 
+    if(sql_stmt->type != STMT_SELECT)
+        return CHIDB_OK;
+
+    if((rc = chidb_schema_load(db)) != CHIDB_OK)
+    {
+        free(*sql_stmt_opt);
+        return rc;
+    }
+
+    if((rc = opt_statement(db, sql_stmt->stmt.select, &sra_opt)) != CHIDB_OK)
+    {
+        free(*sql_stmt_opt);
+        return rc;
+    }
+    (*sql_stmt_opt)->stmt.select = sra_opt;
+
     return CHIDB_OK;
 }
-
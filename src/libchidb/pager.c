@@ -16,6 +16,53 @@
  * In a real database, the pager component typically does some caching
  * of pages to reduce the number of disk accesses.
  *
+ * The pager also implements transactions (see chidb_Pager_begin). Pages
+ * written in a transaction are kept in memory until it is committed, and
+ * the original contents of every page that is changed are first saved in
+ * a rollback journal (a file next to the database, with "-journal"
+ * appended to its name), so that the transaction can be undone even if
+ * some of its pages had to be written to the file before it was over.
+ * The journal has a header (JOURNAL_HEADER_SIZE bytes) with:
+ *
+ * - JOURNAL_MAGIC (8 bytes)
+ * - The page size (2 bytes), followed by two unused bytes
+ * - The number of pages in the file when the transaction began (4 bytes)
+ *
+ * followed by a record for each page: its page number (4 bytes), its
+ * original contents, and a checksum of both (4 bytes).
+ *
+ * Pagers open on the same file (e.g., by several connections to the
+ * same database, in different threads) share the file and a cache of
+ * its committed pages, which any of them can read from at the same
+ * time. Each bucket of the cache has its own latch, which is only held
+ * while a page is looked up or copied.
+ *
+ * Readers see a snapshot of the file: the pages as they were after the
+ * commits that had happened when they acquired a read lock
+ * (chidb_Pager_lockRead), even if other pagers commit transactions
+ * while they read. Only one pager can change the file at a time, the
+ * one that holds the write lock (chidb_Pager_lockWrite). The pages of
+ * its transaction stay in that pager until they are written to the
+ * file, which is done without waiting for readers (and they don't
+ * wait for the writer). Pages written outside a transaction go to the
+ * file right away, so that should only be done when no one else is
+ * reading. When pages of a transaction are written:
+ *
+ * - Before a page in the file is replaced, its committed contents are
+ *   copied to a version of the page, tagged with the number of the
+ *   commit that replaces it. A reader whose snapshot is older than
+ *   that commit reads the version instead of the file. A page and its
+ *   versions are in the same bucket, and the latch is held while both
+ *   are replaced, so readers never see half of a change.
+ * - A transaction is made visible to new readers by incrementing the
+ *   number of commits, once all its pages are in the file.
+ * - Versions are freed as soon as no snapshot needs them, when the
+ *   oldest reader releases its lock or a transaction ends.
+ *
+ * Copying the pages is not needed if there are no readers when the
+ * transaction is committed. In that case, pagers that acquire a read
+ * lock while its pages are being written wait until they all are.
+ *
  */
 
 /*
@@ -57,12 +104,72 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include <chidb/log.h>
 
 #include "chidbInt.h"
 
 #include "pager.h"
+#include "util.h"
+
+#define JOURNAL_SUFFIX "-journal"
+#define JOURNAL_MAGIC "chidbjnl"
+#define JOURNAL_HEADER_SIZE (16)
+
+/* A bucket of the cache of committed pages. Its pages are listed from
+ * the most recently used to the least */
+typedef struct PagerBucket
+{
+    pthread_mutex_t latch;
+    PagerFrame *frames;
+    uint32_t n_frames;
+    struct PagerVersion *versions;
+} PagerBucket;
+
+/* The contents a page had until the commit number end replaced them */
+typedef struct PagerVersion
+{
+    npage_t npage;
+    uint64_t end;
+    uint8_t *data;
+    struct PagerVersion *next;   /* Next version in the same bucket */
+} PagerVersion;
+
+struct PagerShared
+{
+    FILE *f;
+    dev_t dev;                 /* Device and inode of the file */
+    ino_t ino;
+    int refs;                  /* Number of pagers open on the file */
+    uint16_t page_size;
+    npage_t n_pages;           /* Number of committed pages */
+    PagerBucket buckets[PAGER_SHARED_BUCKETS];
+
+    /* Locks */
+    pthread_mutex_t lock;      /* Protects the fields below, and n_pages */
+    pthread_cond_t cond;       /* Signalled when a lock is released */
+    Pager *writer;             /* Pager that holds the write lock, if any */
+    uint32_t next_ticket;      /* The write lock is given in the order */
+    uint32_t now_serving;      /* it was asked for (see lockWrite) */
+    Pager *readers;            /* Pagers that hold read locks */
+    uint64_t n_commits;        /* Transactions committed since the file
+                                * was opened */
+    bool flushing;             /* Is the writer replacing pages without
+                                * keeping versions of them? */
+    uint32_t n_versions;       /* Versions in the buckets */
+
+    PagerShared *next;         /* Next file in pager_files */
+};
+
+/* Files that pagers are open on */
+static PagerShared *pager_files = NULL;
+static pthread_mutex_t pager_files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int pager_recover(Pager *pager);
+static PagerFrame *pager_frame(Pager *pager, npage_t npage);
+static int pager_cache_write(Pager *pager, MemPage *page);
+static int pager_spill(Pager *pager);
 
 /* Open a file
  *
@@ -80,18 +187,299 @@
  */
 int chidb_Pager_open(Pager **pager, const char *filename)
 {
+    PagerShared *shared;
+    struct stat buf;
+    FILE *f;
+    int rc = CHIDB_OK;
+
     *pager = malloc(sizeof(Pager));
-    if (pager == NULL)
+    if (*pager == NULL)
         return CHIDB_ENOMEM;
-    (*pager)->f = fopen(filename, "r+");
+    f = fopen(filename, "r+");
 
-    if ((*pager)->f == NULL)
-        (*pager)->f = fopen(filename, "w+");
+    if (f == NULL)
+        f = fopen(filename, "w+");
 
-    if ((*pager)->f == NULL)
+    if (f == NULL || fstat(fileno(f), &buf) != 0)
+    {
+        if (f != NULL)
+            fclose(f);
+        free(*pager);
         return CHIDB_EIO;
+    }
+
+    (*pager)->journal_name = malloc(strlen(filename) + sizeof(JOURNAL_SUFFIX));
+    if ((*pager)->journal_name == NULL)
+    {
+        fclose(f);
+        free(*pager);
+        return CHIDB_ENOMEM;
+    }
+    sprintf((*pager)->journal_name, "%s" JOURNAL_SUFFIX, filename);
+    (*pager)->n_pages = 0;
+    (*pager)->page_size = 0;
+    (*pager)->n_readers = 0;
+    (*pager)->snapshot = 0;
+    (*pager)->writing = false;
+    (*pager)->next_reader = NULL;
+    pthread_rwlock_init(&(*pager)->rwlock, NULL);
+    (*pager)->in_txn = false;
+    (*pager)->journal = NULL;
+    (*pager)->journaled = NULL;
+    (*pager)->frames = NULL;
+    (*pager)->n_frames = 0;
+    (*pager)->spilling = NULL;
+
+    /* Pagers open on the same file share it */
+    pthread_mutex_lock(&pager_files_lock);
+    for (shared = pager_files; shared != NULL; shared = shared->next)
+        if (shared->dev == buf.st_dev && shared->ino == buf.st_ino)
+            break;
+
+    if (shared != NULL)
+    {
+        shared->refs++;
+        fclose(f);
+    }
+    else if ((shared = calloc(1, sizeof(PagerShared))) == NULL)
+        rc = CHIDB_ENOMEM;
     else
-        return CHIDB_OK;
+    {
+        shared->f = f;
+        shared->dev = buf.st_dev;
+        shared->ino = buf.st_ino;
+        shared->refs = 1;
+        for (int i = 0; i < PAGER_SHARED_BUCKETS; i++)
+            pthread_mutex_init(&shared->buckets[i].latch, NULL);
+        pthread_mutex_init(&shared->lock, NULL);
+        pthread_cond_init(&shared->cond, NULL);
+        shared->next = pager_files;
+        pager_files = shared;
+
+        /* A journal that is still there belongs to a transaction that
+         * never finished, and some of its pages may be in the file */
+        (*pager)->shared = shared;
+        (*pager)->f = f;
+        rc = pager_recover(*pager);
+    }
+    pthread_mutex_unlock(&pager_files_lock);
+
+    if (shared == NULL)
+    {
+        fclose(f);
+        pthread_rwlock_destroy(&(*pager)->rwlock);
+        free((*pager)->journal_name);
+        free(*pager);
+        return rc;
+    }
+    (*pager)->shared = shared;
+    (*pager)->f = shared->f;
+
+    if (rc != CHIDB_OK)
+        chidb_Pager_close(*pager);
+
+    return rc;
+}
+
+
+/* Returns a page in a bucket of the cache of committed pages (moving
+ * it to the front), or NULL if it isn't there. The bucket's latch must
+ * be held */
+static PagerFrame *pager_cache_find(PagerBucket *bucket, npage_t npage)
+{
+    PagerFrame **prev, *frame;
+
+    for (prev = &bucket->frames; *prev != NULL && (*prev)->npage != npage; prev = &(*prev)->next)
+        ;
+    if ((frame = *prev) != NULL)
+    {
+        *prev = frame->next;
+        frame->next = bucket->frames;
+        bucket->frames = frame;
+    }
+
+    return frame;
+}
+
+
+/* Adds a page to a bucket of the cache of committed pages (replacing
+ * the least recently used page, if the bucket is full), and returns it
+ * so that its contents can be copied. The bucket's latch must be held */
+static PagerFrame *pager_cache_add(PagerShared *shared, PagerBucket *bucket, npage_t npage)
+{
+    PagerFrame **prev, *frame;
+
+    if (bucket->n_frames < PAGER_SHARED_WAYS)
+    {
+        if ((frame = malloc(sizeof(PagerFrame))) == NULL)
+            return NULL;
+        if ((frame->data = malloc(shared->page_size)) == NULL)
+        {
+            free(frame);
+            return NULL;
+        }
+        bucket->n_frames++;
+    }
+    else
+    {
+        for (prev = &bucket->frames; (*prev)->next != NULL; prev = &(*prev)->next)
+            ;
+        frame = *prev;
+        *prev = NULL;
+    }
+    frame->npage = npage;
+    frame->next = bucket->frames;
+    bucket->frames = frame;
+
+    return frame;
+}
+
+
+/* Updates the contents of a page in the cache of committed pages. If
+ * it isn't there, and insert is true, it is added */
+static void pager_cache_put(PagerShared *shared, npage_t npage, const uint8_t *data, bool insert)
+{
+    PagerBucket *bucket = &shared->buckets[npage % PAGER_SHARED_BUCKETS];
+    PagerFrame *frame;
+
+    pthread_mutex_lock(&bucket->latch);
+    if ((frame = pager_cache_find(bucket, npage)) == NULL && insert)
+        frame = pager_cache_add(shared, bucket, npage);
+    if (frame != NULL)
+        memcpy(frame->data, data, shared->page_size);
+    pthread_mutex_unlock(&bucket->latch);
+}
+
+
+/* Removes the first page in a bucket of the cache of committed pages.
+ * The bucket's latch must be held */
+static void pager_cache_remove_first(PagerBucket *bucket)
+{
+    PagerFrame *frame = bucket->frames;
+
+    bucket->frames = frame->next;
+    bucket->n_frames--;
+    free(frame->data);
+    free(frame);
+}
+
+
+/* Returns the version of a page that a snapshot (with the given number
+ * of commits) needs, if any: the oldest version that was replaced by a
+ * later commit. The bucket's latch must be held */
+static PagerVersion *pager_version(PagerBucket *bucket, npage_t npage, uint64_t snapshot)
+{
+    PagerVersion *version, *found = NULL;
+
+    for (version = bucket->versions; version != NULL; version = version->next)
+        if (version->npage == npage && version->end > snapshot &&
+            (found == NULL || version->end < found->end))
+            found = version;
+
+    return found;
+}
+
+
+/* Frees the versions of pages that no snapshot needs: those replaced
+ * by a commit that every reader can see. If pending is not zero, the
+ * versions replaced by the transaction that would have been commit
+ * number pending (which has been rolled back) are also freed. The
+ * shared lock must be held */
+static void pager_versions_free(PagerShared *shared, uint64_t pending)
+{
+    PagerVersion **prev, *version;
+    uint64_t oldest = shared->n_commits;
+
+    for (Pager *reader = shared->readers; reader != NULL; reader = reader->next_reader)
+        if (reader->snapshot < oldest)
+            oldest = reader->snapshot;
+
+    for (int i = 0; i < PAGER_SHARED_BUCKETS && shared->n_versions > 0; i++)
+    {
+        PagerBucket *bucket = &shared->buckets[i];
+
+        pthread_mutex_lock(&bucket->latch);
+        for (prev = &bucket->versions; (version = *prev) != NULL; )
+        {
+            if (version->end <= oldest || version->end == pending)
+            {
+                *prev = version->next;
+                shared->n_versions--;
+                free(version->data);
+                free(version);
+            }
+            else
+                prev = &version->next;
+        }
+        pthread_mutex_unlock(&bucket->latch);
+    }
+}
+
+
+/* Removes every page (and version) from the cache of committed pages */
+static void pager_cache_clear(PagerShared *shared)
+{
+    PagerFrame *frame, *next;
+    PagerVersion *version, *next_version;
+
+    for (int i = 0; i < PAGER_SHARED_BUCKETS; i++)
+    {
+        pthread_mutex_lock(&shared->buckets[i].latch);
+        for (frame = shared->buckets[i].frames; frame != NULL; frame = next)
+        {
+            next = frame->next;
+            free(frame->data);
+            free(frame);
+        }
+        for (version = shared->buckets[i].versions; version != NULL; version = next_version)
+        {
+            next_version = version->next;
+            free(version->data);
+            free(version);
+        }
+        shared->buckets[i].frames = NULL;
+        shared->buckets[i].n_frames = 0;
+        shared->buckets[i].versions = NULL;
+        pthread_mutex_unlock(&shared->buckets[i].latch);
+    }
+    shared->n_versions = 0;
+}
+
+
+/* Reads a committed page: the version the pager's snapshot needs, if
+ * the page has been replaced since the snapshot was taken, or else the
+ * page in the cache or the file. Pages read from the file are added
+ * to the cache, unless they may not be committed */
+static int pager_read_committed(Pager *pager, npage_t npage, uint8_t *data)
+{
+    PagerShared *shared = pager->shared;
+    PagerBucket *bucket = &shared->buckets[npage % PAGER_SHARED_BUCKETS];
+    PagerVersion *version = NULL;
+    PagerFrame *frame;
+    ssize_t n;
+    int rc = CHIDB_OK;
+
+    pthread_mutex_lock(&bucket->latch);
+    if (pager->n_readers > 0 && !pager->writing)
+        version = pager_version(bucket, npage, pager->snapshot);
+
+    if (version != NULL)
+        memcpy(data, version->data, pager->page_size);
+    else if ((frame = pager_cache_find(bucket, npage)) != NULL)
+        memcpy(data, frame->data, pager->page_size);
+    /* Unlike fseek and fread, pread doesn't use the file's offset */
+    else if ((n = pread(fileno(pager->f), data, pager->page_size,
+                        (off_t) (npage - 1) * pager->page_size)) < 0)
+        rc = CHIDB_EIO;
+    /* Once pages of a transaction have been written to the file, the
+     * file has pages that aren't committed */
+    else if (n == pager->page_size &&
+             (!pager->in_txn || (!pager->spilled && npage <= pager->orig_n_pages)) &&
+             (frame = pager_cache_add(shared, bucket, npage)) != NULL)
+        memcpy(frame->data, data, pager->page_size);
+    pthread_mutex_unlock(&bucket->latch);
+
+    return rc;
 }
 
 
@@ -111,8 +499,20 @@ int chidb_Pager_open(Pager **pager, const char *filename)
  */
 int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
 {
+    PagerShared *shared = pager->shared;
+
     pager->page_size = pagesize;
-    chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+
+    /* Other pagers open on the file may have set it already */
+    pthread_mutex_lock(&shared->lock);
+    if (shared->page_size != pagesize)
+    {
+        pager_cache_clear(shared);
+        shared->page_size = pagesize;
+        chidb_Pager_getRealDBSize(pager, &shared->n_pages);
+    }
+    pager->n_pages = shared->n_pages;
+    pthread_mutex_unlock(&shared->lock);
 
     return CHIDB_OK;
 }
@@ -135,9 +535,8 @@ int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
  */
 int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
 {
-    int count;
-    count = fseek(pager->f, 0, SEEK_SET);
-    count = fread(header, 1, 100, pager->f);
+    ssize_t count;
+    count = pread(fileno(pager->f), header, 100, 0);
     if (count != 100)
         return CHIDB_NOHEADER;
     else
@@ -159,8 +558,14 @@ int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
 {
     /* We simply increment the page number counter. readPage
      * and writePage take care of the rest. */
+    pthread_rwlock_wrlock(&pager->rwlock);
     *npage = ++pager->n_pages;
 
+    /* Outside a transaction, the page is part of the file right away */
+    if (!pager->in_txn)
+        pager->shared->n_pages = pager->n_pages;
+    pthread_rwlock_unlock(&pager->rwlock);
+
     return CHIDB_OK;
 }
 
@@ -173,6 +578,11 @@ int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
  * a MemPage created by this function.
  * Any changes done to a MemPage will not be effective until you call
  * chidb_Pager_writePage with that MemPage.
+ * Several threads can read and write pages with the same pager at once
+ * (e.g., to insert into different parts of a B-Tree in the same
+ * transaction): each page is read and written as a whole. While the
+ * pager holds a read lock, the pages are the ones in its snapshot (see
+ * chidb_Pager_lockRead).
  *
  * Parameters
  * - pager: A Pager.
@@ -186,20 +596,38 @@ int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
  */
 int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
 {
-    if (npage > pager->n_pages || npage <= 0)
-        return CHIDB_EPAGENO;
-    int n;
+    PagerFrame *frame = NULL;
+    int rc = CHIDB_OK;
 
     *page = malloc(sizeof(MemPage));
-    if (page == NULL)
+    if (*page == NULL)
         return CHIDB_ENOMEM;
     (*page)->npage = npage;
     (*page)->data = calloc(pager->page_size, 1);
     if ((*page)->data == NULL)
+    {
+        free(*page);
         return CHIDB_ENOMEM;
-    fseek(pager->f, (npage - 1) * pager->page_size, SEEK_SET);
-    n = fread((*page)->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", n, npage, *page, (*page)->data);
+    }
+
+    pthread_rwlock_rdlock(&pager->rwlock);
+    if (npage > pager->n_pages || npage <= 0)
+        rc = CHIDB_EPAGENO;
+    /* Pages written in the current transaction may not be in the file
+     * yet (or be being written to it) */
+    else if (pager->in_txn && (frame = pager_frame(pager, npage)) != NULL)
+        memcpy((*page)->data, frame->data, pager->page_size);
+    else
+        rc = pager_read_committed(pager, npage, (*page)->data);
+    pthread_rwlock_unlock(&pager->rwlock);
+
+    if (rc != CHIDB_OK)
+    {
+        free((*page)->data);
+        free(*page);
+        return rc;
+    }
+    chilog(TRACE, "Read page %i into memory [%x data: %x]", npage, *page, (*page)->data);
 
     return CHIDB_OK;
 }
@@ -208,7 +636,8 @@ int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
 /* Write a page to file
  *
  * This page writes the in-memory copy of a page (stored in a MemPage
- * struct) back to disk.
+ * struct) back to disk. If a transaction is open, the page is only
+ * written once the transaction is committed.
  *
  * Parameters
  * - pager: A Pager.
@@ -221,13 +650,32 @@ int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
  */
 int	chidb_Pager_writePage(Pager *pager, MemPage *page)
 {
+    bool spill = false;
+    int n, rc = CHIDB_OK;
+
+    pthread_rwlock_wrlock(&pager->rwlock);
     if (page->npage > pager->n_pages)
-        return CHIDB_EPAGENO;
-    int n;
-    fseek(pager->f, (page->npage - 1) * pager->page_size, SEEK_SET);
-    n = fwrite(page->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Wrote %i bytes to page %i", n, page->npage);
-    return CHIDB_OK;
+        rc = CHIDB_EPAGENO;
+    else if (pager->in_txn)
+    {
+        rc = pager_cache_write(pager, page);
+        spill = rc == CHIDB_OK && pager->n_frames > PAGER_CACHE_MAX;
+    }
+    else if ((n = pwrite(fileno(pager->f), page->data, pager->page_size,
+                         (off_t) (page->npage - 1) * pager->page_size)) != pager->page_size)
+        rc = CHIDB_EIO;
+    else
+    {
+        pager_cache_put(pager->shared, page->npage, page->data, false);
+        chilog(TRACE, "Wrote %i bytes to page %i", n, page->npage);
+    }
+    pthread_rwlock_unlock(&pager->rwlock);
+
+    /* The pages are written to the file after releasing the rwlock */
+    if (spill)
+        rc = pager_spill(pager);
+
+    return rc;
 }
 
 
@@ -243,7 +691,10 @@ int	chidb_Pager_writePage(Pager *pager, MemPage *page)
  */
 int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
 {
-    if (page->npage > pager->n_pages)
+    pthread_rwlock_rdlock(&pager->rwlock);
+    bool valid = page->npage <= pager->n_pages;
+    pthread_rwlock_unlock(&pager->rwlock);
+    if (!valid)
         return CHIDB_EPAGENO;
 
     chilog(TRACE, "Releasing page %i from memory [%x data: %x]", page->npage, page, page->data);
@@ -284,8 +735,782 @@ int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
  */
 int chidb_Pager_close(Pager *pager)
 {
-    fclose(pager->f);
+    PagerShared *shared = pager->shared, **prev;
+
+    /* A transaction that hasn't been committed is rolled back */
+    if (pager->in_txn)
+        chidb_Pager_rollback(pager);
+
+    /* Release any locks */
+    chidb_Pager_unlockWrite(pager);
+    while (pager->n_readers > 0)
+        chidb_Pager_unlockRead(pager);
+
+    pthread_mutex_lock(&pager_files_lock);
+    if (--shared->refs == 0)
+    {
+        for (prev = &pager_files; *prev != shared; prev = &(*prev)->next)
+            ;
+        *prev = shared->next;
+
+        pager_cache_clear(shared);
+        for (int i = 0; i < PAGER_SHARED_BUCKETS; i++)
+            pthread_mutex_destroy(&shared->buckets[i].latch);
+        pthread_mutex_destroy(&shared->lock);
+        pthread_cond_destroy(&shared->cond);
+        fclose(shared->f);
+        free(shared);
+    }
+    pthread_mutex_unlock(&pager_files_lock);
+
+    pthread_rwlock_destroy(&pager->rwlock);
+    free(pager->journal_name);
     free(pager);
 
     return CHIDB_OK;
 }
+
+
+/* Acquire a read lock
+ *
+ * While a pager holds a read lock, it reads a snapshot of the file: the
+ * pages committed when it acquired it, even if other pagers commit
+ * transactions meanwhile. A pager can hold several read locks, which
+ * share the snapshot and must all be released. The pager that holds
+ * the write lock reads the latest pages instead.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_lockRead(Pager *pager)
+{
+    PagerShared *shared = pager->shared;
+
+    pthread_mutex_lock(&shared->lock);
+
+    /* The writer isn't keeping versions of the pages it replaces, since
+     * no one was reading when it began */
+    while (shared->flushing && !pager->writing && pager->n_readers == 0)
+        pthread_cond_wait(&shared->cond, &shared->lock);
+
+    if (pager->n_readers++ == 0)
+    {
+        pager->snapshot = shared->n_commits;
+        pager->next_reader = shared->readers;
+        shared->readers = pager;
+
+        /* Pages may have been added by the last writer */
+        if (!pager->writing)
+            pager->n_pages = shared->n_pages;
+    }
+
+    pthread_mutex_unlock(&shared->lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Release a read lock
+ *
+ * When the last one is released, the versions of pages that only the
+ * pager's snapshot needed are freed.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The pager doesn't hold a read lock
+ */
+int chidb_Pager_unlockRead(Pager *pager)
+{
+    PagerShared *shared = pager->shared;
+    Pager **prev;
+
+    if (pager->n_readers == 0)
+        return CHIDB_EMISUSE;
+
+    pthread_mutex_lock(&shared->lock);
+    if (--pager->n_readers == 0)
+    {
+        for (prev = &shared->readers; *prev != pager; prev = &(*prev)->next_reader)
+            ;
+        *prev = pager->next_reader;
+        if (shared->n_versions > 0)
+            pager_versions_free(shared, 0);
+    }
+    pthread_mutex_unlock(&shared->lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Acquire the write lock
+ *
+ * Only the pager that holds the write lock can write to the file, and
+ * begin a transaction (see chidb_Pager_begin). If other pagers have it
+ * or are waiting for it, this waits until they have released it,
+ * unless this pager holds a read lock: its snapshot won't be the
+ * latest once another pager commits, and changes can't be made to
+ * pages that aren't the latest ones.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (or the pager already holds the
+ *   write lock)
+ * - CHIDB_EBUSY: This pager holds a read lock, and another pager holds
+ *   the write lock or has committed a transaction since the snapshot
+ *   was taken
+ */
+int chidb_Pager_lockWrite(Pager *pager)
+{
+    PagerShared *shared = pager->shared;
+    int rc = CHIDB_OK;
+
+    if (pager->writing)
+        return CHIDB_OK;
+
+    pthread_mutex_lock(&shared->lock);
+    if (pager->n_readers > 0 &&
+        (shared->writer != NULL || shared->next_ticket != shared->now_serving ||
+         pager->snapshot != shared->n_commits))
+        rc = CHIDB_EBUSY;
+    else
+    {
+        /* Otherwise, a pager that commits transactions one after the
+         * other could keep the lock away from the rest */
+        uint32_t ticket = shared->next_ticket++;
+        while (shared->writer != NULL || shared->now_serving != ticket)
+            pthread_cond_wait(&shared->cond, &shared->lock);
+        shared->now_serving++;
+        shared->writer = pager;
+        pager->writing = true;
+        pager->n_pages = shared->n_pages;
+    }
+    pthread_mutex_unlock(&shared->lock);
+
+    return rc;
+}
+
+
+/* Release the write lock
+ *
+ * The pages the pager added to the file outside a transaction become
+ * visible to other pagers (those that acquire a read lock after this).
+ * This must not be done while a transaction is open.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (or the pager didn't hold the
+ *   write lock)
+ * - CHIDB_EMISUSE: A transaction is open
+ */
+int chidb_Pager_unlockWrite(Pager *pager)
+{
+    PagerShared *shared = pager->shared;
+
+    if (pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    pthread_mutex_lock(&shared->lock);
+    if (shared->writer == pager)
+    {
+        shared->n_pages = pager->n_pages;
+        shared->writer = NULL;
+        pager->writing = false;
+        pthread_cond_broadcast(&shared->cond);
+    }
+    pthread_mutex_unlock(&shared->lock);
+
+    return CHIDB_OK;
+}
+
+
+/* Begin a transaction
+ *
+ * Until the transaction is committed (chidb_Pager_commit) or rolled
+ * back (chidb_Pager_rollback), the pages that are written are kept in
+ * memory (unless there are more than PAGER_CACHE_MAX of them) and the
+ * file is left as it was. Other pagers open on the file don't see the
+ * pages of the transaction.
+ *
+ * The pager should hold the write lock (see chidb_Pager_lockWrite),
+ * which it must keep until the transaction is over.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: A transaction is already open
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_begin(Pager *pager)
+{
+    if (pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    pager->journaled = calloc(pager->n_pages / 8 + 1, 1);
+    pager->frames = calloc(PAGER_CACHE_BUCKETS, sizeof(PagerFrame *));
+    if (pager->journaled == NULL || pager->frames == NULL)
+    {
+        free(pager->journaled);
+        free(pager->frames);
+        return CHIDB_ENOMEM;
+    }
+
+    pager->in_txn = true;
+    pager->orig_n_pages = pager->n_pages;
+    pager->journal = NULL;
+    pager->spilled = false;
+    pager->n_frames = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the frame of a page in a hash table of frames, or NULL if
+ * it isn't there */
+static PagerFrame *pager_frame_find(PagerFrame **frames, npage_t npage)
+{
+    PagerFrame *frame = frames[npage % PAGER_CACHE_BUCKETS];
+
+    while (frame != NULL && frame->npage != npage)
+        frame = frame->next;
+
+    return frame;
+}
+
+
+/* Returns the in-memory copy of a page written in the current
+ * transaction, or NULL if it hasn't been written. Pages that
+ * pager_spill is writing to the file are still read from memory
+ * (unless they have been written again since) */
+static PagerFrame *pager_frame(Pager *pager, npage_t npage)
+{
+    PagerFrame *frame = pager_frame_find(pager->frames, npage);
+
+    if (frame == NULL && pager->spilling != NULL)
+        frame = pager_frame_find(pager->spilling, npage);
+
+    return frame;
+}
+
+
+/* Checksum of a journal record. It doesn't start from zero, so that
+ * a record that is all zeroes doesn't have a valid checksum */
+static uint32_t journal_checksum(npage_t npage, const uint8_t *data, uint16_t size)
+{
+    uint32_t sum = 0x63686964 ^ npage;
+
+    for (uint16_t i = 0; i < size; i++)
+        sum = sum * 31 + data[i];
+
+    return sum;
+}
+
+
+/* Saves the contents that a page has in the file in the journal,
+ * creating the journal if this is the first page written in the
+ * transaction */
+static int pager_journal_page(Pager *pager, npage_t npage)
+{
+    uint8_t buf[JOURNAL_HEADER_SIZE];
+    uint8_t *data;
+    ssize_t n;
+    int rc = CHIDB_OK;
+
+    if (pager->journal == NULL)
+    {
+        if ((pager->journal = fopen(pager->journal_name, "w+")) == NULL)
+            return CHIDB_EIO;
+
+        memset(buf, 0, JOURNAL_HEADER_SIZE);
+        memcpy(buf, JOURNAL_MAGIC, 8);
+        put2byte(buf + 8, pager->page_size);
+        put4byte(buf + 12, pager->orig_n_pages);
+        if (fwrite(buf, 1, JOURNAL_HEADER_SIZE, pager->journal) != JOURNAL_HEADER_SIZE)
+            return CHIDB_EIO;
+        pager->journal_synced = false;
+    }
+
+    /* Pages that weren't in the file when the transaction began are
+     * removed when it is rolled back, so only the header is needed */
+    if (npage > pager->orig_n_pages || pager->journaled[npage / 8] & (1 << (npage % 8)))
+        return CHIDB_OK;
+
+    if ((data = calloc(pager->page_size, 1)) == NULL)
+        return CHIDB_ENOMEM;
+
+    n = pread(fileno(pager->f), data, pager->page_size, (off_t) (npage - 1) * pager->page_size);
+    put4byte(buf, npage);
+    put4byte(buf + 4, journal_checksum(npage, data, pager->page_size));
+    if (n < 0
+        || fwrite(buf, 1, 4, pager->journal) != 4
+        || fwrite(data, 1, pager->page_size, pager->journal) != pager->page_size
+        || fwrite(buf + 4, 1, 4, pager->journal) != 4)
+        rc = CHIDB_EIO;
+    free(data);
+
+    if (rc == CHIDB_OK)
+    {
+        pager->journaled[npage / 8] |= 1 << (npage % 8);
+        pager->journal_synced = false;
+    }
+
+    return rc;
+}
+
+
+/* Writes a page of the current transaction to the file. If end is
+ * not zero, and the page in the file is committed, its contents are
+ * first copied to a version of the page that ends with commit number
+ * end. If the transaction is being committed, the page replaces the
+ * one in the cache of committed pages. Otherwise, that one is no
+ * longer the same as the page in the file, which can only be read by
+ * this pager (until the transaction is over) */
+static int pager_flush_page(Pager *pager, PagerFrame *frame, uint64_t end, bool commit)
+{
+    PagerShared *shared = pager->shared;
+    PagerBucket *bucket = &shared->buckets[frame->npage % PAGER_SHARED_BUCKETS];
+    PagerFrame *cached;
+    PagerVersion *version = NULL;
+    off_t offset = (off_t) (frame->npage - 1) * pager->page_size;
+    int rc = CHIDB_OK;
+
+    pthread_mutex_lock(&bucket->latch);
+    cached = pager_cache_find(bucket, frame->npage);
+
+    /* If the page was written to the file before, in this transaction,
+     * its version is already there */
+    bool keep = end != 0 && frame->npage <= pager->orig_n_pages;
+    if (keep && (version = pager_version(bucket, frame->npage, end - 1)) != NULL)
+        keep = version->end != end;
+
+    version = NULL;
+    if (keep)
+    {
+        if ((version = malloc(sizeof(PagerVersion))) == NULL ||
+            (version->data = malloc(pager->page_size)) == NULL)
+            rc = CHIDB_ENOMEM;
+        else if (cached != NULL)
+            memcpy(version->data, cached->data, pager->page_size);
+        else if (pread(fileno(pager->f), version->data, pager->page_size, offset) < 0)
+        {
+            free(version->data);
+            rc = CHIDB_EIO;
+        }
+        if (rc != CHIDB_OK)
+        {
+            free(version);
+            pthread_mutex_unlock(&bucket->latch);
+            return rc;
+        }
+        version->npage = frame->npage;
+        version->end = end;
+        version->next = bucket->versions;
+        bucket->versions = version;
+    }
+
+    if (rc == CHIDB_OK &&
+        pwrite(fileno(pager->f), frame->data, pager->page_size, offset) != pager->page_size)
+        rc = CHIDB_EIO;
+    if (cached != NULL && commit && rc == CHIDB_OK)
+        memcpy(cached->data, frame->data, pager->page_size);
+    else if (cached != NULL)
+        pager_cache_remove_first(bucket);
+    pthread_mutex_unlock(&bucket->latch);
+
+    if (version != NULL)
+    {
+        pthread_mutex_lock(&shared->lock);
+        shared->n_versions++;
+        pthread_mutex_unlock(&shared->lock);
+    }
+
+    return rc;
+}
+
+
+/* Returns the commit number that the versions of the pages replaced
+ * by pager_flush end with (0 if no versions are kept, see below) */
+static uint64_t pager_flush_begin(Pager *pager, bool commit)
+{
+    PagerShared *shared = pager->shared;
+    uint64_t end;
+
+    pthread_mutex_lock(&shared->lock);
+    end = shared->n_commits + 1;
+    if (commit && shared->readers == NULL)
+    {
+        shared->flushing = true;
+        end = 0;
+    }
+    pthread_mutex_unlock(&shared->lock);
+
+    return end;
+}
+
+
+/* Writes the pages in a hash table of frames to the file */
+static int pager_flush_frames(Pager *pager, PagerFrame **frames, uint64_t end, bool commit)
+{
+    PagerFrame *frame;
+    int rc = CHIDB_OK;
+
+    for (int i = 0; i < PAGER_CACHE_BUCKETS && rc == CHIDB_OK; i++)
+        for (frame = frames[i]; frame != NULL && rc == CHIDB_OK; frame = frame->next)
+            rc = pager_flush_page(pager, frame, end, commit);
+
+    return rc;
+}
+
+
+/* Frees the frames in a hash table of frames */
+static void pager_frames_free(PagerFrame **frames)
+{
+    PagerFrame *frame, *next;
+
+    for (int i = 0; i < PAGER_CACHE_BUCKETS; i++)
+    {
+        for (frame = frames[i]; frame != NULL; frame = next)
+        {
+            next = frame->next;
+            free(frame->data);
+            free(frame);
+        }
+        frames[i] = NULL;
+    }
+}
+
+
+/* Writes every page in memory to the file, after making sure that the
+ * journal (with the original contents of those pages) is on disk.
+ *
+ * The committed pages that are replaced are kept as versions that end
+ * with the commit of the transaction, unless it is being committed
+ * and no pager is reading (then, no pager can acquire a read lock
+ * until the transaction has been committed, see pager_flush_end) */
+static int pager_flush(Pager *pager, bool commit)
+{
+    int rc;
+
+    if (pager->journal != NULL && !pager->journal_synced)
+    {
+        if (fflush(pager->journal) != 0 || fsync(fileno(pager->journal)) != 0)
+            return CHIDB_EIO;
+        pager->journal_synced = true;
+    }
+
+    rc = pager_flush_frames(pager, pager->frames, pager_flush_begin(pager, commit), commit);
+    pager_frames_free(pager->frames);
+
+    pager->n_frames = 0;
+    pager->spilled = true;
+    chilog(TRACE, "Flushed the pages of the current transaction");
+
+    return rc;
+}
+
+
+/* Writes the pages of the current transaction to the file when there
+ * are more than PAGER_CACHE_MAX of them, like pager_flush, but
+ * without holding the rwlock while the journal is synced and the
+ * pages are written: they are moved to pager->spilling, where other
+ * threads still read them, and pages written meanwhile go in new
+ * frames. Only one thread spills at a time; the others go on adding
+ * frames until it is done.
+ *
+ * The pages being spilled are already in the journal, so threads that
+ * write other pages meanwhile don't add records that this sync has to
+ * cover, nor read pages of the file that are being replaced */
+static int pager_spill(Pager *pager)
+{
+    PagerFrame **frames;
+    bool sync;
+    int rc = CHIDB_OK;
+
+    if ((frames = calloc(PAGER_CACHE_BUCKETS, sizeof(PagerFrame *))) == NULL)
+        return CHIDB_ENOMEM;
+
+    pthread_rwlock_wrlock(&pager->rwlock);
+    if (pager->spilling != NULL || pager->n_frames <= PAGER_CACHE_MAX)
+    {
+        pthread_rwlock_unlock(&pager->rwlock);
+        free(frames);
+        return CHIDB_OK;
+    }
+    pager->spilling = pager->frames;
+    pager->frames = frames;
+    pager->n_frames = 0;
+    /* Committed pages can't be read into the cache from the file anymore */
+    pager->spilled = true;
+    sync = !pager->journal_synced;
+    pager->journal_synced = true;
+    pthread_rwlock_unlock(&pager->rwlock);
+
+    if (sync && (fflush(pager->journal) != 0 || fsync(fileno(pager->journal)) != 0))
+        rc = CHIDB_EIO;
+    if (rc == CHIDB_OK)
+        rc = pager_flush_frames(pager, pager->spilling, pager_flush_begin(pager, false), false);
+
+    pthread_rwlock_wrlock(&pager->rwlock);
+    frames = pager->spilling;
+    pager->spilling = NULL;
+    if (rc != CHIDB_OK && sync)
+        pager->journal_synced = false;
+    pthread_rwlock_unlock(&pager->rwlock);
+
+    pager_frames_free(frames);
+    free(frames);
+    chilog(TRACE, "Spilled the pages of the current transaction");
+
+    return rc;
+}
+
+
+/* Makes the pages written by pager_flush visible to pagers that
+ * acquire a read lock after this, if the transaction was committed,
+ * and lets them acquire it */
+static void pager_flush_end(Pager *pager, bool committed)
+{
+    PagerShared *shared = pager->shared;
+
+    pthread_mutex_lock(&shared->lock);
+    if (committed)
+    {
+        shared->n_commits++;
+        shared->n_pages = pager->n_pages;
+        /* The pager's own changes are part of its snapshot */
+        if (pager->n_readers > 0)
+            pager->snapshot = shared->n_commits;
+        if (shared->n_versions > 0)
+            pager_versions_free(shared, 0);
+    }
+    if (shared->flushing)
+    {
+        shared->flushing = false;
+        pthread_cond_broadcast(&shared->cond);
+    }
+    pthread_mutex_unlock(&shared->lock);
+}
+
+
+/* Writes a page in the current transaction: its original contents
+ * go in the journal, and the new ones stay in memory */
+static int pager_cache_write(Pager *pager, MemPage *page)
+{
+    PagerFrame *frame;
+    int rc;
+
+    if ((rc = pager_journal_page(pager, page->npage)) != CHIDB_OK)
+        return rc;
+
+    if ((frame = pager_frame_find(pager->frames, page->npage)) == NULL)
+    {
+        if ((frame = malloc(sizeof(PagerFrame))) == NULL)
+            return CHIDB_ENOMEM;
+        if ((frame->data = malloc(pager->page_size)) == NULL)
+        {
+            free(frame);
+            return CHIDB_ENOMEM;
+        }
+        frame->npage = page->npage;
+        frame->next = pager->frames[page->npage % PAGER_CACHE_BUCKETS];
+        pager->frames[page->npage % PAGER_CACHE_BUCKETS] = frame;
+        pager->n_frames++;
+    }
+    memcpy(frame->data, page->data, pager->page_size);
+
+    return CHIDB_OK;
+}
+
+
+/* Writes the original pages in a journal back to the file, and
+ * truncates the file to the size it had before the transaction.
+ *
+ * The journal is on disk before any page is changed in the file, so
+ * a record that wasn't written completely (its checksum is wrong), or
+ * a journal without a complete header, means that the rest of the
+ * transaction's pages were never written to the file. */
+static int pager_playback(Pager *pager, FILE *journal)
+{
+    uint8_t header[JOURNAL_HEADER_SIZE], num[4], sum[4];
+    uint8_t *data;
+    uint16_t page_size;
+    npage_t orig_n_pages, npage;
+    int fd = fileno(pager->f);
+    int rc = CHIDB_OK;
+
+    if (fseek(journal, 0, SEEK_SET) != 0)
+        return CHIDB_EIO;
+    if (fread(header, 1, JOURNAL_HEADER_SIZE, journal) != JOURNAL_HEADER_SIZE
+        || memcmp(header, JOURNAL_MAGIC, 8) != 0)
+        return CHIDB_OK;
+
+    page_size = get2byte(header + 8);
+    orig_n_pages = get4byte(header + 12);
+    if ((data = malloc(page_size)) == NULL)
+        return CHIDB_ENOMEM;
+
+    while (fread(num, 1, 4, journal) == 4
+           && fread(data, 1, page_size, journal) == page_size
+           && fread(sum, 1, 4, journal) == 4)
+    {
+        npage = get4byte(num);
+        if (npage == 0 || npage > orig_n_pages
+            || get4byte(sum) != journal_checksum(npage, data, page_size))
+            break;
+
+        if (pwrite(fd, data, page_size, (off_t) (npage - 1) * page_size) != page_size)
+        {
+            rc = CHIDB_EIO;
+            break;
+        }
+    }
+    free(data);
+
+    if (rc == CHIDB_OK &&
+        (ftruncate(fd, (off_t) orig_n_pages * page_size) != 0 || fsync(fd) != 0))
+        rc = CHIDB_EIO;
+
+    return rc;
+}
+
+
+/* Undoes the changes of a transaction that never finished (when the
+ * database is opened) */
+static int pager_recover(Pager *pager)
+{
+    FILE *journal = fopen(pager->journal_name, "r");
+    int rc;
+
+    if (journal == NULL)
+        return CHIDB_OK;
+
+    chilog(INFO, "Rolling back the transaction in %s", pager->journal_name);
+    rc = pager_playback(pager, journal);
+    fclose(journal);
+
+    if (rc == CHIDB_OK)
+        unlink(pager->journal_name);
+
+    return rc;
+}
+
+
+/* Ends the current transaction. Unless keep_journal is true, the
+ * journal is deleted */
+static void pager_end(Pager *pager, bool keep_journal)
+{
+    pager_frames_free(pager->frames);
+
+    if (pager->journal != NULL)
+    {
+        fclose(pager->journal);
+        if (!keep_journal)
+            unlink(pager->journal_name);
+    }
+
+    free(pager->frames);
+    free(pager->journaled);
+    pager->frames = NULL;
+    pager->journaled = NULL;
+    pager->journal = NULL;
+    pager->n_frames = 0;
+    pager->spilled = false;
+    pager->in_txn = false;
+}
+
+
+/* Commit the current transaction
+ *
+ * Writes the pages of the transaction to the file. The transaction is
+ * durable once the journal is deleted, after the file has been synced.
+ * Other pagers see its pages once they acquire a read lock after
+ * this; those that already hold one keep reading the pages of their
+ * snapshot.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no transaction
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file (the
+ *   transaction is still open, and should be rolled back)
+ */
+int chidb_Pager_commit(Pager *pager)
+{
+    int rc;
+
+    if (!pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    /* Nothing has been written */
+    if (pager->journal == NULL)
+    {
+        pager_end(pager, false);
+        return CHIDB_OK;
+    }
+
+    if ((rc = pager_flush(pager, true)) == CHIDB_OK && fsync(fileno(pager->f)) != 0)
+        rc = CHIDB_EIO;
+    pager_flush_end(pager, rc == CHIDB_OK);
+    if (rc != CHIDB_OK)
+        return rc;
+
+    pager_end(pager, false);
+
+    return CHIDB_OK;
+}
+
+
+/* Roll back the current transaction
+ *
+ * Discards the pages of the transaction and, if any of them were
+ * written to the file, restores their original contents from the
+ * journal. Pages allocated in the transaction are removed. The write
+ * lock is kept.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no transaction
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file (the
+ *   journal is kept, and the transaction will be rolled back when the
+ *   file is opened again)
+ */
+int chidb_Pager_rollback(Pager *pager)
+{
+    int rc = CHIDB_OK;
+
+    if (!pager->in_txn)
+        return CHIDB_EMISUSE;
+
+    if (pager->spilled)
+    {
+        rc = pager_playback(pager, pager->journal);
+
+        /* Readers can read the file again, instead of the versions
+         * of the pages it had */
+        pthread_mutex_lock(&pager->shared->lock);
+        if (rc == CHIDB_OK && pager->shared->n_versions > 0)
+            pager_versions_free(pager->shared, pager->shared->n_commits + 1);
+        pthread_mutex_unlock(&pager->shared->lock);
+    }
+
+    pager->n_pages = pager->orig_n_pages;
+    pager_end(pager, rc != CHIDB_OK);
+
+    return rc;
+}
@@ -41,6 +41,7 @@
 #define PAGER_H_
 
 #include <stdio.h>
+#include <pthread.h>
 #include "chidbInt.h"
 
 struct MemPage
@@ -50,11 +51,63 @@ struct MemPage
 };
 typedef struct MemPage MemPage;
 
+/* A page written in the current transaction, which hasn't been written
+ * to the file yet (see chidb_Pager_begin) */
+struct PagerFrame
+{
+    npage_t npage;
+    uint8_t *data;
+    struct PagerFrame *next;   /* Next frame in the same bucket */
+};
+typedef struct PagerFrame PagerFrame;
+
+/* The part of a pager that is shared by every pager open on the same
+ * file: the file itself, the cache of committed pages, the versions of
+ * pages that snapshots still need, and the locks (see pager.c) */
+typedef struct PagerShared PagerShared;
+
+/* Number of buckets in the hash table of a transaction's pages */
+#define PAGER_CACHE_BUCKETS (1024)
+
+/* Largest number of pages a transaction keeps in memory. When there
+ * are more, they are all written to the file (the journal makes it
+ * possible to undo this on a rollback). The thread whose write went
+ * over the limit writes them without holding the rwlock, so other
+ * threads can keep reading and writing pages (see pager_spill) */
+#define PAGER_CACHE_MAX (2048)
+
+/* The cache of committed pages has PAGER_SHARED_BUCKETS buckets (each
+ * with its own latch), with up to PAGER_SHARED_WAYS pages in each */
+#define PAGER_SHARED_BUCKETS (256)
+#define PAGER_SHARED_WAYS (8)
+
 struct Pager
 {
     FILE *f;
     npage_t n_pages;
     uint16_t page_size;
+    pthread_rwlock_t rwlock;   /* Held to read pages (shared) and to write
+                                * or allocate them (exclusive) */
+
+    PagerShared *shared;
+    int n_readers;             /* Read locks held (chidb_Pager_lockRead) */
+    uint64_t snapshot;         /* Commits that had happened when the first
+                                * of them was acquired */
+    bool writing;              /* Does it hold the write lock? */
+    struct Pager *next_reader; /* Next pager that holds read locks */
+
+    /* Transaction state */
+    char *journal_name;        /* Name of the rollback journal */
+    bool in_txn;               /* Is a transaction open? */
+    npage_t orig_n_pages;      /* Number of pages when it was opened */
+    FILE *journal;             /* Rollback journal (NULL until a page is written) */
+    bool journal_synced;       /* Has the journal been flushed to disk? */
+    bool spilled;              /* Have any pages been written to the file? */
+    uint8_t *journaled;        /* Bitmap of the pages in the journal */
+    PagerFrame **frames;       /* Hash table of the pages written so far */
+    uint32_t n_frames;
+    PagerFrame **spilling;     /* Pages being written to the file by
+                                * pager_spill (NULL if none are) */
 };
 typedef struct Pager Pager;
 
@@ -66,6 +119,13 @@ int chidb_Pager_releaseMemPage(Pager *pager, MemPage *page);
 int	chidb_Pager_readPage(Pager *pager, npage_t page_num, MemPage **page);
 int chidb_Pager_writePage(Pager *pager, MemPage *page);
 int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages);
+int chidb_Pager_lockRead(Pager *pager);
+int chidb_Pager_unlockRead(Pager *pager);
+int chidb_Pager_lockWrite(Pager *pager);
+int chidb_Pager_unlockWrite(Pager *pager);
+int chidb_Pager_begin(Pager *pager);
+int chidb_Pager_commit(Pager *pager);
+int chidb_Pager_rollback(Pager *pager);
 int chidb_Pager_close(Pager *pager);
 
 #endif /*PAGER_H_*/
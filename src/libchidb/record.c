@@ -29,6 +29,13 @@
  *   chidb_DBRecord_appendNull(&dbrb);
  *   chidb_DBRecord_finalize(&dbrb, &dbr);
  *
+ * Records can also be created in an arena (see arena.c) with
+ * chidb_DBRecord_create_empty_arena. All the memory used by such a
+ * record (including the raw record returned by "pack") is drawn from
+ * the arena, and is released when the arena is reset, not when the
+ * record is destroyed. This avoids calling malloc/free for every record
+ * when records are created in bulk (e.g., by the DBM's MakeRecord)
+ *
  */
 
 /*
@@ -75,6 +82,224 @@
 #include "util.h"
 
 
+/* Returns the type class (SQL_NULL, SQL_INTEGER_*, SQL_DOUBLE, SQL_BLOB,
+ * SQL_TEXT or SQL_NOTVALID) of a raw header type. The integer types that
+ * are only used by the compact record format are reported as the smallest
+ * legacy integer type that can hold their values. */
+static inline int __DBRecord_typeClass(uint32_t type)
+{
+    switch(type)
+    {
+    case SQL_NULL:
+    case SQL_INTEGER_1BYTE:
+    case SQL_INTEGER_2BYTE:
+    case SQL_INTEGER_4BYTE:
+    case SQL_INTEGER_8BYTE:
+    case SQL_DOUBLE:
+        return type;
+    case SQL_INTEGER_ZERO:
+    case SQL_INTEGER_ONE:
+        return SQL_INTEGER_1BYTE;
+    case SQL_INTEGER_3BYTE:
+        return SQL_INTEGER_4BYTE;
+    case SQL_INTEGER_6BYTE:
+        return SQL_INTEGER_8BYTE;
+    default:
+        if (type >= SQL_TEXT && (type - SQL_TEXT) % 2 == 0)
+            return SQL_TEXT;
+        else if (type >= SQL_BLOB && (type - SQL_BLOB) % 2 == 0)
+            return SQL_BLOB;
+        else
+            return SQL_NOTVALID;
+    }
+}
+
+/* Returns the number of data bytes taken up by a value of a given raw
+ * header type */
+static inline uint32_t __DBRecord_typeSize(uint32_t type)
+{
+    switch(type)
+    {
+    case SQL_INTEGER_1BYTE:
+        return 1;
+    case SQL_INTEGER_2BYTE:
+        return 2;
+    case SQL_INTEGER_3BYTE:
+        return 3;
+    case SQL_INTEGER_4BYTE:
+        return 4;
+    case SQL_INTEGER_6BYTE:
+        return 6;
+    case SQL_INTEGER_8BYTE:
+    case SQL_DOUBLE:
+        return 8;
+    default:
+        switch(__DBRecord_typeClass(type))
+        {
+        case SQL_TEXT:
+            return (type - SQL_TEXT) / 2;
+        case SQL_BLOB:
+            return (type - SQL_BLOB) / 2;
+        default:
+            return 0;
+        }
+    }
+}
+
+/* Decodes an integer value of a given raw header type */
+static inline int64_t __DBRecord_getInt(uint32_t type, const uint8_t *p)
+{
+    switch(type)
+    {
+    case SQL_INTEGER_ZERO:
+        return 0;
+    case SQL_INTEGER_ONE:
+        return 1;
+    case SQL_INTEGER_1BYTE:
+        return (int8_t) p[0];
+    case SQL_INTEGER_2BYTE:
+        return (int16_t) get2byte(p);
+    case SQL_INTEGER_3BYTE:
+        /* Sign-extend the 24-bit value */
+        return (int32_t) ((uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8) >> 8;
+    case SQL_INTEGER_4BYTE:
+        return (int32_t) get4byte(p);
+    case SQL_INTEGER_6BYTE:
+        /* Sign-extend the 48-bit value */
+        return (int64_t) ((uint64_t) get4byte(p) << 32 | (uint64_t) get2byte(p + 4) << 16) >> 16;
+    case SQL_INTEGER_8BYTE:
+        return (int64_t) get8byte(p);
+    default:
+        return 0;
+    }
+}
+
+/* Decodes a numeric value of a given raw header type as a double */
+static inline double __DBRecord_getDouble(uint32_t type, const uint8_t *p)
+{
+    if (type == SQL_DOUBLE)
+    {
+        uint64_t bits = get8byte(p);
+        double v;
+        memcpy(&v, &bits, sizeof(double));
+        return v;
+    }
+    else
+        return __DBRecord_getInt(type, p);
+}
+
+/* Returns the raw header type the compact record format uses for
+ * an integer value */
+static inline uint32_t __DBRecord_compactIntType(int64_t v)
+{
+    if(v == 0)
+        return SQL_INTEGER_ZERO;
+    else if(v == 1)
+        return SQL_INTEGER_ONE;
+    else if(v >= INT8_MIN && v <= INT8_MAX)
+        return SQL_INTEGER_1BYTE;
+    else if(v >= INT16_MIN && v <= INT16_MAX)
+        return SQL_INTEGER_2BYTE;
+    else if(v >= -(1 << 23) && v < (1 << 23))
+        return SQL_INTEGER_3BYTE;
+    else if(v >= INT32_MIN && v <= INT32_MAX)
+        return SQL_INTEGER_4BYTE;
+    else if(v >= -((int64_t) 1 << 47) && v < ((int64_t) 1 << 47))
+        return SQL_INTEGER_6BYTE;
+    else
+        return SQL_INTEGER_8BYTE;
+}
+
+/* Returns the number of bytes a raw header type takes up in the
+ * header of a record in a given format */
+static inline uint32_t __DBRecord_headerTypeSize(uint8_t format, uint32_t type)
+{
+    if(format == RECORD_FORMAT_COMPACT)
+        return varintLen(type);
+    else
+        return __DBRecord_typeClass(type) == SQL_TEXT ||
+               __DBRecord_typeClass(type) == SQL_BLOB ? 4 : 1;
+}
+
+
+/* Allocates memory for a record being built in a DBRecordBuffer,
+ * from the record's arena if it has one. */
+static int __DBRecordBuffer_alloc(DBRecordBuffer *dbrb, uint32_t size, void **p)
+{
+    if (dbrb->dbr->arena != NULL)
+        return chidb_Arena_alloc(dbrb->dbr->arena, size, p);
+
+    *p = malloc(size);
+    return *p == NULL ? CHIDB_ENOMEM : CHIDB_OK;
+}
+
+/* Makes sure there is room for "len" more bytes of data in a DBRecordBuffer */
+static int __DBRecordBuffer_ensure(DBRecordBuffer *dbrb, uint32_t len)
+{
+    uint32_t buf_size = dbrb->buf_size;
+    void *data;
+
+    if (dbrb->offset + len <= buf_size)
+        return CHIDB_OK;
+
+    while (dbrb->offset + len > buf_size)
+        buf_size += 1024;
+
+    if (dbrb->dbr->arena != NULL)
+    {
+        int rc = chidb_Arena_realloc(dbrb->dbr->arena, dbrb->dbr->data, dbrb->buf_size, buf_size, &data);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+    else
+    {
+        data = realloc(dbrb->dbr->data, buf_size);
+        if (data == NULL)
+            return CHIDB_ENOMEM;
+    }
+
+    dbrb->dbr->data = data;
+    dbrb->buf_size = buf_size;
+
+    return CHIDB_OK;
+}
+
+/* Initializes a DBRecordBuffer (see the create_empty functions below) */
+static int __DBRecord_create_empty(DBRecordBuffer *dbrb, uint8_t nfields, Arena *arena, uint32_t buf_size)
+{
+    int rc;
+    void *p;
+
+    if (arena != NULL)
+        rc = chidb_Arena_alloc(arena, sizeof(DBRecord), &p);
+    else
+        rc = (p = malloc(sizeof(DBRecord))) == NULL ? CHIDB_ENOMEM : CHIDB_OK;
+    if (rc != CHIDB_OK)
+        return rc;
+
+    dbrb->dbr = p;
+    dbrb->buf_size = buf_size;
+    dbrb->field = 0;
+    dbrb->offset = 0;
+    dbrb->header_size = 1;
+
+    dbrb->dbr->nfields = nfields;
+    dbrb->dbr->arena = arena;
+    dbrb->dbr->format = RECORD_FORMAT_LEGACY;
+    if ((rc = __DBRecordBuffer_alloc(dbrb, nfields * sizeof(uint32_t), &p)) != CHIDB_OK)
+        return rc;
+    dbrb->dbr->types = p;
+    if ((rc = __DBRecordBuffer_alloc(dbrb, nfields * sizeof(uint32_t), &p)) != CHIDB_OK)
+        return rc;
+    dbrb->dbr->offsets = p;
+    if ((rc = __DBRecordBuffer_alloc(dbrb, dbrb->buf_size, &p)) != CHIDB_OK)
+        return rc;
+    dbrb->dbr->data = p;
+
+    return CHIDB_OK;
+}
+
+
 /* Create an empty record
  *
  * Note that this function uses a DBRecordBuffer. The actual DBRecord
@@ -92,43 +317,80 @@
  */
 int chidb_DBRecord_create_empty(DBRecordBuffer *dbrb, uint8_t nfields)
 {
-    dbrb->dbr = malloc(sizeof(DBRecord));
-    dbrb->buf_size = 1024;
-    dbrb->field = 0;
-    dbrb->offset = 0;
-    dbrb->header_size = 1;
+    return __DBRecord_create_empty(dbrb, nfields, NULL, 1024);
+}
 
-    dbrb->dbr->nfields = nfields;
-    dbrb->dbr->types = malloc(dbrb->dbr->nfields * sizeof(uint32_t));
-    dbrb->dbr->offsets = malloc(dbrb->dbr->nfields * sizeof(uint32_t));
-    dbrb->dbr->data = malloc(dbrb->buf_size);
 
-    return CHIDB_OK;
+/* Create an empty record in an arena
+ *
+ * Same as chidb_DBRecord_create_empty, but all the memory for the record
+ * is allocated from an arena. The record remains valid until the arena
+ * is reset, and chidb_DBRecord_destroy does not need to be called on it.
+ *
+ * Parameters
+ * - dbrb: Pointer to an uninitialized DBRecordBuffer.
+ * - nfields: Number of fields in the record
+ * - arena: Arena to allocate the record from
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_create_empty_arena(DBRecordBuffer *dbrb, uint8_t nfields, Arena *arena)
+{
+    /* Records built in an arena are usually small, and growing
+     * the data buffer in place is cheap, so we start small */
+    return __DBRecord_create_empty(dbrb, nfields, arena, 64);
 }
 
 
-/* Append a 1-byte integer to an initialized DBRecordBuffer
+/* Set the format of a record being built in a DBRecordBuffer
+ *
+ * Records are created in the legacy format by default. This function
+ * must be called before any value is appended to the record.
  *
  * Parameters
  * - dbrb: Initialized DBRecordBuffer
- * - v: Value to append
+ * - format: RECORD_FORMAT_LEGACY or RECORD_FORMAT_COMPACT
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EMISUSE: Values have already been appended to the record
  */
-int chidb_DBRecord_appendInt8(DBRecordBuffer *dbrb, int8_t v)
+int chidb_DBRecord_setFormat(DBRecordBuffer *dbrb, uint8_t format)
+{
+    if (dbrb->field != 0)
+        return CHIDB_EMISUSE;
+
+    dbrb->dbr->format = format;
+
+    return CHIDB_OK;
+}
+
+
+/* Appends an integer to an initialized DBRecordBuffer. In the legacy
+ * format, the integer is stored with the requested type; in the
+ * compact format, the type is chosen based on the value. */
+static int __DBRecord_appendInt(DBRecordBuffer *dbrb, int64_t v, uint32_t type)
 {
+    uint32_t size;
+
+    if (dbrb->dbr->format == RECORD_FORMAT_COMPACT)
+        type = __DBRecord_compactIntType(v);
+    size = __DBRecord_typeSize(type);
+
     dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
 
-    dbrb->dbr->types[dbrb->field] = SQL_INTEGER_1BYTE;
-    if (dbrb->offset + 1 > dbrb->buf_size)
+    dbrb->dbr->types[dbrb->field] = type;
+    if (__DBRecordBuffer_ensure(dbrb, size) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    /* Store the "size" least significant bytes, in big-endian order */
+    for(int i = size - 1; i >= 0; i--)
     {
-        dbrb->buf_size += 1024;
-        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
+        dbrb->dbr->data[dbrb->offset + i] = (uint8_t) v;
+        v >>= 8;
     }
-    dbrb->dbr->data[dbrb->offset] = v;
-    dbrb->offset += 1;
+    dbrb->offset += size;
     dbrb->header_size++;
     dbrb->field++;
 
@@ -136,7 +398,7 @@ int chidb_DBRecord_appendInt8(DBRecordBuffer *dbrb, int8_t v)
 }
 
 
-/* Append a 2-byte integer to an initialized DBRecordBuffer
+/* Append a 1-byte integer to an initialized DBRecordBuffer
  *
  * Parameters
  * - dbrb: Initialized DBRecordBuffer
@@ -146,22 +408,25 @@ int chidb_DBRecord_appendInt8(DBRecordBuffer *dbrb, int8_t v)
  * - CHIDB_OK: Operation successful
  * - CHIDB_ENOMEM: Could not allocate memory
  */
-int chidb_DBRecord_appendInt16(DBRecordBuffer *dbrb, int16_t v)
+int chidb_DBRecord_appendInt8(DBRecordBuffer *dbrb, int8_t v)
 {
-    dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
+    return __DBRecord_appendInt(dbrb, v, SQL_INTEGER_1BYTE);
+}
 
-    dbrb->dbr->types[dbrb->field] = SQL_INTEGER_2BYTE;
-    if (dbrb->offset + 2 > dbrb->buf_size)
-    {
-        dbrb->buf_size += 1024;
-        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
-    }
-    put2byte(&dbrb->dbr->data[dbrb->offset], v);
-    dbrb->offset += 2;
-    dbrb->header_size++;
-    dbrb->field++;
 
-    return CHIDB_OK;
+/* Append a 2-byte integer to an initialized DBRecordBuffer
+ *
+ * Parameters
+ * - dbrb: Initialized DBRecordBuffer
+ * - v: Value to append
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_appendInt16(DBRecordBuffer *dbrb, int16_t v)
+{
+    return __DBRecord_appendInt(dbrb, v, SQL_INTEGER_2BYTE);
 }
 
 
@@ -177,16 +442,49 @@ int chidb_DBRecord_appendInt16(DBRecordBuffer *dbrb, int16_t v)
  */
 int chidb_DBRecord_appendInt32(DBRecordBuffer *dbrb, int32_t v)
 {
+    return __DBRecord_appendInt(dbrb, v, SQL_INTEGER_4BYTE);
+}
+
+
+/* Append an 8-byte integer to an initialized DBRecordBuffer
+ *
+ * Parameters
+ * - dbrb: Initialized DBRecordBuffer
+ * - v: Value to append
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_appendInt64(DBRecordBuffer *dbrb, int64_t v)
+{
+    return __DBRecord_appendInt(dbrb, v, SQL_INTEGER_8BYTE);
+}
+
+
+/* Append a double (an 8-byte IEEE 754 floating point number)
+ * to an initialized DBRecordBuffer
+ *
+ * Parameters
+ * - dbrb: Initialized DBRecordBuffer
+ * - v: Value to append
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_appendDouble(DBRecordBuffer *dbrb, double v)
+{
+    uint64_t bits;
+
     dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
 
-    dbrb->dbr->types[dbrb->field] = SQL_INTEGER_4BYTE;
-    if (dbrb->offset + 4 > dbrb->buf_size)
-    {
-        dbrb->buf_size += 1024;
-        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
-    }
-    put4byte(&dbrb->dbr->data[dbrb->offset], v);
-    dbrb->offset += 4;
+    dbrb->dbr->types[dbrb->field] = SQL_DOUBLE;
+    if (__DBRecordBuffer_ensure(dbrb, 8) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    memcpy(&bits, &v, sizeof(double));
+    put8byte(&dbrb->dbr->data[dbrb->offset], bits);
+    dbrb->offset += 8;
     dbrb->header_size++;
     dbrb->field++;
 
@@ -229,16 +527,40 @@ int chidb_DBRecord_appendString(DBRecordBuffer *dbrb,  char *v)
     dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
 
     len = strlen(v);
-    if (dbrb->offset + len > dbrb->buf_size)
-    {
-        dbrb->buf_size += 1024;
-        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
-    }
+    if (__DBRecordBuffer_ensure(dbrb, len) != CHIDB_OK)
+        return CHIDB_ENOMEM;
     memcpy(&dbrb->dbr->data[dbrb->offset], v, len);
     dbrb->offset += len;
     dbrb->dbr->types[dbrb->field] = len * 2 + SQL_TEXT;
+    dbrb->header_size += __DBRecord_headerTypeSize(dbrb->dbr->format, dbrb->dbr->types[dbrb->field]);
+    dbrb->field++;
+
+    return CHIDB_OK;
+}
+
+
+/* Append a BLOB to an initialized DBRecordBuffer
+ *
+ * Parameters
+ * - dbrb: Initialized DBRecordBuffer
+ * - v: Bytes to append
+ * - len: Number of bytes
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_appendBlob(DBRecordBuffer *dbrb, const uint8_t *v, uint32_t len)
+{
+    dbrb->dbr->offsets[dbrb->field] = dbrb->offset;
+
+    if (__DBRecordBuffer_ensure(dbrb, len) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    memcpy(&dbrb->dbr->data[dbrb->offset], v, len);
+    dbrb->offset += len;
+    dbrb->dbr->types[dbrb->field] = len * 2 + SQL_BLOB;
+    dbrb->header_size += __DBRecord_headerTypeSize(dbrb->dbr->format, dbrb->dbr->types[dbrb->field]);
     dbrb->field++;
-    dbrb->header_size += 4;
 
     return CHIDB_OK;
 }
@@ -260,7 +582,8 @@ int chidb_DBRecord_appendString(DBRecordBuffer *dbrb,  char *v)
 int chidb_DBRecord_finalize(DBRecordBuffer *dbrb, DBRecord **dbr)
 {
     dbrb->dbr->nfields = dbrb->field;
-    dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->offset);
+    if (dbrb->dbr->arena == NULL)
+        dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->offset);
     dbrb->dbr->data_len = dbrb->offset;
     dbrb->dbr->packed_len = dbrb->header_size + dbrb->offset;
 
@@ -287,25 +610,32 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
         return CHIDB_ENOMEM;
 
     (*dbr)->nfields = 0;
+    (*dbr)->arena = NULL;
 
     uint8_t header_size = raw[0];
     uint8_t header_pos = 1;
+    uint32_t legacy_size = 1;
     (*dbr)->types = malloc(0xFF * sizeof(uint32_t));
     while(header_pos < header_size)
     {
-        if (raw[header_pos] & 0x80)
-        {
-            getVarint32(&raw[header_pos], &(*dbr)->types[(*dbr)->nfields]);
-            header_pos += 4;
-        }
-        else
-        {
-            (*dbr)->types[(*dbr)->nfields] = raw[header_pos];
-            header_pos += 1;
-        }
+        uint64_t type;
+
+        header_pos += getVarint(&raw[header_pos], &type);
+        (*dbr)->types[(*dbr)->nfields] = type;
+        legacy_size += __DBRecord_headerTypeSize(RECORD_FORMAT_LEGACY, type);
 
         (*dbr)->nfields++;
     }
+
+    /* If the header isn't laid out the way the legacy format would
+     * lay it out, then this record is in the compact format */
+    (*dbr)->format = RECORD_FORMAT_LEGACY;
+    for(int i=0; i<(*dbr)->nfields; i++)
+        if ((*dbr)->types[i] == SQL_INTEGER_3BYTE || (*dbr)->types[i] == SQL_INTEGER_6BYTE ||
+                (*dbr)->types[i] == SQL_INTEGER_ZERO || (*dbr)->types[i] == SQL_INTEGER_ONE)
+            (*dbr)->format = RECORD_FORMAT_COMPACT;
+    if (legacy_size != header_size)
+        (*dbr)->format = RECORD_FORMAT_COMPACT;
     (*dbr)->types = realloc((*dbr)->types, (*dbr)->nfields * sizeof(uint32_t));
 
     uint32_t offset = 0;
@@ -315,21 +645,7 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
     for(int i=0; i<(*dbr)->nfields; i++)
     {
         (*dbr)->offsets[i] = offset;
-        int type = chidb_DBRecord_getType(*dbr, i);
-        if (type == SQL_NULL)
-            offset += 0;
-        else if (type == SQL_INTEGER_1BYTE)
-            offset += 1;
-        else if (type == SQL_INTEGER_2BYTE)
-            offset += 2;
-        else if (type == SQL_INTEGER_4BYTE)
-            offset += 4;
-        else if (type == SQL_TEXT)
-        {
-            int len;
-            chidb_DBRecord_getStringLength(*dbr, i, &len);
-            offset += len;
-        }
+        offset += __DBRecord_typeSize((*dbr)->types[i]);
     }
 
     (*dbr)->data_len = offset;
@@ -356,15 +672,27 @@ int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *raw)
  */
 int chidb_DBRecord_pack(DBRecord *dbr, uint8_t **p)
 {
-    *p = malloc(dbr->packed_len);
-    if (p == NULL)
-        return CHIDB_ENOMEM;
+    if (dbr->arena != NULL)
+    {
+        if (chidb_Arena_alloc(dbr->arena, dbr->packed_len, (void **) p) != CHIDB_OK)
+            return CHIDB_ENOMEM;
+    }
+    else
+    {
+        *p = malloc(dbr->packed_len);
+        if (*p == NULL)
+            return CHIDB_ENOMEM;
+    }
     (*p)[0] = dbr->packed_len - dbr->data_len;
 
     uint8_t header_pos = 1;
     for(int i=0; i < dbr->nfields; i++)
     {
-        if (chidb_DBRecord_getType(dbr, i) == SQL_TEXT)
+        if (dbr->format == RECORD_FORMAT_COMPACT)
+        {
+            header_pos += putVarint(*p + header_pos, dbr->types[i]);
+        }
+        else if (__DBRecord_headerTypeSize(RECORD_FORMAT_LEGACY, dbr->types[i]) == 4)
         {
             putVarint32(*p + header_pos, dbr->types[i]);
             header_pos +=4;
@@ -389,18 +717,14 @@ int chidb_DBRecord_pack(DBRecord *dbr, uint8_t **p)
  *
  * Return
  * - SQL_NULL, SQL_INTEGER_1BYTE, SQL_INTEGER_2BYTE, SQL_INTEGER_4BYTE,
- *   or SQL_TEXT depending on the field type.
+ *   SQL_INTEGER_8BYTE, SQL_DOUBLE, SQL_BLOB or SQL_TEXT depending on the
+ *   field type. Integers stored in the compact format are reported as the
+ *   smallest of these integer types that can hold them.
  * - SQL_NOTVALID if the specified field has an invalid field type.
  */
 int chidb_DBRecord_getType(DBRecord *dbr, uint8_t field)
 {
-    if(dbr->types[field] == SQL_NULL || dbr->types[field] == SQL_INTEGER_1BYTE ||
-            dbr->types[field] == SQL_INTEGER_2BYTE || dbr->types[field] == SQL_INTEGER_4BYTE)
-        return dbr->types[field];
-    else if ((dbr->types[field] - SQL_TEXT) % 2 == 0)
-        return SQL_TEXT;
-    else
-        return SQL_NOTVALID;
+    return __DBRecord_typeClass(dbr->types[field]);
 }
 
 
@@ -416,7 +740,7 @@ int chidb_DBRecord_getType(DBRecord *dbr, uint8_t field)
  */
 int chidb_DBRecord_getInt8(DBRecord *dbr, uint8_t field, int8_t *v)
 {
-    *v = dbr->data[dbr->offsets[field]];
+    *v = __DBRecord_getInt(dbr->types[field], &dbr->data[dbr->offsets[field]]);
 
     return CHIDB_OK;
 }
@@ -434,7 +758,7 @@ int chidb_DBRecord_getInt8(DBRecord *dbr, uint8_t field, int8_t *v)
  */
 int chidb_DBRecord_getInt16(DBRecord *dbr, uint8_t field, int16_t *v)
 {
-    *v = get2byte(&dbr->data[dbr->offsets[field]]);
+    *v = __DBRecord_getInt(dbr->types[field], &dbr->data[dbr->offsets[field]]);
 
     return CHIDB_OK;
 }
@@ -452,7 +776,45 @@ int chidb_DBRecord_getInt16(DBRecord *dbr, uint8_t field, int16_t *v)
  */
 int chidb_DBRecord_getInt32(DBRecord *dbr, uint8_t field, int32_t *v)
 {
-    *v = get4byte(&dbr->data[dbr->offsets[field]]);
+    *v = __DBRecord_getInt(dbr->types[field], &dbr->data[dbr->offsets[field]]);
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the value of an 8-byte integer field
+ *
+ * Parameters
+ * - dbr: The DBRecord
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_DBRecord_getInt64(DBRecord *dbr, uint8_t field, int64_t *v)
+{
+    *v = __DBRecord_getInt(dbr->types[field], &dbr->data[dbr->offsets[field]]);
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the value of a double field
+ *
+ * Integer fields are converted to a double.
+ *
+ * Parameters
+ * - dbr: The DBRecord
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_DBRecord_getDouble(DBRecord *dbr, uint8_t field, double *v)
+{
+    *v = __DBRecord_getDouble(dbr->types[field], &dbr->data[dbr->offsets[field]]);
 
     return CHIDB_OK;
 }
@@ -500,6 +862,49 @@ int chidb_DBRecord_getStringLength(DBRecord *dbr, uint8_t field, int *len)
 }
 
 
+/* Returns the value of a BLOB field
+ *
+ * Parameters
+ * - dbr: The DBRecord
+ * - field: Index of the field
+ * - v: Out parameter used to return a copy of the bytes
+ *      (use chidb_DBRecord_getBlobLength to get their number)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_DBRecord_getBlob(DBRecord *dbr, uint8_t field, uint8_t **v)
+{
+    int len;
+    chidb_DBRecord_getBlobLength(dbr, field, &len);
+    *v = malloc(len > 0 ? len : 1);
+    if (*v == NULL)
+        return CHIDB_ENOMEM;
+    memcpy(*v, &dbr->data[dbr->offsets[field]], len);
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the length of a BLOB field
+ *
+ * Parameters
+ * - dbr: The DBRecord
+ * - field: Index of the field
+ * - len: Out parameter used to return the length
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_DBRecord_getBlobLength(DBRecord *dbr, uint8_t field, int *len)
+{
+    *len = (dbr->types[field] - SQL_BLOB) / 2;
+
+    return CHIDB_OK;
+}
+
+
 /* Prints a string representation of a database record to stdout
  *
  * Parameters
@@ -533,6 +938,18 @@ int chidb_DBRecord_print(DBRecord *dbr)
             chidb_DBRecord_getInt32(dbr, i, (int32_t *) &i32);
             printf("| %i ", i32);
         }
+        else if (type == SQL_INTEGER_8BYTE)
+        {
+            int64_t i64;
+            chidb_DBRecord_getInt64(dbr, i, &i64);
+            printf("| %lli ", (long long) i64);
+        }
+        else if (type == SQL_DOUBLE)
+        {
+            double d;
+            chidb_DBRecord_getDouble(dbr, i, &d);
+            printf("| %g ", d);
+        }
         else if (type == SQL_TEXT)
         {
             char *s;
@@ -540,6 +957,12 @@ int chidb_DBRecord_print(DBRecord *dbr)
             printf("| %s ", s);
             free(s);
         }
+        else if (type == SQL_BLOB)
+        {
+            int len;
+            chidb_DBRecord_getBlobLength(dbr, i, &len);
+            printf("| (%i bytes) ", len);
+        }
     }
     printf("|");
 
@@ -547,6 +970,267 @@ int chidb_DBRecord_print(DBRecord *dbr)
 }
 
 
+/* Initializes a view over a raw binary database record
+ *
+ * No memory is allocated and the record is not copied. The view
+ * only remembers where the raw record is; the header is parsed
+ * lazily, as fields are requested. The raw record must remain
+ * valid (and unmodified) for as long as the view is used.
+ *
+ * Parameters
+ * - dbrv: DBRecordView to initialize
+ * - raw: Pointer to first byte of raw binary database record
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_DBRecordView_init(DBRecordView *dbrv, uint8_t *raw)
+{
+    dbrv->raw = raw;
+    dbrv->header_size = raw[0];
+    dbrv->header_pos = 1;
+    dbrv->nparsed = 0;
+    dbrv->next_offset = 0;
+
+    return CHIDB_OK;
+}
+
+
+/* Parses the header of a record view up to (and including) a given field
+ *
+ * Parameters
+ * - dbrv: The DBRecordView
+ * - field: Index of the field
+ *
+ * Return
+ * - CHIDB_OK: Field type and offset are now known
+ * - CHIDB_ENOTFOUND: The record has fewer than field+1 fields
+ */
+static int __DBRecordView_parseTo(DBRecordView *dbrv, uint8_t field)
+{
+    while(dbrv->nparsed <= field)
+    {
+        uint64_t type;
+
+        if(dbrv->header_pos >= dbrv->header_size || dbrv->nparsed == DBRECORD_MAX_FIELDS)
+            return CHIDB_ENOTFOUND;
+
+        dbrv->header_pos += getVarint(&dbrv->raw[dbrv->header_pos], &type);
+
+        dbrv->types[dbrv->nparsed] = type;
+        dbrv->offsets[dbrv->nparsed] = dbrv->next_offset;
+        dbrv->next_offset += __DBRecord_typeSize(type);
+        dbrv->nparsed++;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the number of fields in a record view
+ *
+ * This requires parsing the entire header (but not the data).
+ *
+ * Parameters
+ * - dbrv: The DBRecordView
+ *
+ * Return
+ * - Number of fields in the record
+ */
+int chidb_DBRecordView_getNFields(DBRecordView *dbrv)
+{
+    __DBRecordView_parseTo(dbrv, DBRECORD_MAX_FIELDS - 1);
+
+    return dbrv->nparsed;
+}
+
+
+/* Returns the type of a field in a record view
+ *
+ * Parameters
+ * - dbrv: The DBRecordView
+ * - field: Index of the field
+ *
+ * Return
+ * - SQL_NULL, SQL_INTEGER_1BYTE, SQL_INTEGER_2BYTE, SQL_INTEGER_4BYTE,
+ *   or SQL_TEXT depending on the field type.
+ * - SQL_NOTVALID if the field does not exist or has an invalid field type.
+ */
+int chidb_DBRecordView_getType(DBRecordView *dbrv, uint8_t field)
+{
+    if(__DBRecordView_parseTo(dbrv, field) != CHIDB_OK)
+        return SQL_NOTVALID;
+
+    return __DBRecord_typeClass(dbrv->types[field]);
+}
+
+
+/* Returns a pointer to the data of a field in a record view */
+static inline uint8_t *__DBRecordView_data(DBRecordView *dbrv, uint8_t field)
+{
+    return dbrv->raw + dbrv->header_size + dbrv->offsets[field];
+}
+
+
+/* Returns the value of a 1-byte integer field in a record view
+ *
+ * Parameters
+ * - dbrv: The DBRecordView
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The field does not exist
+ */
+int chidb_DBRecordView_getInt8(DBRecordView *dbrv, uint8_t field, int8_t *v)
+{
+    if(__DBRecordView_parseTo(dbrv, field) != CHIDB_OK)
+        return CHIDB_ENOTFOUND;
+
+    *v = __DBRecord_getInt(dbrv->types[field], __DBRecordView_data(dbrv, field));
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the value of a 2-byte integer field in a record view
+ *
+ * Parameters
+ * - dbrv: The DBRecordView
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The field does not exist
+ */
+int chidb_DBRecordView_getInt16(DBRecordView *dbrv, uint8_t field, int16_t *v)
+{
+    if(__DBRecordView_parseTo(dbrv, field) != CHIDB_OK)
+        return CHIDB_ENOTFOUND;
+
+    *v = __DBRecord_getInt(dbrv->types[field], __DBRecordView_data(dbrv, field));
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the value of a 4-byte integer field in a record view
+ *
+ * Parameters
+ * - dbrv: The DBRecordView
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The field does not exist
+ */
+int chidb_DBRecordView_getInt32(DBRecordView *dbrv, uint8_t field, int32_t *v)
+{
+    if(__DBRecordView_parseTo(dbrv, field) != CHIDB_OK)
+        return CHIDB_ENOTFOUND;
+
+    *v = __DBRecord_getInt(dbrv->types[field], __DBRecordView_data(dbrv, field));
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the value of an 8-byte integer field in a record view
+ *
+ * Parameters
+ * - dbrv: The DBRecordView
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The field does not exist
+ */
+int chidb_DBRecordView_getInt64(DBRecordView *dbrv, uint8_t field, int64_t *v)
+{
+    if(__DBRecordView_parseTo(dbrv, field) != CHIDB_OK)
+        return CHIDB_ENOTFOUND;
+
+    *v = __DBRecord_getInt(dbrv->types[field], __DBRecordView_data(dbrv, field));
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the value of a double field in a record view
+ *
+ * Integer fields are converted to a double.
+ *
+ * Parameters
+ * - dbrv: The DBRecordView
+ * - field: Index of the field
+ * - v: Out parameter used to return the value
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The field does not exist
+ */
+int chidb_DBRecordView_getDouble(DBRecordView *dbrv, uint8_t field, double *v)
+{
+    if(__DBRecordView_parseTo(dbrv, field) != CHIDB_OK)
+        return CHIDB_ENOTFOUND;
+
+    *v = __DBRecord_getDouble(dbrv->types[field], __DBRecordView_data(dbrv, field));
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the value of a string field in a record view
+ *
+ * The string is not copied: v points into the raw record and is
+ * *not* null-terminated, so len must be used to determine its length.
+ *
+ * Parameters
+ * - dbrv: The DBRecordView
+ * - field: Index of the field
+ * - v: Out parameter used to return a pointer to the string
+ * - len: Out parameter used to return the length of the string
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The field does not exist
+ */
+int chidb_DBRecordView_getString(DBRecordView *dbrv, uint8_t field, const uint8_t **v, int *len)
+{
+    if(__DBRecordView_parseTo(dbrv, field) != CHIDB_OK)
+        return CHIDB_ENOTFOUND;
+
+    *v = __DBRecordView_data(dbrv, field);
+    *len = __DBRecord_typeSize(dbrv->types[field]);
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the value of a BLOB field in a record view
+ *
+ * The bytes are not copied: v points into the raw record.
+ *
+ * Parameters
+ * - dbrv: The DBRecordView
+ * - field: Index of the field
+ * - v: Out parameter used to return a pointer to the bytes
+ * - len: Out parameter used to return the number of bytes
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: The field does not exist
+ */
+int chidb_DBRecordView_getBlob(DBRecordView *dbrv, uint8_t field, const uint8_t **v, int *len)
+{
+    return chidb_DBRecordView_getString(dbrv, field, v, len);
+}
+
+
 /* Creates a DBRecord based on a specification string and all the values
  * in the record.
  *
@@ -561,6 +1245,8 @@ int chidb_DBRecord_print(DBRecord *dbr)
  * - i1: A 1-byte integer
  * - i2: A 2-byte integer
  * . i4: A 4-byte integer
+ * - i8: An 8-byte integer
+ * - d: A double
  *
  * For example, "|s|0|i1|i2|i4|".
  *
@@ -615,6 +1301,9 @@ int chidb_DBRecord_create(DBRecord **dbr, const char *spec, ...)
                 i32 = va_arg(args, int);
                 chidb_DBRecord_appendInt32(&dbrb, i32);
                 break;
+            case '8':
+                chidb_DBRecord_appendInt64(&dbrb, va_arg(args, int64_t));
+                break;
             }
 
             break;
@@ -622,6 +1311,9 @@ int chidb_DBRecord_create(DBRecord **dbr, const char *spec, ...)
         case '0':
             chidb_DBRecord_appendNull(&dbrb);
             break;
+        case 'd':
+            chidb_DBRecord_appendDouble(&dbrb, va_arg(args, double));
+            break;
         case 's':
             s = va_arg(args, char *);
             chidb_DBRecord_appendString(&dbrb, s);
@@ -646,6 +1338,10 @@ int chidb_DBRecord_create(DBRecord **dbr, const char *spec, ...)
  */
 int chidb_DBRecord_destroy(DBRecord *dbr)
 {
+    /* Records in an arena are freed when the arena is reset */
+    if (dbr->arena != NULL)
+        return CHIDB_OK;
+
     free(dbr->data);
     free(dbr->types);
     free(dbr->offsets);
@@ -41,6 +41,31 @@
 #define RECORD_H_
 
 #include "chidbInt.h"
+#include "arena.h"
+
+/* Record formats. The format used to write new records is the "schema
+ * format number" in the database file header.
+ *
+ * - RECORD_FORMAT_LEGACY: The original chidb format. Integers are stored
+ *   in 1, 2 or 4 bytes, as requested by the caller, and every TEXT type
+ *   in the header takes up 4 bytes.
+ * - RECORD_FORMAT_COMPACT: Header types are stored as true varints (1-9
+ *   bytes), integers are stored in the smallest number of bytes that can
+ *   hold them (1, 2, 3 or 4), and the integers 0 and 1 take up no space
+ *   at all (they are encoded in the header type).
+ *
+ * Records in either format can be read regardless of the database's
+ * format. */
+#define RECORD_FORMAT_LEGACY (1)
+#define RECORD_FORMAT_COMPACT (4)
+
+/* Additional integer types used by the compact record format. Note that
+ * chidb_DBRecord_getType never returns these; integers are reported as
+ * the smallest of SQL_INTEGER_1BYTE/2BYTE/4BYTE/8BYTE that can hold them. */
+#define SQL_INTEGER_3BYTE (3)
+#define SQL_INTEGER_6BYTE (5)
+#define SQL_INTEGER_ZERO  (8)
+#define SQL_INTEGER_ONE   (9)
 
 struct DBRecord
 {
@@ -50,27 +75,52 @@ struct DBRecord
     uint32_t packed_len;
     uint32_t *types;
     uint32_t *offsets;
+    Arena *arena; /* Arena the record was allocated from (or NULL) */
+    uint8_t format; /* RECORD_FORMAT_* */
 };
 typedef struct DBRecord DBRecord;
 
 struct DBRecordBuffer
 {
     DBRecord *dbr;
-    uint16_t buf_size;
+    uint32_t buf_size;
     uint8_t field;
     uint32_t offset;
     uint8_t header_size;
 };
 typedef struct DBRecordBuffer DBRecordBuffer;
 
+#define DBRECORD_MAX_FIELDS (255)
+
+/* A DBRecordView is a read-only view over a raw database record. Unlike
+ * a DBRecord, it does not copy the record: it points directly into the
+ * raw record (typically a cell payload in an in-memory page), and the
+ * header is only parsed up to the last field that has been requested. */
+struct DBRecordView
+{
+    uint8_t *raw;          /* First byte of the raw record (not owned) */
+    uint8_t header_size;   /* Size of the record header (in bytes) */
+    uint8_t header_pos;    /* Position of the next unparsed header entry */
+    uint8_t nparsed;       /* Number of fields whose type and offset are known */
+    uint32_t next_offset;  /* Data offset of the first unparsed field */
+    uint32_t types[DBRECORD_MAX_FIELDS];
+    uint32_t offsets[DBRECORD_MAX_FIELDS];
+};
+typedef struct DBRecordView DBRecordView;
+
 int chidb_DBRecord_create(DBRecord **dbr, const char *, ...);
 
 int chidb_DBRecord_create_empty(DBRecordBuffer *dbrb, uint8_t nfields);
+int chidb_DBRecord_create_empty_arena(DBRecordBuffer *dbrb, uint8_t nfields, Arena *arena);
+int chidb_DBRecord_setFormat(DBRecordBuffer *dbrb, uint8_t format);
 int chidb_DBRecord_appendInt8(DBRecordBuffer *dbrb, int8_t v);
 int chidb_DBRecord_appendInt16(DBRecordBuffer *dbrb, int16_t v);
 int chidb_DBRecord_appendInt32(DBRecordBuffer *dbrb, int32_t v);
+int chidb_DBRecord_appendInt64(DBRecordBuffer *dbrb, int64_t v);
+int chidb_DBRecord_appendDouble(DBRecordBuffer *dbrb, double v);
 int chidb_DBRecord_appendNull(DBRecordBuffer *dbrb);
 int chidb_DBRecord_appendString(DBRecordBuffer *dbrb,  char *v);
+int chidb_DBRecord_appendBlob(DBRecordBuffer *dbrb, const uint8_t *v, uint32_t len);
 int chidb_DBRecord_finalize(DBRecordBuffer *dbrb, DBRecord **dbr);
 
 int chidb_DBRecord_unpack(DBRecord **dbr, uint8_t *);
@@ -81,11 +131,26 @@ int chidb_DBRecord_getType(DBRecord *dbr, uint8_t field);
 int chidb_DBRecord_getInt8(DBRecord *dbr, uint8_t field, int8_t *v);
 int chidb_DBRecord_getInt16(DBRecord *dbr, uint8_t field, int16_t *v);
 int chidb_DBRecord_getInt32(DBRecord *dbr, uint8_t field, int32_t *v);
+int chidb_DBRecord_getInt64(DBRecord *dbr, uint8_t field, int64_t *v);
+int chidb_DBRecord_getDouble(DBRecord *dbr, uint8_t field, double *v);
 int chidb_DBRecord_getString(DBRecord *dbr, uint8_t field, char **v);
 int chidb_DBRecord_getStringLength(DBRecord *dbr, uint8_t field, int *len);
+int chidb_DBRecord_getBlob(DBRecord *dbr, uint8_t field, uint8_t **v);
+int chidb_DBRecord_getBlobLength(DBRecord *dbr, uint8_t field, int *len);
 
 int chidb_DBRecord_print(DBRecord *dbr);
 
+int chidb_DBRecordView_init(DBRecordView *dbrv, uint8_t *raw);
+int chidb_DBRecordView_getNFields(DBRecordView *dbrv);
+int chidb_DBRecordView_getType(DBRecordView *dbrv, uint8_t field);
+int chidb_DBRecordView_getInt8(DBRecordView *dbrv, uint8_t field, int8_t *v);
+int chidb_DBRecordView_getInt16(DBRecordView *dbrv, uint8_t field, int16_t *v);
+int chidb_DBRecordView_getInt32(DBRecordView *dbrv, uint8_t field, int32_t *v);
+int chidb_DBRecordView_getInt64(DBRecordView *dbrv, uint8_t field, int64_t *v);
+int chidb_DBRecordView_getDouble(DBRecordView *dbrv, uint8_t field, double *v);
+int chidb_DBRecordView_getString(DBRecordView *dbrv, uint8_t field, const uint8_t **v, int *len);
+int chidb_DBRecordView_getBlob(DBRecordView *dbrv, uint8_t field, const uint8_t **v, int *len);
+
 
 int chidb_DBRecord_destroy(DBRecord *dbr);
 
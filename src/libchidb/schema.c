@@ -0,0 +1,376 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database schema
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <strings.h>
+#include <chidb/chidb.h>
+#include "schema.h"
+#include "dbm-cursor.h"
+#include "btree.h"
+
+/* The schema table is always rooted at page 1 */
+#define SCHEMA_ROOT_PAGE (1)
+
+/* Fields of a schema table record */
+#define SCHEMA_TYPE (0)
+#define SCHEMA_NAME (1)
+#define SCHEMA_TABLE_NAME (2)
+#define SCHEMA_ROOT (3)
+#define SCHEMA_SQL (4)
+
+
+/* Reads a text field of a schema record into a newly allocated string */
+static int chidb_schema_string(DBRecordView *record, uint8_t field, char **s)
+{
+    const uint8_t *v;
+    int len;
+
+    if(chidb_DBRecordView_getType(record, field) != SQL_TEXT)
+        return CHIDB_ECORRUPT;
+
+    chidb_DBRecordView_getString(record, field, &v, &len);
+    *s = strndup((const char *) v, len);
+
+    return *s == NULL ? CHIDB_ENOMEM : CHIDB_OK;
+}
+
+/* Reads an integer field of a schema record, whatever its size */
+static int chidb_schema_int(DBRecordView *record, uint8_t field, int32_t *v)
+{
+    int8_t v8;
+    int16_t v16;
+
+    switch(chidb_DBRecordView_getType(record, field))
+    {
+    case SQL_INTEGER_1BYTE:
+        chidb_DBRecordView_getInt8(record, field, &v8);
+        *v = v8;
+        break;
+    case SQL_INTEGER_2BYTE:
+        chidb_DBRecordView_getInt16(record, field, &v16);
+        *v = v16;
+        break;
+    case SQL_INTEGER_4BYTE:
+        chidb_DBRecordView_getInt32(record, field, v);
+        break;
+    default:
+        return CHIDB_ECORRUPT;
+    }
+
+    return CHIDB_OK;
+}
+
+static void chidb_schema_item_free(chidb_schema_item_t *item)
+{
+    free(item->type);
+    free(item->name);
+    free(item->table_name);
+    free(item->sql);
+    chidb_stats_free(&item->stats);
+    if(item->stmt != NULL)
+    {
+        Create_free(item->stmt->stmt.create);
+        free(item->stmt->text);
+        free(item->stmt);
+    }
+    free(item);
+}
+
+/* Creates a schema item from the record in a cursor on the schema table */
+static int chidb_schema_item_new(chidb_dbm_cursor_t *cursor, chidb_schema_item_t **item)
+{
+    DBRecordView *record;
+    int32_t root;
+    int rc;
+
+    *item = calloc(1, sizeof(chidb_schema_item_t));
+    if(*item == NULL)
+        return CHIDB_ENOMEM;
+
+    chidb_dbm_cursor_record(cursor, &record);
+
+    if((rc = chidb_schema_string(record, SCHEMA_TYPE, &(*item)->type)) != CHIDB_OK ||
+       (rc = chidb_schema_string(record, SCHEMA_NAME, &(*item)->name)) != CHIDB_OK ||
+       (rc = chidb_schema_string(record, SCHEMA_TABLE_NAME, &(*item)->table_name)) != CHIDB_OK ||
+       (rc = chidb_schema_int(record, SCHEMA_ROOT, &root)) != CHIDB_OK ||
+       (rc = chidb_schema_string(record, SCHEMA_SQL, &(*item)->sql)) != CHIDB_OK)
+    {
+        chidb_schema_item_free(*item);
+        return rc;
+    }
+    (*item)->root_page = root;
+
+    /* A schema entry we can't make sense of means the file is corrupt */
+    if(chisql_parser((*item)->sql, &(*item)->stmt) != CHIDB_OK ||
+       (*item)->stmt->type != STMT_CREATE)
+    {
+        chidb_schema_item_free(*item);
+        return CHIDB_ECORRUPT;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Load the schema of a database
+ *
+ * Reads the schema table into the database's list of schema items
+ * (along with the statistics of the tables and indexes), discarding
+ * whatever was previously loaded. The schema table is only read
+ * again if the schema cookie has changed since the last time.
+ *
+ * Parameters
+ * - db: Database
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The schema table contains an invalid entry
+ */
+int chidb_schema_load(chidb *db)
+{
+    chidb_dbm_cursor_t cursor;
+    chidb_schema_item_t *item;
+    int rc;
+
+    /* Nothing to do if the schema hasn't changed since it was loaded */
+    if(db->schema_loaded && db->schema_cookie == db->bt->schema_cookie)
+        return CHIDB_OK;
+
+    chidb_schema_free(db);
+
+    cursor.batch = NULL;
+    cursor.hash = NULL;
+    cursor.sorter = NULL;
+    cursor.agg = NULL;
+    if((rc = chidb_dbm_cursor_new(db->bt, SCHEMA_ROOT_PAGE, &cursor)) != CHIDB_OK)
+        return rc;
+
+    for(rc = chidb_dbm_cursor_rewind(db->bt, &cursor);
+        rc == CHIDB_OK;
+        rc = chidb_dbm_cursor_table_move(db->bt, &cursor, true))
+    {
+        if((rc = chidb_schema_item_new(&cursor, &item)) != CHIDB_OK)
+            break;
+        list_append(&db->schema, item);
+    }
+
+    chidb_dbm_cursor_free(db->bt, &cursor);
+
+    if(rc != CHIDB_CANTMOVE)
+        return rc;
+
+    if((rc = chidb_stats_load(db)) != CHIDB_OK)
+        return rc;
+
+    db->schema_loaded = true;
+    db->schema_cookie = db->bt->schema_cookie;
+
+    return CHIDB_OK;
+}
+
+
+/* Free the schema of a database
+ *
+ * Parameters
+ * - db: Database
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_schema_free(chidb *db)
+{
+    while(!list_empty(&db->schema))
+        chidb_schema_item_free(list_extract_at(&db->schema, 0));
+    db->schema_loaded = false;
+
+    return CHIDB_OK;
+}
+
+
+/* Find a table in the schema
+ *
+ * Parameters
+ * - db: Database
+ * - name: Name of the table (case-insensitive)
+ *
+ * Return
+ * - The table's schema item, or NULL if there is no such table
+ */
+chidb_schema_item_t *chidb_schema_table(chidb *db, const char *name)
+{
+    for(int i = 0; i < list_size(&db->schema); i++)
+    {
+        chidb_schema_item_t *item = list_get_at(&db->schema, i);
+        if(!strcmp(item->type, "table") && !strcasecmp(item->name, name))
+            return item;
+    }
+
+    return NULL;
+}
+
+
+/* Find an index on a column
+ *
+ * Parameters
+ * - db: Database
+ * - table_name: Name of the table (case-insensitive)
+ * - column_name: Name of the indexed column (case-insensitive)
+ *
+ * Return
+ * - The index's schema item, or NULL if the column is not indexed
+ */
+chidb_schema_item_t *chidb_schema_index(chidb *db, const char *table_name, const char *column_name)
+{
+    for(int i = 0; i < list_size(&db->schema); i++)
+    {
+        chidb_schema_item_t *item = list_get_at(&db->schema, i);
+        if(!strcmp(item->type, "index") &&
+           !strcasecmp(item->table_name, table_name) &&
+           !strcasecmp(item->stmt->stmt.create->index->column_name, column_name))
+            return item;
+    }
+
+    return NULL;
+}
+
+
+/* Number of columns in a table */
+int chidb_schema_ncolumns(chidb_schema_item_t *table)
+{
+    int n = 0;
+
+    for(Column_t *col = table->stmt->stmt.create->table->columns; col != NULL; col = col->next)
+        n++;
+
+    return n;
+}
+
+
+/* Find a column of a table
+ *
+ * Parameters
+ * - table: Schema item of the table
+ * - name: Name of the column (case-insensitive)
+ * - column: Out parameter for the column's definition (can be NULL)
+ *
+ * Return
+ * - The position of the column in the table, or -1 if there is
+ *   no such column
+ */
+int chidb_schema_column(chidb_schema_item_t *table, const char *name, Column_t **column)
+{
+    int i = 0;
+
+    for(Column_t *col = table->stmt->stmt.create->table->columns; col != NULL; col = col->next, i++)
+    {
+        if(!strcasecmp(col->name, name))
+        {
+            if(column != NULL)
+                *column = col;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+/* Find the INTEGER PRIMARY KEY of a table
+ *
+ * Such a column is an alias for the key of the table's B-Tree, so its
+ * value is read from the key (and stored as NULL in the record).
+ *
+ * Parameters
+ * - table: Schema item of the table
+ *
+ * Return
+ * - The position of the column in the table, or -1 if the table
+ *   has no INTEGER PRIMARY KEY
+ */
+int chidb_schema_pkey(chidb_schema_item_t *table)
+{
+    int i = 0;
+
+    for(Column_t *col = table->stmt->stmt.create->table->columns; col != NULL; col = col->next, i++)
+    {
+        if(col->type != TYPE_INT)
+            continue;
+        for(Constraint_t *cons = col->constraints; cons != NULL; cons = cons->next)
+            if(cons->t == CONS_PRIMARY_KEY)
+                return i;
+    }
+
+    return -1;
+}
+
+
+/* Number of included columns of an index (0 unless it's a covering
+ * index, created with INCLUDE) */
+int chidb_schema_nincluded(chidb_schema_item_t *index)
+{
+    int n = 0;
+
+    for(StrList_t *col = index->stmt->stmt.create->index->include; col != NULL; col = col->next)
+        n++;
+
+    return n;
+}
+
+
+/* Find an included column of an index
+ *
+ * Parameters
+ * - index: Schema item of the index
+ * - name: Name of the column (case-insensitive)
+ *
+ * Return
+ * - The position of the column in the record of included columns
+ *   stored in the index, or -1 if the index doesn't include it
+ */
+int chidb_schema_included(chidb_schema_item_t *index, const char *name)
+{
+    int i = 0;
+
+    for(StrList_t *col = index->stmt->stmt.create->index->include; col != NULL; col = col->next, i++)
+        if(!strcasecmp(col->str, name))
+            return i;
+
+    return -1;
+}
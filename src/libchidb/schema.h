@@ -0,0 +1,88 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Database schema -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef SCHEMA_H_
+#define SCHEMA_H_
+
+#include <chisql/chisql.h>
+#include "chidbInt.h"
+#include "stats.h"
+
+/* An entry of the schema table, which is stored in the table B-Tree
+ * rooted at page 1. Each entry describes a table or an index:
+ *
+ *   type        "table" or "index"
+ *   name        Name of the table or index
+ *   table_name  Table the entry belongs to (for tables, same as name)
+ *   root_page   Root page of the entry's B-Tree
+ *   sql         CREATE statement that created the table or index
+ *
+ * The CREATE statement is parsed when the schema is loaded, so the
+ * columns of a table (or the indexed and included columns of an index)
+ * can be looked up without parsing it again.
+ */
+typedef struct chidb_schema_item
+{
+    char *type;
+    char *name;
+    char *table_name;
+    npage_t root_page;
+    char *sql;
+
+    /* Parsed version of sql */
+    chisql_statement_t *stmt;
+
+    /* Statistics collected by ANALYZE (see stats.h) */
+    chidb_stats_t stats;
+} chidb_schema_item_t;
+
+int chidb_schema_load(chidb *db);
+int chidb_schema_free(chidb *db);
+
+chidb_schema_item_t *chidb_schema_table(chidb *db, const char *name);
+chidb_schema_item_t *chidb_schema_index(chidb *db, const char *table_name, const char *column_name);
+
+int chidb_schema_ncolumns(chidb_schema_item_t *table);
+int chidb_schema_column(chidb_schema_item_t *table, const char *name, Column_t **column);
+int chidb_schema_pkey(chidb_schema_item_t *table);
+int chidb_schema_nincluded(chidb_schema_item_t *index);
+int chidb_schema_included(chidb_schema_item_t *index, const char *name);
+
+#endif /* SCHEMA_H_ */
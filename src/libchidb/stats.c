@@ -0,0 +1,437 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Table statistics and cost model
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <strings.h>
+#include <chidb/chidb.h>
+#include "stats.h"
+#include "schema.h"
+#include "dbm-cursor.h"
+#include "dbm-hash.h"
+
+/* Fields of a record of the statistics table */
+#define STATS_TBL (0)
+#define STATS_IDX (1)
+#define STATS_STAT (2)
+
+
+/* Formats the statistics of a B-Tree
+ *
+ * Parameters
+ * - keys: Keys of the B-Tree, in order
+ * - n: Number of keys
+ * - stat: Out parameter. Newly allocated string with the statistics,
+ *         in the format stored in the statistics table
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_stats_format(const chidb_key_t *keys, uint32_t n, char **stat)
+{
+    uint32_t ndistinct = 0, nbuckets = n < CHIDB_STATS_BUCKETS ? n : CHIDB_STATS_BUCKETS;
+    size_t len = 0;
+
+    for(uint32_t i = 0; i < n; i++)
+        if(i == 0 || keys[i] != keys[i - 1])
+            ndistinct++;
+
+    /* Every number takes at most 10 digits and a space */
+    *stat = malloc(11 * (nbuckets + 3) + 1);
+    if(*stat == NULL)
+        return CHIDB_ENOMEM;
+
+    len += sprintf(*stat + len, "%u %u", n, ndistinct);
+    if(n > 0)
+    {
+        len += sprintf(*stat + len, " %u", keys[0]);
+        for(uint32_t i = 1; i <= nbuckets; i++)
+            len += sprintf(*stat + len, " %u", keys[(uint64_t) i * n / nbuckets - 1]);
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Parses the statistics of a B-Tree
+ *
+ * Parameters
+ * - stat: Statistics, in the format stored in the statistics table
+ * - stats: Out parameter for the statistics
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The statistics are not well-formed
+ */
+int chidb_stats_parse(const char *stat, chidb_stats_t *stats)
+{
+    unsigned int v;
+    int len;
+
+    memset(stats, 0, sizeof(chidb_stats_t));
+
+    if(sscanf(stat, "%u %u%n", &stats->nrows, &stats->ndistinct, &len) != 2)
+        return CHIDB_ECORRUPT;
+
+    for(stat += len; sscanf(stat, " %u%n", &v, &len) == 1; stat += len)
+    {
+        chidb_key_t *bounds = realloc(stats->bounds, sizeof(chidb_key_t) * (stats->nbounds + 1));
+        if(bounds == NULL)
+        {
+            chidb_stats_free(stats);
+            return CHIDB_ENOMEM;
+        }
+        stats->bounds = bounds;
+        stats->bounds[stats->nbounds++] = v;
+    }
+
+    /* The smallest key, and at least one bucket */
+    if(stats->nbounds == 1)
+    {
+        chidb_stats_free(stats);
+        return CHIDB_ECORRUPT;
+    }
+
+    stats->analyzed = true;
+    return CHIDB_OK;
+}
+
+
+void chidb_stats_free(chidb_stats_t *stats)
+{
+    free(stats->bounds);
+    memset(stats, 0, sizeof(chidb_stats_t));
+}
+
+
+/* Reads a text field of a record of the statistics table into a newly
+ * allocated string (NULL if the field is NULL) */
+static int chidb_stats_string(DBRecordView *record, uint8_t field, char **s)
+{
+    const uint8_t *v;
+    int len;
+
+    *s = NULL;
+    if(chidb_DBRecordView_getType(record, field) == SQL_NULL)
+        return CHIDB_OK;
+    if(chidb_DBRecordView_getType(record, field) != SQL_TEXT)
+        return CHIDB_ECORRUPT;
+
+    chidb_DBRecordView_getString(record, field, &v, &len);
+    *s = strndup((const char *) v, len);
+
+    return *s == NULL ? CHIDB_ENOMEM : CHIDB_OK;
+}
+
+/* Finds the schema item a row of the statistics table is about */
+static chidb_schema_item_t *chidb_stats_item(chidb *db, const char *tbl, const char *idx)
+{
+    if(idx == NULL)
+        return chidb_schema_table(db, tbl);
+
+    for(int i = 0; i < list_size(&db->schema); i++)
+    {
+        chidb_schema_item_t *item = list_get_at(&db->schema, i);
+        if(!strcmp(item->type, "index") && !strcasecmp(item->name, idx) &&
+           !strcasecmp(item->table_name, tbl))
+            return item;
+    }
+
+    return NULL;
+}
+
+
+/* Load the statistics of a database
+ *
+ * Reads the statistics table (if there is one) into the schema items
+ * of the tables and indexes that have been analyzed. Rows about tables
+ * or indexes that no longer exist are ignored.
+ *
+ * Parameters
+ * - db: Database, with its schema loaded
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECORRUPT: The statistics table contains an invalid row
+ */
+int chidb_stats_load(chidb *db)
+{
+    chidb_schema_item_t *table = chidb_schema_table(db, CHIDB_STATS_TABLE);
+    chidb_schema_item_t *item;
+    chidb_dbm_cursor_t cursor;
+    DBRecordView *record;
+    char *tbl, *idx, *stat;
+    int rc;
+
+    if(table == NULL)
+        return CHIDB_OK;
+
+    cursor.batch = NULL;
+    cursor.hash = NULL;
+    cursor.sorter = NULL;
+    cursor.agg = NULL;
+    if((rc = chidb_dbm_cursor_new(db->bt, table->root_page, &cursor)) != CHIDB_OK)
+        return rc;
+
+    for(rc = chidb_dbm_cursor_rewind(db->bt, &cursor);
+        rc == CHIDB_OK;
+        rc = chidb_dbm_cursor_table_move(db->bt, &cursor, true))
+    {
+        chidb_dbm_cursor_record(&cursor, &record);
+        tbl = idx = stat = NULL;
+
+        if((rc = chidb_stats_string(record, STATS_TBL, &tbl)) == CHIDB_OK &&
+           (rc = chidb_stats_string(record, STATS_IDX, &idx)) == CHIDB_OK &&
+           (rc = chidb_stats_string(record, STATS_STAT, &stat)) == CHIDB_OK &&
+           (tbl == NULL || stat == NULL))
+            rc = CHIDB_ECORRUPT;
+
+        /* Later rows replace earlier ones */
+        if(rc == CHIDB_OK && (item = chidb_stats_item(db, tbl, idx)) != NULL)
+        {
+            chidb_stats_free(&item->stats);
+            rc = chidb_stats_parse(stat, &item->stats);
+        }
+
+        free(tbl);
+        free(idx);
+        free(stat);
+        if(rc != CHIDB_OK)
+            break;
+    }
+
+    chidb_dbm_cursor_free(db->bt, &cursor);
+
+    return rc == CHIDB_CANTMOVE ? CHIDB_OK : rc;
+}
+
+
+/*** ESTIMATES ***/
+
+/* Number of entries in a table or index */
+double chidb_stats_rows(chidb_schema_item_t *item)
+{
+    return item->stats.analyzed ? item->stats.nrows : CHIDB_STATS_DEFAULT_ROWS;
+}
+
+/* Number of entries of a table or index with a given key */
+double chidb_stats_eq_rows(chidb_schema_item_t *item)
+{
+    if(item->stats.analyzed)
+        return item->stats.ndistinct > 0 ? (double) item->stats.nrows / item->stats.ndistinct : 0;
+
+    /* Table keys are unique */
+    return strcmp(item->type, "table") ? CHIDB_STATS_DEFAULT_EQ_ROWS : 1;
+}
+
+/* Number of distinct keys of a table or index */
+double chidb_stats_distinct(chidb_schema_item_t *item)
+{
+    if(item->stats.analyzed)
+        return item->stats.ndistinct;
+
+    return chidb_stats_rows(item) / chidb_stats_eq_rows(item);
+}
+
+/* Bytes in a record of a table: a byte in the header and the value of
+ * each column (integers are assumed to take 4 bytes) */
+double chidb_stats_record_bytes(chidb_schema_item_t *table)
+{
+    double bytes = 1;
+
+    for(Column_t *col = table->stmt->stmt.create->table->columns; col != NULL; col = col->next)
+        bytes += 1 + (col->type == TYPE_INT ? 4 : col->type == TYPE_DOUBLE ? 8 : CHIDB_STATS_DEFAULT_TEXT_BYTES);
+
+    return bytes;
+}
+
+/* Fraction of the entries of a table or index whose key k satisfies
+ * "k cmp key". Without a histogram, a range is assumed to contain a
+ * third of the entries */
+double chidb_stats_fraction(chidb_schema_item_t *item, enum CondType cmp, chidb_key_t key)
+{
+    chidb_stats_t *stats = &item->stats;
+    uint32_t nbuckets = stats->nbounds - 1;
+    double rows = chidb_stats_rows(item), eq, lt;
+    uint32_t i;
+
+    eq = rows > 0 ? chidb_stats_eq_rows(item) / rows : 0;
+    if(cmp == RA_COND_EQ)
+        return eq;
+    if(!stats->analyzed || stats->nbounds == 0)
+        return 1.0 / 3;
+
+    /* Fraction of the entries with smaller keys, assuming keys are
+     * spread evenly inside each bucket */
+    if(key <= stats->bounds[0])
+    {
+        lt = 0;
+        if(key < stats->bounds[0])
+            eq = 0;
+    }
+    else if(key > stats->bounds[nbuckets])
+    {
+        lt = 1;
+        eq = 0;
+    }
+    else
+    {
+        for(i = 1; key > stats->bounds[i]; i++)
+            ;
+        lt = (i - 1 + (double) (key - stats->bounds[i - 1]) / (stats->bounds[i] - stats->bounds[i - 1])) / nbuckets;
+        if(lt + eq > 1)
+            lt = 1 - eq;
+    }
+
+    switch(cmp)
+    {
+    case RA_COND_LT:
+        return lt;
+    case RA_COND_LEQ:
+        return lt + eq;
+    case RA_COND_GT:
+        return 1 - lt - eq;
+    case RA_COND_GEQ:
+        return 1 - lt;
+    default:
+        return 1.0 / 3;
+    }
+}
+
+
+/*** COST MODEL ***/
+
+/* Costs are the estimated number of B-Tree entries that are read. A
+ * seek reads about one entry in each level of the B-Tree */
+static double chidb_cost_seek(chidb_schema_item_t *item)
+{
+    double n = chidb_stats_rows(item) + 1, depth = 1;
+
+    for(; n >= 2; n /= 2)
+        depth++;
+
+    return depth;
+}
+
+/* Reading every row of a table */
+double chidb_cost_scan(chidb_schema_item_t *table)
+{
+    return chidb_stats_rows(table);
+}
+
+/* Looking up a row by its key */
+double chidb_cost_pk_eq(chidb_schema_item_t *table)
+{
+    return chidb_cost_seek(table);
+}
+
+/* Reading the rows with keys in a range, which holds a given fraction
+ * of the table */
+double chidb_cost_pk_range(chidb_schema_item_t *table, double fraction)
+{
+    return chidb_cost_seek(table) + fraction * chidb_stats_rows(table);
+}
+
+/* Looking up the rows with a given value in an index, and then each of
+ * those rows in the table (unless the index covers every column that is
+ * read, in which case the rows are read from the index alone) */
+double chidb_cost_index_eq(chidb_schema_item_t *table, chidb_schema_item_t *index, bool covering)
+{
+    if(covering)
+        return chidb_cost_seek(index) + chidb_stats_eq_rows(index);
+
+    return chidb_cost_seek(index) + chidb_stats_eq_rows(index) * (1 + chidb_cost_seek(table));
+}
+
+/* Reading every entry of an index, in the order of its keys, and then
+ * each of their rows from the table (unless the index covers every
+ * column that is read) */
+double chidb_cost_index_scan(chidb_schema_item_t *table, chidb_schema_item_t *index, bool covering)
+{
+    if(covering)
+        return chidb_stats_rows(index);
+
+    return chidb_stats_rows(index) * (1 + chidb_cost_seek(table));
+}
+
+/* Building a hash table of the rows of a table (for a hash join): the
+ * table is read once, and adding a row to the hash table is counted as
+ * reading one more entry */
+double chidb_cost_hash_build(chidb_schema_item_t *table)
+{
+    return 2 * chidb_cost_scan(table);
+}
+
+/* Looking up a value in a hash table that holds a given number of rows
+ * with that value */
+double chidb_cost_hash_probe(double matches)
+{
+    return 1 + matches;
+}
+
+/* Going over the memory budget of a hash table (see dbm-hash.h) that
+ * holds a given number of rows of a table, and is probed a given number
+ * of times. The rows of the partitions that don't fit in the budget are
+ * written to disk and read back, which is counted as reading each of
+ * them twice more. The probes come in no particular order, so a probe to
+ * a spilled partition is counted as reading the whole partition back */
+double chidb_cost_hash_spill(chidb_schema_item_t *table, double rows, double probes)
+{
+    /* Each row's entry, the value it's under (an integer, which takes 9
+     * bytes encoded), and its record */
+    double bytes = rows * (sizeof(chidb_dbm_hash_entry_t) + 9 + chidb_stats_record_bytes(table));
+    double spilled;
+
+    if(bytes <= DBM_HASH_BUDGET)
+        return 0;
+
+    spilled = 1 - DBM_HASH_BUDGET / bytes;
+    return 2 * spilled * rows + probes * spilled * rows / DBM_HASH_PARTITIONS;
+}
+
+/* Aggregating rows into groups in the aggregator's hash table (see
+ * dbm-agg.h): like for a hash build, adding a row is counted as reading
+ * one more entry, and so is producing each group once all the rows have
+ * been added */
+double chidb_cost_hash_agg(double rows, double groups)
+{
+    return rows + groups;
+}
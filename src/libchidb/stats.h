@@ -0,0 +1,109 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Table statistics and cost model -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <chisql/chisql.h>
+#include "chidbInt.h"
+
+/* Statistics are collected by ANALYZE, and stored in a table with a row
+ * for each table and index it has analyzed:
+ *
+ *   tbl    Name of the table
+ *   idx    Name of the index (NULL for the table itself)
+ *   stat   "nrows ndistinct min b1 b2 ... bn": the number of entries in
+ *          the B-Tree, the number of distinct keys, the smallest key, and
+ *          the largest key in each bucket of an equi-depth histogram of
+ *          the keys (each bucket holds about nrows/n entries)
+ *
+ * Rows are never removed from the table: running ANALYZE again adds new
+ * rows, and the last row for a table or index is the one that is used.
+ */
+#define CHIDB_STATS_TABLE "chidb_stat"
+#define CHIDB_STATS_SQL "CREATE TABLE chidb_stat(tbl TEXT, idx TEXT, stat TEXT)"
+
+/* Number of buckets of a histogram */
+#define CHIDB_STATS_BUCKETS (16)
+
+/* Statistics of a B-Tree. A table or index that hasn't been analyzed
+ * is assumed to have CHIDB_STATS_DEFAULT_ROWS entries, and an index to
+ * have CHIDB_STATS_DEFAULT_EQ_ROWS entries with each value. Strings are
+ * always assumed to take CHIDB_STATS_DEFAULT_TEXT_BYTES bytes */
+#define CHIDB_STATS_DEFAULT_ROWS (1000000)
+#define CHIDB_STATS_DEFAULT_EQ_ROWS (10)
+#define CHIDB_STATS_DEFAULT_TEXT_BYTES (32)
+
+typedef struct chidb_stats
+{
+    bool analyzed;
+    uint32_t nrows;
+    uint32_t ndistinct;
+    chidb_key_t *bounds;   /* Smallest key, and largest key of each bucket */
+    uint32_t nbounds;
+} chidb_stats_t;
+
+struct chidb_schema_item;
+
+int chidb_stats_load(chidb *db);
+int chidb_stats_format(const chidb_key_t *keys, uint32_t n, char **stat);
+int chidb_stats_parse(const char *stat, chidb_stats_t *stats);
+void chidb_stats_free(chidb_stats_t *stats);
+
+/* Estimates (see stats.c) */
+double chidb_stats_rows(struct chidb_schema_item *item);
+double chidb_stats_eq_rows(struct chidb_schema_item *item);
+double chidb_stats_distinct(struct chidb_schema_item *item);
+double chidb_stats_record_bytes(struct chidb_schema_item *table);
+double chidb_stats_fraction(struct chidb_schema_item *item, enum CondType cmp, chidb_key_t key);
+
+/* Cost model: estimated number of B-Tree entries read by each way of
+ * reading rows from a table */
+double chidb_cost_scan(struct chidb_schema_item *table);
+double chidb_cost_pk_eq(struct chidb_schema_item *table);
+double chidb_cost_pk_range(struct chidb_schema_item *table, double fraction);
+double chidb_cost_index_eq(struct chidb_schema_item *table, struct chidb_schema_item *index, bool covering);
+double chidb_cost_index_scan(struct chidb_schema_item *table, struct chidb_schema_item *index, bool covering);
+double chidb_cost_hash_build(struct chidb_schema_item *table);
+double chidb_cost_hash_probe(double matches);
+double chidb_cost_hash_spill(struct chidb_schema_item *table, double rows, double probes);
+double chidb_cost_hash_agg(double rows, double groups);
+
+#endif /* STATS_H_ */
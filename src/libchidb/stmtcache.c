@@ -0,0 +1,233 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Prepared statement cache
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <ctype.h>
+#include "stmtcache.h"
+#include "dbm.h"
+
+
+/* FNV-1a */
+static uint32_t chidb_stmt_cache_hash(const char *key)
+{
+    uint32_t hash = 2166136261u;
+
+    for(; *key != '\0'; key++)
+    {
+        hash ^= (uint8_t) *key;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void chidb_stmt_cache_evict(chidb_stmt_cache_t *cache, uint32_t i)
+{
+    chidb_stmt_free(cache->entries[i].stmt);
+    free(cache->entries[i].stmt);
+
+    /* The entry's key is owned by its statement */
+    cache->entries[i] = cache->entries[--cache->nEntries];
+}
+
+/* Frees every statement in the cache if they were compiled with a
+ * schema cookie other than the current one */
+static void chidb_stmt_cache_check_cookie(chidb_stmt_cache_t *cache, uint32_t cookie)
+{
+    if(cache->cookie == cookie)
+        return;
+
+    while(cache->nEntries > 0)
+        chidb_stmt_cache_evict(cache, 0);
+    cache->cookie = cookie;
+}
+
+
+/* Initialize an empty cache */
+void chidb_stmt_cache_init(chidb_stmt_cache_t *cache)
+{
+    cache->nEntries = 0;
+    cache->clock = 0;
+    cache->cookie = 0;
+}
+
+
+/* Free every statement in the cache */
+void chidb_stmt_cache_free(chidb_stmt_cache_t *cache)
+{
+    while(cache->nEntries > 0)
+        chidb_stmt_cache_evict(cache, 0);
+}
+
+
+/* Normalise a SQL statement
+ *
+ * Returns the text that statements are cached by: the statement with
+ * every run of whitespace outside quotes replaced by a single space,
+ * and without leading or trailing whitespace and semicolons. Anything
+ * else, including case, is significant (column names in the results
+ * are spelled the way they are in the statement).
+ *
+ * Parameters
+ * - sql: SQL statement
+ *
+ * Return
+ * - The normalised text (which the caller must free), or NULL if
+ *   memory could not be allocated
+ */
+char *chidb_stmt_cache_key(const char *sql)
+{
+    char *key = malloc(strlen(sql) + 1);
+    size_t n = 0;
+    char quote = '\0';
+    bool space = false;
+
+    if(key == NULL)
+        return NULL;
+
+    for(const char *p = sql; *p != '\0'; p++)
+    {
+        if(quote == '\0' && isspace((unsigned char) *p))
+        {
+            space = n > 0;
+            continue;
+        }
+
+        if(space)
+            key[n++] = ' ';
+        space = false;
+
+        if(quote != '\0' && *p == quote)
+            quote = '\0';
+        else if(quote == '\0' && (*p == '\'' || *p == '"'))
+            quote = *p;
+
+        key[n++] = *p;
+    }
+
+    while(quote == '\0' && n > 0 && (key[n - 1] == ';' || key[n - 1] == ' '))
+        n--;
+    key[n] = '\0';
+
+    return key;
+}
+
+
+/* Take a statement out of the cache
+ *
+ * Parameters
+ * - cache: Statement cache
+ * - key: Normalised SQL text of the statement
+ * - cookie: Current schema cookie
+ *
+ * Return
+ * - The cached statement, ready to run, or NULL if there isn't one.
+ *   The statement is no longer in the cache.
+ */
+chidb_stmt *chidb_stmt_cache_take(chidb_stmt_cache_t *cache, const char *key, uint32_t cookie)
+{
+    uint32_t hash = chidb_stmt_cache_hash(key);
+
+    chidb_stmt_cache_check_cookie(cache, cookie);
+
+    for(uint32_t i = 0; i < cache->nEntries; i++)
+    {
+        chidb_stmt_cache_entry_t *entry = &cache->entries[i];
+
+        if(entry->hash == hash && !strcmp(entry->key, key))
+        {
+            chidb_stmt *stmt = entry->stmt;
+
+            cache->entries[i] = cache->entries[--cache->nEntries];
+            return stmt;
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Put a statement in the cache
+ *
+ * The statement must have been reset, and its cache_key set. If the
+ * cache is full, the least recently used statement is freed.
+ *
+ * Parameters
+ * - cache: Statement cache
+ * - stmt: Statement
+ * - cookie: Current schema cookie
+ *
+ * Return
+ * - true if the cache now owns the statement, false if the statement
+ *   can't be cached (because it was compiled with an older schema, or
+ *   because the cache already has a statement with the same SQL). The
+ *   caller is then responsible for freeing it.
+ */
+bool chidb_stmt_cache_put(chidb_stmt_cache_t *cache, chidb_stmt *stmt, uint32_t cookie)
+{
+    chidb_stmt_cache_entry_t *entry;
+    uint32_t hash;
+
+    if(stmt->cache_key == NULL || stmt->cookie != cookie)
+        return false;
+
+    chidb_stmt_cache_check_cookie(cache, cookie);
+
+    hash = chidb_stmt_cache_hash(stmt->cache_key);
+    for(uint32_t i = 0; i < cache->nEntries; i++)
+        if(cache->entries[i].hash == hash && !strcmp(cache->entries[i].key, stmt->cache_key))
+            return false;
+
+    if(cache->nEntries == STMT_CACHE_SIZE)
+    {
+        uint32_t lru = 0;
+
+        for(uint32_t i = 1; i < cache->nEntries; i++)
+            if(cache->entries[i].last_used < cache->entries[lru].last_used)
+                lru = i;
+        chidb_stmt_cache_evict(cache, lru);
+    }
+
+    entry = &cache->entries[cache->nEntries++];
+    entry->key = stmt->cache_key;
+    entry->hash = hash;
+    entry->stmt = stmt;
+    entry->last_used = cache->clock++;
+
+    return true;
+}
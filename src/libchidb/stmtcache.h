@@ -0,0 +1,85 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Prepared statement cache -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef STMTCACHE_H_
+#define STMTCACHE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <chidb/chidb.h>
+
+/* Maximum number of compiled statements kept by a database connection */
+#define STMT_CACHE_SIZE (32)
+
+/* A compiled statement, and the SQL it was compiled from */
+typedef struct chidb_stmt_cache_entry
+{
+    char *key;           /* Normalised SQL text (see chidb_stmt_cache_key) */
+    uint32_t hash;       /* Hash of key */
+    chidb_stmt *stmt;
+    uint64_t last_used;  /* Value of the cache's clock when last used */
+} chidb_stmt_cache_entry_t;
+
+/* Cache of compiled statements, so that a statement that is prepared
+ * over and over again is only parsed and compiled once. The least
+ * recently used statement is evicted when the cache is full.
+ *
+ * Statements are taken out of the cache when they are prepared, and
+ * put back in it when they are finalized, so a cached statement is
+ * never in use. The cache only holds statements compiled with the
+ * current schema cookie (see chidb_Btree_incrSchemaCookie): when the
+ * cookie changes, all the cached statements are freed.
+ */
+typedef struct chidb_stmt_cache
+{
+    chidb_stmt_cache_entry_t entries[STMT_CACHE_SIZE];
+    uint32_t nEntries;
+    uint64_t clock;
+    uint32_t cookie;     /* Schema cookie the statements were compiled with */
+} chidb_stmt_cache_t;
+
+void chidb_stmt_cache_init(chidb_stmt_cache_t *cache);
+void chidb_stmt_cache_free(chidb_stmt_cache_t *cache);
+
+char *chidb_stmt_cache_key(const char *sql);
+chidb_stmt *chidb_stmt_cache_take(chidb_stmt_cache_t *cache, const char *key, uint32_t cookie);
+bool chidb_stmt_cache_put(chidb_stmt_cache_t *cache, chidb_stmt *stmt, uint32_t cookie);
+
+#endif /* STMTCACHE_H_ */
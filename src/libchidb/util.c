@@ -62,6 +62,17 @@ void put4byte(unsigned char *p, uint32_t v)
     p[3] = (uint8_t)v;
 }
 
+uint64_t get8byte(const uint8_t *p)
+{
+    return ((uint64_t) get4byte(p) << 32) | get4byte(p + 4);
+}
+
+void put8byte(unsigned char *p, uint64_t v)
+{
+    put4byte(p, (uint32_t)(v>>32));
+    put4byte(p + 4, (uint32_t)v);
+}
+
 int getVarint32(const uint8_t *p, uint32_t *v)
 {
     *v = 0;
@@ -91,6 +102,75 @@ int putVarint32(uint8_t *p, uint32_t v)
     return CHIDB_OK;
 }
 
+/*
+** Read or write a variable-length integer (1 to 9 bytes). The
+** first eight bytes hold seven bits each, with the high bit set if
+** there are more bytes, and the ninth byte (if any) holds eight bits.
+** A 4-byte varint written by putVarint32 is also a valid varint.
+* Based on SQLite code
+*/
+int getVarint(const uint8_t *p, uint64_t *v)
+{
+    uint64_t x = 0;
+
+    for(int i = 0; i < 8; i++)
+    {
+        x = (x << 7) | (p[i] & 0x7F);
+        if (!(p[i] & 0x80))
+        {
+            *v = x;
+            return i + 1;
+        }
+    }
+
+    *v = (x << 8) | p[8];
+    return 9;
+}
+
+int putVarint(uint8_t *p, uint64_t v)
+{
+    uint8_t buf[9];
+    int n;
+
+    if (v & ((uint64_t) 0xFF000000 << 32))
+    {
+        p[8] = (uint8_t) v;
+        v >>= 8;
+        for(int i = 7; i >= 0; i--)
+        {
+            p[i] = (uint8_t)((v & 0x7F) | 0x80);
+            v >>= 7;
+        }
+        return 9;
+    }
+
+    n = 0;
+    do
+    {
+        buf[n++] = (uint8_t)((v & 0x7F) | 0x80);
+        v >>= 7;
+    } while (v != 0);
+    buf[0] &= 0x7F;
+
+    for(int i = 0; i < n; i++)
+        p[i] = buf[n - 1 - i];
+
+    return n;
+}
+
+int varintLen(uint64_t v)
+{
+    int n = 1;
+
+    if (v & ((uint64_t) 0xFF000000 << 32))
+        return 9;
+
+    while (v >>= 7)
+        n++;
+
+    return n;
+}
+
 
 void chidb_BTree_recordPrinter(BTreeNode *btn, BTreeCell *btc)
 {
@@ -56,8 +56,13 @@
 
 uint32_t get4byte(const uint8_t *p);
 void put4byte(unsigned char *p, uint32_t v);
+uint64_t get8byte(const uint8_t *p);
+void put8byte(unsigned char *p, uint64_t v);
 int getVarint32(const uint8_t *p, uint32_t *v);
 int putVarint32(uint8_t *p, uint32_t v);
+int getVarint(const uint8_t *p, uint64_t *v);
+int putVarint(uint8_t *p, uint64_t v);
+int varintLen(uint64_t v);
 
 int chidb_astrcat(char **dst, char *src);
 
@@ -154,12 +154,22 @@ Index_t *Index_makeUnique(Index_t *idx)
     return idx;
 }
 
+Index_t *Index_include(Index_t *idx, StrList_t *columns)
+{
+    idx->include = columns;
+    return idx;
+}
+
 void Index_print(Index_t *idx)
 {
     printf("Index '%s' on %s (%s)", idx->column_name,
            idx->table_name,
            idx->column_name);
     if (idx->unique) printf(", unique");
+    if (idx->include) {
+        printf(", include ");
+        StrList_print(idx->include);
+    }
     puts("");
 }
 
@@ -168,6 +178,7 @@ void Index_free(Index_t *idx)
     free(idx->name);
     free(idx->column_name);
     free(idx->table_name);
+    StrList_free(idx->include);
     free(idx);
 }
 
@@ -1,7 +1,8 @@
+#include <inttypes.h>
 #include <chisql/chisql.h>
 
 
-Literal_t *litInt(int i)
+Literal_t *litInt(int64_t i)
 {
     Literal_t *lval = (Literal_t *)calloc(1, sizeof(Literal_t));
     lval->t = TYPE_INT;
@@ -33,14 +34,27 @@ Literal_t *litText(char *str)
     return lval;
 }
 
+Literal_t *litParam(int param)
+{
+    Literal_t *lval = (Literal_t *)calloc(1, sizeof(Literal_t));
+    lval->t = TYPE_INT;
+    lval->param = param;
+    return lval;
+}
+
 void Literal_print(Literal_t *val)
 {
     char buf[100];
+    if (val->param)
+    {
+        printf("?%d", val->param);
+        return;
+    }
     printf("%s ", typeToString(val->t, buf));
     switch (val->t)
     {
     case TYPE_INT:
-        printf("%d", val->val.ival);
+        printf("%" PRId64, val->val.ival);
         break;
     case TYPE_DOUBLE:
         printf("%f", val->val.dval);
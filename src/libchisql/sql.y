@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <chidb/chidb.h>
 #include <chisql/chisql.h>
 #include "sql-lexer.h"
@@ -18,11 +19,14 @@ int num_stmts = 0;
 
 chisql_statement_t *__stmt;
 
+int __param(char *name);
+
 %}
 
 %union {
 	double dval;
 	int ival;
+	int64_t i64val;
 	char *strval;
 	Literal_t *lval;
 	Constraint_t *constr;
@@ -52,17 +56,18 @@ chisql_statement_t *__stmt;
 %token VALUES AUTO_INCREMENT ASC DESC UNIQUE IN ON
 %token COUNT SUM AVG MIN MAX INTERSECT EXCEPT DISTINCT
 %token CONCAT TRUE FALSE CASE WHEN DECLARE BIT GROUP
-%token INDEX EXPLAIN
+%token INDEX EXPLAIN ANALYZE LIMIT OFFSET INCLUDE
+%token TOKEN_BEGIN COMMIT ROLLBACK TRANSACTION
 %token <strval> IDENTIFIER
 %token <strval> STRING_LITERAL
 %token <dval> DOUBLE_LITERAL
-%token <ival> INT_LITERAL
+%token <i64val> INT_LITERAL
 
 %type <ival> column_type bool_op comp_op select_combo
-%type <ival> function_name opt_distinct join opt_unique
+%type <ival> function_name opt_distinct join opt_unique transaction
 %type <strval> column_name table_name opt_alias 
-%type <strval> index_name column_name_or_star
-%type <slist> column_names_list opt_column_names
+%type <strval> index_name column_name_or_star analyze
+%type <slist> column_names_list opt_column_names opt_include
 %type <constr> opt_constraints constraints constraint
 %type <lval> literal_value values_list in_statement
 %type <fkeyref> references_stmt
@@ -74,7 +79,7 @@ chisql_statement_t *__stmt;
 %type <colref> column_reference
 %type <del> delete_from
 %type <sra> select select_statement table
-%type <opt> order_by group_by opt_options
+%type <opt> order_by group_by opt_options opt_limit
 %type <tref> table_ref
 %type <tbl> create_table
 %type <jcond> join_condition opt_join_condition
@@ -100,6 +105,8 @@ sql_line
 	| select 		{ __stmt->stmt.select = $1; __stmt->type = STMT_SELECT; }
 	| insert_into 	{ __stmt->stmt.insert = $1; __stmt->type = STMT_INSERT; }
 	| delete_from 	{ __stmt->stmt.delete = $1; __stmt->type = STMT_DELETE; }
+	| analyze 		{ __stmt->stmt.analyze = $1; __stmt->type = STMT_ANALYZE; }
+	| transaction 	{ __stmt->type = $1; }
 	| /* empty */
 	;
 
@@ -109,13 +116,19 @@ create
 	;
 
 create_index
-        : CREATE opt_unique INDEX index_name ON table_name '(' column_name ')'
+        : CREATE opt_unique INDEX index_name ON table_name '(' column_name ')' opt_include
 		{ 
 			$$ = Index_make($4, $6, $8); 
 		  	if ($2 == UNIQUE) $$ = Index_makeUnique($$); 
+			if ($10 != NULL) $$ = Index_include($$, $10);
 		}
 	;
 
+opt_include
+	: INCLUDE '(' column_names_list ')' { $$ = $3; }
+	| /* empty */ { $$ = NULL; }
+	;
+
 opt_unique
 	: UNIQUE { $$ = UNIQUE; }
 	| /* empty */ { $$ = 0; }
@@ -228,7 +241,7 @@ select_combo
 	;
 
 select_statement
-	: SELECT opt_distinct expression_list FROM table opt_where_condition opt_options
+	: SELECT opt_distinct expression_list FROM table opt_where_condition opt_options opt_limit
 		{
 			if ($6 != NULL) 
 				$$ = SRAProject(SRASelect($5, $6), $3);
@@ -236,6 +249,8 @@ select_statement
 				$$ = SRAProject($5, $3);
 			if ($7 != NULL)
 				$$ = SRA_applyOption($$, $7); 
+			if ($8 != NULL)
+				$$ = SRA_applyOption($$, $8);
 			if ($2 == DISTINCT)
 				$$ = SRA_makeDistinct($$);
 		}
@@ -255,6 +270,12 @@ opt_options
 	| /* empty */ { $$ = NULL; }
 	;
 
+opt_limit
+	: LIMIT INT_LITERAL { $$ = Limit_make($2, 0); }
+	| LIMIT INT_LITERAL OFFSET INT_LITERAL { $$ = Limit_make($2, $4); }
+	| /* empty */ { $$ = NULL; }
+	;
+
 opt_where_condition
 	: where_condition {$$ = $1;}
 	| /* empty */		{$$ = NULL;}
@@ -289,8 +310,8 @@ bool_term
    		$$ = ($2 == '=') ? Eq($1, $3) :
    			  ($2 == '>') ? Gt($1, $3) :
    			  ($2 == '<') ? Lt($1, $3) :
-   			  ($2 == GEQ) ? Leq($1, $3) :
-   			  ($2 == LEQ) ? Geq($1, $3) :
+   			  ($2 == GEQ) ? Geq($1, $3) :
+   			  ($2 == LEQ) ? Leq($1, $3) :
    			  Not(Eq($1, $3));
    	}
    | expression in_statement { $$ = In($1, $2); }
@@ -475,6 +496,24 @@ literal_value
 			else
 				$$ = litText($1);
 		}
+	| '?' { $$ = litParam(__param(NULL)); }
+	| ':' IDENTIFIER { $$ = litParam(__param($2)); }
+	;
+
+analyze
+	: ANALYZE { $$ = NULL; }
+	| ANALYZE table_name { $$ = $2; }
+	;
+
+transaction
+	: TOKEN_BEGIN opt_transaction { $$ = STMT_BEGIN; }
+	| COMMIT opt_transaction { $$ = STMT_COMMIT; }
+	| ROLLBACK opt_transaction { $$ = STMT_ROLLBACK; }
+	;
+
+opt_transaction
+	: TRANSACTION
+	| /* empty */
 	;
 
 delete_from
@@ -506,12 +545,40 @@ int chisql_stmt_print(chisql_statement_t *stmt)
     case STMT_DELETE:
         Delete_print(stmt->stmt.delete);
         break;
+    case STMT_ANALYZE:
+        printf("Analyze(%s)\n", stmt->stmt.analyze != NULL ? stmt->stmt.analyze : "");
+        break;
+    case STMT_BEGIN:
+        printf("Begin\n");
+        break;
+    case STMT_COMMIT:
+        printf("Commit\n");
+        break;
+    case STMT_ROLLBACK:
+        printf("Rollback\n");
+        break;
     }
 
     return 0;
 }
 
 
+/* Returns the number of a parameter. Every "?" is a new parameter, but
+ * a ":name" that was already used refers to the same parameter. */
+int __param(char *name)
+{
+  if (name != NULL)
+    for (int i = 0; i < __stmt->nParams; i++)
+      if (__stmt->params[i] != NULL && !strcmp(__stmt->params[i], name)) {
+        free(name);
+        return i + 1;
+      }
+
+  __stmt->params = realloc(__stmt->params, sizeof(char *) * (__stmt->nParams + 1));
+  __stmt->params[__stmt->nParams++] = name;
+  return __stmt->nParams;
+}
+
 char *__sql_semicolon(const char *sql)
 {
   int len = strlen(sql);
@@ -524,11 +591,16 @@ char *__sql_semicolon(const char *sql)
   return t;
 }
 
+/* The parser keeps its state in global variables, so statements
+ * are parsed one at a time */
+static pthread_mutex_t parser_lock = PTHREAD_MUTEX_INITIALIZER;
+
 int chisql_parser(const char *sql, chisql_statement_t **stmt)
 {
   int rc;
-  
-  __stmt = malloc(sizeof(chisql_statement_t));
+
+  pthread_mutex_lock(&parser_lock);
+  __stmt = calloc(1, sizeof(chisql_statement_t));
   char *tsql = __sql_semicolon(sql);
     
   YY_BUFFER_STATE my_string_buffer = yy_scan_string (tsql);
@@ -538,10 +610,15 @@ int chisql_parser(const char *sql, chisql_statement_t **stmt)
   if (rc == 0) {
     __stmt->text = tsql; /* strdup(sql); */
     *stmt = __stmt;
+    pthread_mutex_unlock(&parser_lock);
     return CHIDB_OK;
   } else {
     fprintf(stderr,"invalid sql: \"%s\"\n", tsql);
+    for (int i = 0; i < __stmt->nParams; i++)
+      free(__stmt->params[i]);
+    free(__stmt->params);
     free(__stmt);
+    pthread_mutex_unlock(&parser_lock);
     return CHIDB_EINVALIDSQL;
   }
 
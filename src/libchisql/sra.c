@@ -17,6 +17,7 @@ SRA_t *SRAProject(SRA_t *sra, Expression_t *expr)
     new_sra->t = SRA_PROJECT;
     new_sra->project.sra = sra;
     new_sra->project.expr_list = expr;
+    new_sra->project.limit = -1;
     return new_sra;
 }
 
@@ -122,7 +123,8 @@ void SRA_print(SRA_t *sra)
         SRA_print(sra->project.sra);
         if (sra->project.distinct ||
                 sra->project.group_by ||
-                sra->project.order_by)
+                sra->project.order_by ||
+                sra->project.limit >= 0)
         {
             printf(",\n");
             indent_print("Options: ");
@@ -140,6 +142,14 @@ void SRA_print(SRA_t *sra)
                 Expression_print(sra->project.order_by);
                 printf(sra->project.asc_desc == ORDER_BY_ASC ? " a" : " de");
                 printf("scending");
+                if (sra->project.limit >= 0)
+                    printf(" ");
+            }
+            if (sra->project.limit >= 0)
+            {
+                printf("Limit %d", sra->project.limit);
+                if (sra->project.offset > 0)
+                    printf(" Offset %d", sra->project.offset);
             }
         }
         downInd();
@@ -173,7 +183,7 @@ void SRA_print(SRA_t *sra)
         indent_print(")");
         break;
     case SRA_JOIN:
-        indent_print("Join(");
+        indent_print(sra->join.hash ? "HashJoin(" : "Join(");
         upInd();
         SRA_print(sra->binary.sra1);
         printf(", \n");
@@ -257,6 +267,11 @@ SRA_t *SRA_applyOption(SRA_t *sra, ProjectOption_t *option)
         {
             sra->project.group_by = option->group_by;
         }
+        if (option->limit >= 0)
+        {
+            sra->project.limit = option->limit;
+            sra->project.offset = option->offset;
+        }
     }
     return sra;
 }
@@ -275,6 +290,7 @@ ProjectOption_t *OrderBy_make(Expression_t *expr, enum OrderBy asc_desc)
     ProjectOption_t *ob = (ProjectOption_t *)calloc(1, sizeof(ProjectOption_t));
     ob->asc_desc = asc_desc;
     ob->order_by = expr;
+    ob->limit = -1;
     return ob;
 }
 
@@ -282,9 +298,18 @@ ProjectOption_t *GroupBy_make(Expression_t *expr)
 {
     ProjectOption_t *gb = (ProjectOption_t *)calloc(1, sizeof(ProjectOption_t));
     gb->group_by = expr;
+    gb->limit = -1;
     return gb;
 }
 
+ProjectOption_t *Limit_make(int limit, int offset)
+{
+    ProjectOption_t *lo = (ProjectOption_t *)calloc(1, sizeof(ProjectOption_t));
+    lo->limit = limit;
+    lo->offset = offset;
+    return lo;
+}
+
 ProjectOption_t *ProjectOption_combine(ProjectOption_t *op1,
                                        ProjectOption_t *op2)
 {
@@ -356,7 +381,11 @@ void ProjectOption_print(ProjectOption_t *op)
         printf("Group by: (%p) ", op->group_by);
         Expression_print(op->group_by);
     }
-    if (!op->order_by && !op->group_by)
+    if (op->limit >= 0)
+    {
+        printf("Limit: %d offset %d", op->limit, op->offset);
+    }
+    if (!op->order_by && !op->group_by && op->limit < 0)
     {
         printf("Empty ProjectOption\n");
     }
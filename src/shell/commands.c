@@ -150,6 +150,38 @@ int chidb_shell_handle_sql(chidb_shell_ctx_t *ctx, const char *sql)
                     else if (ctx->mode == MODE_COLUMN)
                         printf("%10i", chidb_column_int(stmt,i));
                 }
+                else if(coltype == SQL_INTEGER_8BYTE)
+                {
+                    if(ctx->mode == MODE_LIST)
+                        printf("%lli", (long long) chidb_column_int64(stmt,i));
+                    else if (ctx->mode == MODE_COLUMN)
+                        printf("%10lli", (long long) chidb_column_int64(stmt,i));
+                }
+                else if(coltype == SQL_DOUBLE)
+                {
+                    if(ctx->mode == MODE_LIST)
+                        printf("%g", chidb_column_double(stmt,i));
+                    else if (ctx->mode == MODE_COLUMN)
+                        printf("%10g", chidb_column_double(stmt,i));
+                }
+                else if(coltype >= SQL_BLOB && (coltype - SQL_BLOB) % 2 == 0)
+                {
+                    int nbytes = chidb_column_bytes(stmt,i);
+                    const uint8_t *blob = chidb_column_blob(stmt,i);
+                    char *hex = malloc(2 * nbytes + 4);
+
+                    /* BLOBs are shown as hex literals: x'0123abcd' */
+                    sprintf(hex, "x'");
+                    for(int j = 0; j < nbytes; j++)
+                        sprintf(hex + 2 + 2 * j, "%02x", blob[j]);
+                    strcat(hex, "'");
+
+                    if(ctx->mode == MODE_LIST)
+                        printf("%s", hex);
+                    else if (ctx->mode == MODE_COLUMN)
+                        printf("%-10.10s", hex);
+                    free(hex);
+                }
                 else if(coltype == SQL_NULL)
                 {
                     /* Print nothing */
@@ -0,0 +1,913 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <check.h>
+#include <chidb/chidb.h>
+#include "check_common.h"
+#include "libchidb/btree.h"
+#include "libchidb/pager.h"
+#include "libchidb/record.h"
+#include "libchidb/util.h"
+
+
+/* Runs a SQL statement that doesn't return any rows */
+static void exec_sql(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+
+    ck_assert_int_eq(chidb_prepare(db, sql, &stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    ck_assert_int_eq(chidb_finalize(stmt), CHIDB_OK);
+}
+
+/* Returns the record format in the header of a database file */
+static uint32_t file_record_format(const char *fname)
+{
+    uint8_t header[100];
+    FILE *f = fopen(fname, "r");
+
+    ck_assert(f != NULL);
+    ck_assert_int_eq(fread(header, 1, sizeof(header), f), sizeof(header));
+    fclose(f);
+
+    return get4byte(&header[HEADER_FORMAT]);
+}
+
+/* Checks that the rows (k, v, s) of table t are the ones in keys, vals
+ * and strs */
+static void check_rows(chidb *db, int n, int *keys, int *vals, const char **strs)
+{
+    chidb_stmt *stmt;
+
+    ck_assert_int_eq(chidb_prepare(db, "SELECT k, v, s FROM t;", &stmt), CHIDB_OK);
+    for(int i = 0; i < n; i++)
+    {
+        ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), keys[i]);
+        ck_assert_int_eq(chidb_column_int(stmt, 1), vals[i]);
+        ck_assert_str_eq(chidb_column_text(stmt, 2), strs[i]);
+    }
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+}
+
+
+#define MAX_EXPLAIN_OPS (100)
+
+/* An instruction, as returned by EXPLAIN */
+typedef struct
+{
+    char opcode[32];
+    int p1, p2, p3;
+} explain_op_t;
+
+/* Gets the program of a statement. Returns its number of instructions */
+static int explain(chidb *db, const char *sql, explain_op_t *ops)
+{
+    chidb_stmt *stmt;
+    int n = 0;
+    char *explain = malloc(strlen(sql) + 9);
+
+    sprintf(explain, "EXPLAIN %s", sql);
+    ck_assert_int_eq(chidb_prepare(db, explain, &stmt), CHIDB_OK);
+    while(chidb_step(stmt) == CHIDB_ROW)
+    {
+        ck_assert(n < MAX_EXPLAIN_OPS);
+        strncpy(ops[n].opcode, chidb_column_text(stmt, 1), sizeof(ops[n].opcode) - 1);
+        ops[n].opcode[sizeof(ops[n].opcode) - 1] = '\0';
+        ops[n].p1 = chidb_column_int(stmt, 2);
+        ops[n].p2 = chidb_column_int(stmt, 3);
+        ops[n].p3 = chidb_column_int(stmt, 4);
+        n++;
+    }
+    chidb_finalize(stmt);
+    free(explain);
+
+    return n;
+}
+
+/* Returns the address of the first instruction with a given opcode and
+ * p1 (any p1, if p1 is -1), or -1 if there isn't one */
+static int find_op(explain_op_t *ops, int n, const char *opcode, int p1)
+{
+    for(int i = 0; i < n; i++)
+        if(!strcmp(ops[i].opcode, opcode) && (p1 == -1 || ops[i].p1 == p1))
+            return i;
+
+    return -1;
+}
+
+/* Returns whether the program of a statement has a given instruction */
+static bool program_has(chidb *db, const char *sql, const char *opcode)
+{
+    explain_op_t ops[MAX_EXPLAIN_OPS];
+    int n = explain(db, sql, ops);
+
+    return find_op(ops, n, opcode, -1) != -1;
+}
+
+/* Returns the cursor that a program opens on the B-Tree with a given
+ * root page, or -1 if there isn't one */
+static int table_cursor(explain_op_t *ops, int n, int root)
+{
+    for(int i = 0; i < n; i++)
+        if(!strcmp(ops[i].opcode, "Integer") && ops[i].p1 == root)
+            for(int j = i + 1; j < n; j++)
+                if(!strcmp(ops[j].opcode, "OpenRead") && ops[j].p2 == ops[i].p2)
+                    return ops[j].p1;
+
+    return -1;
+}
+
+/* Returns the address of the first instruction that reads a column
+ * from a cursor, or -1 if no instruction reads it */
+static int column_read(explain_op_t *ops, int n, int cursor, int column)
+{
+    for(int i = 0; i < n; i++)
+        if((!strcmp(ops[i].opcode, "Column") || !strcmp(ops[i].opcode, "ColumnCmpInt")) &&
+           ops[i].p1 == cursor && ops[i].p2 == column)
+            return i;
+
+    return -1;
+}
+
+/* Creates table t, with rows (k, k * 10, "s<k>") for k = 1..n */
+static void create_t(chidb *db, int n)
+{
+    char sql[100];
+
+    exec_sql(db, "CREATE TABLE t(k INTEGER PRIMARY KEY, v INTEGER, s TEXT);");
+    for(int k = 1; k <= n; k++)
+    {
+        sprintf(sql, "INSERT INTO t VALUES(%d, %d, 's%d');", k, k * 10, k);
+        exec_sql(db, sql);
+    }
+}
+
+
+/* Creates a table f with 300 rows, each of which refers (in column d)
+ * to one of the 5 rows of a table dim. In an empty file, their root
+ * pages are 2 and 3 */
+static void create_star(chidb *db)
+{
+    chidb_stmt *stmt;
+    char name[10];
+
+    exec_sql(db, "CREATE TABLE f(id INTEGER PRIMARY KEY, d INTEGER, x INTEGER, pad TEXT);");
+    exec_sql(db, "CREATE TABLE dim(id INTEGER PRIMARY KEY, name TEXT);");
+
+    ck_assert_int_eq(chidb_prepare(db, "INSERT INTO dim VALUES(?, ?);", &stmt), CHIDB_OK);
+    for(int i = 1; i <= 5; i++)
+    {
+        sprintf(name, "d%d", i);
+        chidb_bind_int(stmt, 1, i);
+        chidb_bind_text(stmt, 2, name);
+        ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+        chidb_reset(stmt);
+    }
+    chidb_finalize(stmt);
+
+    ck_assert_int_eq(chidb_prepare(db, "INSERT INTO f VALUES(?, ?, ?, 'pad');", &stmt), CHIDB_OK);
+    for(int i = 1; i <= 300; i++)
+    {
+        chidb_bind_int(stmt, 1, i);
+        chidb_bind_int(stmt, 2, i % 5 + 1);
+        chidb_bind_int(stmt, 3, i * 7);
+        ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+        chidb_reset(stmt);
+    }
+    chidb_finalize(stmt);
+}
+
+
+START_TEST (test_open_compact)
+{
+    chidb *db;
+    char *fname = create_tmp_file();
+    int keys[] = {1, 2, 3, 4};
+    int vals[] = {0, 1, 300, 2000000000};
+    const char *strs[] = {"a", "bb", "ccc", "dddd"};
+
+    ck_assert_int_eq(chidb_open_v2(fname, &db, CHIDB_OPEN_COMPACT), CHIDB_OK);
+    exec_sql(db, "CREATE TABLE t(k INTEGER PRIMARY KEY, v INTEGER, s TEXT);");
+    exec_sql(db, "INSERT INTO t VALUES(1, 0, 'a');");
+    exec_sql(db, "INSERT INTO t VALUES(2, 1, 'bb');");
+    exec_sql(db, "INSERT INTO t VALUES(3, 300, 'ccc');");
+    exec_sql(db, "INSERT INTO t VALUES(4, 2000000000, 'dddd');");
+    chidb_close(db);
+
+    ck_assert_int_eq(file_record_format(fname), RECORD_FORMAT_COMPACT);
+
+    /* The file keeps its format when it is opened without the flag */
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    check_rows(db, 4, keys, vals, strs);
+    chidb_close(db);
+
+    ck_assert_int_eq(file_record_format(fname), RECORD_FORMAT_COMPACT);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_open_compact_existing)
+{
+    chidb *db;
+    char *fname = create_tmp_file();
+    int keys[] = {1, 2};
+    int vals[] = {70000, 7};
+    const char *strs[] = {"legacy", "compact"};
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    exec_sql(db, "CREATE TABLE t(k INTEGER PRIMARY KEY, v INTEGER, s TEXT);");
+    exec_sql(db, "INSERT INTO t VALUES(1, 70000, 'legacy');");
+    chidb_close(db);
+
+    ck_assert_int_eq(file_record_format(fname), RECORD_FORMAT_LEGACY);
+
+    /* Records written before the format changed can still be read */
+    ck_assert_int_eq(chidb_open_v2(fname, &db, CHIDB_OPEN_COMPACT), CHIDB_OK);
+    exec_sql(db, "INSERT INTO t VALUES(2, 7, 'compact');");
+    chidb_close(db);
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    check_rows(db, 2, keys, vals, strs);
+    chidb_close(db);
+
+    ck_assert_int_eq(file_record_format(fname), RECORD_FORMAT_COMPACT);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_cache_reuse)
+{
+    chidb *db;
+    chidb_stmt *stmt, *cached;
+    char *fname = create_tmp_file();
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    create_t(db, 3);
+
+    ck_assert_int_eq(chidb_prepare(db, "SELECT s FROM t WHERE v = 20;", &stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), "s2");
+
+    /* A statement that is reset runs again from the start */
+    ck_assert_int_eq(chidb_reset(stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), "s2");
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+    cached = stmt;
+
+    /* The same SQL (up to whitespace) gets the finalized statement back,
+     * and other SQL doesn't */
+    ck_assert_int_eq(chidb_prepare(db, "SELECT s FROM t WHERE v = 30;", &stmt), CHIDB_OK);
+    ck_assert(stmt != cached);
+    chidb_finalize(stmt);
+    ck_assert_int_eq(chidb_prepare(db, "  SELECT s  FROM t\n WHERE v = 20", &stmt), CHIDB_OK);
+    ck_assert(stmt == cached);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), "s2");
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_cache_schema_change)
+{
+    chidb *db, *db2;
+    chidb_stmt *stmt;
+    char *fname = create_tmp_file();
+    const char *sql = "SELECT k FROM t WHERE v = 20;";
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    create_t(db, 3);
+    ck_assert(!program_has(db, sql, "IdxPKey"));
+
+    /* Once there is an index, the statement is compiled again to use it */
+    exec_sql(db, "CREATE INDEX idx ON t(v);");
+    ck_assert(program_has(db, sql, "IdxPKey"));
+    chidb_close(db);
+
+    /* Same, but the schema is changed by another connection */
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    exec_sql(db, "CREATE TABLE u(k INTEGER PRIMARY KEY, v INTEGER);");
+    exec_sql(db, "INSERT INTO u VALUES(1, 20);");
+    ck_assert(!program_has(db, "SELECT k FROM u WHERE v = 20;", "IdxPKey"));
+
+    ck_assert_int_eq(chidb_open(fname, &db2), CHIDB_OK);
+    exec_sql(db2, "CREATE INDEX idxu ON u(v);");
+    chidb_close(db2);
+
+    ck_assert(program_has(db, "SELECT k FROM u WHERE v = 20;", "IdxPKey"));
+    ck_assert_int_eq(chidb_prepare(db, "SELECT k FROM u WHERE v = 20;", &stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 0), 1);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_stmt_schema_change)
+{
+    chidb *db;
+    chidb_stmt *stmt, *query;
+    char *fname = create_tmp_file();
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    create_t(db, 3);
+
+    ck_assert_int_eq(chidb_prepare(db, "INSERT INTO t VALUES(?, ?, 'new');", &stmt), CHIDB_OK);
+    chidb_bind_int(stmt, 1, 4);
+    chidb_bind_int(stmt, 2, 40);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+
+    /* A statement that is held on to while the schema changes is
+     * compiled again when it runs, so the INSERT updates the index */
+    exec_sql(db, "CREATE INDEX idx ON t(v);");
+    ck_assert_int_eq(chidb_reset(stmt), CHIDB_OK);
+    chidb_bind_int(stmt, 1, 5);
+    chidb_bind_int(stmt, 2, 50);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    ck_assert(program_has(db, "SELECT k FROM t WHERE v = 50;", "IdxPKey"));
+    ck_assert_int_eq(chidb_prepare(db, "SELECT k FROM t WHERE v = 50;", &query), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(query), CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(query, 0), 5);
+    ck_assert_int_eq(chidb_step(query), CHIDB_DONE);
+    chidb_finalize(query);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_bind_positional)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char *fname = create_tmp_file();
+    char s[] = "s4";
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    create_t(db, 5);
+
+    ck_assert_int_eq(chidb_prepare(db, "SELECT s FROM t WHERE v = ?;", &stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_bind_parameter_count(stmt), 1);
+    ck_assert_int_eq(chidb_bind_int(stmt, 0, 30), CHIDB_EMISUSE);
+    ck_assert_int_eq(chidb_bind_int(stmt, 2, 30), CHIDB_EMISUSE);
+    ck_assert_int_eq(chidb_bind_int(stmt, 1, 30), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), "s3");
+
+    /* Values can't be bound while the statement is running */
+    ck_assert_int_eq(chidb_bind_int(stmt, 1, 50), CHIDB_EMISUSE);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+
+    ck_assert_int_eq(chidb_reset(stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_bind_int(stmt, 1, 50), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), "s5");
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    /* Bound strings are copied, and are kept when the statement is reset */
+    ck_assert_int_eq(chidb_prepare(db, "SELECT k FROM t WHERE s = ?;", &stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_bind_text(stmt, 1, s), CHIDB_OK);
+    s[1] = '1';
+    for(int i = 0; i < 2; i++)
+    {
+        ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), 4);
+        ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+        ck_assert_int_eq(chidb_reset(stmt), CHIDB_OK);
+    }
+    chidb_finalize(stmt);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_bind_types)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char *fname = create_tmp_file();
+    uint8_t blob[] = {0, 1, 2, 0xff};
+    int64_t ms = INT64_C(1700000000123);
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    exec_sql(db, "CREATE TABLE e(k INTEGER PRIMARY KEY, t INTEGER, d DOUBLE, b TEXT);");
+
+    /* Bound BLOBs are copied */
+    ck_assert_int_eq(chidb_prepare(db, "INSERT INTO e VALUES(1, ?, ?, ?);", &stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_bind_int64(stmt, 1, ms), CHIDB_OK);
+    ck_assert_int_eq(chidb_bind_double(stmt, 2, 0.5), CHIDB_OK);
+    ck_assert_int_eq(chidb_bind_blob(stmt, 3, blob, sizeof(blob)), CHIDB_OK);
+    blob[0] = 7;
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+    blob[0] = 0;
+
+    ck_assert_int_eq(chidb_prepare(db, "SELECT t, d, b FROM e WHERE t = ?;", &stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_bind_int64(stmt, 1, ms), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert(chidb_column_int64(stmt, 0) == ms);
+    ck_assert(chidb_column_double(stmt, 1) == 0.5);
+    ck_assert_int_eq(chidb_column_bytes(stmt, 2), sizeof(blob));
+    ck_assert(!memcmp(chidb_column_blob(stmt, 2), blob, sizeof(blob)));
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_bind_named)
+{
+    chidb *db;
+    chidb_stmt *stmt, *cached;
+    char *fname = create_tmp_file();
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    create_t(db, 5);
+
+    /* Every :k is the same parameter */
+    ck_assert_int_eq(chidb_prepare(db, "INSERT INTO t VALUES(:k, :k, :s);", &stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_bind_parameter_count(stmt), 2);
+    ck_assert_int_eq(chidb_bind_parameter_index(stmt, ":k"), 1);
+    ck_assert_int_eq(chidb_bind_parameter_index(stmt, "s"), 2);
+    ck_assert_int_eq(chidb_bind_parameter_index(stmt, ":v"), 0);
+    ck_assert_int_eq(chidb_bind_int(stmt, 1, 6), CHIDB_OK);
+    ck_assert_int_eq(chidb_bind_text(stmt, 2, "six"), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    ck_assert_int_eq(chidb_reset(stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_bind_int(stmt, 1, 7), CHIDB_OK);
+    ck_assert_int_eq(chidb_bind_text(stmt, 2, "seven"), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+    cached = stmt;
+
+    /* A statement prepared again doesn't keep the values bound to it */
+    ck_assert_int_eq(chidb_prepare(db, "INSERT INTO t VALUES(:k, :k, :s);", &stmt), CHIDB_OK);
+    ck_assert(stmt == cached);
+    ck_assert_int_eq(chidb_bind_int(stmt, 1, 8), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    ck_assert_int_eq(chidb_prepare(db, "SELECT k, v, s FROM t WHERE k > 5;", &stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 1), 6);
+    ck_assert_str_eq(chidb_column_text(stmt, 2), "six");
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 1), 7);
+    ck_assert_str_eq(chidb_column_text(stmt, 2), "seven");
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_int(stmt, 1), 8);
+    ck_assert_int_eq(chidb_column_type(stmt, 2), SQL_NULL);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_analyze)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char *fname = create_tmp_file();
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    create_star(db);
+    exec_sql(db, "ANALYZE;");
+
+    ck_assert_int_eq(chidb_prepare(db, "SELECT * FROM chidb_stat;", &stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), "f");
+    ck_assert_int_eq(chidb_column_type(stmt, 1), SQL_NULL);
+    /* The row count and the number of distinct keys come first */
+    ck_assert(!strncmp(chidb_column_text(stmt, 2), "300 300 ", 8));
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), "dim");
+    ck_assert(!strncmp(chidb_column_text(stmt, 2), "5 5 ", 4));
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_join_order)
+{
+    chidb *db;
+    explain_op_t ops[MAX_EXPLAIN_OPS];
+    char *fname = create_tmp_file();
+    const char *sql[] = {"SELECT f.x FROM f, dim WHERE f.d = dim.id AND dim.name = 'd3';",
+                         "SELECT f.x FROM dim, f WHERE f.d = dim.id AND dim.name = 'd3';"};
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    create_star(db);
+    exec_sql(db, "ANALYZE;");
+
+    /* Whichever order the tables are written in, the outer loop reads
+     * dim, which the condition on its name leaves one row of */
+    for(int i = 0; i < 2; i++)
+    {
+        int n = explain(db, sql[i], ops);
+        int f = table_cursor(ops, n, 2), dim = table_cursor(ops, n, 3);
+
+        ck_assert(f != -1);
+        ck_assert(dim != -1);
+        ck_assert(find_op(ops, n, "Rewind", dim) != -1);
+        ck_assert(find_op(ops, n, "Rewind", dim) < find_op(ops, n, "Rewind", f));
+    }
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_pushdown_pruning)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    explain_op_t ops[MAX_EXPLAIN_OPS];
+    char *fname = create_tmp_file();
+    const char *sql = "SELECT f.x FROM f, dim WHERE f.d = dim.id AND dim.name = 'd3' AND f.x < 100;";
+    int n, f, dim;
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    create_star(db);
+    exec_sql(db, "ANALYZE;");
+
+    n = explain(db, sql, ops);
+    f = table_cursor(ops, n, 2);
+    dim = table_cursor(ops, n, 3);
+
+    /* The condition on dim is tested before f is read, and the one on f
+     * alone before the join condition */
+    ck_assert(column_read(ops, n, dim, 1) != -1);
+    ck_assert(column_read(ops, n, dim, 1) < find_op(ops, n, "Rewind", f));
+    ck_assert(column_read(ops, n, f, 2) != -1);
+    ck_assert(column_read(ops, n, f, 2) < column_read(ops, n, f, 1));
+
+    /* Columns the statement doesn't use are never read */
+    ck_assert_int_eq(column_read(ops, n, f, 3), -1);
+
+    ck_assert_int_eq(chidb_prepare(db, sql, &stmt), CHIDB_OK);
+    for(int x = 14; x < 100; x += 35)
+    {
+        ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), x);
+    }
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_group_by_index)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char *fname = create_tmp_file();
+    const char *sql = "SELECT v, COUNT(*) FROM t GROUP BY v;";
+    int vals[] = {10, 20, 30, 40, 50, -60};
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    create_t(db, 5);
+    exec_sql(db, "INSERT INTO t VALUES(6, -60, 's6');");
+    exec_sql(db, "INSERT INTO t(k, s) VALUES(7, 's7');");
+    exec_sql(db, "INSERT INTO t(k, s) VALUES(8, 's8');");
+    exec_sql(db, "CREATE INDEX idx ON t(v);");
+
+    /* The index covers the statement, so it is walked instead of
+     * aggregating the rows in a hash table, and each group is produced
+     * as soon as the next one starts: the negative value after the
+     * others, and then the rows with a NULL, read from the table */
+    ck_assert(program_has(db, sql, "AggBreak"));
+    ck_assert_int_eq(chidb_prepare(db, sql, &stmt), CHIDB_OK);
+    for(int i = 0; i < 6; i++)
+    {
+        ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), vals[i]);
+        ck_assert_int_eq(chidb_column_int(stmt, 1), 1);
+    }
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_int_eq(chidb_column_type(stmt, 0), SQL_NULL);
+    ck_assert_int_eq(chidb_column_int(stmt, 1), 2);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    /* Walking the index would look up every row in the table to read s */
+    ck_assert(!program_has(db, "SELECT v, MAX(s) FROM t GROUP BY v;", "AggBreak"));
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_hash_join_spill)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char *fname = create_tmp_file();
+    const char *sql = "SELECT a.s, b.s FROM a, b WHERE a.x = b.y;";
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    exec_sql(db, "CREATE TABLE a(id INTEGER PRIMARY KEY, x INTEGER, s TEXT);");
+    exec_sql(db, "CREATE TABLE b(id INTEGER PRIMARY KEY, y INTEGER, s TEXT);");
+    exec_sql(db, "CREATE INDEX idxb ON b(y);");
+    exec_sql(db, "INSERT INTO a VALUES(1, 10, 'a1');");
+    exec_sql(db, "INSERT INTO a VALUES(2, 20, 'a2');");
+    exec_sql(db, "INSERT INTO a VALUES(3, 30, 'a3');");
+    exec_sql(db, "INSERT INTO b VALUES(1, 20, 'b1');");
+    exec_sql(db, "INSERT INTO b VALUES(2, 30, 'b2');");
+    exec_sql(db, "INSERT INTO b VALUES(3, 40, 'b3');");
+
+    /* Without statistics, the tables are assumed to be far too large
+     * for a hash table of b to fit in memory, and reading its spilled
+     * partitions back on most probes would cost more than looking up
+     * each row of a in the index on b */
+    ck_assert(!program_has(db, sql, "HashProbe"));
+    ck_assert(program_has(db, sql, "IdxPKey"));
+
+    ck_assert_int_eq(chidb_prepare(db, sql, &stmt), CHIDB_OK);
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), "a2");
+    ck_assert_str_eq(chidb_column_text(stmt, 1), "b1");
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+    ck_assert_str_eq(chidb_column_text(stmt, 0), "a3");
+    ck_assert_str_eq(chidb_column_text(stmt, 1), "b2");
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_order_by_spill)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char *fname = create_tmp_file();
+    char s[50];
+    /* Enough rows for the sorter to go over its memory budget
+     * (DBM_SORTER_BUDGET), and sort them in runs on temporary files */
+    int n = 120000;
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    exec_sql(db, "CREATE TABLE t(k INTEGER PRIMARY KEY, v INTEGER, s TEXT);");
+    exec_sql(db, "BEGIN;");
+    ck_assert_int_eq(chidb_prepare(db, "INSERT INTO t VALUES(?, ?, ?);", &stmt), CHIDB_OK);
+    for(int k = 1; k <= n; k++)
+    {
+        int v = (k * 7919) % n;
+
+        sprintf(s, "row %08d, in no particular order", v);
+        chidb_bind_int(stmt, 1, k);
+        chidb_bind_int(stmt, 2, v);
+        chidb_bind_text(stmt, 3, s);
+        ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+        chidb_reset(stmt);
+    }
+    chidb_finalize(stmt);
+    exec_sql(db, "COMMIT;");
+
+    ck_assert_int_eq(chidb_prepare(db, "SELECT v, s FROM t ORDER BY s DESC;", &stmt), CHIDB_OK);
+    for(int v = n - 1; v >= 0; v--)
+    {
+        ck_assert_int_eq(chidb_step(stmt), CHIDB_ROW);
+        ck_assert_int_eq(chidb_column_int(stmt, 0), v);
+        sprintf(s, "row %08d, in no particular order", v);
+        ck_assert_str_eq(chidb_column_text(stmt, 1), s);
+    }
+    ck_assert_int_eq(chidb_step(stmt), CHIDB_DONE);
+    chidb_finalize(stmt);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_txn_commit)
+{
+    chidb *db, *db2;
+    char *fname = create_tmp_file();
+    int keys[] = {1, 2, 3};
+    int vals[] = {10, 20, 30};
+    const char *strs[] = {"s1", "s2", "s3"};
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    create_t(db, 1);
+
+    ck_assert_int_eq(chidb_get_autocommit(db), 1);
+    exec_sql(db, "BEGIN;");
+    ck_assert_int_eq(chidb_get_autocommit(db), 0);
+    exec_sql(db, "INSERT INTO t VALUES(2, 20, 's2');");
+    exec_sql(db, "INSERT INTO t VALUES(3, 30, 's3');");
+    check_rows(db, 3, keys, vals, strs);
+
+    /* Other connections don't see the changes until they are committed */
+    ck_assert_int_eq(chidb_open(fname, &db2), CHIDB_OK);
+    check_rows(db2, 1, keys, vals, strs);
+
+    exec_sql(db, "COMMIT;");
+    ck_assert_int_eq(chidb_get_autocommit(db), 1);
+    check_rows(db2, 3, keys, vals, strs);
+    chidb_close(db2);
+    chidb_close(db);
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    check_rows(db, 3, keys, vals, strs);
+    chidb_close(db);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_txn_rollback)
+{
+    chidb *db;
+    chidb_stmt *stmt;
+    char *fname = create_tmp_file();
+    int keys[] = {1, 2};
+    int vals[] = {10, 20};
+    const char *strs[] = {"s1", "s2"};
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    create_t(db, 2);
+
+    exec_sql(db, "BEGIN;");
+    exec_sql(db, "INSERT INTO t VALUES(3, 30, 's3');");
+    exec_sql(db, "CREATE TABLE u(k INTEGER PRIMARY KEY, v INTEGER);");
+    exec_sql(db, "INSERT INTO u VALUES(1, 1);");
+    exec_sql(db, "CREATE INDEX idx ON t(v);");
+    exec_sql(db, "ROLLBACK;");
+    ck_assert_int_eq(chidb_get_autocommit(db), 1);
+
+    /* The tables and indexes created in the transaction are gone too */
+    check_rows(db, 2, keys, vals, strs);
+    ck_assert_int_eq(chidb_prepare(db, "SELECT k FROM u;", &stmt), CHIDB_EINVALIDSQL);
+    ck_assert(!program_has(db, "SELECT k FROM t WHERE v = 20;", "IdxPKey"));
+    chidb_close(db);
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    check_rows(db, 2, keys, vals, strs);
+    ck_assert_int_eq(chidb_prepare(db, "SELECT k FROM u;", &stmt), CHIDB_EINVALIDSQL);
+    exec_sql(db, "CREATE TABLE u(k INTEGER PRIMARY KEY, v INTEGER);");
+    chidb_close(db);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_txn_hot_journal)
+{
+    chidb *db;
+    char *fname = create_tmp_file();
+    char journal[1024];
+    int keys[] = {1, 2};
+    int vals[] = {10, 20};
+    const char *strs[] = {"s1", "s2"};
+    int status;
+    pid_t pid;
+
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    create_t(db, 2);
+    chidb_close(db);
+
+    /* A process that dies in the middle of a transaction, after the
+     * transaction has more than PAGER_CACHE_MAX pages, and some of them
+     * have been written to the file */
+    pid = fork();
+    ck_assert(pid != -1);
+    if(pid == 0)
+    {
+        chidb_stmt *stmt;
+        char s[100];
+
+        chidb_open(fname, &db);
+        exec_sql(db, "BEGIN;");
+        chidb_prepare(db, "INSERT INTO t VALUES(?, ?, ?);", &stmt);
+        for(int k = 3; k < PAGER_CACHE_MAX * 12; k++)
+        {
+            sprintf(s, "a row that will never be committed, with key %d", k);
+            chidb_bind_int(stmt, 1, k);
+            chidb_bind_int(stmt, 2, k * 10);
+            chidb_bind_text(stmt, 3, s);
+            if(chidb_step(stmt) != CHIDB_DONE)
+                _exit(1);
+            chidb_reset(stmt);
+        }
+        _exit(0);
+    }
+    ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+    ck_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    sprintf(journal, "%s-journal", fname);
+    ck_assert_int_eq(access(journal, F_OK), 0);
+
+    /* Opening the file rolls the transaction back */
+    ck_assert_int_eq(chidb_open(fname, &db), CHIDB_OK);
+    ck_assert(access(journal, F_OK) != 0);
+    check_rows(db, 2, keys, vals, strs);
+    exec_sql(db, "INSERT INTO t VALUES(3, 30, 's3');");
+    chidb_close(db);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+Suite* make_api_suite (void)
+{
+    Suite *s = suite_create ("API");
+
+    TCase *tc_compact = tcase_create ("Compact record format");
+    tcase_add_test (tc_compact, test_open_compact);
+    tcase_add_test (tc_compact, test_open_compact_existing);
+    suite_add_tcase (s, tc_compact);
+
+    TCase *tc_cache = tcase_create ("Statement cache");
+    tcase_add_test (tc_cache, test_cache_reuse);
+    tcase_add_test (tc_cache, test_cache_schema_change);
+    tcase_add_test (tc_cache, test_stmt_schema_change);
+    suite_add_tcase (s, tc_cache);
+
+    TCase *tc_bind = tcase_create ("Parameters");
+    tcase_add_test (tc_bind, test_bind_positional);
+    tcase_add_test (tc_bind, test_bind_named);
+    tcase_add_test (tc_bind, test_bind_types);
+    suite_add_tcase (s, tc_bind);
+
+    TCase *tc_opt = tcase_create ("Optimizer");
+    tcase_add_test (tc_opt, test_analyze);
+    tcase_add_test (tc_opt, test_join_order);
+    tcase_add_test (tc_opt, test_pushdown_pruning);
+    tcase_add_test (tc_opt, test_group_by_index);
+    tcase_add_test (tc_opt, test_hash_join_spill);
+    suite_add_tcase (s, tc_opt);
+
+    /* Sorting enough rows to spill takes a while */
+    TCase *tc_sort = tcase_create ("Sorting");
+    tcase_set_timeout (tc_sort, 30);
+    tcase_add_test (tc_sort, test_order_by_spill);
+    suite_add_tcase (s, tc_sort);
+
+    TCase *tc_txn = tcase_create ("Transactions");
+    tcase_set_timeout (tc_txn, 30);
+    tcase_add_test (tc_txn, test_txn_commit);
+    tcase_add_test (tc_txn, test_txn_rollback);
+    tcase_add_test (tc_txn, test_txn_hot_journal);
+    suite_add_tcase (s, tc_txn);
+
+    return s;
+}
+
+int main (void)
+{
+    SRunner *sr;
+    int number_failed;
+
+    sr = srunner_create (make_api_suite ());
+
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
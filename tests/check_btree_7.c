@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <pthread.h>
 #include <check.h>
 #include "check_btree.h"
 
@@ -70,12 +71,169 @@ START_TEST (test_7_3)
 END_TEST
 
 
+#define TEST_7_MAX_THREADS (16)
+
+/* Values of the big file that a thread inserts: from first (inclusive)
+ * to end (exclusive), every step values */
+struct test_7_thread
+{
+    chidb *db;
+    int first, end, step;
+};
+
+static void *test_7_insert(void *arg)
+{
+    struct test_7_thread *t = arg;
+
+    for(int i=t->first; i<t->end; i+=t->step)
+        insert_bigfile(t->db, i);
+
+    return NULL;
+}
+
+/* Inserts the values of the big file from nthreads threads at once. If
+ * interleaved, thread i inserts values i, i + nthreads, ... Otherwise,
+ * each thread inserts a range of the values (which are in key order,
+ * so the threads insert disjoint ranges of keys) */
+static void test_7_threads(int nthreads, bool interleaved)
+{
+    chidb *db;
+    int rc;
+    pthread_t threads[TEST_7_MAX_THREADS];
+    struct test_7_thread args[TEST_7_MAX_THREADS];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Btree_begin(db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<nthreads; i++)
+    {
+        args[i].db = db;
+        if(interleaved)
+        {
+            args[i].first = i;
+            args[i].end = bigfile_nvalues;
+            args[i].step = nthreads;
+        }
+        else
+        {
+            args[i].first = i * bigfile_nvalues / nthreads;
+            args[i].end = (i + 1) * bigfile_nvalues / nthreads;
+            args[i].step = 1;
+        }
+        ck_assert(pthread_create(&threads[i], NULL, test_7_insert, &args[i]) == 0);
+    }
+    for(int i=0; i<nthreads; i++)
+        pthread_join(threads[i], NULL);
+
+    rc = chidb_Btree_commit(db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+
+
+START_TEST (test_7_4)
+{
+    test_7_threads(4, true);
+}
+END_TEST
+
+
+START_TEST (test_7_5)
+{
+    test_7_threads(TEST_7_MAX_THREADS, false);
+}
+END_TEST
+
+
+/* Looks up values of the big file (see test_7_insert) while other
+ * threads insert, retrying while they keep changing the nodes */
+static void *test_7_find(void *arg)
+{
+    struct test_7_thread *t = arg;
+    uint8_t *buf;
+    uint16_t size;
+    int rc;
+
+    for(int i=t->first; i<t->end; i+=t->step)
+    {
+        while((rc = chidb_Btree_find(t->db->bt, 1, bigfile_pkeys[i], &buf, &size)) == CHIDB_EBUSY)
+            ;
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(size == ((bigfile_pkeys[i] % 3) + 1) * 64);
+        ck_assert(get4byte(buf) == bigfile_ikeys[i]);
+        free(buf);
+    }
+
+    return NULL;
+}
+
+
+/* Half of the values of the big file are inserted first. Then, four
+ * threads insert the other half while four threads look up the first
+ * one, in nodes that the insertions split */
+START_TEST (test_7_6)
+{
+    chidb *db;
+    int rc, half = bigfile_nvalues / 2;
+    pthread_t threads[8];
+    struct test_7_thread args[8];
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    rc = chidb_Btree_begin(db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    for(int i=0; i<half; i++)
+        insert_bigfile(db, i);
+
+    for(int i=0; i<4; i++)
+    {
+        args[i].db = args[4 + i].db = db;
+        args[i].step = args[4 + i].step = 4;
+        args[i].first = half + i;
+        args[i].end = bigfile_nvalues;
+        args[4 + i].first = i;
+        args[4 + i].end = half;
+        ck_assert(pthread_create(&threads[i], NULL, test_7_insert, &args[i]) == 0);
+        ck_assert(pthread_create(&threads[4 + i], NULL, test_7_find, &args[4 + i]) == 0);
+    }
+    for(int i=0; i<8; i++)
+        pthread_join(threads[i], NULL);
+
+    rc = chidb_Btree_commit(db->bt);
+    ck_assert(rc == CHIDB_OK);
+
+    test_bigfile(db);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
 TCase* make_btree_7_tc(void)
 {
     TCase *tc = tcase_create ("Step 7: Insertion with splitting");
     tcase_add_test (tc, test_7_1);
     tcase_add_test (tc, test_7_2);
     tcase_add_test (tc, test_7_3);
+    tcase_add_test (tc, test_7_4);
+    tcase_add_test (tc, test_7_5);
+    tcase_add_test (tc, test_7_6);
 
     return tc;
 }
@@ -11,20 +11,29 @@
 // Make this array bigger if we ever have more than 1024 DBM tests
 char *dbm_tests[1024];
 
-START_TEST (test_dbm)
+/* Runs a DBM file and checks its results. If peephole is true, the
+ * program is run through the peephole optimizer first, which must
+ * not change the results. */
+void run_dbm_file(const char *filename, bool peephole)
 {
     int rc;
     chidb_dbm_file_t *dbmf;
 
-    rc = chidb_dbm_file_load2(dbm_tests[_i], &dbmf, DATABASES_DIR, GENERATED_DIR, true);
-    ck_assert_msg(rc == CHIDB_OK, "Could not load DBM file %s\n", dbm_tests[_i]);
+    rc = chidb_dbm_file_load2(filename, &dbmf, DATABASES_DIR, GENERATED_DIR, true);
+    ck_assert_msg(rc == CHIDB_OK, "Could not load DBM file %s\n", filename);
+
+    if(peephole)
+    {
+        rc = chidb_stmt_peephole(&dbmf->stmt);
+        ck_assert_msg(rc == CHIDB_OK, "Could not optimize DBM file %s\n", filename);
+    }
 
     list_iterator_start(&dbmf->queryResults);
     do
     {
         rc = chidb_dbm_file_run(dbmf);
 
-        ck_assert_msg(rc == CHIDB_ROW || rc == CHIDB_DONE, "Error while running DBM file %s\n", dbm_tests[_i]);
+        ck_assert_msg(rc == CHIDB_ROW || rc == CHIDB_DONE, "Error while running DBM file %s\n", filename);
 
         if(rc == CHIDB_ROW)
         {
@@ -67,6 +76,15 @@ START_TEST (test_dbm)
                 ck_assert_msg(expected->value.i == actual->value.i,
                         "Expected register %i to have value %i but it has value %i", nReg, expected->value.i, actual->value.i);
                 break;
+            case REG_INT64:
+                ck_assert_msg(expected->value.i64 == actual->value.i64,
+                        "Expected register %i to have value %lli but it has value %lli", nReg,
+                        (long long) expected->value.i64, (long long) actual->value.i64);
+                break;
+            case REG_DOUBLE:
+                ck_assert_msg(expected->value.d == actual->value.d,
+                        "Expected register %i to have value %g but it has value %g", nReg, expected->value.d, actual->value.d);
+                break;
             case REG_STRING:
                 ck_assert_msg(strcmp(expected->value.s, actual->value.s) == 0,
                         "Expected register %i to have value '%s' but it has value '%s'", nReg, expected->value.s, actual->value.s);
@@ -86,6 +104,17 @@ START_TEST (test_dbm)
 
     rc = chidb_dbm_file_close(dbmf);
 }
+
+START_TEST (test_dbm)
+{
+    run_dbm_file(dbm_tests[_i], false);
+}
+END_TEST
+
+START_TEST (test_dbm_peephole)
+{
+    run_dbm_file(dbm_tests[_i], true);
+}
 END_TEST
 
 
@@ -128,6 +157,7 @@ int main (void)
 
                             TCase *tc = tcase_create (strdup(ent2->d_name));
                             tcase_add_loop_test(tc, test_dbm, i, i+1);
+                            tcase_add_loop_test(tc, test_dbm_peephole, i, i+1);
                             suite_add_tcase (s, tc);
 
                             i++;
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "libchidb/record.h"
 
@@ -177,6 +178,218 @@ START_TEST (test_packunpack)
 END_TEST
 
 
+START_TEST (test_view)
+{
+    DBRecord *dbr;
+    DBRecordView dbrv;
+    const uint8_t *s;
+    int8_t i8;
+    int16_t i16;
+    int32_t i32;
+    uint8_t *buf;
+    int len;
+
+    for(int i=0; i<NVALUES; i++)
+    {
+        chidb_DBRecord_create(&dbr, "|s|0|i1|i2|i4|", str_values[i], int8_values[i], int16_values[i], int32_values[i]);
+        chidb_DBRecord_pack(dbr, &buf);
+
+        chidb_DBRecordView_init(&dbrv, buf);
+
+        /* Access the last field first, so the header is parsed in one go */
+        ck_assert_int_eq(chidb_DBRecordView_getType(&dbrv, 4), SQL_INTEGER_4BYTE);
+        chidb_DBRecordView_getInt32(&dbrv, 4, &i32);
+        ck_assert_int_eq(int32_values[i], i32);
+
+        ck_assert_int_eq(chidb_DBRecordView_getType(&dbrv, 0), SQL_TEXT);
+        chidb_DBRecordView_getString(&dbrv, 0, &s, &len);
+        ck_assert_int_eq(strlen(str_values[i]), len);
+        ck_assert(strncmp(str_values[i], (const char *) s, len) == 0);
+
+        ck_assert_int_eq(chidb_DBRecordView_getType(&dbrv, 1), SQL_NULL);
+
+        ck_assert_int_eq(chidb_DBRecordView_getType(&dbrv, 2), SQL_INTEGER_1BYTE);
+        chidb_DBRecordView_getInt8(&dbrv, 2, &i8);
+        ck_assert_int_eq(int8_values[i], i8);
+
+        ck_assert_int_eq(chidb_DBRecordView_getType(&dbrv, 3), SQL_INTEGER_2BYTE);
+        chidb_DBRecordView_getInt16(&dbrv, 3, &i16);
+        ck_assert_int_eq(int16_values[i], i16);
+
+        ck_assert_int_eq(chidb_DBRecordView_getNFields(&dbrv), 5);
+        ck_assert_int_eq(chidb_DBRecordView_getType(&dbrv, 5), SQL_NOTVALID);
+
+        chidb_DBRecord_destroy(dbr);
+        free(buf);
+    }
+}
+END_TEST
+
+
+START_TEST (test_arena)
+{
+    Arena arena;
+    DBRecordBuffer dbrb;
+    DBRecord *dbr1, *dbr2;
+    uint8_t *buf1, *buf2;
+
+    chidb_Arena_init(&arena);
+
+    for(int i=0; i<NVALUES; i++)
+    {
+        chidb_DBRecord_create(&dbr1, "|s|0|i1|i2|i4|", str_values[i], int8_values[i], int16_values[i], int32_values[i]);
+        chidb_DBRecord_pack(dbr1, &buf1);
+
+        chidb_DBRecord_create_empty_arena(&dbrb, 5, &arena);
+        chidb_DBRecord_appendString(&dbrb, str_values[i]);
+        chidb_DBRecord_appendNull(&dbrb);
+        chidb_DBRecord_appendInt8(&dbrb, int8_values[i]);
+        chidb_DBRecord_appendInt16(&dbrb, int16_values[i]);
+        chidb_DBRecord_appendInt32(&dbrb, int32_values[i]);
+        chidb_DBRecord_finalize(&dbrb, &dbr2);
+        chidb_DBRecord_pack(dbr2, &buf2);
+
+        ck_assert_int_eq(dbr1->packed_len, dbr2->packed_len);
+        ck_assert(memcmp(buf1, buf2, dbr1->packed_len) == 0);
+
+        chidb_DBRecord_destroy(dbr1);
+        chidb_DBRecord_destroy(dbr2);
+        free(buf1);
+
+        /* Every other record, release the arena records in bulk */
+        if(i % 2)
+            chidb_Arena_reset(&arena);
+    }
+
+    chidb_Arena_free(&arena);
+}
+END_TEST
+
+
+START_TEST (test_compact)
+{
+    DBRecordBuffer dbrb;
+    DBRecord *dbr1, *dbr2;
+    DBRecordView dbrv;
+    uint8_t *buf;
+    char *s;
+    int32_t i32;
+
+    for(int i=0; i<NVALUES; i++)
+    {
+        chidb_DBRecord_create_empty(&dbrb, 5);
+        chidb_DBRecord_setFormat(&dbrb, RECORD_FORMAT_COMPACT);
+        chidb_DBRecord_appendString(&dbrb, str_values[i]);
+        chidb_DBRecord_appendNull(&dbrb);
+        chidb_DBRecord_appendInt32(&dbrb, int8_values[i]);
+        chidb_DBRecord_appendInt32(&dbrb, int16_values[i]);
+        chidb_DBRecord_appendInt32(&dbrb, int32_values[i]);
+        chidb_DBRecord_finalize(&dbrb, &dbr1);
+        chidb_DBRecord_pack(dbr1, &buf);
+
+        /* Short strings only need a 1-byte header type */
+        if(strlen(str_values[i]) < 57)
+            ck_assert_int_eq(buf[0], 6);
+
+        chidb_DBRecord_unpack(&dbr2, buf);
+        ck_assert_int_eq(dbr2->format, RECORD_FORMAT_COMPACT);
+        ck_assert_int_eq(dbr2->packed_len, dbr1->packed_len);
+
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr2, 0), SQL_TEXT);
+        chidb_DBRecord_getString(dbr2, 0, &s);
+        ck_assert_str_eq(str_values[i], s);
+        free(s);
+
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr2, 1), SQL_NULL);
+
+        /* Integers are reported as the smallest type that holds them */
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr2, 2), SQL_INTEGER_1BYTE);
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr2, 3), int16_values[i] == (int8_t) int16_values[i]? SQL_INTEGER_1BYTE : SQL_INTEGER_2BYTE);
+        for(int j=2; j<5; j++)
+        {
+            int32_t expected = j == 2? int8_values[i] : (j == 3? int16_values[i] : int32_values[i]);
+
+            chidb_DBRecord_getInt32(dbr2, j, &i32);
+            ck_assert_int_eq(expected, i32);
+
+            chidb_DBRecordView_init(&dbrv, buf);
+            chidb_DBRecordView_getInt32(&dbrv, j, &i32);
+            ck_assert_int_eq(expected, i32);
+        }
+
+        chidb_DBRecord_destroy(dbr1);
+        chidb_DBRecord_destroy(dbr2);
+        free(buf);
+    }
+
+    /* 0 and 1 take up no space in the record's data */
+    chidb_DBRecord_create_empty(&dbrb, 2);
+    chidb_DBRecord_setFormat(&dbrb, RECORD_FORMAT_COMPACT);
+    chidb_DBRecord_appendInt32(&dbrb, 0);
+    chidb_DBRecord_appendInt32(&dbrb, 1);
+    chidb_DBRecord_finalize(&dbrb, &dbr1);
+    ck_assert_int_eq(dbr1->data_len, 0);
+    ck_assert_int_eq(dbr1->packed_len, 3);
+    chidb_DBRecord_getInt32(dbr1, 1, &i32);
+    ck_assert_int_eq(i32, 1);
+    chidb_DBRecord_destroy(dbr1);
+}
+END_TEST
+
+
+START_TEST (test_types)
+{
+    DBRecordBuffer dbrb;
+    DBRecord *dbr1, *dbr2;
+    DBRecordView dbrv;
+    uint8_t *buf, *blob;
+    const uint8_t *vblob;
+    uint8_t blob_value[] = {0x00, 0xDE, 0xAD, 0xBE, 0xEF};
+    int64_t i64;
+    double d;
+    int len;
+
+    for(uint8_t format = RECORD_FORMAT_LEGACY; format <= RECORD_FORMAT_COMPACT; format += 3)
+    {
+        chidb_DBRecord_create_empty(&dbrb, 3);
+        chidb_DBRecord_setFormat(&dbrb, format);
+        chidb_DBRecord_appendInt64(&dbrb, -9000000000LL);
+        chidb_DBRecord_appendDouble(&dbrb, 3.25);
+        chidb_DBRecord_appendBlob(&dbrb, blob_value, sizeof(blob_value));
+        chidb_DBRecord_finalize(&dbrb, &dbr1);
+        chidb_DBRecord_pack(dbr1, &buf);
+        chidb_DBRecord_unpack(&dbr2, buf);
+
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr2, 1), SQL_DOUBLE);
+        ck_assert_int_eq(chidb_DBRecord_getType(dbr2, 2), SQL_BLOB);
+
+        chidb_DBRecord_getInt64(dbr2, 0, &i64);
+        ck_assert(i64 == -9000000000LL);
+        chidb_DBRecord_getDouble(dbr2, 1, &d);
+        ck_assert(d == 3.25);
+        chidb_DBRecord_getBlobLength(dbr2, 2, &len);
+        ck_assert_int_eq(len, sizeof(blob_value));
+        chidb_DBRecord_getBlob(dbr2, 2, &blob);
+        ck_assert(!memcmp(blob, blob_value, sizeof(blob_value)));
+        free(blob);
+
+        chidb_DBRecordView_init(&dbrv, buf);
+        chidb_DBRecordView_getInt64(&dbrv, 0, &i64);
+        ck_assert(i64 == -9000000000LL);
+        chidb_DBRecordView_getDouble(&dbrv, 1, &d);
+        ck_assert(d == 3.25);
+        chidb_DBRecordView_getBlob(&dbrv, 2, &vblob, &len);
+        ck_assert_int_eq(len, sizeof(blob_value));
+        ck_assert(!memcmp(vblob, blob_value, sizeof(blob_value)));
+
+        chidb_DBRecord_destroy(dbr1);
+        chidb_DBRecord_destroy(dbr2);
+        free(buf);
+    }
+}
+END_TEST
+
+
 Suite* make_dbrecord_suite (void)
 {
     Suite *s = suite_create ("DB Record");
@@ -197,6 +410,22 @@ Suite* make_dbrecord_suite (void)
     tcase_add_test (tc_packunpack, test_packunpack);
     suite_add_tcase (s, tc_packunpack);
 
+    TCase *tc_compact = tcase_create ("Compact record format");
+    tcase_add_test (tc_compact, test_compact);
+    suite_add_tcase (s, tc_compact);
+
+    TCase *tc_view = tcase_create ("Record views");
+    tcase_add_test (tc_view, test_view);
+    suite_add_tcase (s, tc_view);
+
+    TCase *tc_arena = tcase_create ("Records in an arena");
+    tcase_add_test (tc_arena, test_arena);
+    suite_add_tcase (s, tc_arena);
+
+    TCase *tc_types = tcase_create ("64-bit integers, doubles and blobs");
+    tcase_add_test (tc_types, test_types);
+    suite_add_tcase (s, tc_types);
+
     return s;
 }
 
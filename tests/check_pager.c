@@ -146,6 +146,83 @@ START_TEST (test_readwrite)
 END_TEST
 
 
+START_TEST (test_shared)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg1, *pg2;
+    MemPage *page;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg1, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg1, PAGE_SIZE);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg1, &npage);
+        chidb_Pager_readPage(pg1, npage, &page);
+        page->data[0] = j;
+        chidb_Pager_writePage(pg1, page);
+        chidb_Pager_releaseMemPage(pg1, page);
+    }
+
+    /* A second pager on the same file sees the pages of the first one */
+    rc = chidb_Pager_open(&pg2, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg2, PAGE_SIZE);
+    ck_assert_int_eq(pg2->n_pages, MAXPAGES);
+
+    /* ...but not the pages of its transaction until it's committed */
+    rc = chidb_Pager_lockWrite(pg1);
+    ck_assert(rc == CHIDB_OK);
+    rc = chidb_Pager_begin(pg1);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_readPage(pg1, 1, &page);
+    page->data[0] = 100;
+    chidb_Pager_writePage(pg1, page);
+    chidb_Pager_releaseMemPage(pg1, page);
+    chidb_Pager_allocatePage(pg1, &npage);
+
+    rc = chidb_Pager_lockRead(pg2);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_readPage(pg2, 1, &page);
+    ck_assert_int_eq(page->data[0], 1);
+    chidb_Pager_releaseMemPage(pg2, page);
+    ck_assert_int_eq(pg2->n_pages, MAXPAGES);
+
+    /* Its snapshot won't be the latest once the transaction commits */
+    rc = chidb_Pager_lockWrite(pg2);
+    ck_assert(rc == CHIDB_EBUSY);
+
+    rc = chidb_Pager_commit(pg1);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_unlockWrite(pg1);
+
+    /* A reader keeps its snapshot until it releases its read lock */
+    chidb_Pager_readPage(pg2, 1, &page);
+    ck_assert_int_eq(page->data[0], 1);
+    chidb_Pager_releaseMemPage(pg2, page);
+    rc = chidb_Pager_lockWrite(pg2);
+    ck_assert(rc == CHIDB_EBUSY);
+    chidb_Pager_unlockRead(pg2);
+
+    rc = chidb_Pager_lockRead(pg2);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_readPage(pg2, 1, &page);
+    ck_assert_int_eq(page->data[0], 100);
+    chidb_Pager_releaseMemPage(pg2, page);
+    ck_assert_int_eq(pg2->n_pages, MAXPAGES + 1);
+    chidb_Pager_unlockRead(pg2);
+
+    chidb_Pager_close(pg2);
+    chidb_Pager_close(pg1);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
 Suite* make_pager_suite (void)
 {
     Suite *s = suite_create ("Pager");
@@ -162,6 +239,10 @@ Suite* make_pager_suite (void)
     tcase_add_test (tc_readwrite, test_readwrite);
     suite_add_tcase (s, tc_readwrite);
 
+    TCase *tc_shared = tcase_create ("Sharing a file");
+    tcase_add_test (tc_shared, test_shared);
+    suite_add_tcase (s, tc_shared);
+
     return s;
 }
 
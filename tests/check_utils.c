@@ -7,6 +7,8 @@
 uint16_t uint16_values[] = {0,1,128,255,256,32767,32768,65535};
 uint32_t uint32_values[] = {0,255,256,32767,32768,65535,65536,4294967295};
 uint32_t varint32_values[] = {0,255,256,32767,32768,65535,65536,268435455};
+uint64_t varint_values[] = {0,127,128,16383,16384,4294967295,72057594037927935ULL,18446744073709551615ULL};
+int varint_lengths[] = {1,1,2,2,3,5,8,9};
 
 START_TEST (test_getput2byte)
 {
@@ -56,6 +58,36 @@ START_TEST (test_varint32)
 END_TEST
 
 
+START_TEST (test_varint)
+{
+    uint8_t buf[9];
+
+    for(int i=0; i<NVALUES; i++)
+    {
+        uint64_t val;
+        int len;
+
+        len = putVarint(buf, varint_values[i]);
+        ck_assert_int_eq(len, varint_lengths[i]);
+        ck_assert_int_eq(varintLen(varint_values[i]), varint_lengths[i]);
+        len = getVarint(buf, &val);
+        ck_assert_int_eq(len, varint_lengths[i]);
+        ck_assert(val == varint_values[i]);
+    }
+
+    /* Varints written by putVarint32 can be read by getVarint */
+    for(int i=0; i<NVALUES; i++)
+    {
+        uint64_t val;
+
+        putVarint32(buf, varint32_values[i]);
+        ck_assert_int_eq(getVarint(buf, &val), 4);
+        ck_assert(val == varint32_values[i]);
+    }
+}
+END_TEST
+
+
 Suite* make_utils_suite (void)
 {
     Suite *s = suite_create ("Utils");
@@ -64,6 +96,7 @@ Suite* make_utils_suite (void)
     tcase_add_test (tc_integer, test_getput2byte);
     tcase_add_test (tc_integer, test_getput4byte);
     tcase_add_test (tc_integer, test_varint32);
+    tcase_add_test (tc_integer, test_varint);
     suite_add_tcase (s, tc_integer);
 
     return s;